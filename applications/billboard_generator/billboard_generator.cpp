@@ -26,6 +26,7 @@
 #include <osg/Math>
 #include <osg/MatrixTransform>
 #include <osg/PolygonOffset>
+#include <osg/Program>
 #include <osg/Projection>
 #include <osg/ShapeDrawable>
 #include <osg/StateSet>
@@ -42,6 +43,7 @@
 #include <osgDB/ReadFile>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
 #include <osg/Texture2DArray>
 
 #include <osgUtil/LineSegmentIntersector>
@@ -67,41 +69,13 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 // for the grid data..
 osg::ref_ptr<osg::Texture2D> texture2D = new osg::Texture2D();
 osg::ref_ptr<osg::Camera> camera = new osg::Camera();
 osg::ref_ptr<osg::Image> image = new osg::Image();
 
 
-class Capture : public osg::Camera::DrawCallback { 
-public: 
-	Capture( const std::string& imagename ) : m_imageName(imagename) {} 
-	void setFilename(const std::string  &filename) {m_imageName = filename;}
-	virtual void operator () (osg::RenderInfo& renderInfo) const { 
-		/*osg::ref_ptr<osg::Image> image = new osg::Image; 
-		image->allocateImage(512,
-		512,
-		1,   // 2D texture is 1 pixel deep
-		GL_RGBA,
-		GL_UNSIGNED_BYTE);
-		image->setInternalTextureFormat(GL_RGBA8);*/
-		//camera->getOrCreateStateSet()->setTextureAttributeAndModes(0, texture2D, osg::StateAttribute::ON); 
-		//glBindTexture(GL_TEXTURE_2D,texture2D->getTextureObject(renderInfo.getContextID())->_id);
-		//image->readPixels(0,0,512,512,GL_RGBA,GL_UNSIGNED_BYTE);
-
-		//renderInfo.getState()->applyAttribute(texture2D); 
-		//osg::ref_ptr<osg::Image> image = new osg::Image;
-		//image->readImageFromCurrentTexture(renderInfo.getContextID(),false,GL_UNSIGNED_BYTE); 
-
-		//texture2D->apply( *( renderInfo.getState() ) ); 
-		//image->readImageFromCurrentTexture(renderInfo.getContextID(), true); 
-		osgDB::writeImageFile(*image, m_imageName); 
-	} 
-
-private: 
-	std::string m_imageName; 
-}; 
-
 osg::ref_ptr<osg::Geode> CreateGeometry(const osg::Vec3 &min_pos, const osg::Vec3 &max_pos, osg::ref_ptr<osg::Texture2D> texture)
 {
 	osg::Vec3 size = max_pos - min_pos;
@@ -176,54 +150,388 @@ osg::ref_ptr<osg::Geode> CreateGeometry(const osg::Vec3 &min_pos, const osg::Vec
 	return geode;
 }
 
-int main( int argc, char **argv )
+/**
+	Load model and add it to a transform that rotate the model so that
+	model up (z) is aligned with the capture camera y-axis.
+*/
+osg::MatrixTransform* CreateModelTransform(const std::string &filename)
 {
-	osg::ArgumentParser arguments(&argc,argv);
+	osg::Node* mesh_node = osgDB::readNodeFile(filename);
+	if(!mesh_node)
+		return NULL;
+	mesh_node->getOrCreateStateSet()->setMode( GL_LIGHTING, osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE );
+	osg::MatrixTransform* transform = new osg::MatrixTransform;
+	transform->setMatrix(osg::Matrix::scale(1,1,1)*osg::Matrixd::rotate(osg::DegreesToRadians(-90.0),1,0,0));
+	transform->addChild(mesh_node);
+	return transform;
+}
 
-	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
-	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" is a utility for creating billboards from 3D models.");
-	arguments.getApplicationUsage()->addCommandLineOption("--model <filename>","The input model.");
-	
+/**
+	Fit capture camera projection to bounding box of the rotated model.
+	Near and far plane is set from the model depth so that large models are not clipped.
+*/
+void SetupCaptureProjection(const osg::BoundingBox &bb)
+{
+	const double depth_margin = 1.0;
+	camera->setProjectionMatrixAsOrtho(bb._min.x(), bb._max.x(), bb._min.y(), bb._max.y(), -bb._max.z() - depth_margin, -bb._min.z() + depth_margin);
+}
 
-	// if user request help write it out to cout.
-	if (arguments.read("-h") || arguments.read("--help"))
+/**
+	Check if file can be loaded as model, used to filter directory content in batch mode.
+*/
+bool IsModelFile(const std::string &filename)
+{
+	const std::string ext = osgDB::getLowerCaseFileExtension(filename);
+	if(ext == "")
+		return false;
+	//skip our own output
+	const std::string name = osgDB::getStrippedName(filename);
+	if(name.size() > 3 && name.substr(name.size() - 3) == "_bb")
+		return false;
+	osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(ext);
+	return rw && (rw->supportedFeatures() & osgDB::ReaderWriter::FEATURE_READ_NODE);
+}
+
+/**
+	Collect all models to process in batch mode from --model, --model_dir and --model_list arguments
+*/
+std::vector<std::string> CollectModels(osg::ArgumentParser &arguments)
+{
+	std::vector<std::string> models;
+	std::string filename;
+	while (arguments.read("--model",filename))
 	{
-		arguments.getApplicationUsage()->write(std::cout);
+		models.push_back(filename);
+	}
+
+	std::string model_dir;
+	while (arguments.read("--model_dir",model_dir))
+	{
+		osgDB::DirectoryContents contents = osgDB::getSortedDirectoryContents(model_dir);
+		for(size_t i = 0; i < contents.size(); i++)
+		{
+			const std::string model_file = osgDB::concatPaths(model_dir, contents[i]);
+			if(osgDB::fileType(model_file) == osgDB::REGULAR_FILE && IsModelFile(model_file))
+				models.push_back(model_file);
+		}
+	}
+
+	std::string model_list;
+	while (arguments.read("--model_list",model_list))
+	{
+		std::ifstream list_file(model_list.c_str());
+		if(!list_file)
+		{
+			std::cerr << "Failed to open model list:" << model_list << "\n";
+			continue;
+		}
+		std::string line;
+		while(std::getline(list_file, line))
+		{
+			line = osgDB::trimEnclosingSpaces(line);
+			if(line != "" && line[0] != '#')
+				models.push_back(line);
+		}
+	}
+	return models;
+}
+
+/**
+	Get camera view direction (from model center toward camera) and up vector for one
+	impostor frame. Frames are laid out in a frames x frames grid using hemi-octahedral
+	mapping of the upper hemisphere. Note that BRTShaderInstancing (BT_IMPOSTOR) use the same
+	mapping and up-vector convention to select and orient frames at runtime.
+*/
+void GetImpostorFrameView(int frame_x, int frame_y, int frames, osg::Vec3 &dir, osg::Vec3 &up)
+{
+	const float u = ((frame_x + 0.5f) / frames)*2.0f - 1.0f;
+	const float v = ((frame_y + 0.5f) / frames)*2.0f - 1.0f;
+	const float px = (u + v)*0.5f;
+	const float py = (v - u)*0.5f;
+	dir.set(px, py, 1.0f - fabs(px) - fabs(py));
+	dir.normalize();
+	osg::Vec3 right = osg::Vec3(0, 0, 1) ^ dir;
+	if(right.length() < 0.0001f)
+		right.set(1, 0, 0);
+	right.normalize();
+	up = dir ^ right;
+}
+
+/**
+	Get impostor layer width (largest footprint extent) and height from model bounding box.
+	Note that BRTShaderInstancing (BT_IMPOSTOR) and Utils::getBillboardBound frame the quad
+	at instance position + height/2 with radius 0.5*sqrt(2*width^2 + height^2).
+*/
+void GetImpostorSize(const osg::BoundingBox &bb, float &width, float &height)
+{
+	width = osg::maximum(bb._max.x() - bb._min.x(), bb._max.y() - bb._min.y());
+	height = bb._max.z() - bb._min.z();
+}
+
+/**
+	Program used to capture impostor normal/depth frames.
+	Normal is written in model space (rgb) and depth relative to model
+	center plane (alpha, 0.5 at center, 1 toward camera).
+*/
+osg::Program* CreateNormalDepthProgram()
+{
+	const std::string vertex_source =
+		"uniform mat4 ViewToModel;\n"
+		"varying vec3 ModelNormal;\n"
+		"varying float EyeDepth;\n"
+		"varying vec2 TexCoord;\n"
+		"void main()\n"
+		"{\n"
+		"   ModelNormal = mat3(ViewToModel) * (gl_NormalMatrix * gl_Normal);\n"
+		"   EyeDepth = (gl_ModelViewMatrix * gl_Vertex).z;\n"
+		"   TexCoord = gl_MultiTexCoord0.st;\n"
+		"   gl_Position = ftransform();\n"
+		"}\n";
+	const std::string fragment_source =
+		"uniform sampler2D modelTexture;\n"
+		"uniform float CaptureDistance;\n"
+		"uniform float CaptureRadius;\n"
+		"varying vec3 ModelNormal;\n"
+		"varying float EyeDepth;\n"
+		"varying vec2 TexCoord;\n"
+		"void main()\n"
+		"{\n"
+		"   if(texture2D(modelTexture, TexCoord).a < 0.5) discard;\n"
+		"   vec3 normal = normalize(gl_FrontFacing ? ModelNormal : -ModelNormal);\n"
+		"   float depth = clamp(0.5 + (CaptureDistance + EyeDepth)/(2.0*CaptureRadius), 0.0, 1.0);\n"
+		"   gl_FragColor = vec4(normal*0.5 + 0.5, depth);\n"
+		"}\n";
+	osg::Program* program = new osg::Program;
+	program->addShader(new osg::Shader(osg::Shader::VERTEX, vertex_source));
+	program->addShader(new osg::Shader(osg::Shader::FRAGMENT, fragment_source));
+	return program;
+}
+
+/**
+	Bake hemi-octahedral impostor atlases for model attached to transform.
+	Each frame is rendered with the capture camera (that should have the frame size as viewport)
+	and copied into the color and normal/depth atlases.
+*/
+void BakeImpostor(osgViewer::Viewer &viewer, osg::MatrixTransform* transform, int frames, const osg::Vec4 &clearColor, osg::Image* color_atlas, osg::Image* normal_atlas)
+{
+	//keep model z-up, camera orbit the model instead
+	transform->setMatrix(osg::Matrix::identity());
+	osg::ComputeBoundsVisitor  cbv;
+	transform->accept(cbv);
+	const osg::BoundingBox bb = cbv.getBoundingBox();
+	//same center and radius as runtime quad, instance position is footprint center at model base
+	float width, height;
+	GetImpostorSize(bb, width, height);
+	const osg::Vec3 center(bb.center().x(), bb.center().y(), bb._min.z() + height*0.5f);
+	const float radius = 0.5f*sqrtf(2.0f*width*width + height*height);
+	const float distance = radius*2.0f;
+	camera->setProjectionMatrixAsOrtho(-radius, radius, -radius, radius, distance - radius*1.5f, distance + radius*1.5f);
+
+	osg::Uniform* view_to_model = new osg::Uniform(osg::Uniform::FLOAT_MAT4, "ViewToModel");
+	osg::StateSet* normal_state = new osg::StateSet;
+	normal_state->setAttributeAndModes(CreateNormalDepthProgram(), osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+	normal_state->setMode(GL_BLEND, osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE);
+	normal_state->addUniform(view_to_model);
+	normal_state->addUniform(new osg::Uniform("modelTexture", 0));
+	normal_state->addUniform(new osg::Uniform("CaptureDistance", distance));
+	normal_state->addUniform(new osg::Uniform("CaptureRadius", radius));
+
+	for(int pass = 0; pass < 2; pass++)
+	{
+		osg::Image* atlas = pass == 0 ? color_atlas : normal_atlas;
+		if(pass == 0)
+		{
+			camera->setClearColor(clearColor);
+			transform->setStateSet(NULL);
+		}
+		else
+		{
+			//flat up-facing normal and zero depth for background pixels
+			camera->setClearColor(osg::Vec4(0.5, 0.5, 1.0, 0.0));
+			transform->setStateSet(normal_state);
+		}
+
+		for(int y = 0; y < frames; y++)
+		{
+			for(int x = 0; x < frames; x++)
+			{
+				osg::Vec3 dir, up;
+				GetImpostorFrameView(x, y, frames, dir, up);
+				const osg::Matrix view = osg::Matrix::lookAt(center + dir*distance, center, up);
+				camera->setViewMatrix(view);
+				view_to_model->set(osg::Matrixf(osg::Matrix::inverse(view)));
+				viewer.frame(0.1);
+				viewer.frame(0.1);
+				atlas->copySubImage(x*image->s(), y*image->t(), 0, image.get());
+			}
+		}
+	}
+	transform->setStateSet(NULL);
+	camera->setViewMatrix(osg::Matrix::identity());
+}
+
+/**
+	Render billboard textures for all provided models without opening any window.
+	The capture camera render to FBO inside a pbuffer context (or directly
+	into the pbuffer if use_fbo is false, useful for software GL without FBO support).
+	One texture is written for each model to out_dir, the texture can be used as
+	BillboardLayer::TextureName, note that all textures get same resolution as required by the texture array.
+	If impostor_frames > 0 a hemi-octahedral impostor atlas is baked instead, with impostor_frames x impostor_frames
+	views in the color texture and a matching normal/depth texture (<name>_bb_normal.<ext>).
+*/
+int RunBatch(const std::vector<std::string> &models, const std::string &out_dir, const std::string &out_ext, int textureWidth, int textureHeight, const osg::Vec4 &clearColor, bool use_fbo, int impostor_frames)
+{
+	//in impostor mode the capture camera render one frame at a time
+	const int capture_width = impostor_frames > 0 ? textureWidth / impostor_frames : textureWidth;
+	const int capture_height = impostor_frames > 0 ? textureHeight / impostor_frames : textureHeight;
+	if(capture_width < 1 || capture_height < 1)
+	{
+		std::cerr << "Texture size too small for " << impostor_frames << " impostor frames\n";
 		return 1;
 	}
 
-	std::string filename;
-	if (!arguments.read("--model",filename))
+	if(!osgDB::fileExists(out_dir) && !osgDB::makeDirectory(out_dir))
 	{
-		std::cout << "You need to provide a model";
-		return 0;
+		std::cerr << "Failed to create output directory:" << out_dir << "\n";
+		return 1;
 	}
-	std::string out_path = osgDB::getFilePath(filename) + "/";
 
+	osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+	traits->x = 0;
+	traits->y = 0;
+	traits->width = textureWidth;
+	traits->height = textureHeight;
+	traits->red = 8;
+	traits->green = 8;
+	traits->blue = 8;
+	traits->alpha = 8;
+	traits->depth = 24;
+	traits->windowDecoration = false;
+	traits->pbuffer = true;
+	traits->doubleBuffer = false;
+	traits->sharedContext = 0;
+
+	osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+	if(!gc.valid())
+	{
+		std::cerr << "Failed to create pbuffer graphics context\n";
+		return 1;
+	}
 
-	int textureWidth = 512;
-	int textureHeight= 512;
+	osgViewer::Viewer viewer;
+	viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+	viewer.getCamera()->setGraphicsContext(gc.get());
+	viewer.getCamera()->setViewport(new osg::Viewport(0, 0, textureWidth, textureHeight));
+	viewer.getCamera()->setDrawBuffer(GL_FRONT);
+	viewer.getCamera()->setReadBuffer(GL_FRONT);
 
-	if (arguments.read("--tw",textureWidth))
+	camera->setReferenceFrame(osg::Camera::ABSOLUTE_RF);
+	camera->setRenderOrder(osg::Camera::PRE_RENDER);
+	camera->setViewport(0, 0, capture_width, capture_height);
+	camera->setClearColor(clearColor);
+	camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if(use_fbo)
+		camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+	else
 	{
-		
+		camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER);
+		camera->setDrawBuffer(GL_FRONT);
+		camera->setReadBuffer(GL_FRONT);
 	}
 
-	if (arguments.read("--th",textureHeight))
+	image->allocateImage(capture_width,
+		capture_height,
+		1,
+		GL_RGBA,
+		GL_UNSIGNED_BYTE);
+	image->setInternalTextureFormat(GL_RGBA8);
+	camera->attach(osg::Camera::COLOR_BUFFER, image.get());
+
+	viewer.setSceneData(camera);
+	viewer.realize();
+
+	int num_failed = 0;
+	for(size_t i = 0; i < models.size(); i++)
 	{
+		osg::ref_ptr<osg::MatrixTransform> transform = CreateModelTransform(models[i]);
+		if(!transform.valid())
+		{
+			std::cerr << "Failed to load model:" << models[i] << "\n";
+			num_failed++;
+			continue;
+		}
+
+		camera->removeChildren(0, camera->getNumChildren());
+		camera->addChild(transform);
+
+		const std::string out_file = osgDB::concatPaths(out_dir, osgDB::getStrippedName(models[i]) + "_bb." + out_ext);
+		if(impostor_frames > 0)
+		{
+			osg::ref_ptr<osg::Image> color_atlas = new osg::Image;
+			color_atlas->allocateImage(capture_width*impostor_frames, capture_height*impostor_frames, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+			color_atlas->setInternalTextureFormat(GL_RGBA8);
+			osg::ref_ptr<osg::Image> normal_atlas = static_cast<osg::Image*>(color_atlas->clone(osg::CopyOp::DEEP_COPY_IMAGES));
+			BakeImpostor(viewer, transform.get(), impostor_frames, clearColor, color_atlas.get(), normal_atlas.get());
+
+			const std::string normal_file = osgDB::getNameLessExtension(out_file) + "_normal." + out_ext;
+			if(!osgDB::writeImageFile(*color_atlas, out_file) || !osgDB::writeImageFile(*normal_atlas, normal_file))
+			{
+				std::cerr << "Failed to write impostor:" << out_file << "\n";
+				num_failed++;
+				continue;
+			}
+
+			//model is captured z-up, report layer settings using model footprint and height
+			osg::ComputeBoundsVisitor  cbv;
+			transform->accept(cbv);
+			float width, height;
+			GetImpostorSize(cbv.getBoundingBox(), width, height);
+			std::cout << "Impostor " << i + 1 << " of " << models.size() << ": " << out_file << "\n";
+			std::cout << "   Type=\"BT_IMPOSTOR\" ImpostorFrames=\"" << impostor_frames << "\"\n";
+			std::cout << "   TextureName=\"" << osgDB::getSimpleFileName(out_file) << "\""
+				<< " MinWidth=\"" << width << "\" MaxWidth=\"" << width << "\""
+				<< " MinHeight=\"" << height << "\" MaxHeight=\"" << height << "\"\n";
+			continue;
+		}
+
+		osg::ComputeBoundsVisitor  cbv;
+		transform->accept(cbv);
+		const osg::BoundingBox bb = cbv.getBoundingBox();
+		SetupCaptureProjection(bb);
+
+		//render twice to make sure all textures are loaded and applied
+		viewer.frame(0.1);
+		viewer.frame(0.1);
 
+		osg::ref_ptr<osg::Image> out_image = static_cast<osg::Image*>(image->clone(osg::CopyOp::DEEP_COPY_IMAGES));
+		if(!osgDB::writeImageFile(*out_image, out_file))
+		{
+			std::cerr << "Failed to write billboard:" << out_file << "\n";
+			num_failed++;
+			continue;
+		}
+		//print layer settings that match the captured model
+		std::cout << "Billboard " << i + 1 << " of " << models.size() << ": " << out_file << "\n";
+		std::cout << "   TextureName=\"" << osgDB::getSimpleFileName(out_file) << "\""
+			<< " MinWidth=\"" << bb._max.x() - bb._min.x() << "\" MaxWidth=\"" << bb._max.x() - bb._min.x() << "\""
+			<< " MinHeight=\"" << bb._max.y() - bb._min.y() << "\" MaxHeight=\"" << bb._max.y() - bb._min.y() << "\"\n";
 	}
+	camera->removeChildren(0, camera->getNumChildren());
+	std::cout << "Done, " << models.size() - num_failed << " of " << models.size() << " billboards created\n";
+	return num_failed > 0 ? 1 : 0;
+}
+
+int RunInteractive(osg::ArgumentParser &arguments, const std::string &filename, int textureWidth, int textureHeight, const osg::Vec4 &clearColor)
+{
+	std::string out_path = osgDB::getFilePath(filename) + "/";
 
-		
 	osgViewer::Viewer viewer(arguments);
-	//osg::Group* mesh_ = 
-	osg::Node* mesh_node = osgDB::readNodeFile(filename);//"C:/dev/dependencies/osg/OpenSceneGraph-Data-3.0.0/trees/birch.osg");
- 	//osg::Node* mesh_node = osgDB::readNodeFile("C:/temp/exp_tress/birch/birch.obj");
-//	  osg::Node* mesh_node = osgDB::readNodeFile("C:/temp/exp_tress/pine01/pine01_no_alpha.osg");
-	mesh_node->getOrCreateStateSet()->setMode( GL_LIGHTING, osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE );
-	osg::MatrixTransform* transform = new osg::MatrixTransform;
-	transform->setMatrix(osg::Matrix::scale(1,1,1)*osg::Matrixd::rotate(osg::DegreesToRadians(-90.0),1,0,0));
-	transform->addChild(mesh_node);
+	osg::MatrixTransform* transform = CreateModelTransform(filename);
+	if(!transform)
+	{
+		std::cout << "Failed to load model:" << filename;
+		return 0;
+	}
 
 	osg::ComputeBoundsVisitor  cbv;
 	osg::BoundingBox &bb(cbv.getBoundingBox());
@@ -235,9 +543,7 @@ int main( int argc, char **argv )
 	float maxy = bb._max.y();
 
 	float minz = bb._min.z();
-	float maxz = bb._max.z();
-
-	
+	//float maxz = bb._max.z();
 
 	// Create a render-to-texture camera with an absolute
 	// reference frame and pre-render
@@ -247,20 +553,15 @@ int main( int argc, char **argv )
 
 	// Set the camera's projection matrix to reflect the
 	// world of the geometries that will appear in the texture
-	camera->setProjectionMatrixAsOrtho2D(minx, maxx, miny, maxy);
+	SetupCaptureProjection(bb);
 
 	//Set the camera's viewport to the same size of the texture
 	camera->setViewport(0, 0, textureWidth, textureHeight);
 
-	//osg::Vec4 clearColor(30.0/255.0, 41.0/255.0, 18.0/255.0, 0); //pine
-	//osg::Vec4 clearColor(16.0/255.0, 20.0/255.0, 8.0/255.0, 0); //spruce
-	osg::Vec4 clearColor(27.0/255.0, 44.0/255.0, 18.0/255.0, 0); //birch
 	// Set the camera's clear color and masks
 	camera->setClearColor(clearColor);
 	camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT); 
-	Capture* capture_cb = new Capture("c:/temp/output2.tga");
-	camera->setPostDrawCallback( capture_cb); 
 
 	//Create the texture image
 	image->allocateImage(textureWidth,
@@ -361,12 +662,12 @@ int main( int argc, char **argv )
 		transform->setMatrix(osg::Matrix::scale(1,1,1)*osg::Matrixd::rotate(osg::DegreesToRadians(angle),0,0,1)*osg::Matrixd::rotate(osg::DegreesToRadians(-90.0),1,0,0));
 		std::stringstream ss;
 		ss << out_path << billboard_prefix << "_bb_" << i << ".tga";// << std::endl;
-		capture_cb->setFilename(ss.str());
 		//update twice to get correct rotation
 		viewer.frame(0.1);
 		viewer.frame(0.1);
 		osg::ref_ptr<osg::Texture2D> out_texture = new osg::Texture2D();
 		osg::Image* out_image = static_cast<osg::Image*>(image->clone(osg::CopyOp::DEEP_COPY_IMAGES));
+		osgDB::writeImageFile(*out_image, ss.str());
 		out_texture->setImage(out_image);
 		out_image->setFileName(osgDB::getSimpleFileName(ss.str()));
 		out_transform->setMatrix(osg::Matrix::scale(1,1,1)*osg::Matrixd::rotate(osg::DegreesToRadians(angle),0,0,1));
@@ -399,47 +700,84 @@ int main( int argc, char **argv )
 	out_file = out_path + out_file + "_bb.osg";
 	osgDB::writeNodeFile(*out_group,out_file);
 
-	if (!arguments.read("--view"))
-	{
-	//	return 0;
-	}
 	while(!viewer.done())
 	{
 		viewer.frame(0.1);
 	}
-
 	return 0;
-	// use an ArgumentParser object to manage the program arguments.
-	/*	osg::ArgumentParser arguments(&argc,argv);
+}
 
-	// construct the viewer.
-	osgViewer::Viewer viewer(arguments);
+int main( int argc, char **argv )
+{
+	osg::ArgumentParser arguments(&argc,argv);
 
-	//unsigned int numTreesToCreate = 2000;
-	//arguments.read("--trees",numTreesToCreate);
-	//unsigned int maxNumTreesPerCell = sqrtf(static_cast<float>(numTreesToCreate));
-	//arguments.read("--trees-per-cell",maxNumTreesPerCell);
-	//osg::ref_ptr<osgVegetation::ForestTechniqueManager> ttm = new osgVegetation::ForestTechniqueManager;
+	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" is a utility for creating billboards from 3D models.");
+	arguments.getApplicationUsage()->addCommandLineOption("--model <filename>","The input model, can be repeated in batch mode.");
+	arguments.getApplicationUsage()->addCommandLineOption("--tw <width>","Billboard texture width (default 512).");
+	arguments.getApplicationUsage()->addCommandLineOption("--th <height>","Billboard texture height (default 512).");
+	arguments.getApplicationUsage()->addCommandLineOption("--clear_color <r> <g> <b>","Billboard background color (0-255), alpha is always 0.");
+	arguments.getApplicationUsage()->addCommandLineOption("--batch","Headless batch mode, render offscreen and write one billboard texture per model.");
+	arguments.getApplicationUsage()->addCommandLineOption("--model_dir <path>","Batch mode: process all models in directory.");
+	arguments.getApplicationUsage()->addCommandLineOption("--model_list <filename>","Batch mode: process all models listed in file (one per line).");
+	arguments.getApplicationUsage()->addCommandLineOption("--out_dir <path>","Batch mode: output folder for billboard textures.");
+	arguments.getApplicationUsage()->addCommandLineOption("--out_ext <ext>","Batch mode: output texture format (default png).");
+	arguments.getApplicationUsage()->addCommandLineOption("--no_fbo","Batch mode: render directly to pbuffer instead of FBO.");
+	arguments.getApplicationUsage()->addCommandLineOption("--impostor <frames>","Bake hemi-octahedral impostor atlas with frames x frames views (color + normal/depth), implies --batch.");
 
-	// add the stats handler
-	viewer.addEventHandler(new osgViewer::StatsHandler);
+	// if user request help write it out to cout.
+	if (arguments.read("-h") || arguments.read("--help"))
+	{
+		arguments.getApplicationUsage()->write(std::cout);
+		return 1;
+	}
 
-	//viewer.addEventHandler(new TechniqueEventHandler(ttm.get()));
-	viewer.addEventHandler(new osgGA::StateSetManipulator(viewer.getCamera()->getOrCreateStateSet()));
+	int textureWidth = 512;
+	int textureHeight= 512;
 
+	if (arguments.read("--tw",textureWidth))
+	{
+		
+	}
 
-	osg::ref_ptr<osgGA::KeySwitchMatrixManipulator> keyswitchManipulator = new osgGA::KeySwitchMatrixManipulator;
+	if (arguments.read("--th",textureHeight))
+	{
+
+	}
+
+	//osg::Vec4 clearColor(30.0/255.0, 41.0/255.0, 18.0/255.0, 0); //pine
+	//osg::Vec4 clearColor(16.0/255.0, 20.0/255.0, 8.0/255.0, 0); //spruce
+	osg::Vec4 clearColor(27.0/255.0, 44.0/255.0, 18.0/255.0, 0); //birch
+	float r = 0, g = 0, b = 0;
+	if (arguments.read("--clear_color", r, g, b))
+	{
+		clearColor.set(r/255.0, g/255.0, b/255.0, 0);
+	}
 
-	keyswitchManipulator->addMatrixManipulator( '1', "Trackball", new osgGA::TrackballManipulator() );
-	keyswitchManipulator->addMatrixManipulator( '2', "Flight", new osgGA::FlightManipulator() );
-	keyswitchManipulator->addMatrixManipulator( '3', "Drive", new osgGA::DriveManipulator() );
-	keyswitchManipulator->addMatrixManipulator( '4', "Terrain", new osgGA::TerrainManipulator() );
-	keyswitchManipulator->addMatrixManipulator( '5', "Orbit", new osgGA::OrbitManipulator() );
-	keyswitchManipulator->addMatrixManipulator( '6', "FirstPerson", new osgGA::FirstPersonManipulator() );
-	keyswitchManipulator->addMatrixManipulator( '7', "Spherical", new osgGA::SphericalManipulator() );
-	viewer.setCameraManipulator( keyswitchManipulator.get() );
+	int impostor_frames = 0;
+	arguments.read("--impostor", impostor_frames);
 
-	viewer.setSceneData(osgDB::readNodeFile("C:/temp/exp_tress/birch/birch.obj"));
+	if (arguments.read("--batch") || impostor_frames > 0)
+	{
+		std::string out_dir = ".";
+		arguments.read("--out_dir", out_dir);
+		std::string out_ext = "png";
+		arguments.read("--out_ext", out_ext);
+		const bool use_fbo = !arguments.read("--no_fbo");
+		const std::vector<std::string> models = CollectModels(arguments);
+		if(models.size() == 0)
+		{
+			std::cout << "You need to provide models using --model, --model_dir or --model_list";
+			return 1;
+		}
+		return RunBatch(models, out_dir, out_ext, textureWidth, textureHeight, clearColor, use_fbo, impostor_frames);
+	}
 
-	return viewer.run();*/
+	std::string filename;
+	if (!arguments.read("--model",filename))
+	{
+		std::cout << "You need to provide a model";
+		return 0;
+	}
+	return RunInteractive(arguments, filename, textureWidth, textureHeight, clearColor);
 }
@@ -7,10 +7,14 @@
 #include <osgDB/FileNameUtils>
 #include <iostream>
 #include <sstream>
+#include <set>
+#include "BillboardHull.h"
 #include "BillboardQuadTreeScattering.h"
+#include "InstanceCache.h"
 #include "MeshQuadTreeScattering.h"
 #include "Serializer.h"
 #include "TerrainQuery.h"
+#include "TextureCompressor.h"
 
 int main( int argc, char **argv )
 {
@@ -30,7 +34,7 @@ int main( int argc, char **argv )
 */
 	arguments.getApplicationUsage()->addCommandLineOption("--vegetation_config <filename>","Configuration file");
 	arguments.getApplicationUsage()->addCommandLineOption("--environment_config <filename>", "Environment config file");
-	arguments.getApplicationUsage()->addCommandLineOption("--terrain_query_config <filename>", "Terrain query config file");
+	arguments.getApplicationUsage()->addCommandLineOption("--terrain_query_config <filename>", "Terrain query config file (optional with --read_instance_cache unless procedural data sets are used)");
 	
 	arguments.getApplicationUsage()->addCommandLineOption("--out","out file");
 	arguments.getApplicationUsage()->addCommandLineOption("--terrain","Terrain file");
@@ -39,6 +43,11 @@ int main( int argc, char **argv )
 	arguments.getApplicationUsage()->addCommandLineOption("--bounding_box <x.min x-max y-min y-max>","Optional bounding box");
 	arguments.getApplicationUsage()->addCommandLineOption("--paged_lod","Optional save paged LOD database");
 	arguments.getApplicationUsage()->addCommandLineOption("--save_terrain","Optional inject terrain in database");
+	arguments.getApplicationUsage()->addCommandLineOption("--flat_quadtree","Optional save non paged database as flat quad tree node instead of nested LOD nodes");
+	arguments.getApplicationUsage()->addCommandLineOption("--combined_scattering","Optional scatter all vegetation data sets from shared terrain samples (fewer terrain queries, more memory, changes instance placement)");
+	arguments.getApplicationUsage()->addCommandLineOption("--write_instance_cache <filename>","Optional scatter step only, save raw instances to file (--out is then optional)");
+	arguments.getApplicationUsage()->addCommandLineOption("--read_instance_cache <filename>","Optional build database from saved instances instead of terrain queries (terrain is then only loaded for --save_terrain)");
+	arguments.getApplicationUsage()->addCommandLineOption("--compress_textures","Optional precompile billboard textures to DXT5 with coverage preserving mipmaps (<texture>_bc3_a<alpha ref>.dds) and billboard hull polygons (<texture>_hull_a<alpha ref>.txt)");
 
 	unsigned int helpType = 0;
 	if ((helpType = arguments.readHelpType()))
@@ -70,14 +79,38 @@ int main( int argc, char **argv )
 		pagedLOD = true;
 	}
 
+	bool flat_quadtree = false;
+	if(arguments.read("--flat_quadtree"))
+	{
+		flat_quadtree = true;
+	}
+
 	bool save_terrain = false;
 	if(arguments.read("--save_terrain"))
 	{
 		save_terrain = true;
 	}
 
+	bool compress_textures = false;
+	if(arguments.read("--compress_textures"))
+	{
+		compress_textures = true;
+	}
+
+	bool combined_scattering = false;
+	if(arguments.read("--combined_scattering"))
+	{
+		combined_scattering = true;
+	}
+
+	std::string write_cache_file;
+	arguments.read("--write_instance_cache", write_cache_file);
+
+	std::string read_cache_file;
+	arguments.read("--read_instance_cache", read_cache_file);
+
 	std::string out_file;
-	if(!arguments.read("--out", out_file))
+	if(!arguments.read("--out", out_file) && write_cache_file == "")
 	{
 		std::cerr << "No out file specified\n";
 		return 0;
@@ -89,32 +122,10 @@ int main( int argc, char **argv )
 		std::cout << "Using seed" << seed_value << "\n";
 	}
 
-	//Load terrain
 	osg::ref_ptr<osg::Group> group = new osg::Group;
-	osg::Node* terrain = NULL;
+	osg::ref_ptr<osg::Node> terrain;
 	std::string terrain_file;
-	if(arguments.read("--terrain",terrain_file))
-	{
-		terrain = osgDB::readNodeFile(terrain_file);
-		if(!terrain)
-		{
-			std::cerr << "Failed to load terrain: " + terrain_file + "\n";
-			return 0;
-		}
-
-		//add terrain path 
-		const std::string terrain_path = osgDB::getFilePath(terrain_file);
-		osgDB::Registry::instance()->getDataFilePathList().push_back(terrain_path);  
-
-		osg::ComputeBoundsVisitor  cbv;
-		terrain->accept(cbv);
-		bounding_box = osg::BoundingBoxd(cbv.getBoundingBox()._min, cbv.getBoundingBox()._max);
-		if(useBBox)
-		{
-			bounding_box._min.set(xmin,ymin,bounding_box._min.z());
-			bounding_box._max.set(xmax,ymax,bounding_box._max.z());
-		}
-	}
+	arguments.read("--terrain",terrain_file);
 
 	std::string config_file;
 	if(!arguments.read("--vegetation_config",config_file))
@@ -130,12 +141,9 @@ int main( int argc, char **argv )
 		return 0;
 	}
 
+	//terrain query config is only required when scattering, see below
 	std::string tq_filename;
-	if(!arguments.read("--terrain_query_config",tq_filename))
-	{
-		std::cerr << "No terrain query config provided\n";
-		return 0;
-	}
+	arguments.read("--terrain_query_config",tq_filename);
 
 	osgVegetation::Serializer serializer;
 	try
@@ -145,16 +153,118 @@ int main( int argc, char **argv )
 		const std::string config_path = osgDB::getFilePath(config_file);
 		osgDB::Registry::instance()->getDataFilePathList().push_back(config_path); 
 
-		osg::ref_ptr<osgVegetation::ITerrainQuery> tq = serializer.loadTerrainQuery(terrain, tq_filename);
+		if(compress_textures)
+		{
+			//compressed mipmaps depend on alpha rejection value, compile each texture once for each value used
+			std::set<std::string> compiled_textures;
+			for(size_t i = 0; i < bb_vector.size(); i++)
+			{
+				for(size_t j = 0; j < bb_vector[i].Layers.size(); j++)
+				{
+					const std::string texture_name = bb_vector[i].Layers[j].TextureName;
+					const std::string compressed_name = osgVegetation::TextureCompressor::getCompressedTextureName(texture_name, bb_vector[i].AlphaRefValue);
+					if(compiled_textures.find(compressed_name) != compiled_textures.end())
+						continue;
+					compiled_textures.insert(compressed_name);
+					std::cout << "Compressing texture:" << texture_name << "\n";
+					const std::string compressed_file = osgVegetation::TextureCompressor::compileTexture(texture_name, bb_vector[i].AlphaRefValue);
+					std::cout << "   Saved:" << compressed_file << "\n";
+				}
+			}
+
+			//hull polygons need uncompressed texels, compute them from source textures
+			std::set<std::string> compiled_hulls;
+			for(size_t i = 0; i < bb_vector.size(); i++)
+			{
+				if(!osgVegetation::BillboardHull::isEnabled(bb_vector[i]))
+					continue;
+				const float hull_alpha_ref = osgVegetation::BillboardHull::getAlphaRef(bb_vector[i]);
+				for(size_t j = 0; j < bb_vector[i].Layers.size(); j++)
+				{
+					const std::string texture_name = bb_vector[i].Layers[j].TextureName;
+					const std::string hull_name = osgVegetation::BillboardHull::getHullFileName(texture_name, hull_alpha_ref);
+					if(compiled_hulls.find(hull_name) != compiled_hulls.end())
+						continue;
+					compiled_hulls.insert(hull_name);
+					const std::string hull_file = osgVegetation::BillboardHull::compileHull(texture_name, hull_alpha_ref);
+					std::cout << "Billboard hull:" << texture_name << "\n   Saved:" << hull_file << "\n";
+				}
+			}
+		}
+
+		//terrain is only queried when scattering, instance cache hold all instances except procedural ones
+		bool query_terrain = (read_cache_file == "");
+		for(size_t i = 0; i < bb_vector.size(); i++)
+		{
+			if(bb_vector[i].Technique == osgVegetation::BRT_GPU_PROCEDURAL)
+				query_terrain = true;
+		}
+
+		//Load terrain, paged database only reference terrain file if saved
+		if(terrain_file != "" && (query_terrain || (save_terrain && !pagedLOD)))
+		{
+			terrain = osgDB::readNodeFile(terrain_file);
+			if(!terrain)
+			{
+				std::cerr << "Failed to load terrain: " + terrain_file + "\n";
+				return 0;
+			}
+
+			//add terrain path 
+			const std::string terrain_path = osgDB::getFilePath(terrain_file);
+			osgDB::Registry::instance()->getDataFilePathList().push_back(terrain_path);  
+
+			osg::ComputeBoundsVisitor  cbv;
+			terrain->accept(cbv);
+			bounding_box = osg::BoundingBoxd(cbv.getBoundingBox()._min, cbv.getBoundingBox()._max);
+			if(useBBox)
+			{
+				bounding_box._min.set(xmin,ymin,bounding_box._min.z());
+				bounding_box._max.set(xmax,ymax,bounding_box._max.z());
+			}
+		}
+
+		osg::ref_ptr<osgVegetation::ITerrainQuery> tq;
+		if(query_terrain)
+		{
+			if(tq_filename == "")
+			{
+				std::cerr << "No terrain query config provided\n";
+				return 0;
+			}
+			tq = serializer.loadTerrainQuery(terrain.get(), tq_filename);
+		}
 		osgVegetation::EnvironmentSettings env_settings;
 		if(env_filename != "")
 			env_settings = serializer.loadEnvironmentSettings(env_filename);
 		osgVegetation::BillboardQuadTreeScattering scattering(tq, env_settings);
+		scattering.setCombinedScattering(combined_scattering);
+		scattering.setUseQuadTreeNode(flat_quadtree);
+		//billboard scattering use own random state per tile, global rand() is not used
+		scattering.setSeed(static_cast<unsigned int>(seed_value));
+
+		osg::ref_ptr<osgVegetation::InstanceCache> instance_cache;
+		if(read_cache_file != "")
+		{
+			std::cout << "Reading instance cache:" << read_cache_file << "\n";
+			instance_cache = osgVegetation::InstanceCache::read(read_cache_file);
+			//instances are only valid for scatter area
+			bounding_box = instance_cache->getBoundingBox();
+		}
+		else if(write_cache_file != "")
+		{
+			std::cout << "Start Scattering (instance cache)...\n";
+			instance_cache = scattering.scatter(bounding_box, bb_vector);
+			instance_cache->write(write_cache_file);
+			std::cout << "Saved instance cache:" << write_cache_file << "\n";
+		}
+		if(out_file == "")
+			return 0;
+		scattering.setInstanceCache(instance_cache.get());
+
 		std::cout << "Using bounding box:" << bounding_box.xMin() << " " << bounding_box.yMin() << " "<< bounding_box.xMax() << " " << bounding_box.yMax() << "\n";
 		std::cout << "Start Scattering...\n";
 
-		srand(seed_value); //reset random numbers, TODO: support layer seed
-
 		osg::Node* bb_node = scattering.generate(bounding_box, bb_vector, out_file, pagedLOD);
 		group->addChild(bb_node);
 		
@@ -168,8 +278,8 @@ int main( int argc, char **argv )
 			else
 			{
 				osg::Group* veg_group = dynamic_cast<osg::Group*>(bb_node);
-				if(veg_group)
-					veg_group->addChild(terrain);
+				if(veg_group && terrain.valid())
+					veg_group->addChild(terrain.get());
 			}
 		}
 		osgDB::writeNodeFile(*bb_node, out_file);
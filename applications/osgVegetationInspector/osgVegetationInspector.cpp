@@ -0,0 +1,782 @@
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/LOD>
+#include <osg/PagedLOD>
+#include <osg/ProxyNode>
+#include <osg/TextureBuffer>
+#include <osg/NodeVisitor>
+#include <osg/Version>
+#include <osgViewer/Viewer>
+#include <cfloat>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "BRTProceduralGrass.h"
+#include "InstanceExtractor.h"
+#include "VegetationInstanceIndex.h"
+#include "VegetationQuadTree.h"
+
+/**
+	Visitor that load all tiles (PagedLOD and ProxyNode children) and check
+	that every vegetation instance is inside its drawable bound and inside all enclosing LOD spheres.
+	Flattened VegetationQuadTree tiles are checked as the LOD nodes they replace.
+*/
+class BoundVerifyVisitor : public osg::NodeVisitor
+{
+public:
+	BoundVerifyVisitor(const std::string &root_path) : m_RootPath(root_path),
+		m_NumTiles(0),
+		m_NumInstances(0),
+		m_NumDrawableViolations(0),
+		m_NumLODViolations(0),
+		m_NumMissingFiles(0)
+	{
+		setTraversalMode(TRAVERSE_ALL_CHILDREN);
+		setNodeMaskOverride(~0);
+	}
+
+	void apply(osg::Node& node)
+	{
+		//don't traverse mesh template
+		if(_verifyMeshes(node))
+			return;
+		traverse(node);
+	}
+
+	void apply(osg::Group& group)
+	{
+		osgVegetation::VegetationQuadTree* quad_tree = dynamic_cast<osgVegetation::VegetationQuadTree*>(&group);
+		if(quad_tree && quad_tree->getNumTiles() > 0)
+			_traverseQuadTreeTile(*quad_tree, 0);
+		else
+			apply(static_cast<osg::Node&>(group));
+	}
+
+	void apply(osg::Geode& geode)
+	{
+		if(_verifyMeshes(geode))
+			return;
+		for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+		{
+			osgVegetation::ExtractedInstanceVector instances;
+			if(osgVegetation::InstanceExtractor::extractBillboards(geode.getDrawable(i), instances))
+				_verify(instances, _getDrawableBound(geode.getDrawable(i)));
+		}
+	}
+
+	void apply(osg::LOD& lod)
+	{
+		const bool user_center = lod.getCenterMode() == osg::LOD::USER_DEFINED_CENTER;
+		if(user_center)
+			m_Spheres.push_back(osg::BoundingSphere(lod.getCenter(), lod.getRadius()));
+		traverse(lod);
+		if(user_center)
+			m_Spheres.pop_back();
+	}
+
+	void apply(osg::PagedLOD& plod)
+	{
+		const bool user_center = plod.getCenterMode() == osg::LOD::USER_DEFINED_CENTER;
+		if(user_center)
+			m_Spheres.push_back(osg::BoundingSphere(plod.getCenter(), plod.getRadius()));
+		traverse(plod);
+		for(unsigned int i = 0; i < plod.getNumFileNames(); i++)
+		{
+			if(plod.getFileName(i) != "")
+				_traverseFile(plod.getDatabasePath(), plod.getFileName(i));
+		}
+		if(user_center)
+			m_Spheres.pop_back();
+	}
+
+	void apply(osg::ProxyNode& pn)
+	{
+		traverse(pn);
+		for(unsigned int i = 0; i < pn.getNumFileNames(); i++)
+		{
+			//skip already loaded children
+			if(i < pn.getNumChildren())
+				continue;
+			_traverseFile(pn.getDatabasePath(), pn.getFileName(i));
+		}
+	}
+
+	void report() const
+	{
+		std::cout << "Tiles:" << m_NumTiles << " Instances:" << m_NumInstances << std::endl;
+		std::cout << "Instances outside drawable bound:" << m_NumDrawableViolations << std::endl;
+		std::cout << "Instances outside LOD bound:" << m_NumLODViolations << std::endl;
+		if(m_NumMissingFiles > 0)
+			std::cout << "Missing tile files:" << m_NumMissingFiles << std::endl;
+	}
+
+	bool valid() const { return m_NumDrawableViolations == 0 && m_NumLODViolations == 0 && m_NumMissingFiles == 0; }
+private:
+	osg::BoundingBox _getDrawableBound(const osg::Drawable* drawable) const
+	{
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 3, 2)
+		return drawable->getBoundingBox();
+#else
+		return drawable->getBound();
+#endif
+	}
+
+	bool _verifyMeshes(osg::Node& node)
+	{
+		osgVegetation::ExtractedInstanceVector instances;
+		if(!osgVegetation::InstanceExtractor::extractMeshes(&node, instances))
+			return false;
+		//instanced drawables share tile bound, use first one
+		osg::BoundingBox drawable_bb;
+		osg::Geode* geode = _findGeode(&node);
+		if(geode && geode->getNumDrawables() > 0)
+			drawable_bb = _getDrawableBound(geode->getDrawable(0));
+		_verify(instances, drawable_bb);
+		return true;
+	}
+
+	void _traverseQuadTreeTile(osgVegetation::VegetationQuadTree &quad_tree, unsigned int index)
+	{
+		//final tiles are nodes that were not flattened and have no LOD sphere
+		const osgVegetation::VegetationQuadTree::Tile tile = quad_tree.getTile(index);
+		const bool flattened = tile.NumChildren > 0 || tile.ChildMaxRange > 0;
+		if(flattened)
+			m_Spheres.push_back(osg::BoundingSphere(tile.Center, tile.Radius));
+		if(tile.Content >= 0)
+			quad_tree.getChild(tile.Content)->accept(*this);
+		for(unsigned int i = 0; i < tile.NumChildren; i++)
+			_traverseQuadTreeTile(quad_tree, tile.FirstChild + i);
+		if(flattened)
+			m_Spheres.pop_back();
+	}
+
+	osg::Geode* _findGeode(osg::Node* node) const
+	{
+		if(node->asGeode())
+			return node->asGeode();
+		osg::Group* group = node->asGroup();
+		for(unsigned int i = 0; group && i < group->getNumChildren(); i++)
+		{
+			osg::Geode* geode = _findGeode(group->getChild(i));
+			if(geode)
+				return geode;
+		}
+		return NULL;
+	}
+
+	void _traverseFile(const std::string &database_path, const std::string &file_name)
+	{
+		std::string path = database_path;
+		if(path == "")
+			path = m_RootPath;
+		const std::string full_name = path == "" ? file_name : osgDB::concatPaths(path, file_name);
+		osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(full_name);
+		if(!node.valid())
+		{
+			std::cout << "Failed to load:" << full_name << std::endl;
+			m_NumMissingFiles++;
+			return;
+		}
+		node->accept(*this);
+	}
+
+	void _verify(const osgVegetation::ExtractedInstanceVector &instances, const osg::BoundingBox &drawable_bb)
+	{
+		m_NumTiles++;
+		m_NumInstances += instances.size();
+
+		//instance data is stored as float, allow some slack
+		const double epsilon = 0.01;
+		for(size_t i = 0; i < instances.size(); i++)
+		{
+			const osg::BoundingBoxd &bb = instances[i].Bound;
+			bool inside_drawable = drawable_bb.valid();
+			for(unsigned int j = 0; j < 8 && inside_drawable; j++)
+			{
+				const osg::Vec3d p = bb.corner(j);
+				inside_drawable = p.x() >= drawable_bb.xMin() - epsilon && p.x() <= drawable_bb.xMax() + epsilon &&
+					p.y() >= drawable_bb.yMin() - epsilon && p.y() <= drawable_bb.yMax() + epsilon &&
+					p.z() >= drawable_bb.zMin() - epsilon && p.z() <= drawable_bb.zMax() + epsilon;
+			}
+			if(!inside_drawable)
+				m_NumDrawableViolations++;
+
+			bool inside_lod = true;
+			for(size_t j = 0; j < m_Spheres.size() && inside_lod; j++)
+			{
+				for(unsigned int k = 0; k < 8 && inside_lod; k++)
+				{
+					const osg::Vec3d delta = bb.corner(k) - osg::Vec3d(m_Spheres[j].center());
+					inside_lod = delta.length() <= m_Spheres[j].radius() + epsilon;
+				}
+			}
+			if(!inside_lod)
+				m_NumLODViolations++;
+		}
+	}
+
+	std::string m_RootPath;
+	std::vector<osg::BoundingSphere> m_Spheres;
+	unsigned int m_NumTiles;
+	size_t m_NumInstances;
+	size_t m_NumDrawableViolations;
+	size_t m_NumLODViolations;
+	unsigned int m_NumMissingFiles;
+};
+
+/**
+	Visitor that count drawables, used to estimate draw calls of instanced mesh templates
+*/
+class DrawableCountVisitor : public osg::NodeVisitor
+{
+public:
+	DrawableCountVisitor() : m_NumDrawables(0)
+	{
+		setTraversalMode(TRAVERSE_ALL_CHILDREN);
+		setNodeMaskOverride(~0);
+	}
+
+	void apply(osg::Geode& geode)
+	{
+		m_NumDrawables += geode.getNumDrawables();
+	}
+	unsigned int m_NumDrawables;
+};
+
+/**
+	Visitor that load all tiles (PagedLOD and ProxyNode children) and collect statistics for each quad tree level.
+	The last range of a LOD node hold the next level (child tiles or tile file), other ranges hold
+	instances of the LOD node level. Tiles are LOD children, a tile is empty if no instance is found below it.
+	Flattened VegetationQuadTree tiles are counted as the LOD nodes they replace.
+*/
+class DatabaseStatsVisitor : public osg::NodeVisitor
+{
+public:
+	DatabaseStatsVisitor(const std::string &root_path) : m_RootPath(root_path),
+		m_Level(0),
+		m_CurrentFile("root"),
+		m_NumInstances(0),
+		m_NumMissingFiles(0)
+	{
+		setTraversalMode(TRAVERSE_ALL_CHILDREN);
+		setNodeMaskOverride(~0);
+	}
+
+	void addRootFile(const std::string &filename)
+	{
+		m_CurrentFile = osgDB::getSimpleFileName(filename);
+		_getLevel().NumFiles++;
+		_getLevel().FileBytes += _getFileSize(osgDB::findDataFile(filename));
+	}
+
+	void apply(osg::Node& node)
+	{
+		//don't traverse mesh template
+		if(_addMeshes(node))
+			return;
+		traverse(node);
+	}
+
+	void apply(osg::Group& group)
+	{
+		osgVegetation::VegetationQuadTree* quad_tree = dynamic_cast<osgVegetation::VegetationQuadTree*>(&group);
+		if(quad_tree && quad_tree->getNumTiles() > 0)
+			_traverseQuadTreeTile(*quad_tree, 0);
+		else
+			apply(static_cast<osg::Node&>(group));
+	}
+
+	void apply(osg::Geode& geode)
+	{
+		if(_addMeshes(geode))
+			return;
+		size_t num_instances = 0;
+		unsigned int num_draw_calls = 0;
+		for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+		{
+			const osg::Drawable* drawable = geode.getDrawable(i);
+			const osg::StateSet* state_set = drawable->getStateSet();
+			const osg::Uniform* layer_info = state_set ? state_set->getUniform("LayerInfo") : NULL;
+			if(layer_info)
+			{
+				//procedural grass, instances generated on GPU, one for each cell
+				osg::Vec4 value;
+				layer_info->get(value);
+				const osg::Geometry* geom = drawable->asGeometry();
+				const unsigned int num_cells = geom && geom->getNumPrimitiveSets() > 0 ? geom->getPrimitiveSet(0)->getNumInstances() : 0;
+				_getLevel().Instances[_getLayerName("procedural layer", static_cast<int>(value.z()))] += num_cells;
+				num_instances += num_cells;
+				num_draw_calls++;
+				continue;
+			}
+
+			osgVegetation::ExtractedInstanceVector instances;
+			if(!osgVegetation::InstanceExtractor::extractBillboards(drawable, instances))
+				continue;
+			for(size_t j = 0; j < instances.size(); j++)
+				_getLevel().Instances[_getLayerName("billboard layer", instances[j].TextureIndex)]++;
+			_getLevel().TBOBytes += _getDataBufferBytes(state_set);
+			num_instances += instances.size();
+			num_draw_calls++;
+		}
+		if(num_draw_calls > 0)
+			_addTile(num_instances, num_draw_calls);
+	}
+
+	void apply(osg::LOD& lod)
+	{
+		_addLOD(lod);
+		for(unsigned int i = 0; i < lod.getNumChildren(); i++)
+			_traverseChild(lod, i, lod.getChild(i));
+	}
+
+	void apply(osg::PagedLOD& plod)
+	{
+		_addLOD(plod);
+		_getLevel().NumPagedLODNodes++;
+		for(unsigned int i = 0; i < plod.getNumChildren(); i++)
+			_traverseChild(plod, i, plod.getChild(i));
+		for(unsigned int i = plod.getNumChildren(); i < plod.getNumFileNames(); i++)
+		{
+			if(plod.getFileName(i) == "")
+				continue;
+			osg::ref_ptr<osg::Node> node = _readFile(plod.getDatabasePath(), plod.getFileName(i), i + 1 == plod.getNumRanges() ? m_Level + 1 : m_Level);
+			if(node.valid())
+			{
+				const std::string parent_file = m_CurrentFile;
+				m_CurrentFile = osgDB::getSimpleFileName(plod.getFileName(i));
+				_traverseChild(plod, i, node.get());
+				m_CurrentFile = parent_file;
+			}
+		}
+	}
+
+	void apply(osg::ProxyNode& pn)
+	{
+		traverse(pn);
+		for(unsigned int i = pn.getNumChildren(); i < pn.getNumFileNames(); i++)
+		{
+			osg::ref_ptr<osg::Node> node = _readFile(pn.getDatabasePath(), pn.getFileName(i), m_Level);
+			if(node.valid())
+			{
+				const std::string parent_file = m_CurrentFile;
+				m_CurrentFile = osgDB::getSimpleFileName(pn.getFileName(i));
+				node->accept(*this);
+				m_CurrentFile = parent_file;
+			}
+		}
+	}
+
+	void report() const
+	{
+		std::cout << "Levels:" << m_Levels.size() << " Instances:" << m_NumInstances << std::endl;
+		for(size_t i = 0; i < m_Levels.size(); i++)
+		{
+			const LevelStats &level = m_Levels[i];
+			size_t num_instances = 0;
+			for(std::map<std::string, size_t>::const_iterator iter = level.Instances.begin(); iter != level.Instances.end(); ++iter)
+				num_instances += iter->second;
+			std::cout << "Level " << i << std::endl;
+			std::cout << "  LOD nodes:" << level.NumLODNodes << " (paged:" << level.NumPagedLODNodes << ")"
+				<< " Tiles:" << level.NumTiles << " Empty tiles:" << level.NumEmptyTiles
+				<< " Instance nodes:" << level.NumInstanceNodes << std::endl;
+			std::cout << "  Files:" << level.NumFiles << " File bytes:" << level.FileBytes << " TBO bytes:" << level.TBOBytes
+				<< " Draw calls (all tiles visible):" << level.NumDrawCalls << std::endl;
+			if(level.NumLODNodes > 0)
+			{
+				std::cout << "  LOD ranges";
+				if(level.NumDistanceLODs > 0)
+					std::cout << " distance:" << level.MinRange << "-" << level.MaxRange;
+				if(level.NumDistanceLODs < level.NumLODNodes)
+					std::cout << " pixel size nodes:" << level.NumLODNodes - level.NumDistanceLODs;
+				std::cout << std::endl;
+			}
+			std::cout << "  Instances:" << num_instances << std::endl;
+			for(std::map<std::string, size_t>::const_iterator iter = level.Instances.begin(); iter != level.Instances.end(); ++iter)
+				std::cout << "    " << iter->first << ":" << iter->second << std::endl;
+			if(level.LargestNodes.size() > 0)
+			{
+				std::cout << "  Largest instance nodes:" << std::endl;
+				for(size_t j = 0; j < level.LargestNodes.size(); j++)
+					std::cout << "    " << level.LargestNodes[j].first << " instances in " << level.LargestNodes[j].second << std::endl;
+			}
+		}
+		if(m_NumMissingFiles > 0)
+			std::cout << "Missing tile files:" << m_NumMissingFiles << std::endl;
+	}
+
+	bool valid() const { return m_NumMissingFiles == 0; }
+private:
+	struct LevelStats
+	{
+		LevelStats() : NumLODNodes(0),
+			NumPagedLODNodes(0),
+			NumDistanceLODs(0),
+			NumTiles(0),
+			NumEmptyTiles(0),
+			NumInstanceNodes(0),
+			NumFiles(0),
+			FileBytes(0),
+			TBOBytes(0),
+			NumDrawCalls(0),
+			MinRange(FLT_MAX),
+			MaxRange(0)
+		{
+
+		}
+		unsigned int NumLODNodes;
+		unsigned int NumPagedLODNodes;
+		unsigned int NumDistanceLODs;
+		unsigned int NumTiles;
+		unsigned int NumEmptyTiles;
+		unsigned int NumInstanceNodes;
+		unsigned int NumFiles;
+		unsigned long long FileBytes;
+		unsigned long long TBOBytes;
+		unsigned int NumDrawCalls;
+		//range of next level child
+		float MinRange;
+		float MaxRange;
+		std::map<std::string, size_t> Instances;
+		//instance count and file name, sorted largest first
+		std::vector<std::pair<size_t, std::string> > LargestNodes;
+	};
+
+	LevelStats& _getLevel(unsigned int level)
+	{
+		if(m_Levels.size() <= level)
+			m_Levels.resize(level + 1);
+		return m_Levels[level];
+	}
+
+	LevelStats& _getLevel() { return _getLevel(m_Level); }
+
+	std::string _getLayerName(const std::string &prefix, int index) const
+	{
+		std::stringstream ss;
+		ss << prefix << " " << index;
+		return ss.str();
+	}
+
+	unsigned long long _getFileSize(const std::string &filename) const
+	{
+		std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+		return file.is_open() ? static_cast<unsigned long long>(file.tellg()) : 0;
+	}
+
+	unsigned int _getDataBufferBytes(const osg::StateSet* state_set) const
+	{
+		//data buffer is always bound to texture unit 1
+		const osg::TextureBuffer* tbo = state_set ? dynamic_cast<const osg::TextureBuffer*>(state_set->getTextureAttribute(1, osg::StateAttribute::TEXTURE)) : NULL;
+		return tbo && tbo->getImage() ? tbo->getImage()->getTotalSizeInBytes() : 0;
+	}
+
+	void _addLOD(const osg::LOD& lod)
+	{
+		_addLOD(lod.getRangeMode(), lod.getNumRanges() > 0, lod.getNumRanges() > 0 ? lod.getMaxRange(lod.getNumRanges() - 1) : 0);
+	}
+
+	void _addLOD(osg::LOD::RangeMode mode, bool has_range, float next_level_range)
+	{
+		LevelStats &level = _getLevel();
+		level.NumLODNodes++;
+		if(mode == osg::LOD::DISTANCE_FROM_EYE_POINT && has_range)
+		{
+			level.NumDistanceLODs++;
+			level.MinRange = std::min(level.MinRange, next_level_range);
+			level.MaxRange = std::max(level.MaxRange, next_level_range);
+		}
+	}
+
+	void _traverseChild(const osg::LOD& lod, unsigned int index, osg::Node* child)
+	{
+		//last range hold next level
+		_traverseTile(child, index + 1 == lod.getNumRanges());
+	}
+
+	void _traverseTile(osg::Node* tile, bool next_level)
+	{
+		const unsigned int parent_level = m_Level;
+		if(next_level)
+			m_Level++;
+		const size_t num_instances = m_NumInstances;
+		tile->accept(*this);
+		_getLevel().NumTiles++;
+		if(m_NumInstances == num_instances)
+			_getLevel().NumEmptyTiles++;
+		m_Level = parent_level;
+	}
+
+	/**
+		Flattened tile is counted as LOD node with content at tile level and child tile group at next level,
+		final tiles (not flattened) are traversed as they were children of the group.
+	*/
+	void _traverseQuadTreeTile(osgVegetation::VegetationQuadTree &quad_tree, unsigned int index)
+	{
+		const osgVegetation::VegetationQuadTree::Tile tile = quad_tree.getTile(index);
+		const bool flattened = tile.NumChildren > 0 || tile.ChildMaxRange > 0;
+		if(!flattened)
+		{
+			if(tile.Content >= 0)
+				quad_tree.getChild(tile.Content)->accept(*this);
+			return;
+		}
+		_addLOD(quad_tree.getRangeMode(), true, tile.ChildMaxRange);
+		if(tile.Content >= 0)
+			_traverseTile(quad_tree.getChild(tile.Content), false);
+		if(tile.NumChildren == 0)
+			return;
+
+		const unsigned int parent_level = m_Level;
+		m_Level++;
+		const size_t num_instances = m_NumInstances;
+		for(unsigned int i = 0; i < tile.NumChildren; i++)
+			_traverseQuadTreeTile(quad_tree, tile.FirstChild + i);
+		_getLevel().NumTiles++;
+		if(m_NumInstances == num_instances)
+			_getLevel().NumEmptyTiles++;
+		m_Level = parent_level;
+	}
+
+	void _addTile(size_t num_instances, unsigned int num_draw_calls)
+	{
+		const size_t max_largest = 5;
+		LevelStats &level = _getLevel();
+		level.NumInstanceNodes++;
+		level.NumDrawCalls += num_draw_calls;
+		m_NumInstances += num_instances;
+		std::vector<std::pair<size_t, std::string> > &largest = level.LargestNodes;
+		if(largest.size() < max_largest || largest.back().first < num_instances)
+		{
+			if(largest.size() == max_largest)
+				largest.pop_back();
+			largest.push_back(std::pair<size_t, std::string>(num_instances, m_CurrentFile));
+			for(size_t i = largest.size() - 1; i > 0 && largest[i - 1].first < largest[i].first; i--)
+				std::swap(largest[i - 1], largest[i]);
+		}
+	}
+
+	bool _addMeshes(osg::Node& node)
+	{
+		const unsigned int num_meshes = osgVegetation::InstanceExtractor::getNumMeshes(&node);
+		if(num_meshes == 0)
+			return false;
+		const std::string name = node.getName() != "" ? node.getName() : std::string("unnamed");
+		_getLevel().Instances["mesh " + name] += num_meshes;
+		_getLevel().TBOBytes += _getDataBufferBytes(node.getStateSet());
+		//one instanced draw call for each drawable in mesh template
+		DrawableCountVisitor dcv;
+		node.accept(dcv);
+		_addTile(num_meshes, dcv.m_NumDrawables);
+		return true;
+	}
+
+	osg::ref_ptr<osg::Node> _readFile(const std::string &database_path, const std::string &file_name, unsigned int level)
+	{
+		std::string path = database_path;
+		if(path == "")
+			path = m_RootPath;
+		const std::string full_name = path == "" ? file_name : osgDB::concatPaths(path, file_name);
+		osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(full_name);
+		if(!node.valid())
+		{
+			std::cout << "Failed to load:" << full_name << std::endl;
+			m_NumMissingFiles++;
+			return NULL;
+		}
+		_getLevel(level).NumFiles++;
+		_getLevel(level).FileBytes += _getFileSize(osgDB::findDataFile(full_name));
+		return node;
+	}
+
+	std::string m_RootPath;
+	unsigned int m_Level;
+	std::string m_CurrentFile;
+	std::vector<LevelStats> m_Levels;
+	size_t m_NumInstances;
+	unsigned int m_NumMissingFiles;
+};
+
+struct ProceduralGrassTile
+{
+	osg::BoundingBoxd BB;
+	float Seed;
+	osg::ref_ptr<osg::Image> TerrainImage;
+	osg::ref_ptr<osg::Image> CoverageImage;
+	osg::ref_ptr<osg::Image> PlacementImage;
+};
+
+/**
+	Render synthetic procedural grass tiles to placement images in a pbuffer and compare with
+	CPU reference (BRTProceduralGrass::computeInstances). Tiles are placed far from origin and
+	use negative indices to cover the full hash range. Works with Mesa llvmpipe (LIBGL_ALWAYS_SOFTWARE=1).
+	@return Number of mismatching instances, -1 if no context could be created
+*/
+int VerifyProceduralGrass()
+{
+	osgVegetation::BillboardLayerVector layers;
+	const double densities[3] = {4.0, 1.0, 0.25};
+	for (int i = 0; i < 3; i++)
+	{
+		osgVegetation::BillboardLayer layer("", 0);
+		layer.Density = densities[i];
+		layer._TextureIndex = i;
+		layers.push_back(layer);
+	}
+	osgVegetation::BillboardData data(layers, false, 0.5f, false);
+	data.Type = osgVegetation::BT_GRASS;
+	data.Technique = osgVegetation::BRT_GPU_PROCEDURAL;
+	std::vector<int> layer_indices;
+	for (int i = 0; i < 3; i++)
+		layer_indices.push_back(i);
+
+	osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+	traits->width = 16;
+	traits->height = 16;
+	traits->pbuffer = true;
+	traits->doubleBuffer = false;
+	osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+	if (!gc.valid())
+	{
+		std::cout << "Failed to create pbuffer context" << std::endl;
+		return -1;
+	}
+	osgViewer::Viewer viewer;
+	viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+	viewer.getCamera()->setGraphicsContext(gc.get());
+	viewer.getCamera()->setViewport(0, 0, traits->width, traits->height);
+
+	const int res = 32;
+	const double tile_size = 64.0;
+	const int tile_x[4] = {-37, 121, 4093, -5000};
+	const int tile_y[4] = {121, -37, -4097, 5000};
+	std::vector<ProceduralGrassTile> tiles;
+	osg::ref_ptr<osg::Group> root = new osg::Group;
+	for (int t = 0; t < 4; t++)
+	{
+		ProceduralGrassTile tile;
+		const osg::Vec3d origin(tile_x[t] * tile_size, tile_y[t] * tile_size, 0);
+		tile.BB = osg::BoundingBoxd(origin, origin + osg::Vec3d(tile_size, tile_size, 100));
+		tile.Seed = osgVegetation::BRTProceduralGrass::getTileSeed(t, static_cast<unsigned int>(tile_x[t] + 10000), static_cast<unsigned int>(tile_y[t] + 10000), 1234);
+		tile.TerrainImage = osgVegetation::BRTProceduralGrass::createTerrainImage(res);
+		tile.CoverageImage = osgVegetation::BRTProceduralGrass::createCoverageImage(res);
+		for (int r = 0; r < res; r++)
+		{
+			for (int c = 0; c < res; c++)
+			{
+				osg::Vec4* terrain = reinterpret_cast<osg::Vec4*>(tile.TerrainImage->data(c, r));
+				terrain->set(c / float(res), r / float(res), 0.5f, 100.0f + 10.0f*sinf(c*0.3f)*cosf(r*0.2f));
+				float* mask = reinterpret_cast<float*>(tile.CoverageImage->data(c, r));
+				*mask = static_cast<float>((c / 4 + r / 4 + t) % 8);
+			}
+		}
+		tile.PlacementImage = new osg::Image;
+		root->addChild(osgVegetation::BRTProceduralGrass::createPlacementCamera(data, layer_indices, tile.BB, tile.Seed,
+			tile.TerrainImage.get(), tile.CoverageImage.get(), tile.PlacementImage.get()));
+		tiles.push_back(tile);
+	}
+	viewer.setSceneData(root.get());
+	viewer.realize();
+	viewer.frame();
+
+	int num_mismatches = 0;
+	for (size_t t = 0; t < tiles.size(); t++)
+	{
+		const int tile_mismatches = osgVegetation::BRTProceduralGrass::comparePlacement(data, layer_indices, tiles[t].BB, tiles[t].Seed,
+			tiles[t].TerrainImage.get(), tiles[t].CoverageImage.get(), tiles[t].PlacementImage.get(), 0.01f);
+		std::cout << "Tile:" << t << " Seed:" << tiles[t].Seed << " Mismatches:" << tile_mismatches << std::endl;
+		num_mismatches += tile_mismatches;
+	}
+	return num_mismatches;
+}
+
+int main(int argc, char **argv)
+{
+	osg::ArgumentParser arguments(&argc, argv);
+	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " inspect vegetation created by osgVegetationBuilder.");
+	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options]");
+	arguments.getApplicationUsage()->addCommandLineOption("--verify_bounds <filename>", "Load all tiles of vegetation file and check that every instance is inside its tile bound");
+	arguments.getApplicationUsage()->addCommandLineOption("--write_index <filename> <index_filename>", "Load all tiles of vegetation file and save spatial instance index (see VegetationInstanceIndex)");
+	arguments.getApplicationUsage()->addCommandLineOption("--stats <filename>", "Load all tiles of vegetation file and report statistics for each level (nodes, instances per layer, file bytes, empty and largest tiles, draw calls and LOD ranges)");
+	arguments.getApplicationUsage()->addCommandLineOption("--verify_procedural_grass", "Render procedural grass placement on GPU (pbuffer) and check that it match the CPU reference implementation");
+
+	if (arguments.argc() <= 1 || arguments.read("-h") || arguments.read("--help"))
+	{
+		arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+		return 1;
+	}
+
+	std::string verify_file;
+	if (arguments.read("--verify_bounds", verify_file))
+	{
+		osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(verify_file);
+		if (!node.valid())
+		{
+			std::cout << "Failed to load:" << verify_file << std::endl;
+			return 1;
+		}
+		BoundVerifyVisitor bvv(osgDB::getFilePath(verify_file));
+		node->accept(bvv);
+		bvv.report();
+		return bvv.valid() ? 0 : 1;
+	}
+
+	std::string stats_file;
+	if (arguments.read("--stats", stats_file))
+	{
+		osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(stats_file);
+		if (!node.valid())
+		{
+			std::cout << "Failed to load:" << stats_file << std::endl;
+			return 1;
+		}
+		DatabaseStatsVisitor dsv(osgDB::getFilePath(stats_file));
+		dsv.addRootFile(stats_file);
+		node->accept(dsv);
+		dsv.report();
+		return dsv.valid() ? 0 : 1;
+	}
+
+	if (arguments.read("--verify_procedural_grass"))
+	{
+		try
+		{
+			const int num_mismatches = VerifyProceduralGrass();
+			std::cout << "Procedural grass mismatches:" << num_mismatches << std::endl;
+			return num_mismatches == 0 ? 0 : 1;
+		}
+		catch (std::exception& e)
+		{
+			std::cout << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	std::string database_file, index_file;
+	if (arguments.read("--write_index", database_file, index_file))
+	{
+		try
+		{
+			osg::ref_ptr<osgVegetation::VegetationInstanceIndex> index = osgVegetation::VegetationInstanceIndex::createFromDatabase(database_file);
+			index->write(index_file);
+			std::cout << "Instances:" << index->getNumInstances() << " Cell size:" << index->getCellSize() << std::endl;
+		}
+		catch (std::exception& e)
+		{
+			std::cout << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+	return 1;
+}
@@ -1,4 +1,10 @@
 #include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <osg/ComputeBoundsVisitor>
 #include <osgUtil/Optimizer>
 #include <osg/CoordinateSystemNode>
 #include <osg/Fog>
@@ -20,6 +26,13 @@
 #include <osgShadow/StandardShadowMap>
 #include <osgShadow/ViewDependentShadowMap>
 #include <osg/Version>
+#include "TerrainQuery.h"
+#include "TerrainOcclusionCuller.h"
+#include "PredictivePager.h"
+#include "OnDemandVegetation.h"
+#include "Serializer.h"
+#include "ProgramCache.h"
+#include "VegetationStats.h"
 
 #ifndef OSG_VERSION_GREATER_OR_EQUAL
 #define OSG_VERSION_GREATER_OR_EQUAL(MAJOR, MINOR, PATCH) ((OPENSCENEGRAPH_MAJOR_VERSION>MAJOR) || (OPENSCENEGRAPH_MAJOR_VERSION==MAJOR && (OPENSCENEGRAPH_MINOR_VERSION>MINOR || (OPENSCENEGRAPH_MINOR_VERSION==MINOR && OPENSCENEGRAPH_PATCH_VERSION>=PATCH))))
@@ -30,6 +43,105 @@
 	#include <osg/Types>
 #endif
 
+struct BenchmarkFrame
+{
+	BenchmarkFrame() : FrameNumber(0), PathTime(0), FrameTime(-1), CullTime(-1), DrawTime(-1), GPUTime(-1) {}
+	unsigned int FrameNumber;
+	double PathTime;
+	//seconds, negative if not measured
+	double FrameTime;
+	double CullTime;
+	double DrawTime;
+	double GPUTime;
+	osgVegetation::VegetationStats::FrameCounters Vegetation;
+};
+
+//read camera stats of recent frames, GPU times are available a few frames later
+void UpdateBenchmarkTimes(osg::Stats* stats, std::vector<BenchmarkFrame> &frames)
+{
+	for (size_t i = frames.size(); i > 0 && frames[i - 1].FrameNumber + 20 > stats->getLatestFrameNumber(); i--)
+	{
+		BenchmarkFrame &frame = frames[i - 1];
+		stats->getAttribute(frame.FrameNumber, "Cull traversal time taken", frame.CullTime);
+		stats->getAttribute(frame.FrameNumber, "Draw traversal time taken", frame.DrawTime);
+		stats->getAttribute(frame.FrameNumber, "GPU draw time taken", frame.GPUTime);
+	}
+}
+
+double GetPercentile(const std::vector<double> &sorted_values, double percentile)
+{
+	const size_t index = static_cast<size_t>(percentile*(sorted_values.size() - 1) + 0.5);
+	return sorted_values[std::min(index, sorted_values.size() - 1)];
+}
+
+void WriteBenchmarkSummary(std::ostream &os, const std::string &name, std::vector<double> values)
+{
+	if (values.size() == 0)
+	{
+		os << name << ": not measured" << std::endl;
+		return;
+	}
+	std::sort(values.begin(), values.end());
+	double sum = 0;
+	for (size_t i = 0; i < values.size(); i++)
+		sum += values[i];
+	os << name << " (ms) mean:" << sum / values.size() << " p50:" << GetPercentile(values, 0.5) << " p90:" << GetPercentile(values, 0.9)
+		<< " p95:" << GetPercentile(values, 0.95) << " p99:" << GetPercentile(values, 0.99) << " max:" << values.back() << std::endl;
+}
+
+bool WriteBenchmark(const std::string &filename, const std::vector<BenchmarkFrame> &frames, osgVegetation::VegetationStats* stats)
+{
+	std::ofstream file(filename.c_str());
+	if (!file.is_open())
+		return false;
+	file << "frame,path_time,frame_ms,cull_ms,draw_ms,gpu_ms";
+	//vegetation counters, always collected in benchmark
+	if (stats)
+	{
+		file << ",veg_cull_ms,tiles_visited,tiles_culled,tiles_occluded,tiles_drawn,pending_requests,instances";
+		for (unsigned int i = 0; i < stats->getNumCategories(); i++)
+			file << ",\"" << stats->getCategory(i) << "\"";
+	}
+	file << std::endl;
+
+	std::vector<double> frame_times, cull_times, draw_times, gpu_times;
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		const BenchmarkFrame &frame = frames[i];
+		const double times[4] = {frame.FrameTime, frame.CullTime, frame.DrawTime, frame.GPUTime};
+		std::vector<double>* summary[4] = {&frame_times, &cull_times, &draw_times, &gpu_times};
+		file << i << "," << frame.PathTime;
+		for (int j = 0; j < 4; j++)
+		{
+			//empty value if not measured
+			file << ",";
+			if (times[j] >= 0)
+			{
+				file << times[j] * 1000.0;
+				summary[j]->push_back(times[j] * 1000.0);
+			}
+		}
+		if (stats)
+		{
+			unsigned int num_instances = 0;
+			for (size_t j = 0; j < frame.Vegetation.NumInstances.size(); j++)
+				num_instances += frame.Vegetation.NumInstances[j];
+			file << "," << frame.Vegetation.CullTime * 1000.0 << "," << frame.Vegetation.NumTilesVisited << "," << frame.Vegetation.NumTilesCulled
+				<< "," << frame.Vegetation.NumTilesOccluded << "," << frame.Vegetation.NumTilesDrawn << "," << frame.Vegetation.NumPendingRequests << "," << num_instances;
+			for (unsigned int j = 0; j < stats->getNumCategories(); j++)
+				file << "," << (j < frame.Vegetation.NumInstances.size() ? frame.Vegetation.NumInstances[j] : 0);
+		}
+		file << std::endl;
+	}
+
+	std::cout << "Benchmark, frames:" << frames.size() << std::endl;
+	WriteBenchmarkSummary(std::cout, "Frame", frame_times);
+	WriteBenchmarkSummary(std::cout, "Cull", cull_times);
+	WriteBenchmarkSummary(std::cout, "Draw", draw_times);
+	WriteBenchmarkSummary(std::cout, "GPU", gpu_times);
+	return file.good();
+}
+
 int main(int argc, char **argv)
 {
 	//std::string opt_env= "OSG_OPTIMIZER=COMBINE_ADJACENT_LODS SHARE_DUPLICATE_STATE MERGE_GEOMETRY MAKE_FAST_GEOMETRY CHECK_GEOMETRY OPTIMIZE_TEXTURE_SETTINGS STATIC_OBJECT_DETECTION";
@@ -56,6 +168,17 @@ int main(int argc, char **argv)
 	arguments.getApplicationUsage()->addCommandLineOption("--fov <value>", "Field of view");
 	arguments.getApplicationUsage()->addCommandLineOption("--enable_fog", "Use Fog");
 	arguments.getApplicationUsage()->addCommandLineOption("--shadow_type <value>", "Set Shadow type NONE,LISPSM or VDSM");
+	arguments.getApplicationUsage()->addCommandLineOption("--terrain_occlusion <filename>", "Load terrain from file and use it to cull vegetation tiles hidden behind terrain, all other files are treated as vegetation");
+	arguments.getApplicationUsage()->addCommandLineOption("--occlusion_resolution <value>", "Number of terrain samples along each axis used by terrain occlusion (default 256)");
+	arguments.getApplicationUsage()->addCommandLineOption("--prefetch <seconds>", "Prefetch paged tiles along extrapolated camera path, value is look ahead time");
+	arguments.getApplicationUsage()->addCommandLineOption("--prefetch_budget <value>", "Max number of prefetch requests each frame (default 8)");
+	arguments.getApplicationUsage()->addCommandLineOption("--on_demand <vegetation_config> <terrain_query_config> <terrain_file>", "Generate billboard vegetation tiles on demand while paging instead of loading prebuilt vegetation");
+	arguments.getApplicationUsage()->addCommandLineOption("--environment_config <filename>", "Environment settings used by on demand vegetation");
+	arguments.getApplicationUsage()->addCommandLineOption("--cache_dir <path>", "Save on demand generated tiles to directory and reuse them on later runs");
+	arguments.getApplicationUsage()->addCommandLineOption("--program_binaries <path>", "Save linked shader program binaries (one per shader define combination) to directory and use them on later runs to skip shader compilation");
+	arguments.getApplicationUsage()->addCommandLineOption("--vegetation_stats", "Collect vegetation statistics (tiles, instances per layer, TBO bytes of drawn tiles, pending requests, cull time) and show them on the viewer stats page");
+	arguments.getApplicationUsage()->addCommandLineOption("--benchmark <frames> <csv_file>", "Render offscreen along animation path (-p) for fixed number of frames and write per frame cull, draw and GPU times, tile and instance counts to file. Implies --vegetation_stats, counters add cull overhead that is included in cull_ms and reported in veg_cull_ms");
+	arguments.getApplicationUsage()->addCommandLineOption("--benchmark_size <width> <height>", "Offscreen resolution used by benchmark (default 1280 720)");
 
 	osgViewer::Viewer viewer(arguments);
 
@@ -128,8 +251,85 @@ int main(int argc, char **argv)
 	if(shadow_type == "NONE")
 		enableShadows = false;
 
+	std::string occlusion_terrain_file;
+	while (arguments.read("--terrain_occlusion", occlusion_terrain_file))
+	{
+
+	}
+
+	unsigned int occlusion_resolution = 256;
+	while (arguments.read("--occlusion_resolution", occlusion_resolution))
+	{
+
+	}
+
+	double prefetch_time = 0;
+	while (arguments.read("--prefetch", prefetch_time))
+	{
+
+	}
+
+	unsigned int prefetch_budget = 8;
+	while (arguments.read("--prefetch_budget", prefetch_budget))
+	{
+
+	}
+
+	std::string on_demand_config, on_demand_tq_config, on_demand_terrain_file;
+	while (arguments.read("--on_demand", on_demand_config, on_demand_tq_config, on_demand_terrain_file))
+	{
+
+	}
+
+	std::string env_config;
+	while (arguments.read("--environment_config", env_config))
+	{
+
+	}
+
+	std::string cache_dir;
+	while (arguments.read("--cache_dir", cache_dir))
+	{
+
+	}
+
+	std::string program_binaries_dir;
+	while (arguments.read("--program_binaries", program_binaries_dir))
+	{
+
+	}
+	if (program_binaries_dir != "")
+		osgVegetation::ProgramCache::instance()->setBinaryDirectory(program_binaries_dir);
+
+	bool use_vegetation_stats = false;
+	while (arguments.read("--vegetation_stats"))
+	{
+		use_vegetation_stats = true;
+	}
+
+	unsigned int benchmark_frames = 0;
+	std::string benchmark_file;
+	while (arguments.read("--benchmark", benchmark_frames, benchmark_file))
+	{
+
+	}
+	//instance counts are part of benchmark result
+	if (benchmark_frames > 0)
+		use_vegetation_stats = true;
+
+	unsigned int benchmark_width = 1280;
+	unsigned int benchmark_height = 720;
+	while (arguments.read("--benchmark_size", benchmark_width, benchmark_height))
+	{
+
+	}
+
+	//share identical vegetation shader programs between loaded files and paged tiles
+	osgDB::Registry::instance()->setReadFileCallback(new osgVegetation::ProgramCache::ShareProgramsReadCallback());
+
 
 	// set up the camera manipulators.
+	osg::ref_ptr<osgGA::AnimationPathManipulator> benchmark_path;
 	{
 		osg::ref_ptr<osgGA::KeySwitchMatrixManipulator> keyswitchManipulator = new osgGA::KeySwitchMatrixManipulator;
 
@@ -156,6 +356,7 @@ int main(int argc, char **argv)
 				keyswitchManipulator->addMatrixManipulator(keyForAnimationPath, "Path", apm);
 				keyswitchManipulator->selectMatrixManipulator(num);
 				++keyForAnimationPath;
+				benchmark_path = apm;
 			}
 		}
 
@@ -172,7 +373,8 @@ int main(int argc, char **argv)
 	viewer.addEventHandler(new osgViewer::WindowSizeHandler);
 
 	// add the stats handler
-	viewer.addEventHandler(new osgViewer::StatsHandler);
+	osg::ref_ptr<osgViewer::StatsHandler> stats_handler = new osgViewer::StatsHandler;
+	viewer.addEventHandler(stats_handler.get());
 
 	// add the help handler
 	viewer.addEventHandler(new osgViewer::HelpHandler(arguments.getApplicationUsage()));
@@ -192,6 +394,53 @@ int main(int argc, char **argv)
 #else
 	osg::ref_ptr<osg::Node> loadedModel = osgDB::readNodeFiles(arguments);
 #endif
+
+	//create on demand vegetation, only top tiles are generated here, the rest is generated when paged in
+	osg::ref_ptr<osg::Node> on_demand_terrain;
+	if (on_demand_config != "")
+	{
+		on_demand_terrain = osgDB::readNodeFile(on_demand_terrain_file);
+		if (!on_demand_terrain)
+		{
+			std::cout << arguments.getApplicationName() << ": Failed to load terrain:" << on_demand_terrain_file << std::endl;
+			return 1;
+		}
+		osgDB::Registry::instance()->getDataFilePathList().push_back(osgDB::getFilePath(on_demand_terrain_file));
+		osgDB::Registry::instance()->getDataFilePathList().push_back(osgDB::getFilePath(on_demand_config));
+
+		osg::ComputeBoundsVisitor cbv;
+		on_demand_terrain->accept(cbv);
+		const osg::BoundingBoxd terrain_bb(cbv.getBoundingBox()._min, cbv.getBoundingBox()._max);
+
+		osg::ref_ptr<osg::Group> on_demand_group = new osg::Group;
+		try
+		{
+			osgVegetation::Serializer serializer;
+			std::vector<osgVegetation::BillboardData> bb_vector = serializer.loadBillboardData(on_demand_config);
+			osg::ref_ptr<osgVegetation::ITerrainQuery> tq = serializer.loadTerrainQuery(on_demand_terrain.get(), on_demand_tq_config);
+			osgVegetation::EnvironmentSettings env_settings;
+			if (env_config != "")
+				env_settings = serializer.loadEnvironmentSettings(env_config);
+			for (size_t i = 0; i < bb_vector.size(); i++)
+			{
+				std::stringstream ss;
+				ss << "veg" << i;
+				osg::ref_ptr<osgVegetation::OnDemandVegetation> veg = new osgVegetation::OnDemandVegetation(ss.str(), tq.get(), env_settings, bb_vector[i], terrain_bb, i);
+				veg->setCacheDirectory(cache_dir);
+				on_demand_group->addChild(veg->createRoot());
+			}
+		}
+		catch (std::exception& e)
+		{
+			std::cout << arguments.getApplicationName() << ": " << e.what() << std::endl;
+			return 1;
+		}
+
+		if (loadedModel.valid())
+			on_demand_group->addChild(loadedModel);
+		loadedModel = on_demand_group;
+	}
+
 	if (!loadedModel)
 	{
 		std::cout << arguments.getApplicationName() << ": No data loaded" << std::endl;
@@ -213,6 +462,54 @@ int main(int argc, char **argv)
 	osgUtil::Optimizer optimizer;
 	optimizer.optimize(loadedModel);
 
+	//cull vegetation tiles hidden behind terrain
+	osg::ref_ptr<osgVegetation::TerrainOcclusionCuller> occlusion_culler;
+	osg::ref_ptr<osg::Node> occlusion_terrain;
+	if (occlusion_terrain_file != "")
+	{
+		occlusion_terrain = osgDB::readNodeFile(occlusion_terrain_file);
+		if (!occlusion_terrain)
+		{
+			std::cout << arguments.getApplicationName() << ": Failed to load terrain:" << occlusion_terrain_file << std::endl;
+			return 1;
+		}
+		std::cout << "Sampling terrain for occlusion culling..." << std::endl;
+		osg::ref_ptr<osgVegetation::TerrainQuery> tq = new osgVegetation::TerrainQuery(occlusion_terrain.get(), osgVegetation::CoverageData());
+		//only heights are used, skip coverage lookup
+		tq->setCoverageTextureSuffix("");
+		//sample tight terrain bounds, bounding sphere would waste samples outside terrain
+		osg::ComputeBoundsVisitor cbv;
+		occlusion_terrain->accept(cbv);
+		const osg::BoundingBoxd terrain_bb(cbv.getBoundingBox()._min, cbv.getBoundingBox()._max);
+		osg::ref_ptr<osg::HeightField> hf = osgVegetation::TerrainOcclusionCuller::createHeightField(tq.get(), terrain_bb, occlusion_resolution, occlusion_resolution);
+		occlusion_culler = new osgVegetation::TerrainOcclusionCuller(hf.get());
+		occlusion_culler->install(loadedModel.get());
+	}
+
+	//vegetation stats lines are added to the viewer stats page, must be installed after occlusion culler.
+	//Counters are collected during cull and add to measured cull time (reported separately as vegetation cull time)
+	osg::ref_ptr<osgVegetation::VegetationStats> vegetation_stats;
+	unsigned int num_category_lines = 0;
+	if (use_vegetation_stats)
+	{
+		vegetation_stats = new osgVegetation::VegetationStats();
+		vegetation_stats->install(loadedModel.get());
+		if (occlusion_culler.valid())
+			vegetation_stats->setOcclusionCuller(occlusion_culler.get());
+	}
+	if (use_vegetation_stats)
+	{
+		const osg::Vec4 text_color(0.6f, 1.0f, 0.4f, 1.0f);
+		const osg::Vec4 bar_color(0.6f, 1.0f, 0.4f, 0.5f);
+		stats_handler->addUserStatsLine("Veg cull ms", text_color, bar_color, osgVegetation::VegetationStats::getCullTimeName(), 1000.0, true, false, "", "", 0);
+		stats_handler->addUserStatsLine("Veg tiles visited", text_color, bar_color, osgVegetation::VegetationStats::getTilesVisitedName(), 1.0, true, false, "", "", 0);
+		stats_handler->addUserStatsLine("Veg tiles culled", text_color, bar_color, osgVegetation::VegetationStats::getTilesCulledName(), 1.0, true, false, "", "", 0);
+		stats_handler->addUserStatsLine("Veg tiles occluded", text_color, bar_color, osgVegetation::VegetationStats::getTilesOccludedName(), 1.0, true, false, "", "", 0);
+		stats_handler->addUserStatsLine("Veg tiles drawn", text_color, bar_color, osgVegetation::VegetationStats::getTilesDrawnName(), 1.0, true, false, "", "", 0);
+		stats_handler->addUserStatsLine("Veg pending pages", text_color, bar_color, osgVegetation::VegetationStats::getPendingRequestsName(), 1.0, true, false, "", "", 0);
+		stats_handler->addUserStatsLine("Veg drawn TBO MB", text_color, bar_color, osgVegetation::VegetationStats::getDrawnTBOBytesName(), 1.0 / (1024.0*1024.0), true, false, "", "", 0);
+	}
+
 	//Create root node
 	osg::Group* group = new osg::Group;
 
@@ -246,8 +543,50 @@ int main(int argc, char **argv)
 	pLightSource->setLight(pLight);
 	group->addChild(pLightSource);
 	group->addChild(loadedModel);
+	if (occlusion_terrain.valid())
+		group->addChild(occlusion_terrain);
+	if (on_demand_terrain.valid())
+		group->addChild(on_demand_terrain);
 
 	
+	if (benchmark_frames > 0)
+	{
+		if (!benchmark_path.valid() || !benchmark_path->getAnimationPath())
+		{
+			std::cout << arguments.getApplicationName() << ": Benchmark need animation path (-p)" << std::endl;
+			return 1;
+		}
+
+		//render to pbuffer, no window needed and resolution is independent of screen
+		osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+		traits->readDISPLAY();
+		traits->setUndefinedScreenDetailsToDefaultScreen();
+		traits->x = 0;
+		traits->y = 0;
+		traits->width = benchmark_width;
+		traits->height = benchmark_height;
+		traits->pbuffer = true;
+		traits->doubleBuffer = false;
+		traits->samples = osg::DisplaySettings::instance()->getNumMultiSamples();
+		traits->sampleBuffers = traits->samples > 0 ? 1 : 0;
+		osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+		if (!gc.valid())
+		{
+			std::cout << arguments.getApplicationName() << ": Failed to create offscreen context" << std::endl;
+			return 1;
+		}
+		viewer.getCamera()->setGraphicsContext(gc.get());
+		viewer.getCamera()->setViewport(new osg::Viewport(0, 0, benchmark_width, benchmark_height));
+		viewer.getCamera()->setDrawBuffer(GL_FRONT);
+		viewer.getCamera()->setReadBuffer(GL_FRONT);
+
+		//camera is moved along path by fixed steps, single thread to get repeatable timings
+		viewer.setCameraManipulator(NULL);
+		viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+		viewer.getCamera()->getStats()->collectStats("rendering", true);
+		viewer.getCamera()->getStats()->collectStats("gpu", true);
+	}
+
 	double nearClip = 10;
 	double farClip = 10000;
 	viewer.getCamera()->setComputeNearFarMode(osgUtil::CullVisitor::DO_NOT_COMPUTE_NEAR_FAR);
@@ -348,9 +687,28 @@ int main(int argc, char **argv)
 	{
 		viewer.setSceneData(group);
 	}
+	if (program_binaries_dir != "")
+	{
+		//binaries are keyed by driver, driver is read when context is realized and binaries are loaded when programs are linked
+		viewer.setRealizeOperation(new osgVegetation::ProgramCache::DriverInfoOperation());
+		viewer.getCamera()->setFinalDrawCallback(new osgVegetation::ProgramCache::SaveBinariesCallback());
+	}
 	viewer.realize();
 
-	while (!viewer.done())
+	osg::ref_ptr<osgVegetation::PredictivePager> predictive_pager;
+	if (prefetch_time > 0 && viewer.getDatabasePager())
+	{
+		predictive_pager = new osgVegetation::PredictivePager(loadedModel.get(), viewer.getDatabasePager());
+		predictive_pager->setLookAheadTime(prefetch_time);
+		predictive_pager->setMaxRequestsPerFrame(prefetch_budget);
+	}
+
+	std::vector<BenchmarkFrame> benchmark_results;
+	//occlusion counters summed over all frames, reported on exit
+	double num_occluded_tiles = 0;
+	double num_occluded_instances = 0;
+	unsigned int num_frames = 0;
+	while (!viewer.done() && (benchmark_frames == 0 || benchmark_results.size() < benchmark_frames))
 	{
 		//animate light if shadows enabled
 	//	if (enableShadows)
@@ -363,7 +721,75 @@ int main(int argc, char **argv)
 			lightDir.normalize();
 			pLight->setDirection(lightDir);
 		}
-		viewer.frame();
+		if (benchmark_frames > 0)
+		{
+			//path sampled at fixed steps regardless of frame time
+			const osg::AnimationPath* path = benchmark_path->getAnimationPath();
+			BenchmarkFrame result;
+			result.PathTime = path->getFirstTime() + path->getPeriod()*benchmark_results.size() / benchmark_frames;
+			osg::Matrixd path_matrix;
+			path->getMatrix(result.PathTime, path_matrix);
+			viewer.getCamera()->setViewMatrix(osg::Matrixd::inverse(path_matrix));
+			const osg::Timer_t start_tick = osg::Timer::instance()->tick();
+			viewer.frame(result.PathTime);
+			result.FrameTime = osg::Timer::instance()->delta_s(start_tick, osg::Timer::instance()->tick());
+			result.FrameNumber = viewer.getFrameStamp()->getFrameNumber();
+			benchmark_results.push_back(result);
+		}
+		else
+			viewer.frame();
+
+		if (benchmark_frames > 0)
+			UpdateBenchmarkTimes(viewer.getCamera()->getStats(), benchmark_results);
+
+		if (vegetation_stats.valid())
+		{
+			vegetation_stats->recordFrame(viewer.getViewerStats(), viewer.getFrameStamp()->getFrameNumber());
+			if (benchmark_frames > 0)
+				benchmark_results.back().Vegetation = vegetation_stats->getLastFrame();
+			//instance categories are found while rendering, add line for each new one
+			for (; num_category_lines < vegetation_stats->getNumCategories(); num_category_lines++)
+			{
+				const std::string category = vegetation_stats->getCategory(num_category_lines);
+				stats_handler->addUserStatsLine("Veg " + category, osg::Vec4(0.4f, 0.8f, 1.0f, 1.0f), osg::Vec4(0.4f, 0.8f, 1.0f, 0.5f),
+					osgVegetation::VegetationStats::getInstancesName(category), 1.0, true, false, "", "", 0);
+			}
+		}
+
+		num_frames++;
+		if (occlusion_culler.valid())
+		{
+			num_occluded_tiles += occlusion_culler->getNumCulledTiles();
+			num_occluded_instances += occlusion_culler->getNumCulledInstances();
+			occlusion_culler->resetCounters();
+		}
+
+		if (predictive_pager.valid())
+			predictive_pager->update(viewer.getCamera(), viewer.getFrameStamp());
+	}
+
+	if (predictive_pager.valid())
+		predictive_pager->report(std::cout);
+
+	if (occlusion_culler.valid() && num_frames > 0)
+	{
+		//per frame values are shown on stats page (vegetation stats)
+		std::cout << "Terrain occlusion, frames:" << num_frames << " culled tiles per frame:" << num_occluded_tiles / num_frames
+			<< " culled instances per frame:" << num_occluded_instances / num_frames << std::endl;
+	}
+
+	if (benchmark_frames > 0)
+	{
+		//extra frames to collect pending GPU timer results
+		for (int i = 0; i < 3 && !viewer.done(); i++)
+			viewer.frame();
+		UpdateBenchmarkTimes(viewer.getCamera()->getStats(), benchmark_results);
+		if (!WriteBenchmark(benchmark_file, benchmark_results, vegetation_stats.get()))
+		{
+			std::cout << arguments.getApplicationName() << ": Failed to write benchmark file:" << benchmark_file << std::endl;
+			return 1;
+		}
+		return 0;
 	}
 	return 1;
 }
@@ -5,6 +5,7 @@
 #include "IBillboardRenderingTech.h"
 #include "BillboardData.h"
 #include "EnvironmentSettings.h"
+#include "ShaderLibrary.h"
 
 namespace osgVegetation
 {
@@ -17,12 +18,15 @@ namespace osgVegetation
 		BRTGeometryShader(BillboardData &data, const EnvironmentSettings &env_settings);
 
 		//IBillboardRenderingTech
-		osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb);
+		osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb, float fade_radius);
 		osg::StateSet* getStateSet() const {return m_StateSet;}
+		osg::StateSet* getShadowCasterStateSet() const {return m_ShadowCasterStateSet.get();}
 	protected:
 		osg::StateSet* _createStateSet(BillboardData &data, const EnvironmentSettings &env_settings);
-		osg::Program* _createShaders(BillboardData &data, const EnvironmentSettings &env_settings) const;
+		osg::StateSet* _createShadowCasterStateSet(BillboardData &data, const EnvironmentSettings &env_settings) const;
+		osg::Program* _createShaders(BillboardData &data, const ShaderDefines &defines, const std::string &fragment_file) const;
 		osg::StateSet* m_StateSet;
+		osg::ref_ptr<osg::StateSet> m_ShadowCasterStateSet;
 		bool m_PPL;
 	};
 }
@@ -0,0 +1,404 @@
+#include "BRTProceduralGrass.h"
+#include <osg/AlphaFunc>
+#include <osg/BlendFunc>
+#include <osg/CullFace>
+#include <osg/Geode>
+#include <osg/Math>
+#include <osg/Texture2D>
+#include <osg/Texture2DArray>
+#include <osg/Multisample>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "VegetationUtils.h"
+#include "ProgramCache.h"
+#include "ShaderLibrary.h"
+
+namespace osgVegetation
+{
+	BRTProceduralGrass::BRTProceduralGrass(BillboardData &data, const EnvironmentSettings &env_settings)
+	{
+		if (!(data.Type == BT_GRASS || data.Type == BT_CROSS_QUADS))
+			OSGV_EXCEPT(std::string("BRTProceduralGrass::BRTProceduralGrass - Unsupported billboard type").c_str());
+
+		if (data.Layers.size() > MAX_LAYERS)
+			OSGV_EXCEPT(std::string("BRTProceduralGrass::BRTProceduralGrass - Too many layers, coverage mask hold max 24 layers").c_str());
+
+		if (data.ProceduralTerrainResolution < 2)
+			OSGV_EXCEPT(std::string("BRTProceduralGrass::BRTProceduralGrass - ProceduralTerrainResolution must be at least 2").c_str());
+
+		//two crossed quads, x = offset along blade direction, y = quad index, z = height factor
+		m_TemplateVertices = new osg::Vec3Array;
+		m_TemplateTexCoords = new osg::Vec2Array;
+		for (int q = 0; q < 2; q++)
+		{
+			m_TemplateVertices->push_back(osg::Vec3(-0.5f, q, 0.0f)); m_TemplateTexCoords->push_back(osg::Vec2(0.0f, 0.0f));
+			m_TemplateVertices->push_back(osg::Vec3( 0.5f, q, 0.0f)); m_TemplateTexCoords->push_back(osg::Vec2(1.0f, 0.0f));
+			m_TemplateVertices->push_back(osg::Vec3( 0.5f, q, 1.0f)); m_TemplateTexCoords->push_back(osg::Vec2(1.0f, 1.0f));
+			m_TemplateVertices->push_back(osg::Vec3(-0.5f, q, 1.0f)); m_TemplateTexCoords->push_back(osg::Vec2(0.0f, 1.0f));
+		}
+		m_StateSet = _createStateSet(data, env_settings);
+	}
+
+	BRTProceduralGrass::~BRTProceduralGrass()
+	{
+
+	}
+
+	float BRTProceduralGrass::_mod289(float x)
+	{
+		//only used for integer values below 2^24, correct quotient rounding so result is exact
+		float r = x - 289.0f*floorf(x / 289.0f);
+		r = r < 0.0f ? r + 289.0f : r;
+		return r >= 289.0f ? r - 289.0f : r;
+	}
+
+	float BRTProceduralGrass::_permute(float x)
+	{
+		//x must be in [0,289) to keep (34x+1)x below 2^22
+		return _mod289((34.0f*x + 1.0f)*x);
+	}
+
+	float BRTProceduralGrass::_random(const osg::Vec2 &cell, float seed, float k)
+	{
+		//must match cellRandom in brt_procedural_grass_vertex.glsl
+		const float lo_x = _mod289(cell.x());
+		const float lo_y = _mod289(cell.y());
+		const float hi_x = _mod289(floorf((cell.x() - lo_x) / 289.0f + 0.5f));
+		const float hi_y = _mod289(floorf((cell.y() - lo_y) / 289.0f + 0.5f));
+		float h = _permute(_mod289(seed + k));
+		h = _permute(_mod289(h + lo_x));
+		h = _permute(_mod289(h + lo_y));
+		h = _permute(_mod289(h + hi_x));
+		h = _permute(_mod289(h + hi_y));
+		const float h2 = _permute(_mod289(h + 7.0f));
+		return (h + h2 / 289.0f) / 289.0f;
+	}
+
+	float BRTProceduralGrass::getTileSeed(int ld, unsigned int x, unsigned int y, unsigned int seed)
+	{
+		float h = _permute(static_cast<float>(seed % 289));
+		h = _permute(_mod289(h + static_cast<float>(ld % 289)));
+		h = _permute(_mod289(h + static_cast<float>(x % 289)));
+		return _permute(_mod289(h + static_cast<float>(y % 289)));
+	}
+
+	int BRTProceduralGrass::getNumCells(const BillboardLayer &layer, double tile_size)
+	{
+		return std::max(1, static_cast<int>(tile_size*sqrt(layer.Density) + 0.5));
+	}
+
+	osg::Image* BRTProceduralGrass::createTerrainImage(int resolution)
+	{
+		osg::Image* image = new osg::Image;
+		image->allocateImage(resolution, resolution, 1, GL_RGBA, GL_FLOAT);
+		image->setInternalTextureFormat(GL_RGBA32F_ARB);
+		return image;
+	}
+
+	osg::Image* BRTProceduralGrass::createCoverageImage(int resolution)
+	{
+		osg::Image* image = new osg::Image;
+		image->allocateImage(resolution, resolution, 1, GL_LUMINANCE, GL_FLOAT);
+		image->setInternalTextureFormat(GL_LUMINANCE32F_ARB);
+		return image;
+	}
+
+	void BRTProceduralGrass::computeInstances(const BillboardData &data, const std::vector<int> &layers, const osg::BoundingBoxd &bb, float seed,
+		const osg::Image* terrain_image, const osg::Image* coverage_image, BillboardVegetationObjectVector &instances)
+	{
+		//same operations and precision as vertex shader
+		const float tile_size = static_cast<float>(bb.xMax() - bb.xMin());
+		const osg::Vec2 origin(static_cast<float>(bb.xMin()), static_cast<float>(bb.yMin()));
+		const osg::Vec2 tile_index(floorf(origin.x() / tile_size + 0.5f), floorf(origin.y() / tile_size + 0.5f));
+		const int res = terrain_image->s();
+		const float fres = static_cast<float>(res);
+
+		for (size_t l = 0; l < layers.size(); l++)
+		{
+			const BillboardLayer &layer = data.Layers[layers[l]];
+			const float cells = static_cast<float>(getNumCells(layer, tile_size));
+			const float layer_bit = static_cast<float>(1 << layers[l]);
+			const float cell_size = tile_size / cells;
+			const int num_instances = static_cast<int>(cells*cells);
+			for (int id = 0; id < num_instances; id++)
+			{
+				const float j = floorf((static_cast<float>(id) + 0.5f) / cells);
+				const float i = static_cast<float>(id) - j*cells;
+				const osg::Vec2 global_cell(tile_index.x()*cells + i, tile_index.y()*cells + j);
+				const osg::Vec2 local((i + _random(global_cell, seed, 0.0f))*cell_size, (j + _random(global_cell, seed, 1.0f))*cell_size);
+
+				//coverage from closest sample
+				const osg::Vec2 f(local.x() / tile_size*(fres - 1.0f), local.y() / tile_size*(fres - 1.0f));
+				const int nc = osg::clampBetween(static_cast<int>(floorf(f.x() + 0.5f)), 0, res - 1);
+				const int nr = osg::clampBetween(static_cast<int>(floorf(f.y() + 0.5f)), 0, res - 1);
+				const float mask = *reinterpret_cast<const float*>(coverage_image->data(nc, nr));
+				if (fmodf(floorf((mask + 0.5f) / layer_bit), 2.0f) < 0.5f)
+					continue;
+
+				//bilinear terrain sample
+				const int c0 = std::min(static_cast<int>(floorf(f.x())), res - 2);
+				const int r0 = std::min(static_cast<int>(floorf(f.y())), res - 2);
+				const float tx = f.x() - c0;
+				const float ty = f.y() - r0;
+				const osg::Vec4 s00 = *reinterpret_cast<const osg::Vec4*>(terrain_image->data(c0, r0));
+				const osg::Vec4 s10 = *reinterpret_cast<const osg::Vec4*>(terrain_image->data(c0 + 1, r0));
+				const osg::Vec4 s01 = *reinterpret_cast<const osg::Vec4*>(terrain_image->data(c0, r0 + 1));
+				const osg::Vec4 s11 = *reinterpret_cast<const osg::Vec4*>(terrain_image->data(c0 + 1, r0 + 1));
+				const osg::Vec4 terrain = (s00*(1.0f - tx) + s10*tx)*(1.0f - ty) + (s01*(1.0f - tx) + s11*tx)*ty;
+
+				const float scale = layer.Scale.x()*(1.0f - _random(global_cell, seed, 2.0f)) + layer.Scale.y()*_random(global_cell, seed, 2.0f);
+				const float width = (layer.Width.x()*(1.0f - _random(global_cell, seed, 3.0f)) + layer.Width.y()*_random(global_cell, seed, 3.0f))*scale;
+				const float height = (layer.Height.x()*(1.0f - _random(global_cell, seed, 4.0f)) + layer.Height.y()*_random(global_cell, seed, 4.0f))*scale;
+				const float intensity = layer.ColorIntensity.x()*(1.0f - _random(global_cell, seed, 5.0f)) + layer.ColorIntensity.y()*_random(global_cell, seed, 5.0f);
+
+				osg::Vec3 terrain_color(terrain.r(), terrain.g(), terrain.b());
+				if (layer.UseTerrainIntensity)
+				{
+					const float terrain_intensity = (terrain_color.x() + terrain_color.y() + terrain_color.z()) / 3.0f;
+					terrain_color.set(terrain_intensity, terrain_intensity, terrain_intensity);
+				}
+				const float ratio = static_cast<float>(layer.TerrainColorRatio);
+				const osg::Vec3 color = terrain_color*(ratio*intensity) + osg::Vec3(1, 1, 1)*(intensity*(1.0f - ratio));
+
+				BillboardObject* veg_obj = new BillboardObject;
+				veg_obj->Position.set(origin.x() + local.x(), origin.y() + local.y(), terrain.a());
+				veg_obj->Width = width;
+				veg_obj->Height = height;
+				veg_obj->TextureIndex = layer._TextureIndex;
+				veg_obj->Color.set(color.x(), color.y(), color.z(), 1.0f);
+				instances.push_back(veg_obj);
+			}
+		}
+	}
+
+	osg::StateSet* BRTProceduralGrass::_createStateSet(BillboardData &data, const EnvironmentSettings &env_settings)
+	{
+		osg::ref_ptr<osg::Texture2DArray> tex = Utils::loadTextureArray(data);
+
+		osg::StateSet *dstate = new osg::StateSet;
+		dstate->setTextureAttribute(0, tex, osg::StateAttribute::ON);
+		dstate->addUniform(new osg::Uniform("baseTexture", 0));
+		dstate->addUniform(new osg::Uniform("TerrainTexture", TERRAIN_TEXTURE_UNIT));
+		dstate->addUniform(new osg::Uniform("CoverageTexture", COVERAGE_TEXTURE_UNIT));
+
+		osg::AlphaFunc* alphaFunc = new osg::AlphaFunc;
+		alphaFunc->setFunction(osg::AlphaFunc::GEQUAL, data.AlphaRefValue);
+		dstate->setAttributeAndModes(alphaFunc, osg::StateAttribute::ON);
+		//blades are single sided quads
+		dstate->setAttributeAndModes(new osg::CullFace(), osg::StateAttribute::OFF);
+
+		if (data.UseAlphaBlend)
+		{
+			dstate->setAttributeAndModes(new osg::BlendFunc, osg::StateAttribute::ON);
+			dstate->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+		}
+		if (data.UseMultiSample)
+		{
+			dstate->setMode(GL_SAMPLE_ALPHA_TO_COVERAGE_ARB, 1);
+			dstate->setAttributeAndModes(new osg::BlendFunc(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO), osg::StateAttribute::OVERRIDE);
+			dstate->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+		}
+
+		osg::Uniform* shadowTextureUnit = new osg::Uniform(osg::Uniform::INT, "shadowTextureUnit");
+		shadowTextureUnit->set(env_settings.BaseShadowTextureUnit);
+		dstate->addUniform(shadowTextureUnit);
+
+		//CAST_SHADOW is only used by shadow caster programs, main program keep fading
+		const ShaderDefines defines = ShaderLibrary::getBillboardDefines(data, env_settings);
+		const std::string program_key = ShaderLibrary::getProgramKey("BRTProceduralGrass", defines);
+		osg::Program* program = ProgramCache::instance()->getProgram(program_key);
+		if (program == NULL)
+			program = ProgramCache::instance()->addProgram(program_key, ShaderLibrary::createProgram("BRTProceduralGrass", "brt_procedural_grass_vertex.glsl", "", "brt_fragment.glsl", defines));
+		//Protect to avoid problems with LIPSSM shadows
+		dstate->setAttributeAndModes(program, osg::StateAttribute::PROTECTED | osg::StateAttribute::ON);
+		ShaderLibrary::applyDefines(dstate, defines);
+		dstate->setDataVariance(osg::Object::DYNAMIC);
+		return dstate;
+	}
+
+	osg::StateSet* BRTProceduralGrass::_createLayerStateSet(const BillboardLayer &layer) const
+	{
+		osg::StateSet* state_set = new osg::StateSet;
+		state_set->addUniform(new osg::Uniform("LayerSize", osg::Vec4(layer.Width.x(), layer.Width.y(), layer.Height.x(), layer.Height.y())));
+		state_set->addUniform(new osg::Uniform("LayerScale", osg::Vec4(layer.Scale.x(), layer.Scale.y(), layer.ColorIntensity.x(), layer.ColorIntensity.y())));
+		state_set->addUniform(new osg::Uniform("LayerTerrainIntensity", layer.UseTerrainIntensity ? 1.0f : 0.0f));
+		//cells depend on tile size and are set per tile together with layer bit and texture index
+		return state_set;
+	}
+
+	void BRTProceduralGrass::_setTileState(osg::StateSet* tile_state, const osg::BoundingBoxd &bb, float seed,
+		osg::Image* terrain_image, osg::Image* coverage_image, double radius)
+	{
+		//samples are fetched at texel centers, no filtering or resizing
+		osg::Texture2D* terrain_tex = new osg::Texture2D(terrain_image);
+		osg::Texture2D* coverage_tex = new osg::Texture2D(coverage_image);
+		osg::Texture2D* textures[2] = {terrain_tex, coverage_tex};
+		for (int i = 0; i < 2; i++)
+		{
+			textures[i]->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+			textures[i]->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+			textures[i]->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+			textures[i]->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+			textures[i]->setResizeNonPowerOfTwoHint(false);
+			textures[i]->setUseHardwareMipMapGeneration(false);
+		}
+		tile_state->setTextureAttribute(TERRAIN_TEXTURE_UNIT, terrain_tex, osg::StateAttribute::ON);
+		tile_state->setTextureAttribute(COVERAGE_TEXTURE_UNIT, coverage_tex, osg::StateAttribute::ON);
+
+		const double tile_size = bb.xMax() - bb.xMin();
+		const osg::Vec4 tile_data(bb.xMin(), bb.yMin(), tile_size, seed);
+		const osg::Vec4 tile_info(floor(bb.xMin() / tile_size + 0.5), floor(bb.yMin() / tile_size + 0.5), terrain_image->s(), radius);
+		tile_state->addUniform(new osg::Uniform("TileData", tile_data));
+		tile_state->addUniform(new osg::Uniform("TileInfo", tile_info));
+	}
+
+	osg::Camera* BRTProceduralGrass::createPlacementCamera(const BillboardData &data, const std::vector<int> &layers, const osg::BoundingBoxd &bb, float seed,
+		osg::Image* terrain_image, osg::Image* coverage_image, osg::Image* placement_image)
+	{
+		const double tile_size = bb.xMax() - bb.xMin();
+		int num_instances = 0;
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			const int cells = getNumCells(data.Layers[layers[i]], tile_size);
+			num_instances += cells*cells;
+		}
+		const int width = PLACEMENT_IMAGE_WIDTH;
+		const int height = std::max(1, (num_instances + width - 1) / width);
+		placement_image->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
+		placement_image->setInternalTextureFormat(GL_RGBA32F_ARB);
+
+		osg::Camera* camera = new osg::Camera;
+		camera->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+		camera->setRenderOrder(osg::Camera::PRE_RENDER);
+		camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+		camera->setViewport(0, 0, width, height);
+		camera->setClearColor(osg::Vec4(0, 0, 0, 0));
+		camera->setClearMask(GL_COLOR_BUFFER_BIT);
+		camera->setProjectionMatrix(osg::Matrix::identity());
+		camera->setViewMatrix(osg::Matrix::identity());
+		camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+		camera->setCullingActive(false);
+		camera->attach(osg::Camera::COLOR_BUFFER, placement_image);
+
+		osg::StateSet* state_set = camera->getOrCreateStateSet();
+		const ShaderDefines defines(1, "PLACEMENT_OUTPUT");
+		const std::string program_key = ShaderLibrary::getProgramKey("BRTProceduralGrassPlacement", defines);
+		osg::Program* program = ProgramCache::instance()->getProgram(program_key);
+		if (program == NULL)
+			program = ProgramCache::instance()->addProgram(program_key, ShaderLibrary::createProgram("BRTProceduralGrassPlacement", "brt_procedural_grass_vertex.glsl", "", "brt_procedural_grass_placement_fragment.glsl", defines));
+		state_set->setAttributeAndModes(program, osg::StateAttribute::ON);
+		ShaderLibrary::applyDefines(state_set, defines);
+		state_set->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
+		state_set->setMode(GL_BLEND, osg::StateAttribute::OFF);
+		state_set->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+		state_set->addUniform(new osg::Uniform("TerrainTexture", TERRAIN_TEXTURE_UNIT));
+		state_set->addUniform(new osg::Uniform("CoverageTexture", COVERAGE_TEXTURE_UNIT));
+		_setTileState(state_set, bb, seed, terrain_image, coverage_image, 0);
+
+		osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array(1);
+		osg::Geode* geode = new osg::Geode;
+		int offset = 0;
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			const BillboardLayer &layer = data.Layers[layers[i]];
+			const int cells = getNumCells(layer, tile_size);
+
+			//one point for each instance
+			osg::Geometry* geometry = new osg::Geometry;
+			geometry->setUseDisplayList(false);
+			geometry->setUseVertexBufferObjects(true);
+			geometry->setVertexArray(vertices.get());
+			osg::DrawArrays* primitive_set = new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, 1);
+			primitive_set->setNumInstances(cells*cells);
+			geometry->addPrimitiveSet(primitive_set);
+			osg::StateSet* layer_state = geometry->getOrCreateStateSet();
+			layer_state->addUniform(new osg::Uniform("LayerInfo", osg::Vec4(cells, 1 << layers[i], layer._TextureIndex, layer.TerrainColorRatio)));
+			layer_state->addUniform(new osg::Uniform("PlacementInfo", osg::Vec3(offset, width, height)));
+			geode->addDrawable(geometry);
+			offset += cells*cells;
+		}
+		camera->addChild(geode);
+		return camera;
+	}
+
+	int BRTProceduralGrass::comparePlacement(const BillboardData &data, const std::vector<int> &layers, const osg::BoundingBoxd &bb, float seed,
+		const osg::Image* terrain_image, const osg::Image* coverage_image, const osg::Image* placement_image, float tolerance)
+	{
+		//covered instances in same order as computeInstances
+		std::vector<osg::Vec3> gpu_positions;
+		const int num_pixels = placement_image->s()*placement_image->t();
+		const osg::Vec4* pixels = reinterpret_cast<const osg::Vec4*>(placement_image->data());
+		const double tile_size = bb.xMax() - bb.xMin();
+		int offset = 0;
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			const int cells = getNumCells(data.Layers[layers[i]], tile_size);
+			for (int id = offset; id < offset + cells*cells && id < num_pixels; id++)
+			{
+				if (pixels[id].w() > 0.5f)
+					gpu_positions.push_back(osg::Vec3(pixels[id].x(), pixels[id].y(), pixels[id].z()));
+			}
+			offset += cells*cells;
+		}
+
+		BillboardVegetationObjectVector instances;
+		computeInstances(data, layers, bb, seed, terrain_image, coverage_image, instances);
+		int num_mismatches = std::abs(static_cast<int>(instances.size()) - static_cast<int>(gpu_positions.size()));
+		const size_t num_common = std::min(instances.size(), gpu_positions.size());
+		for (size_t i = 0; i < num_common; i++)
+		{
+			const osg::Vec3 delta = instances[i]->Position - gpu_positions[i];
+			if (fabs(delta.x()) > tolerance || fabs(delta.y()) > tolerance || fabs(delta.z()) > tolerance)
+				num_mismatches++;
+		}
+		return num_mismatches;
+	}
+
+	osg::Node* BRTProceduralGrass::createTile(const BillboardData &data, const osg::BoundingBoxd &bb, const std::vector<int> &layers, float seed,
+		osg::Image* terrain_image, osg::Image* coverage_image, const osg::BoundingBoxd &bound, float fade_radius)
+	{
+		if (m_LayerStateSets.size() != data.Layers.size())
+		{
+			m_LayerStateSets.clear();
+			for (size_t i = 0; i < data.Layers.size(); i++)
+				m_LayerStateSets.push_back(_createLayerStateSet(data.Layers[i]));
+		}
+
+		const double tile_size = bb.xMax() - bb.xMin();
+		osg::Geode* geode = new osg::Geode;
+		_setTileState(geode->getOrCreateStateSet(), bb, seed, terrain_image, coverage_image, fade_radius);
+
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			const BillboardLayer &layer = data.Layers[layers[i]];
+			const int cells = getNumCells(layer, tile_size);
+
+			osg::Geometry* geometry = new osg::Geometry;
+			geometry->setUseDisplayList(false);
+			geometry->setUseVertexBufferObjects(true);
+			geometry->setVertexArray(m_TemplateVertices.get());
+			geometry->setTexCoordArray(0, m_TemplateTexCoords.get());
+			osg::DrawArrays* primitive_set = new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, m_TemplateVertices->size());
+			primitive_set->setNumInstances(cells*cells);
+			geometry->addPrimitiveSet(primitive_set);
+			//template vertices don't reflect instance positions, use tile bound only
+			geometry->setComputeBoundingBoxCallback(new StaticBoundingBox(bound));
+			geometry->setInitialBound(osg::BoundingBox(bound._min, bound._max));
+
+			//layer settings are shared, per tile values are added to a child state set on the geometry
+			osg::StateSet* layer_state = dynamic_cast<osg::StateSet*>(m_LayerStateSets[layers[i]]->clone(osg::CopyOp::SHALLOW_COPY));
+			layer_state->addUniform(new osg::Uniform("LayerInfo", osg::Vec4(cells, 1 << layers[i], layer._TextureIndex, layer.TerrainColorRatio)));
+			geometry->setStateSet(layer_state);
+			geode->addDrawable(geometry);
+		}
+		return geode;
+	}
+
+	osg::Node* BRTProceduralGrass::create(const BillboardVegetationObjectVector &/*trees*/, const osg::BoundingBoxd &/*bb*/, float /*fade_radius*/)
+	{
+		OSGV_EXCEPT(std::string("BRTProceduralGrass::create - instances are generated on GPU, use createTile").c_str());
+		return NULL;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "Common.h"
+#include <osg/StateSet>
+#include <osg/Camera>
+#include <osg/Geometry>
+#include <osg/Image>
+#include <osg/BoundingBox>
+#include <vector>
+#include "IBillboardRenderingTech.h"
+#include "BillboardData.h"
+#include "EnvironmentSettings.h"
+
+namespace osgVegetation
+{
+	/**
+		IBillboardRenderingTech implementation where grass instances are generated in the vertex shader,
+		no per-instance data is stored. Each tile hold a coarse terrain sample grid (terrain color and height)
+		and a coverage mask (bit n set if coverage material of layer n is present at sample) as small float textures.
+		Each layer is drawn as instanced crossed quads, one instance for each cell in a jittered grid
+		(cells per tile side given by layer density). Jitter, size, color intensity and rotation are derived from a
+		hash of the global cell index and a per-tile seed. The hash only use integer valued float arithmetic
+		(below 2^22) so computeInstances() give the same placement on CPU, use createPlacementCamera and comparePlacement
+		to check that GPU and CPU agree (e.g. osgVegetationInspector --verify_procedural_grass under Mesa llvmpipe). Instances outside coverage are collapsed
+		to zero size. Only GLSL 1.20 with ARB_draw_instanced and vertex texture fetch is needed (no geometry shader).
+	*/
+	class osgvExport BRTProceduralGrass : public IBillboardRenderingTech
+	{
+	public:
+		BRTProceduralGrass(BillboardData &data, const EnvironmentSettings &env_settings);
+		virtual ~BRTProceduralGrass();
+
+		//IBillboardRenderingTech, not supported since instances are generated on GPU, use createTile
+		osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb, float fade_radius);
+		osg::StateSet* getStateSet() const {return m_StateSet;}
+
+		/**
+			Create tile node
+			@param data Billboard data (same layer order for all tiles)
+			@param bb Tile region, must be aligned to tile size (quad tree tile)
+			@param layers Index of layers (in BillboardData) to render in this tile
+			@param seed Tile seed, see getTileSeed
+			@param terrain_image Terrain samples at tile grid points (including tile edges), see createTerrainImage
+			@param coverage_image Coverage mask at tile grid points, see createCoverageImage
+			@param bound Bound of all instances in tile, only used for culling
+			@param fade_radius Distance where instances are faded out, based on tile region (see IBillboardRenderingTech::create)
+		*/
+		osg::Node* createTile(const BillboardData &data, const osg::BoundingBoxd &bb, const std::vector<int> &layers, float seed,
+			osg::Image* terrain_image, osg::Image* coverage_image, const osg::BoundingBoxd &bound, float fade_radius);
+
+		/**
+			Allocate terrain sample image, rgb hold terrain color and alpha terrain height
+		*/
+		static osg::Image* createTerrainImage(int resolution);
+
+		/**
+			Allocate coverage mask image, each sample hold bit mask of covered layer indices (max 24 layers)
+		*/
+		static osg::Image* createCoverageImage(int resolution);
+
+		/**
+			CPU reference implementation, generate same instances as vertex shader for tile.
+			Distance fading is view dependent and not included.
+			@param data Billboard data, same as provided to createTile
+			@param layers Index of layers, same as provided to createTile
+			@param bb Tile region
+			@param seed Tile seed
+			@param terrain_image Terrain samples
+			@param coverage_image Coverage mask
+			@param instances Generated instances are appended to this vector
+		*/
+		static void computeInstances(const BillboardData &data, const std::vector<int> &layers, const osg::BoundingBoxd &bb, float seed,
+			const osg::Image* terrain_image, const osg::Image* coverage_image, BillboardVegetationObjectVector &instances);
+
+		/**
+			Create pre render camera that write placement of all instances in tile (same order as computeInstances,
+			including instances outside coverage) to placement image, one pixel for each instance where
+			rgb hold position and alpha is 1 if instance is covered.
+			@param placement_image Image that is allocated and attached to camera, read back when camera is rendered
+		*/
+		static osg::Camera* createPlacementCamera(const BillboardData &data, const std::vector<int> &layers, const osg::BoundingBoxd &bb, float seed,
+			osg::Image* terrain_image, osg::Image* coverage_image, osg::Image* placement_image);
+
+		/**
+			Compare placement image rendered by createPlacementCamera with computeInstances
+			@param tolerance Max position difference in each axis
+			@return Number of instances that don't match
+		*/
+		static int comparePlacement(const BillboardData &data, const std::vector<int> &layers, const osg::BoundingBoxd &bb, float seed,
+			const osg::Image* terrain_image, const osg::Image* coverage_image, const osg::Image* placement_image, float tolerance);
+
+		/**
+			Number of grid cells along each tile side for layer
+		*/
+		static int getNumCells(const BillboardLayer &layer, double tile_size);
+
+		/**
+			Seed for tile, in range [0,289)
+		*/
+		static float getTileSeed(int ld, unsigned int x, unsigned int y, unsigned int seed);
+
+		//max layers that can be stored in coverage mask (float mantissa)
+		static const int MAX_LAYERS = 24;
+		static const int TERRAIN_TEXTURE_UNIT = 4;
+		static const int COVERAGE_TEXTURE_UNIT = 5;
+		static const int PLACEMENT_IMAGE_WIDTH = 256;
+	protected:
+		osg::StateSet* _createStateSet(BillboardData &data, const EnvironmentSettings &env_settings);
+		static void _setTileState(osg::StateSet* tile_state, const osg::BoundingBoxd &bb, float seed,
+			osg::Image* terrain_image, osg::Image* coverage_image, double radius);
+		osg::StateSet* _createLayerStateSet(const BillboardLayer &layer) const;
+		static float _permute(float x);
+		static float _mod289(float x);
+		static float _random(const osg::Vec2 &cell, float seed, float k);
+		osg::StateSet* m_StateSet;
+		osg::ref_ptr<osg::Vec3Array> m_TemplateVertices;
+		osg::ref_ptr<osg::Vec2Array> m_TemplateTexCoords;
+		//created on first use, indexed by layer index
+		std::vector<osg::ref_ptr<osg::StateSet> > m_LayerStateSets;
+	};
+}
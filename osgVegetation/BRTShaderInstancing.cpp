@@ -1,4 +1,5 @@
 #include "BRTShaderInstancing.h"
+#include "BillboardHull.h"
 #include <osg/AlphaFunc>
 #include <osg/Billboard>
 #include <osg/BlendFunc>
@@ -17,18 +18,25 @@
 #include <osgDB/WriteFile>
 #include <osgDB/FileUtils>
 #include "VegetationUtils.h"
+#include "ProgramCache.h"
+#include "ShaderLibrary.h"
+#include "ShadowCaster.h"
 
 
 namespace osgVegetation
 {
-	BRTShaderInstancing::BRTShaderInstancing(BillboardData &data, const EnvironmentSettings &env_settings) : m_PPL(true)
+	BRTShaderInstancing::BRTShaderInstancing(BillboardData &data, const EnvironmentSettings &env_settings)
 	{
 		m_TrueBillboards = (data.Type == BT_ROTATED_QUAD);
+		m_Impostor = (data.Type == BT_IMPOSTOR);
+		m_UseHull = false;
 
-		if (!(data.Type == BT_ROTATED_QUAD || data.Type == BT_CROSS_QUADS))
+		if (!(data.Type == BT_ROTATED_QUAD || data.Type == BT_CROSS_QUADS || data.Type == BT_IMPOSTOR))
 			OSGV_EXCEPT(std::string("BRTShaderInstancing::BRTShaderInstancing - Unsupported billboard type").c_str());
 
 		m_StateSet = _createStateSet(data, env_settings);
+		if (data.CastShadows && env_settings.ShadowMode != SM_DISABLED)
+			m_ShadowCasterStateSet = _createShadowCasterStateSet(data, env_settings);
 	}
 
 	BRTShaderInstancing::~BRTShaderInstancing()
@@ -49,7 +57,7 @@ namespace osgVegetation
 		// enable alpha-to-coverage multisampling for vegetation.
 		dstate->setAttributeAndModes(alphaFunc, osg::StateAttribute::ON);
 
-		if (m_TrueBillboards)
+		if (m_TrueBillboards || m_Impostor)
 			dstate->setAttributeAndModes(new osg::CullFace(), osg::StateAttribute::OFF);
 		else
 			dstate->setAttributeAndModes(new osg::CullFace(), osg::StateAttribute::ON);
@@ -71,338 +79,55 @@ namespace osgVegetation
 		osg::Uniform* baseTextureSampler = new osg::Uniform(osg::Uniform::SAMPLER_2D_ARRAY, "baseTexture", num_textures);
 		dstate->addUniform(baseTextureSampler);
 
-		osg::Uniform* shadowTextureUnit = new osg::Uniform(osg::Uniform::INT, "shadowTextureUnit");
-		shadowTextureUnit->set(env_settings.BaseShadowTextureUnit);
-		dstate->addUniform(shadowTextureUnit);
-		dstate->setMode(GL_LIGHTING, osg::StateAttribute::ON);
+		if (BillboardHull::isEnabled(data))
 		{
-			osg::Program* program = new osg::Program;
-			//dstate->setAttribute(program);
-			//Protect to avoid problems with LIPSSM shadows
-			dstate->setAttributeAndModes(program, osg::StateAttribute::PROTECTED | osg::StateAttribute::ON);
-			dstate->setDataVariance(osg::Object::DYNAMIC);
-		
-			std::stringstream vertexShaderSource;
-			vertexShaderSource <<
-				//"#version 430 compatibility\n"
-				"#extension GL_ARB_uniform_buffer_object : enable\n"
-				"uniform samplerBuffer DataBufferTexture;\n"
-				"uniform float TileRadius;\n"
-				"varying vec2 TexCoord;\n"
-				"varying vec4 Color;\n"
-				"varying vec3 Ambient;\n"
-				"varying float VegetationType; \n";
-			if (m_PPL)
-			{
-				vertexShaderSource <<
-					"varying vec3 Normal;\n"
-					"varying vec3 LightDir;\n";
-			}
-
-			if (env_settings.ShadowMode != SM_DISABLED &&  data.ReceiveShadows)
-			{
-				if (env_settings.ShadowMode == SM_LISPSM)
-				{
-					vertexShaderSource << "uniform int shadowTextureUnit; \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM1)
-				{
-					vertexShaderSource << "uniform int shadowTextureUnit0; \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM2)
-				{
-					vertexShaderSource <<
-						"uniform int shadowTextureUnit0; \n"
-						"uniform int shadowTextureUnit1; \n";
-				}
-			
-				vertexShaderSource << "void DynamicShadow(in vec4 ecPosition )                               \n"
-					"{                                                                      \n"
-					"    // generate coords for shadow mapping                              \n";
-				if (env_settings.ShadowMode == SM_LISPSM)
-				{
-					vertexShaderSource <<
-						"    gl_TexCoord[shadowTextureUnit].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit] );             \n"
-						"    gl_TexCoord[shadowTextureUnit].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit] );             \n"
-						"    gl_TexCoord[shadowTextureUnit].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit] );             \n"
-						"    gl_TexCoord[shadowTextureUnit].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit] );             \n"
-						"} \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM1)
-				{
-					vertexShaderSource <<
-						"    gl_TexCoord[shadowTextureUnit0].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit0].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit0].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit0].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit0] );             \n"
-						"} \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM2)
-				{
-					vertexShaderSource <<
-						"    gl_TexCoord[shadowTextureUnit0].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit0].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit0].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit0].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit0] );             \n"
-						"    gl_TexCoord[shadowTextureUnit1].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit1] );             \n"
-						"    gl_TexCoord[shadowTextureUnit1].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit1] );             \n"
-						"    gl_TexCoord[shadowTextureUnit1].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit1] );             \n"
-						"    gl_TexCoord[shadowTextureUnit1].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit1] );             \n"
-						"} \n";
-				}
-			}
-
-			vertexShaderSource <<
-				"void main()\n"
-				"{\n"
-				"   vec3 normal;\n"
-				"   int instanceAddress = gl_InstanceID * 3;\n"
-				"   vec3 position = texelFetch(DataBufferTexture, instanceAddress).xyz;\n"
-				"   Color         = texelFetch(DataBufferTexture, instanceAddress + 1);\n"
-				"   vec4 data     = texelFetch(DataBufferTexture, instanceAddress + 2);\n"
-				"   vec2 scale     = data.xy;\n"
-				"   VegetationType = data.z;\n"
-				"   vec4 camera_pos = gl_ModelViewMatrixInverse[3];\n";
-			if (env_settings.ShadowMode == SM_DISABLED || !data.CastShadows) //shadow casting and vertex fading don't mix well
-			{
-				vertexShaderSource <<
-					"   float distance = length(camera_pos.xyz - position.xyz);\n"
-					"   scale = scale*clamp((1.0 - (distance-TileRadius))/(TileRadius*0.2),0.0,1.0);\n";
-			}
-			if (m_TrueBillboards)
-			{
-				vertexShaderSource <<
-					"    vec3 dir = camera_pos.xyz - position.xyz;\n"
-					"	 dir.z = 0;\n //we are only interested in xy-plane direction"
-					"    dir = normalize(dir);\n"
-					"    vec3 left = vec3(-dir.y,dir.x, 0);\n"
-					"	 left = normalize(left);\n"
-					"	 left.xy *= scale.xx;\n"
-					"    vec4 m_pos = gl_Vertex;\n"
-					"    m_pos.z *= scale.y;\n"
-					"	 m_pos.xy = m_pos.x*left.xy;\n"
-					"	 m_pos.xyz += position;\n";
-				if (env_settings.ShadowMode != SM_DISABLED && data.ReceiveShadows)
-					vertexShaderSource << "   DynamicShadow(gl_ModelViewMatrix * m_pos);\n";
-				vertexShaderSource << "   gl_Position = gl_ModelViewProjectionMatrix * m_pos;\n";
-				//"   gl_Position = gl_ProjectionMatrix * modelView * gl_Vertex ;\n";
-				if (data.TerrainNormal)
-				{
-					vertexShaderSource <<
-						"   normal = normalize(gl_NormalMatrix * vec3(0,0,1));\n";
-				}
-				else
-				{
-					//skip standard normal transformation for billboards,
-					//we want normal in eye-space and we know how to handle this transformation by hand
-					vertexShaderSource <<
-						"   normal = normalize(vec3(gl_Normal.x,0,-gl_Normal.y));\n";
-				}
-			}
+			osg::Uniform* hull_uniform = BillboardHull::createUniform(tex.get(), data);
+			if (hull_uniform)
+				dstate->addUniform(hull_uniform);
 			else
-			{
-				vertexShaderSource <<
-					"   mat4 modelView = gl_ModelViewMatrix * mat4( scale.x, 0.0, 0.0, 0.0,\n"
-					"              0.0, scale.x, 0.0, 0.0,\n"
-					"              0.0, 0.0, scale.y, 0.0,\n"
-					"              position.x, position.y, position.z, 1.0);\n"
-					"   vec4 mv_pos = modelView * gl_Vertex;\n";
-				if (env_settings.ShadowMode != SM_DISABLED &&  data.ReceiveShadows)
-					vertexShaderSource << "   DynamicShadow(mv_pos);\n";
-
-				vertexShaderSource << "   gl_Position = gl_ProjectionMatrix * mv_pos ;\n";
-				if (data.TerrainNormal)
-				{
-					vertexShaderSource <<
-						"   normal = normalize(gl_NormalMatrix * vec3(0,0,1));\n";
-				}
-				else
-				{
-					vertexShaderSource <<
-						//"   normal = normalize(gl_NormalMatrix * gl_Normal);\n";
-						"   normal = normalize(vec3(gl_Normal.x,0,-gl_Normal.y));\n";
-				}
-			}
-
-			if (m_PPL)
-			{
-				vertexShaderSource <<
-					"   Normal = normal;\n"
-					"   LightDir = normalize(gl_LightSource[0].position.xyz);\n"
-					"   Ambient  = gl_LightSource[0].ambient.xyz;\n";
-			}
-			else
-			{
-				vertexShaderSource <<
-					"   vec3 lightDir = normalize(gl_LightSource[0].position.xyz);\n"
-					"   float NdotL = max(dot(normal, lightDir), 0.0);\n"
-					"   Color.xyz = NdotL*Color.xyz*gl_LightSource[0].diffuse.xyz + gl_LightSource[0].ambient.xyz*Color.xyz;\n";
-			}
-			vertexShaderSource <<
-				"   TexCoord = gl_MultiTexCoord0.st;\n"
-				"}\n";
-
-			std::stringstream fragmentShaderSource;
-			fragmentShaderSource <<
-				//"#version 430 core\n"
-				"#extension GL_EXT_gpu_shader4 : enable\n"
-				"#extension GL_EXT_texture_array : enable\n"
-				"uniform sampler2DArray baseTexture; \n";
-
-			if (env_settings.ShadowMode != SM_DISABLED && data.ReceiveShadows)
-			{
-				if (env_settings.ShadowMode == SM_LISPSM)
-				{
-					fragmentShaderSource <<
-						"uniform sampler2DShadow shadowTexture; \n"
-						"uniform int shadowTextureUnit; \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM1)
-				{
-					fragmentShaderSource <<
-						"uniform sampler2DShadow shadowTexture0; \n"
-						"uniform int shadowTextureUnit0; \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM2)
-				{
-					fragmentShaderSource <<
-						"uniform sampler2DShadow shadowTexture0; \n"
-						"uniform int shadowTextureUnit0; \n"
-						"uniform sampler2DShadow shadowTexture1; \n"
-						"uniform int shadowTextureUnit1; \n";
-				}
-			}
-			fragmentShaderSource <<
-
-				"uniform float TileRadius;\n"
-				"varying float VegetationType; \n"
-				"varying vec3 Ambient; \n"
-				"varying vec2 TexCoord;\n";
-			if (m_PPL)
-			{
-				fragmentShaderSource <<
-					"varying vec3 Normal;\n"
-					"varying vec3 LightDir;\n";
-			}
-
-			fragmentShaderSource <<
-				"varying vec4 Color;\n"
-				"void main(void) \n"
-				"{\n"
-				"   vec4 outColor = texture2DArray( baseTexture, vec3(TexCoord, VegetationType)); \n"
-				"   float shadow = 1.0;\n";
+				data.UseAlphaHull = false;
+		}
+		m_UseHull = BillboardHull::isEnabled(data);
 
-			if (env_settings.ShadowMode != SM_DISABLED && data.ReceiveShadows)
-			{
-				if (env_settings.ShadowMode == SM_LISPSM)
-				{
-					fragmentShaderSource <<
-						"   shadow = shadow2DProj( shadowTexture, gl_TexCoord[shadowTextureUnit] ).r;   \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM1)
-				{
-					fragmentShaderSource <<
-						"   shadow = shadow2DProj( shadowTexture0, gl_TexCoord[shadowTextureUnit0] ).r;   \n";
-				}
-				else if (env_settings.ShadowMode == SM_VDSM2)
-				{
-					fragmentShaderSource <<
-						"   float shadow0 = shadow2DProj( shadowTexture0, gl_TexCoord[shadowTextureUnit0] ).r;   \n"
-						"   float shadow1 = shadow2DProj( shadowTexture1, gl_TexCoord[shadowTextureUnit1] ).r;   \n"
-						"   shadow  = shadow0*shadow1; \n";
-				}
-			}
-			if (m_PPL)
-			{
-				fragmentShaderSource <<
-					"   float NdotL = max(dot(normalize(Normal), LightDir), 0.0);\n"
-					"   outColor.xyz = shadow*NdotL*outColor.xyz*Color.xyz + Ambient.xyz*outColor.xyz*Color.xyz; \n";
-			}
-			else
-			{
-				fragmentShaderSource <<
-					"   outColor.xyz = shadow*outColor.xyz * Color.xyz;\n";
-			}
-			
-		
-			fragmentShaderSource <<
-				"   float depth = gl_FragCoord.z / gl_FragCoord.w;\n";
-			if (env_settings.UseFog)
-			{
-				switch (env_settings.FogMode)
-				{
-				case osg::Fog::LINEAR:
-					// Linear fog
-					fragmentShaderSource << "   float fogFactor = (gl_Fog.end - depth) * gl_Fog.scale;\n";
-					break;
-				case osg::Fog::EXP:
-					// Exp fog
-					fragmentShaderSource << "   float fogFactor = exp(-gl_Fog.density * depth);\n";
-					break;
-				case osg::Fog::EXP2:
-					// Exp fog
-					fragmentShaderSource << "   float fogFactor = exp(-pow((gl_Fog.density * depth), 2.0));\n";
-					break;
-				}
-				fragmentShaderSource <<
-					"   fogFactor = clamp(fogFactor, 0.0, 1.0);\n"
-					"   outColor.xyz = mix(gl_Fog.color.xyz, outColor.xyz, fogFactor);\n";
-			}
-			fragmentShaderSource <<
-				"   float fade_in_dist = TileRadius*0.5;\n"
-				"   //float fade_value = clamp((1.0 - (depth - (fade_in_dist*gl_ProjectionMatrix[0][0])))/((fade_in_dist*gl_ProjectionMatrix[0][0])*0.2),0.0,1.0);\n"
-				"   //float fade_value = clamp(1.0 - ((depth - fade_in_dist) / (fade_in_dist * 0.1)), 0.0, 1.0);\n"
-				"   //outColor.w = outColor.w * fade_value;\n"
-				"   if(outColor.w < 0.01) discard;\n"
-				"   gl_FragColor = outColor;\n"
-				"}\n";
-
-
-			std::stringstream ss_sufix;
-			if (m_PPL) ss_sufix << "_ppl";
-			if (m_TrueBillboards) ss_sufix << "_tbb";
-			if (data.TerrainNormal)	ss_sufix << "_tn";
-			if (data.ReceiveShadows) ss_sufix << "_s";
-			ss_sufix << ".glsl";
-
-			const std::string btr_vertex_file(std::string("btr_vertex" + ss_sufix.str()));
-			const std::string btr_fragment_file(std::string("btr_fragment" + ss_sufix.str()));
-
-			osg::Shader* vertex_shader = NULL;
-			//first check if shader exist
-			/*if(osgDB::fileExists(btr_vertex_file))
-			{
-			vertex_shader = new osg::Shader(osg::Shader::VERTEX);
-			vertex_shader->setFileName(btr_vertex_file);
-			vertex_shader->loadShaderSourceFromFile(btr_vertex_file);
+		if (m_Impostor)
+		{
+			//normal/depth atlas share layout with color atlas
+			osg::ref_ptr<osg::Texture2DArray> normal_tex = Utils::loadTextureArray(data, "_normal");
+			dstate->setTextureAttribute(2, normal_tex, osg::StateAttribute::ON);
+			dstate->addUniform(new osg::Uniform("normalTexture", 2));
+			dstate->addUniform(new osg::Uniform("ImpostorFrames", static_cast<float>(data.ImpostorFrames)));
+		}
 
-			}
-			else*/
-			{
-				vertex_shader = new osg::Shader(osg::Shader::VERTEX, vertexShaderSource.str());
-				//Save shader
-				//osgDB::writeShaderFile(*vertex_shader, btr_vertex_file);
-			}
-			program->addShader(vertex_shader);
+		osg::Uniform* shadowTextureUnit = new osg::Uniform(osg::Uniform::INT, "shadowTextureUnit");
+		shadowTextureUnit->set(env_settings.BaseShadowTextureUnit);
+		dstate->addUniform(shadowTextureUnit);
+		dstate->setMode(GL_LIGHTING, osg::StateAttribute::ON);
 
-			osg::Shader* fragment_shader = NULL;
-			/*if(osgDB::fileExists(btr_fragment_file))
-			{
-			fragment_shader = new osg::Shader(osg::Shader::FRAGMENT);
-			fragment_shader->setFileName(btr_fragment_file);
-			fragment_shader->loadShaderSourceFromFile(btr_fragment_file);
-			}
-			else*/
-			{
-				fragment_shader = new osg::Shader(osg::Shader::FRAGMENT, fragmentShaderSource.str());
-				//Save shader
-				//osgDB::writeShaderFile(*fragment_shader, btr_fragment_file);
-			}
-			program->addShader(fragment_shader);
-		}
+		ShaderDefines defines = ShaderLibrary::getBillboardDefines(data, env_settings);
+		//keep per pixel lighting of original instancing shader (no light diffuse color)
+		defines.push_back("INSTANCING_LIGHTING");
+		const std::string program_key = ShaderLibrary::getProgramKey("BRTShaderInstancing", defines);
+		osg::Program* program = ProgramCache::instance()->getProgram(program_key);
+		if (program == NULL)
+			program = ProgramCache::instance()->addProgram(program_key, ShaderLibrary::createProgram("BRTShaderInstancing", "brt_instancing_vertex.glsl", "", "brt_fragment.glsl", defines));
+
+		//Protect to avoid problems with LIPSSM shadows
+		dstate->setAttributeAndModes(program, osg::StateAttribute::PROTECTED | osg::StateAttribute::ON);
+		dstate->setDataVariance(osg::Object::DYNAMIC);
+		ShaderLibrary::applyDefines(dstate, defines);
 		return dstate;
 	}
 
+	osg::StateSet* BRTShaderInstancing::_createShadowCasterStateSet(const BillboardData &data, const EnvironmentSettings &env_settings) const
+	{
+		const ShaderDefines defines = ShaderLibrary::getBillboardShadowCasterDefines(data);
+		const std::string program_key = ShaderLibrary::getProgramKey("BRTShaderInstancingShadowCaster", defines);
+		osg::Program* program = ProgramCache::instance()->getProgram(program_key);
+		if (program == NULL)
+			program = ProgramCache::instance()->addProgram(program_key, ShaderLibrary::createProgram("BRTShaderInstancingShadowCaster", "brt_instancing_vertex.glsl", "", "brt_shadow_fragment.glsl", defines));
+		return ShadowCaster::createStateSet(program, data, env_settings);
+	}
+
 	osg::Geometry* BRTShaderInstancing::_createSingleQuadsWithNormals(const osg::Vec3& pos, float w, float h)
 	{
 		// set up the coords
@@ -455,6 +180,66 @@ namespace osgVegetation
 	}
 
 
+	osg::Geometry* BRTShaderInstancing::_createHullCards(bool orthogonal)
+	{
+		//card shape is fetched from BillboardHull uniform in vertex shader, vertex hold
+		//hull vertex index, card index (0 = xz-plane, 1 = yz-plane) and normal roundness.
+		//Each card side is a triangle fan around hull vertex 0, orthogonal cards get back sides (cull face enabled)
+		const unsigned int num_cards = orthogonal ? 2 : 1;
+		const unsigned int num_sides = orthogonal ? 2 : 1;
+		const float roundness = orthogonal ? 0.0f : 1.0f;
+		osg::Vec3Array* v = new osg::Vec3Array;
+		for (unsigned int card = 0; card < num_cards; card++)
+		{
+			for (unsigned int side = 0; side < num_sides; side++)
+			{
+				for (unsigned int i = 1; i < BillboardHull::MAX_VERTICES - 1; i++)
+				{
+					const unsigned int i1 = side == 0 ? i : i + 1;
+					const unsigned int i2 = side == 0 ? i + 1 : i;
+					v->push_back(osg::Vec3(0.0f, static_cast<float>(card), roundness));
+					v->push_back(osg::Vec3(static_cast<float>(i1), static_cast<float>(card), roundness));
+					v->push_back(osg::Vec3(static_cast<float>(i2), static_cast<float>(card), roundness));
+				}
+			}
+		}
+
+		osg::Geometry *geom = new osg::Geometry;
+		geom->setVertexArray(v);
+		geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, v->size()));
+		return geom;
+	}
+
+	osg::Geometry* BRTShaderInstancing::_createImpostorQuad()
+	{
+		//unit quad in [-1,1], oriented and scaled per instance in vertex shader
+		osg::Vec3Array& v = *(new osg::Vec3Array(4));
+		osg::Vec3Array& n = *(new osg::Vec3Array(1));
+		osg::Vec2Array& t = *(new osg::Vec2Array(4));
+
+		v[0].set(-1.0f, -1.0f, 0.0f);
+		v[1].set(1.0f, -1.0f, 0.0f);
+		v[2].set(1.0f, 1.0f, 0.0f);
+		v[3].set(-1.0f, 1.0f, 0.0f);
+
+		n[0].set(0, 0, 1);
+
+		t[0].set(0.0f, 0.0f);
+		t[1].set(1.0f, 0.0f);
+		t[2].set(1.0f, 1.0f);
+		t[3].set(0.0f, 1.0f);
+
+		osg::Geometry *geom = new osg::Geometry;
+
+		geom->setVertexArray(&v);
+		geom->setNormalArray(&n);
+		geom->setTexCoordArray(0, &t);
+		geom->setNormalBinding(osg::Geometry::BIND_OVERALL);
+		geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, 4));
+
+		return geom;
+	}
+
 	osg::Geometry* BRTShaderInstancing::_createOrthogonalQuadsWithNormals(const osg::Vec3& pos, float w, float h)
 	{
 		// set up the coords
@@ -591,14 +376,18 @@ namespace osgVegetation
 		return geom;
 	}
 
-	osg::Node* BRTShaderInstancing::create(const BillboardVegetationObjectVector &veg_objects, const osg::BoundingBoxd &bb)
+	osg::Node* BRTShaderInstancing::create(const BillboardVegetationObjectVector &veg_objects, const osg::BoundingBoxd &bb, float fade_radius)
 	{
 		osg::Geode* geode = 0;
 		//osg::Group* group = 0;
 		if (veg_objects.size() > 0)
 		{
 			osg::ref_ptr<osg::Geometry> templateGeometry;
-			if (m_TrueBillboards)
+			if (m_Impostor)
+				templateGeometry = _createImpostorQuad();
+			else if (m_UseHull)
+				templateGeometry = _createHullCards(!m_TrueBillboards);
+			else if (m_TrueBillboards)
 				templateGeometry = _createSingleQuadsWithNormals(osg::Vec3(0.0f, 0.0f, 0.0f), 1.0f, 1.0f);
 			else
 				templateGeometry = _createOrthogonalQuadsWithNormals(osg::Vec3(0.0f, 0.0f, 0.0f), 1.0f, 1.0f);
@@ -629,13 +418,14 @@ namespace osgVegetation
 			tbo->setImage(treeParamsImage.get());
 			tbo->setInternalFormat(GL_RGBA32F_ARB);
 			geometry->getOrCreateStateSet()->setTextureAttribute(1, tbo.get(), osg::StateAttribute::ON);
+			//template vertices don't reflect instance positions, use tile bound only
+			geometry->setComputeBoundingBoxCallback(new StaticBoundingBox(bb));
 			geometry->setInitialBound(osg::BoundingBox(bb._min, bb._max));
 			osg::Uniform* dataBufferSampler = new osg::Uniform("DataBufferTexture", 1);
 			geometry->getOrCreateStateSet()->addUniform(dataBufferSampler);
 
 			osg::Uniform* tile_rad_uniform = new osg::Uniform(osg::Uniform::FLOAT, "TileRadius");
-			float radius = bb.radius();
-			tile_rad_uniform->set(radius);
+			tile_rad_uniform->set(fade_radius);
 			geometry->getOrCreateStateSet()->addUniform(tile_rad_uniform);
 
 			//assume square tile
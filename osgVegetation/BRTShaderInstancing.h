@@ -19,15 +19,21 @@ namespace osgVegetation
 		virtual ~BRTShaderInstancing();
 		
 		//IBillboardRenderingTech
-		osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb);
+		osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb, float fade_radius);
 		osg::StateSet* getStateSet() const {return m_StateSet;}
+		osg::StateSet* getShadowCasterStateSet() const {return m_ShadowCasterStateSet.get();}
 
 	protected:
 		osg::StateSet* _createStateSet(BillboardData &data, const EnvironmentSettings &env_settings);
+		osg::StateSet* _createShadowCasterStateSet(const BillboardData &data, const EnvironmentSettings &env_settings) const;
 		osg::Geometry* _createOrthogonalQuadsWithNormals( const osg::Vec3& pos, float w, float h);
 		osg::Geometry* _createSingleQuadsWithNormals( const osg::Vec3& pos, float w, float h);
+		osg::Geometry* _createImpostorQuad();
+		osg::Geometry* _createHullCards(bool orthogonal);
 		osg::StateSet* m_StateSet;
+		osg::ref_ptr<osg::StateSet> m_ShadowCasterStateSet;
 		bool m_TrueBillboards;
-		bool m_PPL;
+		bool m_Impostor;
+		bool m_UseHull;
 	};
 }
\ No newline at end of file
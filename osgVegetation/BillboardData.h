@@ -8,7 +8,8 @@ namespace osgVegetation
 	{
 		BT_ROTATED_QUAD,
 		BT_CROSS_QUADS,
-		BT_GRASS
+		BT_GRASS,
+		BT_IMPOSTOR
 	};
 	
 	/**
@@ -16,11 +17,14 @@ namespace osgVegetation
 		This list the type of technique used to realize the billboard rendering.
 		For example if we should use shader instancing (BRTShaderInstancing) or 
 		geometry shaders (BRTGeometryShader) .
+		BRT_GPU_PROCEDURAL (BRTProceduralGrass) store no instances, grass is generated in 
+		the vertex shader from terrain samples and a per-tile seed.
 	*/
 	enum BillboardRenderingTechnique
 	{
 		BRT_SHADER_INSTANCING,
-		BRT_GEOMETRY_SHADER
+		BRT_GEOMETRY_SHADER,
+		BRT_GPU_PROCEDURAL
 	};
 
 	/**
@@ -39,10 +43,17 @@ namespace osgVegetation
 			TerrainNormal(terrain_normal),
 			ReceiveShadows(false),
 			CastShadows(false),
+			ShadowInstanceRatio(1.0f),
 			Type(BT_CROSS_QUADS),
 			TilePixelSize(0),
 			Technique(BRT_SHADER_INSTANCING),
-			UseMultiSample(false)
+			UseMultiSample(false),
+			UseAlphaHull(false),
+			ImpostorFrames(8),
+			AdaptiveSubdivision(false),
+			MaxTileInstances(0),
+			ScreenSpaceError(0),
+			ProceduralTerrainResolution(32)
 		{
 
 		}
@@ -75,10 +86,17 @@ namespace osgVegetation
 		bool ReceiveShadows;
 		
 		/**
-			Should geometry cast shadows or not.
+			Should geometry cast shadows or not. For BRT_SHADER_INSTANCING and BRT_GEOMETRY_SHADER
+			a separate shadow caster node (depth only alpha tested program) is added to each tile,
+			regular tiles are then only drawn in the main pass.
 		*/
 		bool CastShadows;
 
+		/**
+			Ratio of tile instances used by shadow casters (0-1), default to 1 (all instances)
+		*/
+		float ShadowInstanceRatio;
+
 		/**
 			The billboard collection
 		*/
@@ -103,6 +121,51 @@ namespace osgVegetation
 			Rendering Technique, default to BRT_SHADER_INSTANCING
 		*/
 		BillboardRenderingTechnique Technique;
-		
+
+		/**
+			Draw billboards as convex polygons (max 8 vertices) enclosing the visible texels of each texture
+			instead of full texture quads, this reduce alpha tested overdraw for sparse foliage textures (see BillboardHull).
+			Used by BRT_SHADER_INSTANCING and BRT_GEOMETRY_SHADER, BT_IMPOSTOR billboards always use full quads.
+			With precompiled (compressed) textures hull polygons must be precompiled too (builder --compress_textures).
+			Default to false
+		*/
+		bool UseAlphaHull;
+
+		/**
+			Number of view frames along each atlas axis for BT_IMPOSTOR billboards,
+			must match the --impostor value used when baking the textures with billboard_generator.
+			Layer textures are expected to be hemi-octahedral color atlases and
+			a matching normal/depth atlas named <texture>_normal.<ext> is loaded as well.
+			Default to 8
+		*/
+		int ImpostorFrames;
+
+		/**
+			Enable adaptive quad tree subdivision, subtrees without any instances
+			are pruned so that no LOD/PagedLOD nodes or tile files are created for empty areas.
+			Default to false
+		*/
+		bool AdaptiveSubdivision;
+
+		/**
+			Max number of instances in one tile, tiles that exceed this budget are split into
+			quadrant sub tiles (own tile files with paged LOD), see QuadTreeSubdivision. 0 (default) means no limit.
+		*/
+		unsigned int MaxTileInstances;
+
+		/**
+			Target screen space error in pixels. If this value is > 0 the LOD range of each tile is
+			computed so that instances of finer layers are switched in before their projected
+			size exceed this value (based on EnvironmentSettings::ViewFOV and ViewportHeight).
+			Instances are also faded out at this distance instead of at tile radius.
+			TilePixelSize take precedence if set. Default to 0 (disabled)
+		*/
+		float ScreenSpaceError;
+
+		/**
+			Number of terrain samples (height, color and coverage) along each tile side 
+			stored for BRT_GPU_PROCEDURAL tiles. Default to 32
+		*/
+		int ProceduralTerrainResolution;
 	};
 }
@@ -0,0 +1,292 @@
+#include "BillboardHull.h"
+#include <osg/Array>
+#include <osg/Math>
+#include <osgDB/ReadFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <OpenThreads/ScopedLock>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace osgVegetation
+{
+	//keep texture rectangle if polygon cover more than this part of the texture
+	const double MAX_HULL_AREA = 0.95;
+
+	OpenThreads::Mutex BillboardHull::m_Mutex;
+
+	static float Cross(const osg::Vec2 &a, const osg::Vec2 &b)
+	{
+		return a.x()*b.y() - a.y()*b.x();
+	}
+
+	static bool IsVisible(float alpha, float alpha_ref)
+	{
+		return alpha_ref > 0 ? alpha >= alpha_ref : alpha > 0;
+	}
+
+	bool BillboardHull::isEnabled(const BillboardData &data)
+	{
+		return data.UseAlphaHull && data.Type != BT_IMPOSTOR && data.Technique != BRT_GPU_PROCEDURAL;
+	}
+
+	float BillboardHull::getAlphaRef(const BillboardData &data)
+	{
+		return (data.UseAlphaBlend || data.UseMultiSample) ? 0.0f : data.AlphaRefValue;
+	}
+
+	std::string BillboardHull::getHullFileName(const std::string &texture_name, float alpha_ref)
+	{
+		std::stringstream ss;
+		ss << osgDB::getNameLessExtension(texture_name) << "_hull_a" << static_cast<int>(osg::clampBetween(alpha_ref, 0.0f, 1.0f)*255.0f + 0.5f) << ".txt";
+		return ss.str();
+	}
+
+	std::string BillboardHull::compileHull(const std::string &texture_name, float alpha_ref)
+	{
+		const std::string texture_file = osgDB::findDataFile(texture_name);
+		if(texture_file == "")
+			OSGV_EXCEPT(std::string("BillboardHull::compileHull - Failed to find texture:" + texture_name).c_str());
+
+		osg::ref_ptr<osg::Image> image = osgDB::readImageFile(texture_file);
+		if(!image.valid())
+			OSGV_EXCEPT(std::string("BillboardHull::compileHull - Failed to load texture:" + texture_file).c_str());
+		if(image->isCompressed())
+			OSGV_EXCEPT(std::string("BillboardHull::compileHull - Compressed source texture:" + texture_file).c_str());
+
+		const std::vector<osg::Vec2> hull = compute(image.get(), alpha_ref);
+		const std::string out_file = getHullFileName(texture_file, alpha_ref);
+		std::ofstream file(out_file.c_str());
+		if(!file.is_open())
+			OSGV_EXCEPT(std::string("BillboardHull::compileHull - Failed to write file:" + out_file).c_str());
+		file << hull.size() << std::endl;
+		for(size_t i = 0; i < hull.size(); i++)
+			file << hull[i].x() << " " << hull[i].y() << std::endl;
+		return out_file;
+	}
+
+	bool BillboardHull::readHull(const std::string &filename, std::vector<osg::Vec2> &polygon)
+	{
+		std::ifstream file(filename.c_str());
+		if(!file.is_open())
+			return false;
+		unsigned int num_vertices = 0;
+		file >> num_vertices;
+		if(num_vertices < 3 || num_vertices > MAX_VERTICES)
+			return false;
+		polygon.resize(num_vertices);
+		for(unsigned int i = 0; i < num_vertices; i++)
+			file >> polygon[i].x() >> polygon[i].y();
+		return !file.fail();
+	}
+
+	std::vector<osg::Vec2> BillboardHull::_getTextureRectangle()
+	{
+		std::vector<osg::Vec2> rect;
+		rect.push_back(osg::Vec2(0, 0));
+		rect.push_back(osg::Vec2(1, 0));
+		rect.push_back(osg::Vec2(1, 1));
+		rect.push_back(osg::Vec2(0, 1));
+		return rect;
+	}
+
+	double BillboardHull::getArea(const std::vector<osg::Vec2> &polygon)
+	{
+		double area = 0;
+		for(size_t i = 0; i < polygon.size(); i++)
+			area += Cross(polygon[i], polygon[(i + 1) % polygon.size()]);
+		return fabs(area)*0.5;
+	}
+
+	std::vector<osg::Vec2> BillboardHull::_getConvexHull(std::vector<osg::Vec2> points)
+	{
+		//monotone chain, counter clockwise without collinear points
+		std::sort(points.begin(), points.end());
+		points.erase(std::unique(points.begin(), points.end()), points.end());
+		if(points.size() < 3)
+			return points;
+
+		std::vector<osg::Vec2> hull(2 * points.size());
+		size_t k = 0;
+		for(size_t i = 0; i < points.size(); i++)
+		{
+			while(k >= 2 && Cross(hull[k - 1] - hull[k - 2], points[i] - hull[k - 2]) <= 0)
+				k--;
+			hull[k++] = points[i];
+		}
+		const size_t lower_size = k + 1;
+		for(size_t i = points.size() - 1; i > 0; i--)
+		{
+			while(k >= lower_size && Cross(hull[k - 1] - hull[k - 2], points[i - 1] - hull[k - 2]) <= 0)
+				k--;
+			hull[k++] = points[i - 1];
+		}
+		hull.resize(k - 1);
+		return hull;
+	}
+
+	bool BillboardHull::_simplify(std::vector<osg::Vec2> &polygon, unsigned int max_vertices)
+	{
+		//remove the edge that add least area when neighbour edges are extended to their intersection,
+		//polygon stay convex and still enclose the original polygon
+		while(polygon.size() > max_vertices)
+		{
+			const size_t n = polygon.size();
+			size_t best_edge = n;
+			double best_area = DBL_MAX;
+			osg::Vec2 best_point;
+			for(size_t i = 0; i < n; i++)
+			{
+				const osg::Vec2 &a = polygon[(i + n - 1) % n];
+				const osg::Vec2 &b = polygon[i];
+				const osg::Vec2 &c = polygon[(i + 1) % n];
+				const osg::Vec2 &d = polygon[(i + 2) % n];
+				const osg::Vec2 dir1 = b - a;
+				const osg::Vec2 dir2 = c - d;
+				const float denom = Cross(dir1, dir2);
+				if(fabs(denom) < 1e-12f)
+					continue;
+				//intersection b + dir1*s = c + dir2*u, edges must converge outside the polygon
+				const float s = Cross(c - b, dir2) / denom;
+				const float u = Cross(c - b, dir1) / denom;
+				if(s < 0 || u < 0)
+					continue;
+				const osg::Vec2 p = b + dir1*s;
+				if(p.x() < -1e-5f || p.y() < -1e-5f || p.x() > 1.00001f || p.y() > 1.00001f)
+					continue;
+				const double area = fabs(Cross(p - b, c - b))*0.5;
+				if(area < best_area)
+				{
+					best_area = area;
+					best_edge = i;
+					best_point = p;
+				}
+			}
+			if(best_edge == n)
+				return false;
+			polygon[best_edge] = best_point;
+			polygon.erase(polygon.begin() + (best_edge + 1) % n);
+		}
+		for(size_t i = 0; i < polygon.size(); i++)
+			polygon[i].set(osg::clampBetween(polygon[i].x(), 0.0f, 1.0f), osg::clampBetween(polygon[i].y(), 0.0f, 1.0f));
+		return true;
+	}
+
+	std::vector<osg::Vec2> BillboardHull::compute(const osg::Image* image, float alpha_ref)
+	{
+		if(image == NULL || image->data() == NULL || image->isCompressed() || image->s() < 1 || image->t() < 1)
+			return _getTextureRectangle();
+
+		//outline of visible texels in each row, texels are expanded by one texel to cover bilinear filter footprint
+		const int width = image->s();
+		const int height = image->t();
+		std::vector<osg::Vec2> points;
+		for(int t = 0; t < height; t++)
+		{
+			int min_s = -1;
+			int max_s = -1;
+			for(int s = 0; s < width; s++)
+			{
+				if(IsVisible(image->getColor(s, t).a(), alpha_ref))
+				{
+					if(min_s < 0)
+						min_s = s;
+					max_s = s;
+				}
+			}
+			if(min_s < 0)
+				continue;
+			const float s0 = static_cast<float>(std::max(min_s - 1, 0)) / static_cast<float>(width);
+			const float s1 = static_cast<float>(std::min(max_s + 2, width)) / static_cast<float>(width);
+			const float t0 = static_cast<float>(std::max(t - 1, 0)) / static_cast<float>(height);
+			const float t1 = static_cast<float>(std::min(t + 2, height)) / static_cast<float>(height);
+			points.push_back(osg::Vec2(s0, t0));
+			points.push_back(osg::Vec2(s1, t0));
+			points.push_back(osg::Vec2(s0, t1));
+			points.push_back(osg::Vec2(s1, t1));
+		}
+		if(points.empty())
+			return _getTextureRectangle();
+
+		std::vector<osg::Vec2> hull = _getConvexHull(points);
+		//rectangle need fewer vertices, keep it if polygon don't save any significant fill area
+		if(!_simplify(hull, MAX_VERTICES) || getArea(hull) > MAX_HULL_AREA)
+			return _getTextureRectangle();
+
+		if(image->getOrigin() == osg::Image::TOP_LEFT)
+		{
+			//flip to texture coordinates and keep counter clockwise order
+			for(size_t i = 0; i < hull.size(); i++)
+				hull[i].y() = 1.0f - hull[i].y();
+			std::reverse(hull.begin(), hull.end());
+		}
+		return hull;
+	}
+
+	osg::Uniform* BillboardHull::createUniform(osg::Texture2DArray* tex, const BillboardData &data)
+	{
+		const unsigned int num_textures = tex->getNumImages();
+		if(num_textures > MAX_TEXTURES)
+		{
+			std::cout << "Billboard hull disabled, textures:" << num_textures << " max:" << MAX_TEXTURES << std::endl;
+			return NULL;
+		}
+
+		//source texture of each array index, saved polygons are named after source texture
+		std::vector<std::string> texture_names(num_textures);
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._TextureIndex >= 0 && data.Layers[i]._TextureIndex < static_cast<int>(num_textures))
+				texture_names[data.Layers[i]._TextureIndex] = data.Layers[i].TextureName;
+		}
+
+		const float alpha_ref = getAlphaRef(data);
+		std::stringstream key;
+		key << "BillboardHull:" << alpha_ref;
+
+		osg::ref_ptr<osg::Vec2Array> hulls;
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			hulls = dynamic_cast<osg::Vec2Array*>(tex->getUserData());
+			if(!hulls.valid() || hulls->getName() != key.str())
+			{
+				hulls = new osg::Vec2Array;
+				hulls->setName(key.str());
+				for(unsigned int i = 0; i < num_textures; i++)
+				{
+					const osg::Image* image = tex->getImage(i);
+					const std::string hull_file = texture_names[i] != "" ? osgDB::findDataFile(getHullFileName(texture_names[i], alpha_ref)) : "";
+					std::vector<osg::Vec2> hull;
+					const bool saved = hull_file != "" && readHull(hull_file, hull);
+					if(!saved)
+						hull = compute(image, alpha_ref);
+					std::cout << "Billboard hull texture:" << (image ? image->getFileName() : "") << " vertices:" << hull.size()
+						<< " fill area saved:" << static_cast<int>(100.0*(1.0 - getArea(hull))) << "%";
+					if(saved)
+						std::cout << " (" << hull_file << ")";
+					else if(image && image->isCompressed())
+						std::cout << " (compressed texture without hull file, using quad)";
+					std::cout << std::endl;
+					//pad with last vertex, gives degenerated triangles
+					const osg::Vec2 last = hull.back();
+					hull.resize(MAX_VERTICES, last);
+					hulls->insert(hulls->end(), hull.begin(), hull.end());
+				}
+				tex->setUserData(hulls.get());
+			}
+		}
+
+		osg::Uniform* uniform = new osg::Uniform(osg::Uniform::FLOAT_VEC4, "BillboardHull", MAX_TEXTURES*MAX_VERTICES/2);
+		for(unsigned int i = 0; i < hulls->size() / 2; i++)
+		{
+			const osg::Vec2 &v0 = (*hulls)[2 * i];
+			const osg::Vec2 &v1 = (*hulls)[2 * i + 1];
+			uniform->setElement(i, osg::Vec4(v0.x(), v0.y(), v1.x(), v1.y()));
+		}
+		return uniform;
+	}
+}
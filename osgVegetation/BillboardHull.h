@@ -0,0 +1,95 @@
+#pragma once
+#include "Common.h"
+#include "BillboardData.h"
+#include <osg/Image>
+#include <osg/Texture2DArray>
+#include <osg/Uniform>
+#include <osg/Vec2>
+#include <OpenThreads/Mutex>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Convex polygon in texture coordinates that enclose all visible texels of a billboard texture.
+		Billboard techniques use the polygon as card outline instead of the full texture rectangle
+		to reduce alpha tested overdraw (see BillboardData::UseAlphaHull).
+		The polygon is conservative, texels are expanded by one texel to include bilinear filtering footprint,
+		and is simplified to max MAX_VERTICES vertices by merging edges (polygon only grow).
+		Polygon vertices are stored counter clockwise in the "BillboardHull" uniform, MAX_VERTICES/2 vec4 per texture
+		(two vertices in each vec4), lists with less vertices are padded with last vertex.
+		Polygons need uncompressed texels, use compileHull to compute them offline from the source texture
+		(done together with TextureCompressor::compileTexture by the builder), saved polygons are
+		loaded at runtime and also work with precompiled DDS texture arrays.
+	*/
+	class osgvExport BillboardHull
+	{
+	public:
+		/**
+			Max number of polygon vertices
+		*/
+		static const unsigned int MAX_VERTICES = 8;
+
+		/**
+			Max number of textures in uniform array, must match BillboardHull array size in shaders
+		*/
+		static const unsigned int MAX_TEXTURES = 16;
+
+		/**
+			Check if billboard data use hull polygons, BT_IMPOSTOR and BRT_GPU_PROCEDURAL always use full quads
+		*/
+		static bool isEnabled(const BillboardData &data);
+
+		/**
+			Compute polygon enclosing texels with alpha >= alpha_ref (alpha > 0 if alpha_ref is 0).
+			Full texture rectangle is returned if image is compressed, has no visible texels
+			or if the polygon don't save any significant fill area.
+		*/
+		static std::vector<osg::Vec2> compute(const osg::Image* image, float alpha_ref);
+
+		/**
+			Alpha value that decide visible texels, alpha blended and alpha to coverage billboards
+			enclose all texels with alpha > 0 (0 is returned), otherwise BillboardData::AlphaRefValue
+		*/
+		static float getAlphaRef(const BillboardData &data);
+
+		/**
+			Get name of saved polygon file that correspond to texture_name and alpha_ref,
+			ie. "tree.png" with alpha_ref 0.5 -> "tree_hull_a128.txt" (alpha_ref in 8-bit units)
+		*/
+		static std::string getHullFileName(const std::string &texture_name, float alpha_ref);
+
+		/**
+			Load source texture, compute polygon and save it next to the texture (see getHullFileName)
+			@param texture_name Texture, resolved through osgDB data file path
+			@param alpha_ref Alpha value that decide visible texels, see getAlphaRef
+			@return Name of written file
+		*/
+		static std::string compileHull(const std::string &texture_name, float alpha_ref);
+
+		/**
+			Read polygon saved by compileHull, return false if file is missing or invalid
+		*/
+		static bool readHull(const std::string &filename, std::vector<osg::Vec2> &polygon);
+
+		/**
+			Polygon area in texture space (full texture = 1)
+		*/
+		static double getArea(const std::vector<osg::Vec2> &polygon);
+
+		/**
+			Create BillboardHull uniform for all textures in texture array (see Utils::loadTextureArray).
+			Polygons saved by compileHull are used if present, otherwise polygons are computed from the
+			loaded images (compressed images use full quads). Polygons are stored as texture user data,
+			fill area saved is reported for each texture.
+			@return NULL if texture array hold more than MAX_TEXTURES textures
+		*/
+		static osg::Uniform* createUniform(osg::Texture2DArray* tex, const BillboardData &data);
+	private:
+		static std::vector<osg::Vec2> _getConvexHull(std::vector<osg::Vec2> points);
+		static bool _simplify(std::vector<osg::Vec2> &polygon, unsigned int max_vertices);
+		static std::vector<osg::Vec2> _getTextureRectangle();
+		static OpenThreads::Mutex m_Mutex;
+	};
+}
@@ -20,8 +20,10 @@ namespace osgVegetation
 			Density(1.0),
 			TerrainColorRatio(0.0),
 			UseTerrainIntensity(false),
+			ShadowDistance(0),
 			_TextureIndex(-1),
-			_QTLevel(-1)
+			_QTLevel(-1),
+			_LayerIndex(-1)
 		{
 
 		}
@@ -75,6 +77,13 @@ namespace osgVegetation
 		*/
 		bool UseTerrainIntensity;
 
+		/**
+			Max distance for shadow casting instances of this layer (see BillboardData::CastShadows),
+			shadow casters beyond this distance are skipped in shadow pass. 
+			0 (default) means shadows are cast as long as the layer is visible
+		*/
+		double ShadowDistance;
+
 		/**
 			Coverage material vector that specify where to scatter billboards
 		*/
@@ -85,6 +94,8 @@ namespace osgVegetation
 		int _TextureIndex;
 		//internal data holding quad tree level for this layer
 		int _QTLevel;
+		//internal data holding layer index in configuration order (layers are sorted by scattering)
+		int _LayerIndex;
 
 		/**
 			Helper function to check is this layer hold coverage material
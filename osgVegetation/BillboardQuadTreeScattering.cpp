@@ -4,14 +4,23 @@
 #include <osg/ComputeBoundsVisitor>
 #include <osg/PagedLOD>
 #include <osg/ProxyNode>
+#include <osg/Texture2DArray>
+#include <osg/Math>
 #include <osgDB/WriteFile>
 #include <osgDB/ReadFile>
 #include <osgDB/FileNameUtils>
 #include <sstream>
 #include <stdexcept>
+#include <algorithm>
+#include <map>
+#include "ScatterSampler.h"
 #include "BRTGeometryShader.h"
 #include "BRTShaderInstancing.h"
+#include "BRTProceduralGrass.h"
+#include "QuadTreeSubdivision.h"
 #include "VegetationUtils.h"
+#include "VegetationQuadTree.h"
+#include "ShadowCaster.h"
 #include "ITerrainQuery.h"
 
 namespace osgVegetation
@@ -20,75 +29,298 @@ namespace osgVegetation
 			m_BRT(NULL),
 			m_TerrainQuery(tq),
 			m_UsePagedLOD(false),
+			m_UseQuadTreeNode(false),
 			m_FilenamePrefix("quadtree_"),
 			m_EnvironmentSettings(env_settings),
 			m_FinalLOD(0),
 			m_CurrentTile(0),
-			m_NumberOfTiles(0)
+			m_NumberOfTiles(0),
+			m_NumShadowCasters(0),
+			m_BillboardType(BT_CROSS_QUADS),
+			m_BillboardTechnique(BRT_SHADER_INSTANCING),
+			m_OnDemand(false),
+			m_OnDemandData(NULL),
+			m_Seed(0),
+			m_DataSetIndex(0),
+			m_CombinedScattering(false),
+			m_CombinedData(NULL),
+			m_CombinedRootSize(0),
+			m_NumSharedSamples(0),
+			m_NumIndependentSamples(0)
 	{
 
 	}
 
-	void BillboardQuadTreeScattering::_populateVegetationTile(const BillboardLayer& layer,const  osg::BoundingBoxd& bb,BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb) const
+	BillboardQuadTreeScattering::~BillboardQuadTreeScattering()
 	{
-		osg::Vec3d origin = bb._min; 
-		osg::Vec3d size = bb._max - bb._min; 
-		double min_z = FLT_MAX;
-		double max_z = -FLT_MAX;
-		unsigned int num_objects_to_create = size.x()*size.y()*layer.Density;
-		instances.reserve(instances.size()+num_objects_to_create);
-		out_bb = bb;
-		//std::cout << "pos:" << origin.x() << "size: " << size.x();
-		for(unsigned int i=0;i<num_objects_to_create;++i)
+		delete m_BRT;
+		delete m_OnDemandData;
+	}
+
+	void BillboardQuadTreeScattering::_populateVegetationTile(const BillboardLayer& layer,const  osg::BoundingBoxd& bb,BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb, RandomGenerator &rng) const
+	{
+		std::vector<ScatterSample> samples;
+		ScatterSampler(m_TerrainQuery, m_Offset, m_InitBB).scatterLayer(layer, bb, rng, samples);
+		instances.reserve(instances.size() + samples.size());
+		for(size_t i = 0; i < samples.size(); i++)
+		{
+			BillboardObject* veg_obj = _createBillboardObject(layer, samples[i]);
+			instances.push_back(veg_obj);
+			//expand tile bound with rendered instance extent
+			out_bb.expandBy(Utils::getBillboardBound(veg_obj->Position, veg_obj->Width, veg_obj->Height, m_BillboardType, m_BillboardTechnique));
+		}
+	}
+
+	BillboardObject* BillboardQuadTreeScattering::_createBillboardObject(const BillboardLayer& layer, const ScatterSample &sample) const
+	{
+		BillboardObject* veg_obj = new BillboardObject;
+		veg_obj->Width = sample.Width;
+		veg_obj->Height = sample.Height;
+		veg_obj->TextureIndex = layer._TextureIndex;
+		veg_obj->Position = sample.Position - m_Offset;
+		veg_obj->Color = _getBillboardColor(layer, sample.TerrainColor, sample.ColorIntensity);
+		return veg_obj;
+	}
+
+	osg::Vec4 BillboardQuadTreeScattering::_getBillboardColor(const BillboardLayer& layer, osg::Vec4 terrain_color, float rand_int) const
+	{
+		if(layer.UseTerrainIntensity)
+		{
+			float terrain_intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
+			terrain_color.set(terrain_intensity,terrain_intensity,terrain_intensity,terrain_color.a());
+		}
+		//generate static color data
+		osg::Vec4 color = terrain_color*(layer.TerrainColorRatio*rand_int);
+		color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
+		color.set(color.r(), color.g(), color.b(), 1.0);
+		return color;
+	}
+
+	void BillboardQuadTreeScattering::_initLayerIndices(BillboardData &data) const
+	{
+		//remember configuration order before layers are sorted, used to identify layers in instance cache
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._LayerIndex < 0)
+				data.Layers[i]._LayerIndex = static_cast<int>(i);
+		}
+	}
+
+	void BillboardQuadTreeScattering::_scatterLayer(const BillboardLayer& layer, unsigned int data_set, const osg::BoundingBoxd &bb, InstanceCache &cache, RandomGenerator &rng) const
+	{
+		//same sampling as _populateVegetationTile but store raw values
+		std::vector<ScatterSample> samples;
+		ScatterSampler(m_TerrainQuery, m_Offset, m_InitBB).scatterLayer(layer, bb, rng, samples);
+		for(size_t i = 0; i < samples.size(); i++)
+		{
+			const ScatterSample &sample = samples[i];
+			InstanceRecord record;
+			record.Width = sample.Width;
+			record.Height = sample.Height;
+			for(int j = 0; j < 3; j++)
+				record.Position[j] = sample.Position[j];
+			for(int j = 0; j < 4; j++)
+				record.TerrainColor[j] = sample.TerrainColor[j];
+			record.ColorIntensity = sample.ColorIntensity;
+			cache.addInstance(data_set, layer._LayerIndex, record);
+		}
+	}
+
+	void BillboardQuadTreeScattering::_getCachedInstances(const BillboardLayer& layer, const osg::BoundingBoxd &bb, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb) const
+	{
+		//cache is in world coordinates
+		const osg::BoundingBoxd world_bb(bb._min + m_Offset, bb._max + m_Offset);
+		std::vector<const InstanceRecord*> records;
+		m_InstanceCache->getInstances(static_cast<unsigned int>(m_DataSetIndex), layer._LayerIndex, world_bb, records);
+		instances.reserve(instances.size() + records.size());
+		for(size_t i = 0; i < records.size(); i++)
+		{
+			const InstanceRecord &record = *records[i];
+			const osg::Vec4 terrain_color(record.TerrainColor[0], record.TerrainColor[1], record.TerrainColor[2], record.TerrainColor[3]);
+			BillboardObject* veg_obj = new BillboardObject;
+			veg_obj->Width = record.Width;
+			veg_obj->Height = record.Height;
+			veg_obj->TextureIndex = layer._TextureIndex;
+			veg_obj->Position = osg::Vec3d(record.Position[0], record.Position[1], record.Position[2]) - m_Offset;
+			veg_obj->Color = _getBillboardColor(layer, terrain_color, record.ColorIntensity);
+			instances.push_back(veg_obj);
+			out_bb.expandBy(Utils::getBillboardBound(veg_obj->Position, veg_obj->Width, veg_obj->Height, m_BillboardType, m_BillboardTechnique));
+		}
+	}
+
+	bool BillboardQuadTreeScattering::_hasLayersAtLevel(const BillboardData &data, int ld) const
+	{
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._QTLevel == ld)
+				return true;
+		}
+		return false;
+	}
+
+	void BillboardQuadTreeScattering::_populateCombinedTile(int ld, int x, int y, const osg::BoundingBoxd &bb, RandomGenerator &rng)
+	{
+		std::vector<BillboardData> &data = *m_CombinedData;
+		std::vector<BillboardVegetationObjectVector> &set_instances = m_CombinedTiles[TileIndex(ld, std::make_pair(x, y))];
+		set_instances.resize(data.size());
+
+		const ScatterSampler sampler(m_TerrainQuery, m_Offset, m_InitBB);
+		if(sampler.isTileExcluded(bb))
+			return;
+
+		//collect layers due at this tile in current and following data sets
+		const osg::Vec3d size = bb._max - bb._min;
+		std::vector<const BillboardLayer*> layers;
+		std::vector<size_t> layer_sets;
+		std::vector<unsigned int> layer_counts;
+		std::map<std::string, unsigned int> material_counts;
+		for(size_t i = m_DataSetIndex; i < data.size(); i++)
+		{
+			if(data[i].Technique == BRT_GPU_PROCEDURAL)
+				continue;
+			for(size_t j = 0; j < data[i].Layers.size(); j++)
+			{
+				const BillboardLayer &layer = data[i].Layers[j];
+				if(layer._QTLevel != ld)
+					continue;
+				const unsigned int num_objects = size.x()*size.y()*layer.Density;
+				layers.push_back(&layer);
+				layer_sets.push_back(i);
+				layer_counts.push_back(num_objects);
+				m_NumIndependentSamples += num_objects;
+				for(size_t k = 0; k < layer.CoverageMaterials.size(); k++)
+					material_counts[layer.CoverageMaterials[k]] += num_objects;
+			}
+		}
+
+		//pool size that give each layer same expected density as independent scattering
+		unsigned int num_samples = 0;
+		for(std::map<std::string, unsigned int>::const_iterator iter = material_counts.begin(); iter != material_counts.end(); ++iter)
+			num_samples = std::max(num_samples, iter->second);
+		m_NumSharedSamples += num_samples;
+
+		for(unsigned int i = 0; i < num_samples; i++)
 		{
-			double rand_x = Utils::random(origin.x(), origin.x() + size.x());
-			double rand_y = Utils::random(origin.y(), origin.y() + size.y());
-			osg::Vec3d pos(rand_x, rand_y,0);
-			osg::Vec3d inter;
-			osg::Vec4 terrain_color;
-			osg::Vec4 coverage_color;
-			float rand_int = Utils::random(layer.ColorIntensity.x(),layer.ColorIntensity.y());
-			osg::Vec3d offset_pos = pos + m_Offset;
-			if(m_InitBB.contains(pos))
+			ScatterSample sample;
+			std::string material_name;
+			if(!sampler.sampleTerrain(bb, rng, sample, material_name))
+				continue;
+
+			//select at most one layer covering sample material, with probability layer count/pool size
+			const double select = rng.random(0.0, static_cast<double>(num_samples));
+			double acc = 0;
+			for(size_t j = 0; j < layers.size(); j++)
 			{
+				if(!layers[j]->hasCoverage(material_name))
+					continue;
+				acc += layer_counts[j];
+				if(select < acc)
+				{
+					sample.ColorIntensity = rng.random(layers[j]->ColorIntensity.x(), layers[j]->ColorIntensity.y());
+					ScatterSampler::randomizeSize(*layers[j], rng, sample);
+					set_instances[layer_sets[j]].push_back(_createBillboardObject(*layers[j], sample));
+					break;
+				}
+			}
+		}
+	}
+
+	void BillboardQuadTreeScattering::_getCombinedTileInstances(int ld, int x, int y, const osg::BoundingBoxd &bb, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb, RandomGenerator &rng)
+	{
+		std::vector<BillboardData> &data = *m_CombinedData;
+		if(!_hasLayersAtLevel(data[m_DataSetIndex], ld))
+			return;
+
+		const TileIndex index(ld, std::make_pair(x, y));
+		CombinedTileMap::iterator iter = m_CombinedTiles.find(index);
+		if(iter == m_CombinedTiles.end())
+		{
+			_populateCombinedTile(ld, x, y, bb, rng);
+			iter = m_CombinedTiles.find(index);
+		}
+
+		BillboardVegetationObjectVector &set_instances = iter->second[m_DataSetIndex];
+		for(size_t i = 0; i < set_instances.size(); i++)
+		{
+			const BillboardObject &obj = *set_instances[i];
+			instances.push_back(set_instances[i]);
+			out_bb.expandBy(Utils::getBillboardBound(obj.Position, obj.Width, obj.Height, m_BillboardType, m_BillboardTechnique));
+		}
+		set_instances.clear();
+
+		//release tile when no following data set will visit it
+		for(size_t i = m_DataSetIndex + 1; i < data.size(); i++)
+		{
+			if(data[i].Technique != BRT_GPU_PROCEDURAL && _hasLayersAtLevel(data[i], ld))
+				return;
+		}
+		m_CombinedTiles.erase(iter);
+	}
+
+	void BillboardQuadTreeScattering::_addProceduralTile(const BillboardData &data, int ld, const osg::BoundingBoxd &bb, int x, int y, osg::Group* group, osg::BoundingBoxd &out_bb) const
+	{
+		std::vector<int> layers;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(ld == data.Layers[i]._QTLevel)
+				layers.push_back(static_cast<int>(i));
+		}
+		if(layers.size() == 0)
+			return;
+
+		//sample terrain at tile grid points (including tile edges), instances are generated on GPU from these samples
+		const int res = data.ProceduralTerrainResolution;
+		osg::ref_ptr<osg::Image> terrain_image = BRTProceduralGrass::createTerrainImage(res);
+		osg::ref_ptr<osg::Image> coverage_image = BRTProceduralGrass::createCoverageImage(res);
+		const double step = (bb.xMax() - bb.xMin()) / static_cast<double>(res - 1);
+		bool has_coverage = false;
+		for(int r = 0; r < res; r++)
+		{
+			for(int c = 0; c < res; c++)
+			{
+				const osg::Vec3d pos(bb.xMin() + c*step, bb.yMin() + r*step, 0);
+				osg::Vec3d offset_pos = pos + m_Offset;
+				osg::Vec4 terrain_color(1, 1, 1, 1);
+				osg::Vec4 coverage_color;
+				osg::Vec3d inter;
 				std::string material_name;
-				if(m_TerrainQuery->getTerrainData(offset_pos, terrain_color, material_name, coverage_color, inter))
+				float height = 0;
+				float mask = 0;
+				if(m_InitBB.contains(pos) && m_TerrainQuery->getTerrainData(offset_pos, terrain_color, material_name, coverage_color, inter))
 				{
-					if(layer.hasCoverage(material_name))
+					height = inter.z() - m_Offset.z();
+					for(size_t i = 0; i < layers.size(); i++)
 					{
-						BillboardObject* veg_obj = new BillboardObject;
-						float tree_scale = Utils::random(layer.Scale.x() ,layer.Scale.y());
-						veg_obj->Width = Utils::random(layer.Width.x(), layer.Width.y())*tree_scale;
-						veg_obj->Height = Utils::random(layer.Height.x(), layer.Height.y())*tree_scale;
-						veg_obj->TextureIndex = layer._TextureIndex;
-						veg_obj->Position = inter - m_Offset;
-						if(layer.UseTerrainIntensity)
-						{
-							float terrain_intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
-							terrain_color.set(terrain_intensity,terrain_intensity,terrain_intensity,terrain_color.a());
-						}
-						//generate static color data
-						veg_obj->Color = terrain_color*(layer.TerrainColorRatio*rand_int);
-						veg_obj->Color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
-						veg_obj->Color.set(veg_obj->Color.r(), veg_obj->Color.g(), veg_obj->Color.b(), 1.0);
-						instances.push_back(veg_obj);
-
-						if (veg_obj->Position.z() > max_z)
-							max_z = veg_obj->Position.z();
-						if (veg_obj->Position.z() < min_z)
-							min_z = veg_obj->Position.z();
+						if(data.Layers[layers[i]].hasCoverage(material_name))
+							mask += static_cast<float>(1 << layers[i]);
 					}
 				}
+				has_coverage = has_coverage || mask > 0;
+				*reinterpret_cast<osg::Vec4*>(terrain_image->data(c, r)) = osg::Vec4(terrain_color.r(), terrain_color.g(), terrain_color.b(), height);
+				*reinterpret_cast<float*>(coverage_image->data(c, r)) = mask;
 			}
 		}
-		
-		if (instances.size() > 0)
-		{
-			if(max_z > out_bb._max.z())
-				out_bb._max.z() = max_z;
-			if (min_z > out_bb._min.z())
-				out_bb._min.z() = min_z;
-		}
+		if(!has_coverage)
+			return;
+
+		//use CPU reference to get exact bound of generated instances
+		const float seed = BRTProceduralGrass::getTileSeed(ld, x, y, m_Seed);
+		BillboardVegetationObjectVector instances;
+		BRTProceduralGrass::computeInstances(data, layers, bb, seed, terrain_image.get(), coverage_image.get(), instances);
+		if(instances.size() == 0)
+			return;
+
+		osg::BoundingBoxd tile_bb;
+		for(size_t i = 0; i < instances.size(); i++)
+			tile_bb.expandBy(Utils::getBillboardBound(instances[i]->Position, instances[i]->Width, instances[i]->Height, m_BillboardType, m_BillboardTechnique));
+
+		BRTProceduralGrass* brt = dynamic_cast<BRTProceduralGrass*>(m_BRT);
+		//fade out at tile region radius (same as instance tiles), tight bound is only used for culling
+		osg::BoundingBoxd fade_bb = bb;
+		fade_bb._min.z() = tile_bb._min.z();
+		fade_bb._max.z() = tile_bb._max.z();
+		group->addChild(brt->createTile(data, bb, layers, seed, terrain_image.get(), coverage_image.get(), tile_bb, _getFadeRadius(data, ld, fade_bb)));
+		out_bb.expandBy(tile_bb);
 	}
 
 	std::string BillboardQuadTreeScattering::_createFileName( unsigned int lv,	unsigned int x, unsigned int y ) const
@@ -98,60 +330,280 @@ namespace osgVegetation
 		return sstream.str();
 	}
 
-	osg::Node* BillboardQuadTreeScattering::_createLODRec(int ld, BillboardData &data, BillboardVegetationObjectVector instances, const osg::BoundingBoxd &bb,int x, int y)
+	void BillboardQuadTreeScattering::_addTileGeometry(const BillboardData &data, const BillboardVegetationObjectVector &instances, const osg::BoundingBoxd &region, float fade_radius, osg::Group* group,
+		const std::string &filename, int split_depth, int quadrant_path)
+	{
+		if(!QuadTreeSubdivision::needSplit(instances.size(), data.MaxTileInstances, split_depth))
+		{
+			osg::BoundingBoxd bb;
+			for(size_t i = 0; i < instances.size(); i++)
+			{
+				const BillboardObject &obj = *instances[i];
+				bb.expandBy(Utils::getBillboardBound(obj.Position, obj.Width, obj.Height, m_BillboardType, m_BillboardTechnique));
+			}
+			//instance bound is only used for culling, fading is based on tile region
+			if(split_depth == 0)
+				group->addChild(m_BRT->create(instances, bb, fade_radius));
+			else
+			{
+				//on demand tiles are kept in memory
+				const std::string save_path = m_UsePagedLOD && !m_OnDemand ? m_SavePath : "";
+				m_Subdivision.addSubTile(group, m_BRT->create(instances, bb, fade_radius), bb, save_path, QuadTreeSubdivision::getSubTileFileName(filename, split_depth, quadrant_path));
+			}
+			return;
+		}
+
+		//split tile region into quadrant sub tiles
+		osg::Group* split_node = m_Subdivision.createSplitNode(split_depth);
+		group->addChild(split_node);
+		BillboardVegetationObjectVector quadrant_instances[4];
+		QuadTreeSubdivision::splitInstances(instances, region, quadrant_instances);
+		osg::BoundingBoxd quadrant_regions[4];
+		QuadTreeSubdivision::getQuadrantRegions(region, quadrant_regions);
+		//sub tiles keep fade radius of parent tile, only culling bound shrink
+		for(int i = 0; i < 4; i++)
+		{
+			if(quadrant_instances[i].size() > 0)
+				_addTileGeometry(data, quadrant_instances[i], quadrant_regions[i], fade_radius, split_node, filename, split_depth + 1, quadrant_path*4 + i);
+		}
+	}
+
+	static double GetShadowDistance(const BillboardData &data, unsigned int texture_index)
+	{
+		//layers may share texture, use longest distance (0 = no limit)
+		double distance = -1;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._TextureIndex != static_cast<int>(texture_index))
+				continue;
+			if(data.Layers[i].ShadowDistance <= 0)
+				return 0;
+			distance = std::max(distance, data.Layers[i].ShadowDistance);
+		}
+		return distance > 0 ? distance : 0;
+	}
+
+	void BillboardQuadTreeScattering::_addShadowCasters(const BillboardData &data, const BillboardVegetationObjectVector &instances, float fade_radius, osg::Group* group)
+	{
+		osg::StateSet* caster_state_set = m_BRT->getShadowCasterStateSet();
+		if(caster_state_set == NULL)
+			return;
+
+		//regular tile geometry is only drawn in main pass
+		for(unsigned int i = 0; i < group->getNumChildren(); i++)
+			group->getChild(i)->setNodeMask(~m_EnvironmentSettings.CastsShadowTraversalMask);
+
+		//one shadow caster for each shadow distance used by layers in this tile
+		std::map<double, BillboardVegetationObjectVector> distance_instances;
+		for(size_t i = 0; i < instances.size(); i++)
+			distance_instances[GetShadowDistance(data, instances[i]->TextureIndex)].push_back(instances[i]);
+
+		for(std::map<double, BillboardVegetationObjectVector>::const_iterator iter = distance_instances.begin(); iter != distance_instances.end(); ++iter)
+		{
+			BillboardVegetationObjectVector shadow_instances;
+			ShadowCaster::selectInstances(iter->second, data.ShadowInstanceRatio, shadow_instances);
+			if(shadow_instances.size() == 0)
+				continue;
+			osg::BoundingBoxd caster_bb;
+			for(size_t i = 0; i < shadow_instances.size(); i++)
+			{
+				const BillboardObject &obj = *shadow_instances[i];
+				caster_bb.expandBy(Utils::getBillboardBound(obj.Position, obj.Width, obj.Height, m_BillboardType, m_BillboardTechnique));
+			}
+			group->addChild(ShadowCaster::createNode(m_BRT->create(shadow_instances, caster_bb, fade_radius), caster_bb, iter->first, caster_state_set, m_EnvironmentSettings));
+			m_NumShadowCasters++;
+		}
+	}
+
+	void BillboardQuadTreeScattering::_setShadowCasterMask(osg::Node* tile, int num_shadow_casters) const
+	{
+		//no shadow casters in this tile or below, skip tile (and paging) in shadow pass
+		if(m_BRT->getShadowCasterStateSet() && m_NumShadowCasters == num_shadow_casters)
+			tile->setNodeMask(~m_EnvironmentSettings.CastsShadowTraversalMask);
+	}
+
+	double BillboardQuadTreeScattering::_getLayerSwitchDistance(const BillboardLayer &layer, float screen_space_error) const
+	{
+		//largest instance size in this layer
+		const double size = std::max(layer.Width.y(), layer.Height.y())*layer.Scale.y();
+		//distance where instance project to screen_space_error pixels
+		const double half_fov = osg::DegreesToRadians(m_EnvironmentSettings.ViewFOV*0.5);
+		return size*m_EnvironmentSettings.ViewportHeight / (2.0*tan(half_fov)*screen_space_error);
+	}
+
+	double BillboardQuadTreeScattering::_getScreenSpaceCutoff(const BillboardData &data, int ld, double tile_radius) const
+	{
+		//children must be active as soon as any layer below this level should be visible,
+		//range is measured to tile center so add tile radius
+		double cutoff = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._QTLevel > ld)
+				cutoff = std::max(cutoff, _getLayerSwitchDistance(data.Layers[i], data.ScreenSpaceError) + tile_radius);
+		}
+		return cutoff;
+	}
+
+	static double GetGroundArea(double radius, double eye_height, double max_area)
+	{
+		//area of ground disc within radius from eye, limited to generation area
+		const double ground_radius2 = radius*radius - eye_height*eye_height;
+		return ground_radius2 > 0 ? std::min(max_area, osg::PI*ground_radius2) : 0;
+	}
+
+	float BillboardQuadTreeScattering::_getFadeRadius(const BillboardData &data, int ld, const osg::BoundingBoxd &region) const
+	{
+		if(data.ScreenSpaceError <= 0 || data.TilePixelSize > 0)
+			return static_cast<float>(region.radius());
+		//fade out where instances of layers at this level project to screen space error pixels,
+		//LOD cutoff of parent tile is based on same distance so tile is always loaded within fade radius
+		double fade_radius = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._QTLevel == ld)
+				fade_radius = std::max(fade_radius, _getLayerSwitchDistance(data.Layers[i], data.ScreenSpaceError));
+		}
+		return static_cast<float>(fade_radius);
+	}
+
+	void BillboardQuadTreeScattering::_reportLODRanges(const BillboardData &data, double max_bb_size) const
 	{
-		if(ld < 6) //only show progress above lod 6, we don't want to spam the log
+		std::cout << "Screen space error LOD ranges (error:" << data.ScreenSpaceError << "px fov:" << m_EnvironmentSettings.ViewFOV 
+			<< " viewport height:" << m_EnvironmentSettings.ViewportHeight << ")" << std::endl;
+
+		std::vector<double> level_cutoff(m_FinalLOD, 0);
+		double tile_size = max_bb_size;
+		for(int ld = 0; ld < m_FinalLOD; ld++)
+		{
+			//approximate tile radius from tile side, tight bounds are used during generation
+			level_cutoff[ld] = _getScreenSpaceCutoff(data, ld, tile_size*sqrt(0.5));
+			std::cout << " Level:" << ld << " Tile size:" << tile_size << " Children range:" << level_cutoff[ld] << std::endl;
+			tile_size *= 0.5;
+		}
+
+		//instances are faded out at fade radius of their tile, largest switch distance of layers at same level
+		std::vector<double> level_fade(m_FinalLOD + 1, 0);
+		for(size_t i = 0; i < data.Layers.size(); i++)
+			level_fade[data.Layers[i]._QTLevel] = std::max(level_fade[data.Layers[i]._QTLevel], _getLayerSwitchDistance(data.Layers[i], data.ScreenSpaceError));
+
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			const BillboardLayer &layer = data.Layers[i];
+			std::cout << " Layer:" << layer.TextureName << " Level:" << layer._QTLevel 
+				<< " Switch distance:" << _getLayerSwitchDistance(layer, data.ScreenSpaceError)
+				<< " View distance:" << level_fade[layer._QTLevel];
+			if(layer._QTLevel > 0)
+				std::cout << " Loaded range:" << level_cutoff[layer._QTLevel - 1];
+			std::cout << std::endl;
+		}
+
+		//expected instance count at some typical eye heights, 
+		//assume full coverage (upper bound) and that viewer is located inside the area
+		const double eye_heights[] = {2.0, 50.0, 200.0};
+		const double aspect_ratio = 16.0/9.0;
+		const double h_fov = 2.0*atan(tan(osg::DegreesToRadians(m_EnvironmentSettings.ViewFOV*0.5))*aspect_ratio);
+		const double area = (m_InitBB.xMax() - m_InitBB.xMin())*(m_InitBB.yMax() - m_InitBB.yMin());
+		for(int i = 0; i < 3; i++)
+		{
+			double loaded_count = 0;
+			double visible_count = 0;
+			for(size_t j = 0; j < data.Layers.size(); j++)
+			{
+				const int level = data.Layers[j]._QTLevel;
+				const double loaded_area = level > 0 ? GetGroundArea(level_cutoff[level - 1], eye_heights[i], area) : area;
+				loaded_count += loaded_area*data.Layers[j].Density;
+				visible_count += GetGroundArea(level_fade[level], eye_heights[i], area)*data.Layers[j].Density;
+			}
+			std::cout << " Eye height:" << eye_heights[i] << " Loaded instances:" << static_cast<size_t>(loaded_count) 
+				<< " Visible instances:" << static_cast<size_t>(visible_count)
+				<< " In view (16:9):" << static_cast<size_t>(visible_count*h_fov/(2.0*osg::PI)) << std::endl;
+		}
+	}
+
+	void BillboardQuadTreeScattering::_reportSubdivision(const BillboardData &data) const
+	{
+		m_Subdivision.report(data.AdaptiveSubdivision, data.MaxTileInstances, m_UsePagedLOD);
+		if(m_NumShadowCasters > 0)
+			std::cout << "Shadow casters:" << m_NumShadowCasters << std::endl;
+	}
+
+	static double GetTileCutoff(const osg::BoundingBoxd &cutoff_bb, const osg::Vec3d &lod_center)
+	{
+		//children are needed within region diameter from region center, LOD distance is measured
+		//from lod_center (tight bound) so add center offset to keep children loaded over whole region
+		return cutoff_bb.radius()*2.0 + (lod_center - cutoff_bb.center()).length();
+	}
+
+	osg::Node* BillboardQuadTreeScattering::_createLODRec(int ld, BillboardData &data, BillboardVegetationObjectVector instances, const osg::BoundingBoxd &bb,int x, int y, osg::BoundingBoxd &out_bb)
+	{
+		if(ld < 6 && !m_OnDemand) //only show progress above lod 6, we don't want to spam the log
 			std::cout << "Progress:" << static_cast<int>(100.0f*(static_cast<float>(m_CurrentTile)/ static_cast<float>(m_NumberOfTiles))) <<  "% Tile:" << m_CurrentTile << " of:" << m_NumberOfTiles << std::endl;
 		m_CurrentTile++;
-
+		//used to check if any shadow casters are added to this tile or child tiles
+		const int num_shadow_casters = m_NumShadowCasters;
 		
 		osg::ref_ptr<osg::Group> children_group = new osg::Group;
 
-		//mesh_group is returned as raw pointer
-		osg::Group* mesh_group = new osg::Group;
+		//mesh_group is released when returned
+		osg::ref_ptr<osg::Group> mesh_group = new osg::Group;
 
 
 		BillboardVegetationObjectVector tile_instances;
 		//double max_tile_size = 0;
-		osg::BoundingBoxd tile_bb = bb;
-		tile_bb._min.z() = FLT_MAX;
-		tile_bb._max.z() = -FLT_MAX;
+		//tight bound of instances in this tile, expanded by _populateVegetationTile
+		osg::BoundingBoxd tile_bb;
 
-		for(size_t i = 0; i < data.Layers.size(); i++)
+		//per tile random state, on demand tiles must be reproducible regardless of load order
+		//and can be generated by any DatabasePager thread (global rand() state is shared)
+		RandomGenerator rng(_getTileSeed(ld, x, y));
+
+		if(data.Technique == BRT_GPU_PROCEDURAL)
+			_addProceduralTile(data, ld, bb, x, y, mesh_group.get(), tile_bb);
+		else if(m_CombinedData)
+			_getCombinedTileInstances(ld, x, y, bb, tile_instances, tile_bb, rng);
+		else
 		{
-			if(ld == data.Layers[i]._QTLevel)
+			for(size_t i = 0; i < data.Layers.size(); i++)
 			{
-				 _populateVegetationTile(data.Layers[i], bb, tile_instances, tile_bb);
-				 //save view max view distance for this tile level
-				 //if(data.Layers[i].MinTileSize > max_tile_size)
-				//	 max_tile_size = data.Layers[i].MinTileSize;
+				if(ld == data.Layers[i]._QTLevel)
+				{
+					if(m_InstanceCache.valid())
+						_getCachedInstances(data.Layers[i], bb, tile_instances, tile_bb);
+					else
+						_populateVegetationTile(data.Layers[i], bb, tile_instances, tile_bb, rng);
+					 //save view max view distance for this tile level
+					 //if(data.Layers[i].MinTileSize > max_tile_size)
+					//	 max_tile_size = data.Layers[i].MinTileSize;
+				}
 			}
 		}
 	
-		//const double bb_size = (bb._max.x() - bb._min.x());
-		double tile_radius = bb.radius();
-		double tile_cutoff = tile_radius*2.0f;
-		osg::Vec3d tile_center = bb.center();
-		double tile_min_z = bb._min.z();
-		double tile_max_z = bb._max.z();
-
-		if(tile_instances.size() > 0)
+		//LOD cutoff is based on tile region (and instance height range if any), see GetTileCutoff
+		osg::BoundingBoxd cutoff_bb = bb;
+		if(tile_bb.valid())
 		{
-			//we have geometry in this tile, update radius etc.
-			tile_radius = tile_bb.radius();
-			tile_cutoff = tile_radius*2.0f;
-			tile_center = tile_bb.center();
-			tile_min_z = tile_bb._min.z();
-			tile_max_z = tile_bb._max.z();
+			cutoff_bb._min.z() = tile_bb._min.z();
+			cutoff_bb._max.z() = tile_bb._max.z();
 			//expand view distance to cutoff?
 			//max_tile_size = std::max(max_tile_size, tile_cutoff);
-			osg::Node* tile_geometry = m_BRT->create(tile_instances, tile_bb);
-
-			mesh_group->addChild(tile_geometry);
 		}
+		if(tile_instances.size() > 0)
+		{
+			//fade out at tile region radius (or screen space error distance), tight bound is only used for culling
+			const float fade_radius = _getFadeRadius(data, ld, cutoff_bb);
+			_addTileGeometry(data, tile_instances, bb, fade_radius, mesh_group.get(), _createFileName(ld, x, y), 0, 0);
+			_addShadowCasters(data, tile_instances, fade_radius, mesh_group.get());
+		}
+		const double tile_min_z = bb._min.z();
+		const double tile_max_z = bb._max.z();
+
+		//bottom-up bound of this tile and all child tiles
+		out_bb = tile_bb;
 
 		//split bounding box into four new children
 		bool final_lod = (ld == m_FinalLOD);
+		if(!final_lod && m_OnDemand)
+			return _createOnDemandLOD(ld, data, bb, x, y, mesh_group.get(), cutoff_bb, out_bb);
 		if(!final_lod)
 		{
 			double sx = (bb._max.x() - bb._min.x())*0.5;
@@ -167,11 +619,38 @@ namespace osgVegetation
 			osg::BoundingBoxd b4(osg::Vec3(bb._min.x(),		 bb._min.y() + sy  , tile_min_z),
 				osg::Vec3(bb._min.x() + sx,  bb._max.y()		, tile_max_z));
 
-			//first check that we are inside initial bounding box
-			if(b1.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b1, x*2,   y*2));
-			if(b2.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b2, x*2,   y*2+1));
-			if(b3.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b3, x*2+1, y*2+1));
-			if(b4.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b4, x*2+1, y*2));
+			//first check that we are inside initial bounding box, 
+			//empty subtrees are returned as NULL in adaptive mode and silently ignored by addChild
+			osg::BoundingBoxd child_bb[4];
+			if(b1.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b1, x*2,   y*2, child_bb[0]));
+			if(b2.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b2, x*2,   y*2+1, child_bb[1]));
+			if(b3.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b3, x*2+1, y*2+1, child_bb[2]));
+			if(b4.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b4, x*2+1, y*2, child_bb[3]));
+			for(int i = 0; i < 4; i++)
+				out_bb.expandBy(child_bb[i]);
+
+			//use tight bound for LOD center and radius, fallback to tile region if empty
+			const osg::BoundingBoxd &lod_bb = out_bb.valid() ? out_bb : bb;
+			const osg::Vec3d tile_center = lod_bb.center();
+			const double tile_radius = lod_bb.radius();
+
+			double tile_cutoff = GetTileCutoff(cutoff_bb, tile_center);
+			if(data.ScreenSpaceError > 0)
+			{
+				const double sse_cutoff = _getScreenSpaceCutoff(data, ld, tile_radius);
+				if(sse_cutoff > 0)
+					tile_cutoff = sse_cutoff;
+			}
+
+			m_Subdivision.NumInnerTiles++;
+			if(data.AdaptiveSubdivision && children_group->getNumChildren() == 0)
+			{
+				//no instances below this tile, skip LOD node and tile file
+				if(mesh_group->getNumChildren() == 0)
+					return NULL;
+				return mesh_group.release();
+			}
+			m_Subdivision.NumLODNodes++;
 
 			if(m_UsePagedLOD)
 			{
@@ -189,29 +668,11 @@ namespace osgVegetation
 				}
 				const std::string filename = _createFileName(ld, x,y);
 				plod->setFileName( c_index, filename );
-				
-				if(data.TilePixelSize > 0)
-				{
-					plod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
-					plod->setRange( 0, data.TilePixelSize, FLT_MAX);
-					if(c_index > 0)
-						plod->setRange( 1, data.TilePixelSize, FLT_MAX );
-				}
-				else
-				{
-					plod->setRange(0, data.TilePixelSize, FLT_MAX);
-					if (c_index > 0)
-					{
-						plod->setRange(0, 0, FLT_MAX);
-						plod->setRange(1, 0, tile_cutoff);
-					}
-					else
-						plod->setRange(0, 0, tile_cutoff);
-				}
+				_setPagedLODRanges(plod, data, c_index, tile_cutoff);
 
 				osgDB::writeNodeFile( *children_group, m_SavePath + filename );
-
-				
+				m_Subdivision.NumTileFiles++;
+				_setShadowCasterMask(plod, num_shadow_casters);
 				return plod;
 			}
 			else
@@ -229,11 +690,34 @@ namespace osgVegetation
 					plod->setRange( 0, data.TilePixelSize, FLT_MAX);
 					plod->setRange( 1, data.TilePixelSize, FLT_MAX );
 				}
+				_setShadowCasterMask(plod, num_shadow_casters);
 				return plod;
 			}
 		}
+		else if(data.AdaptiveSubdivision && mesh_group->getNumChildren() == 0)
+			return NULL;
 		else
-			return mesh_group;
+			return mesh_group.release();
+	}
+
+	/**
+		Move texture arrays from data set state set to returned state set. Layer files (and tile files) are 
+		written without texture arrays and inherit them from the top file where each array is written once, 
+		data sets with same textures share array (see Utils::loadTextureArray).
+	*/
+	static osg::StateSet* ExtractTextureArrays(osg::StateSet* state_set)
+	{
+		osg::StateSet* texture_state_set = new osg::StateSet;
+		for(unsigned int unit = 0; unit < state_set->getTextureAttributeList().size(); unit++)
+		{
+			const osg::StateSet::RefAttributePair* pair = state_set->getTextureAttributePair(unit, osg::StateAttribute::TEXTURE);
+			if(pair && dynamic_cast<osg::Texture2DArray*>(pair->first.get()))
+			{
+				texture_state_set->setTextureAttribute(unit, pair->first.get(), pair->second);
+				state_set->removeTextureAttribute(unit, osg::StateAttribute::TEXTURE);
+			}
+		}
+		return texture_state_set;
 	}
 
 	bool BillboardSortPredicate(const BillboardLayer &lhs, const BillboardLayer &rhs)
@@ -257,24 +741,62 @@ namespace osgVegetation
 
 		osg::Node *node = NULL;
 
-		//use proxy file for top node
+		if(m_InstanceCache.valid())
+		{
+			//all layers must be found in cache
+			for(size_t i = 0; i < data.size(); i++)
+			{
+				if(data[i].Technique == BRT_GPU_PROCEDURAL)
+				{
+					//procedural tiles are not cached and still query terrain
+					if(m_TerrainQuery == NULL)
+						OSGV_EXCEPT(std::string("BillboardQuadTreeScattering::generate - terrain query required by procedural data set").c_str());
+					continue;
+				}
+				_initLayerIndices(data[i]);
+				for(size_t j = 0; j < data[i].Layers.size(); j++)
+				{
+					if(!m_InstanceCache->hasLayer(i, data[i].Layers[j]._LayerIndex))
+					{
+						std::stringstream ss;
+						ss << "BillboardQuadTreeScattering::generate - data set " << i << " layer " << data[i].Layers[j]._LayerIndex << " not found in instance cache";
+						OSGV_EXCEPT(ss.str().c_str());
+					}
+				}
+			}
+		}
+		else if(m_CombinedScattering && data.size() > 1)
+			_initCombinedScattering(bounding_box, data);
+
+		//use proxy file for each data set, texture arrays are kept in top file (see ExtractTextureArrays)
 		if(m_UsePagedLOD)
 		{
-			osg::ProxyNode* pn = new osg::ProxyNode();
-			node  = pn;
+			osg::Group* root = new osg::Group();
+			node  = root;
 			for(size_t i=0; i < data.size();i++)
 			{
 				std::stringstream ss;
 				ss << "billboard_layer" << i;
-				osg::Node* bb_node = generate(bounding_box, data[i], output_file, use_paged_lod, ss.str());
-				if(bb_node)
+				m_DataSetIndex = i;
+				m_TopStateSet = NULL;
+				osg::ref_ptr<osg::Node> bb_node = generate(bounding_box, data[i], output_file, use_paged_lod, ss.str());
+				if(bb_node.valid())
 				{
+					//state set added to top tile by generate
+					osg::StateSet* state_set = m_TopStateSet.get();
+					osg::Group* texture_group = new osg::Group();
+					if(state_set)
+						texture_group->setStateSet(ExtractTextureArrays(state_set));
+					root->addChild(texture_group);
+
 					//save osg files that can be used for editing
 					const std::string file_name = ss.str() + ".osg";
 					osgDB::ReaderWriter::Options *options = new osgDB::ReaderWriter::Options();
 					options->setOptionString(std::string("OutputShaderFiles"));
 					osgDB::writeNodeFile(*bb_node, m_SavePath + file_name,options);
-					pn->setFileName(i, file_name);
+					osg::ProxyNode* pn = new osg::ProxyNode();
+					pn->setFileName(0, file_name);
+					texture_group->addChild(pn);
 					
 					/*const std::string file_name = ss.str() + ".ive";
 					osgDB::ReaderWriter::Options *options = new osgDB::ReaderWriter::Options();
@@ -284,9 +806,9 @@ namespace osgVegetation
 				}
 			}
 
-			if(output_file != "") //save proxy node
+			if(output_file != "") //save proxy nodes, texture arrays shared by data sets are written once
 			{
-				osgDB::writeNodeFile(*pn, output_file + ".osg");
+				osgDB::writeNodeFile(*root, output_file + ".osg");
 			}
 		}
 		else
@@ -297,6 +819,7 @@ namespace osgVegetation
 			{
 				std::stringstream ss;
 				ss << "billboard_layer" << i;
+				m_DataSetIndex = i;
 				osg::Node* bb_node = generate(bounding_box, data[i], output_file, use_paged_lod, ss.str());
 				if(bb_node)
 				{
@@ -304,12 +827,51 @@ namespace osgVegetation
 				}
 			}
 		}
+		m_DataSetIndex = 0;
+		m_TopStateSet = NULL;
+
+		if(m_CombinedData)
+		{
+			std::cout << "Combined scattering, terrain samples:" << m_NumSharedSamples << " (independent:" << m_NumIndependentSamples << ")" << std::endl;
+			m_CombinedData = NULL;
+			m_CombinedTiles.clear();
+			m_CombinedRootSize = 0;
+		}
 		return node;
 	}
 
-	osg::Node* BillboardQuadTreeScattering::generate(const osg::BoundingBoxd &boudning_box, BillboardData &data, const std::string &output_file, bool use_paged_lod, const std::string &filename_prefix)
+	void BillboardQuadTreeScattering::_initCombinedScattering(const osg::BoundingBoxd &bounding_box, std::vector<BillboardData> &data)
 	{
-		m_FilenamePrefix = filename_prefix;
+		m_CombinedData = &data;
+		m_DataSetIndex = 0;
+		m_CombinedTiles.clear();
+		m_NumSharedSamples = 0;
+		m_NumIndependentSamples = 0;
+
+		//all data sets must share quad tree layout
+		m_CombinedRootSize = std::max(bounding_box._max.x() - bounding_box._min.x(), bounding_box._max.y() - bounding_box._min.y());
+		for(size_t i = 0; i < data.size(); i++)
+		{
+			for(size_t j = 0; j < data[i].Layers.size(); j++)
+				m_CombinedRootSize = std::max(m_CombinedRootSize, data[i].Layers[j].MinTileSize);
+		}
+
+		//layer levels and texture indices are needed up front to scatter instances for following data sets,
+		//same result as _initQuadTree for each data set
+		for(size_t i = 0; i < data.size(); i++)
+		{
+			_initLayerIndices(data[i]);
+			std::stable_sort(data[i].Layers.begin(), data[i].Layers.end(), BillboardSortPredicate);
+			_setLayerLevels(data[i], m_CombinedRootSize);
+			if(data[i].Technique != BRT_GPU_PROCEDURAL)
+				Utils::loadTextureArray(data[i]);
+		}
+	}
+
+	osg::BoundingBoxd BillboardQuadTreeScattering::_initQuadTree(const osg::BoundingBoxd &boudning_box, BillboardData &data)
+	{
+		m_BillboardType = data.Type;
+		m_BillboardTechnique = data.Technique;
 		//remove any previous render technique
 		delete m_BRT;
 
@@ -317,6 +879,8 @@ namespace osgVegetation
 			m_BRT = new BRTShaderInstancing(data, m_EnvironmentSettings);
 		else if (data.Technique == BRT_GEOMETRY_SHADER)
 			m_BRT = new BRTGeometryShader(data, m_EnvironmentSettings);
+		else if (data.Technique == BRT_GPU_PROCEDURAL)
+			m_BRT = new BRTProceduralGrass(data, m_EnvironmentSettings);
 		else
 			OSGV_EXCEPT(std::string("BillboardQuadTreeScattering::generate - unkown rendering tech").c_str());
 
@@ -331,25 +895,74 @@ namespace osgVegetation
 		m_InitBB._min.set(0,0,0);
 		m_InitBB._max = boudning_box._max - boudning_box._min;
 
-		//add offset matrix
-		osg::MatrixTransform* transform = new osg::MatrixTransform;
-		transform->setMatrix(osg::Matrix::translate(m_Offset));
-
 		//reset
 		m_FinalLOD =0;
 		m_NumberOfTiles = 1; //at least one LOD tile
 		m_CurrentTile = 0;
+		m_Subdivision.reset();
+		m_NumShadowCasters = 0;
 
-		//sort by tile size
-		std::sort(data.Layers.begin(), data.Layers.end(), BillboardSortPredicate);
+		//sort by tile size, stable to keep layer order if already sorted by combined scattering
+		_initLayerIndices(data);
+		std::stable_sort(data.Layers.begin(), data.Layers.end(), BillboardSortPredicate);
 
 		//Get max tile size
 		for(size_t i = 0; i < data.Layers.size(); i++)
 		{
 			max_bb_size = std::max(max_bb_size, data.Layers[i].MinTileSize);
 		}
+		max_bb_size = std::max(max_bb_size, m_CombinedRootSize);
+
+		m_FinalLOD = _setLayerLevels(data, max_bb_size);
+
+		//Create squared bounding box for top level quad tree tile
+		osg::BoundingBoxd qt_bb;
+		qt_bb._max.set(max_bb_size, max_bb_size, boudning_box._max.z() - boudning_box._min.z());
+		qt_bb._min.set(0,0,0);
+		return qt_bb;
+	}
 
+	InstanceCache* BillboardQuadTreeScattering::scatter(const osg::BoundingBoxd &bounding_box, std::vector<BillboardData> &data)
+	{
+		osg::ref_ptr<InstanceCache> cache = new InstanceCache(bounding_box);
+
+		//same local area as _initQuadTree
+		m_Offset = bounding_box._min;
+		m_InitBB._min.set(0,0,0);
+		m_InitBB._max = bounding_box._max - bounding_box._min;
+
+		RandomGenerator rng(m_Seed);
+		for(size_t i = 0; i < data.size(); i++)
+		{
+			//procedural grass store no instances
+			if(data[i].Technique == BRT_GPU_PROCEDURAL)
+				continue;
+			_initLayerIndices(data[i]);
+			for(size_t j = 0; j < data[i].Layers.size(); j++)
+			{
+				const BillboardLayer &layer = data[i].Layers[j];
+				std::cout << "Scattering data set:" << i << " layer:" << layer._LayerIndex << " (" << layer.TextureName << ")" << std::endl;
+				const double tile_size = layer.MinTileSize > 0 ? layer.MinTileSize : std::max(m_InitBB.xMax(), m_InitBB.yMax());
+				cache->addLayer(i, layer._LayerIndex, tile_size);
+				//scatter in tiles of layer size to keep number of samples per step low
+				for(double y = 0; y < m_InitBB.yMax(); y += tile_size)
+				{
+					for(double x = 0; x < m_InitBB.xMax(); x += tile_size)
+					{
+						const osg::BoundingBoxd tile_bb(x, y, m_InitBB.zMin(), x + tile_size, y + tile_size, m_InitBB.zMax());
+						_scatterLayer(layer, i, tile_bb, *cache, rng);
+					}
+				}
+			}
+		}
+		std::cout << "Scattered instances:" << cache->getNumInstances() << std::endl;
+		return cache.release();
+	}
+
+	int BillboardQuadTreeScattering::_setLayerLevels(BillboardData &data, double max_bb_size) const
+	{
 		//set quad tree LOD level for each billboard layer
+		int final_lod = 0;
 		for(size_t i = 0; i < data.Layers.size(); i++)
 		{
 			double temp_size  = max_bb_size;
@@ -360,14 +973,22 @@ namespace osgVegetation
 				temp_size *= 0.5;
 			}
 			data.Layers[i]._QTLevel = ld;
-			if(m_FinalLOD < ld)
-				m_FinalLOD = ld;
+			if(final_lod < ld)
+				final_lod = ld;
 		}
+		return final_lod;
+	}
 
-		//Create squared bounding box for top level quad tree tile
-		osg::BoundingBoxd qt_bb;
-		qt_bb._max.set(max_bb_size, max_bb_size, boudning_box._max.z() - boudning_box._min.z());
-		qt_bb._min.set(0,0,0);
+	osg::Node* BillboardQuadTreeScattering::generate(const osg::BoundingBoxd &boudning_box, BillboardData &data, const std::string &output_file, bool use_paged_lod, const std::string &filename_prefix)
+	{
+		m_FilenamePrefix = filename_prefix;
+		m_OnDemand = false;
+		const osg::BoundingBoxd qt_bb = _initQuadTree(boudning_box, data);
+		const double max_bb_size = qt_bb.xMax() - qt_bb.xMin();
+
+		//add offset matrix
+		osg::MatrixTransform* transform = new osg::MatrixTransform;
+		transform->setMatrix(osg::Matrix::translate(m_Offset));
 
 		//get total number of tiles to process, used for progress report
 		int ld = 0;
@@ -380,11 +1001,148 @@ namespace osgVegetation
 
 		//Start recursive scattering process
 		BillboardVegetationObjectVector instances;
-		osg::Node* outnode = _createLODRec(0, data, instances, qt_bb,0,0);
+		osg::BoundingBoxd out_bb;
+		osg::Node* outnode = _createLODRec(0, data, instances, qt_bb,0,0, out_bb);
+		if(outnode == NULL) //nothing generated in adaptive mode
+			outnode = new osg::Group;
+		if(m_UseQuadTreeNode && !m_UsePagedLOD)
+		{
+			//LOD/Group nodes are released when replaced, tile content is kept by quad tree
+			osg::ref_ptr<osg::Node> lod_root = outnode;
+			osg::ref_ptr<VegetationQuadTree> quad_tree = VegetationQuadTree::create(lod_root.get());
+			if(quad_tree.valid())
+				outnode = quad_tree.release();
+			else
+				outnode = lod_root.release();
+		}
+		_reportSubdivision(data);
+		if(data.ScreenSpaceError > 0 && data.TilePixelSize == 0)
+			_reportLODRanges(data, max_bb_size);
 
-		//Add state set to top node
+		//Add state set to top node, state attributes and textures are shared with render technique state set
+		m_TopStateSet = dynamic_cast<osg::StateSet*>(m_BRT->getStateSet()->clone(osg::CopyOp::DEEP_COPY_STATESETS));
+		outnode->setStateSet(m_TopStateSet.get());
+		transform->addChild(outnode);
+		return transform;
+	}
+
+	osg::Node* BillboardQuadTreeScattering::generateOnDemand(const osg::BoundingBoxd &boudning_box, const BillboardData &data, const std::string &name, unsigned int seed)
+	{
+		m_OnDemand = true;
+		m_UsePagedLOD = true;
+		m_OnDemandName = name;
+		m_Seed = seed;
+		delete m_OnDemandData;
+		m_OnDemandData = new BillboardData(data);
+		m_QTBB = _initQuadTree(boudning_box, *m_OnDemandData);
+
+		//add offset matrix
+		osg::MatrixTransform* transform = new osg::MatrixTransform;
+		transform->setMatrix(osg::Matrix::translate(m_Offset));
+		//tiles paged in later are local to this transform, prevent optimizer from flattening it
+		transform->setDataVariance(osg::Object::DYNAMIC);
+
+		//only top tile is created here, children are generated when paged in
+		BillboardVegetationObjectVector instances;
+		osg::BoundingBoxd out_bb;
+		osg::Node* outnode = _createLODRec(0, *m_OnDemandData, instances, m_QTBB, 0, 0, out_bb);
 		outnode->setStateSet(dynamic_cast<osg::StateSet*>(m_BRT->getStateSet()->clone(osg::CopyOp::DEEP_COPY_STATESETS)));
 		transform->addChild(outnode);
 		return transform;
 	}
+
+	osg::Node* BillboardQuadTreeScattering::generateTileChildren(int ld, unsigned int x, unsigned int y)
+	{
+		if(!m_OnDemand)
+			OSGV_EXCEPT(std::string("BillboardQuadTreeScattering::generateTileChildren - generateOnDemand not called").c_str());
+
+		osg::Group* group = new osg::Group;
+		if(ld >= m_FinalLOD)
+			return group;
+
+		//tile index x run along y-axis and index y along x-axis, see _createLODRec
+		const double child_size = (m_QTBB.xMax() - m_QTBB.xMin()) / static_cast<double>(2 << ld);
+		for(unsigned int i = 0; i < 4; i++)
+		{
+			const unsigned int cx = x*2 + (i >> 1);
+			const unsigned int cy = y*2 + (i & 1);
+			const osg::BoundingBoxd child_bb(m_QTBB.xMin() + cy*child_size, m_QTBB.yMin() + cx*child_size, m_QTBB.zMin(),
+				m_QTBB.xMin() + (cy + 1)*child_size, m_QTBB.yMin() + (cx + 1)*child_size, m_QTBB.zMax());
+			if(!child_bb.intersects(m_InitBB))
+				continue;
+			BillboardVegetationObjectVector instances;
+			osg::BoundingBoxd out_bb;
+			group->addChild(_createLODRec(ld + 1, *m_OnDemandData, instances, child_bb, cx, cy, out_bb));
+		}
+		return group;
+	}
+
+	std::string BillboardQuadTreeScattering::_createOnDemandFileName(unsigned int lv, unsigned int x, unsigned int y) const
+	{
+		std::stringstream sstream;
+		sstream << m_OnDemandName << "_" << lv << "_" << x << "_" << y << ".osgveg";
+		return sstream.str();
+	}
+
+	unsigned int BillboardQuadTreeScattering::_getTileSeed(unsigned int lv, unsigned int x, unsigned int y) const
+	{
+		//spatial hash of tile index combined with user seed
+		return (m_Seed * 2654435761u) ^ (lv * 19349663u) ^ (x * 73856093u) ^ (y * 83492791u);
+	}
+
+	void BillboardQuadTreeScattering::_setPagedLODRanges(osg::PagedLOD* plod, const BillboardData &data, int c_index, double tile_cutoff) const
+	{
+		if(data.TilePixelSize > 0)
+		{
+			plod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+			plod->setRange( 0, data.TilePixelSize, FLT_MAX);
+			if(c_index > 0)
+				plod->setRange( 1, data.TilePixelSize, FLT_MAX );
+		}
+		else if (c_index > 0)
+		{
+			plod->setRange(0, 0, FLT_MAX);
+			plod->setRange(1, 0, tile_cutoff);
+		}
+		else
+			plod->setRange(0, 0, tile_cutoff);
+	}
+
+	osg::Node* BillboardQuadTreeScattering::_createOnDemandLOD(int ld, const BillboardData &data, const osg::BoundingBoxd &bb, int x, int y, osg::Group* mesh_group, const osg::BoundingBoxd &cutoff_bb, osg::BoundingBoxd &out_bb)
+	{
+		//children are not generated yet, use tile region expanded by tallest instance below this level as bound
+		double max_height = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i]._QTLevel > ld)
+				max_height = std::max(max_height, static_cast<double>(data.Layers[i].Height.y()*data.Layers[i].Scale.y()));
+		}
+		osg::BoundingBoxd region = bb;
+		region._max.z() += max_height;
+		out_bb.expandBy(region);
+
+		const double tile_radius = out_bb.radius();
+		double tile_cutoff = GetTileCutoff(cutoff_bb, out_bb.center());
+		if(data.ScreenSpaceError > 0)
+		{
+			const double sse_cutoff = _getScreenSpaceCutoff(data, ld, tile_radius);
+			if(sse_cutoff > 0)
+				tile_cutoff = sse_cutoff;
+		}
+
+		osg::PagedLOD* plod = new osg::PagedLOD;
+		plod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
+		plod->setCenter(out_bb.center());
+		plod->setRadius(tile_radius);
+
+		int c_index = 0;
+		if(mesh_group->getNumChildren() > 0)
+		{
+			plod->addChild(mesh_group);
+			c_index++;
+		}
+		plod->setFileName(c_index, _createOnDemandFileName(ld, x, y));
+		_setPagedLODRanges(plod, data, c_index, tile_cutoff);
+		return plod;
+	}
 }
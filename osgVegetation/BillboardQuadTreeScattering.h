@@ -3,17 +3,24 @@
 #include <osg/BoundingBox>
 #include <osg/Referenced>
 #include <osg/Node>
+#include <osg/StateSet>
 #include <osg/ref_ptr>
+#include <osg/PagedLOD>
 
 #include <vector>
+#include <map>
 #include "IBillboardRenderingTech.h"
 #include "BillboardLayer.h"
 #include "BillboardData.h"
 #include "EnvironmentSettings.h"
+#include "InstanceCache.h"
+#include "QuadTreeSubdivision.h"
+#include "VegetationUtils.h"
 
 namespace osgVegetation
 {
 	class ITerrainQuery;
+	struct ScatterSample;
 
 	/**
 		Class used for billboard generation. Billboards are stored in quad tree
@@ -28,8 +35,10 @@ namespace osgVegetation
 	public:
 		/**
 		@param tq Pointer to TerrainQuery class, used during the scattering step.
+		May be NULL if all instances are read from instance cache (no procedural data sets).
 		*/
 		BillboardQuadTreeScattering(ITerrainQuery* tq, const EnvironmentSettings& env_settings);
+		virtual ~BillboardQuadTreeScattering();
 		/**
 			Generate vegetation data by providing billboard data
 			@param bb Generation area
@@ -40,7 +49,80 @@ namespace osgVegetation
 		*/
 		osg::Node* generate(const osg::BoundingBoxd &bb, BillboardData &data, const std::string &output_file = "", bool use_paged_lod = false, const std::string &filename_prefix = "");
 
+		/**
+			Generate vegetation for multiple data sets, each data set get its own quad tree (and tile files)
+			@param bb Generation area
+			@param data Billboard data sets
+			@param out_put_file Filename if you want to save data base, see above
+			@param use_paged_lod Use PagedLOD instead of regular LOD nodes
+		*/
 		osg::Node* generate(const osg::BoundingBoxd &bb,std::vector<osgVegetation::BillboardData> &data, const std::string &output_file, bool use_paged_lod);
+
+		/**
+			Enable combined scattering when generating multiple data sets (default false).
+			Terrain is then sampled once for all data sets: the first data set that reach a tile
+			draw a shared pool of terrain samples for every layer (in this and following data sets) due at that tile.
+			Each sample is assigned to at most one layer covering the sample material,
+			with probability proportional to layer density, so expected layer density is unchanged
+			while layers with different coverage materials share terrain samples.
+			All data sets use the same quad tree root size (largest of all data sets).
+			Output is the same per data set structure as independent generation, 
+			instances of data sets not yet written are kept in memory until that data set is generated.
+			Note that instance placement differ from independent generation (same density, other samples).
+		*/
+		void setCombinedScattering(bool value) {m_CombinedScattering = value;}
+		bool getCombinedScattering() const {return m_CombinedScattering;}
+
+		/**
+			Scatter all layers without creating any scene graph, terrain is only queried in this step.
+			Instances are stored as raw records (see InstanceCache) that can be saved to file and 
+			later used to generate vegetation with different render settings, see setInstanceCache.
+			Data sets using BRT_GPU_PROCEDURAL are skipped (no instances stored).
+			@param bb Generation area
+			@param data Billboard data sets
+		*/
+		InstanceCache* scatter(const osg::BoundingBoxd &bb, std::vector<osgVegetation::BillboardData> &data);
+
+		/**
+			Set instance cache used as instance source instead of terrain queries when generating vegetation.
+			Data set and layer configuration order must match the order used in the scatter step.
+			Render settings (technique, type, tile size, shadows etc.) are free to change, 
+			while color ratio and intensity settings are applied from current layer settings.
+			Set to NULL (default) to scatter from terrain.
+		*/
+		void setInstanceCache(InstanceCache* cache) {m_InstanceCache = cache;}
+		InstanceCache* getInstanceCache() const {return m_InstanceCache.get();}
+
+		/**
+			Replace nested LOD hierarchy with a flat VegetationQuadTree node (default false).
+			Only used when paged LOD is disabled.
+		*/
+		void setUseQuadTreeNode(bool value) {m_UseQuadTreeNode = value;}
+		bool getUseQuadTreeNode() const {return m_UseQuadTreeNode;}
+
+		/**
+			Base seed combined with tile index for per tile random state (default 0),
+			same seed and data give same instances. Replaced by seed argument in generateOnDemand.
+		*/
+		void setSeed(unsigned int seed) {m_Seed = seed;}
+		unsigned int getSeed() const {return m_Seed;}
+
+		/**
+			Setup on demand generation and create top tile. Child tiles are referenced
+			as "<name>_<level>_<x>_<y>.osgveg" files that are generated by generateTileChildren 
+			when paged in (see OnDemandVegetation). Each tile use its own random state (RandomGenerator) so 
+			that tiles are reproducible regardless of load order.
+			@param bb Generation area
+			@param data Billboard layers and settings
+			@param name Name used to identify this generator in tile file names
+			@param seed Base seed combined with tile index
+		*/
+		osg::Node* generateOnDemand(const osg::BoundingBoxd &bb, const BillboardData &data, const std::string &name, unsigned int seed = 0);
+
+		/**
+			Generate the four children of tile, only valid after generateOnDemand
+		*/
+		osg::Node* generateTileChildren(int ld, unsigned int x, unsigned int y);
 	private:
 		int m_FinalLOD;
 
@@ -48,6 +130,10 @@ namespace osgVegetation
 		int m_CurrentTile;
 		int m_NumberOfTiles;
 
+		//data used for adaptive subdivision report
+		QuadTreeSubdivision m_Subdivision;
+		int m_NumShadowCasters;
+
 		//Area bounding box
 		osg::BoundingBoxd m_InitBB;
 		
@@ -58,7 +144,39 @@ namespace osgVegetation
 	
 		ITerrainQuery* m_TerrainQuery;
 		EnvironmentSettings m_EnvironmentSettings;
+		
+		//used to calculate instance bounds
+		BillboardType m_BillboardType;
+		BillboardRenderingTechnique m_BillboardTechnique;
 		bool m_UsePagedLOD;
+		bool m_UseQuadTreeNode;
+
+		//on demand generation
+		bool m_OnDemand;
+		BillboardData* m_OnDemandData;
+		std::string m_OnDemandName;
+		unsigned int m_Seed;
+		osg::BoundingBoxd m_QTBB;
+
+		//index of data set being generated
+		size_t m_DataSetIndex;
+
+		//state set added to top tile by last generate call
+		osg::ref_ptr<osg::StateSet> m_TopStateSet;
+
+		//pre scattered instances
+		osg::ref_ptr<InstanceCache> m_InstanceCache;
+
+		//combined scattering of multiple data sets
+		bool m_CombinedScattering;
+		std::vector<BillboardData>* m_CombinedData;
+		double m_CombinedRootSize;
+		typedef std::pair<int, std::pair<int, int> > TileIndex;
+		//instances for each data set, indexed by quad tree tile
+		typedef std::map<TileIndex, std::vector<BillboardVegetationObjectVector> > CombinedTileMap;
+		CombinedTileMap m_CombinedTiles;
+		size_t m_NumSharedSamples;
+		size_t m_NumIndependentSamples;
 
 		//Output stuff
 		std::string m_SavePath;
@@ -67,7 +185,32 @@ namespace osgVegetation
 
 		//Helpers
 		std::string _createFileName(unsigned int lv,	unsigned int x, unsigned int y) const;
-		void _populateVegetationTile(const BillboardLayer& layer,const osg::BoundingBoxd &box, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb) const;
-		osg::Node* _createLODRec(int ld, BillboardData &data, BillboardVegetationObjectVector trees, const osg::BoundingBoxd &box ,int x, int y);
+		void _populateVegetationTile(const BillboardLayer& layer,const osg::BoundingBoxd &box, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb, RandomGenerator &rng) const;
+		BillboardObject* _createBillboardObject(const BillboardLayer& layer, const ScatterSample &sample) const;
+		osg::Vec4 _getBillboardColor(const BillboardLayer& layer, osg::Vec4 terrain_color, float rand_int) const;
+		void _initLayerIndices(BillboardData &data) const;
+		void _scatterLayer(const BillboardLayer& layer, unsigned int data_set, const osg::BoundingBoxd &box, InstanceCache &cache, RandomGenerator &rng) const;
+		void _getCachedInstances(const BillboardLayer& layer, const osg::BoundingBoxd &box, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb) const;
+		int _setLayerLevels(BillboardData &data, double max_bb_size) const;
+		bool _hasLayersAtLevel(const BillboardData &data, int ld) const;
+		void _initCombinedScattering(const osg::BoundingBoxd &bb, std::vector<BillboardData> &data);
+		void _populateCombinedTile(int ld, int x, int y, const osg::BoundingBoxd &box, RandomGenerator &rng);
+		void _getCombinedTileInstances(int ld, int x, int y, const osg::BoundingBoxd &box, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb, RandomGenerator &rng);
+		osg::Node* _createLODRec(int ld, BillboardData &data, BillboardVegetationObjectVector trees, const osg::BoundingBoxd &box ,int x, int y, osg::BoundingBoxd &out_bb);
+		void _addTileGeometry(const BillboardData &data, const BillboardVegetationObjectVector &instances, const osg::BoundingBoxd &region, float fade_radius, osg::Group* group,
+			const std::string &filename, int split_depth, int quadrant_path);
+		void _reportSubdivision(const BillboardData &data) const;
+		void _addShadowCasters(const BillboardData &data, const BillboardVegetationObjectVector &instances, float fade_radius, osg::Group* group);
+		void _setShadowCasterMask(osg::Node* tile, int num_shadow_casters) const;
+		double _getLayerSwitchDistance(const BillboardLayer &layer, float screen_space_error) const;
+		double _getScreenSpaceCutoff(const BillboardData &data, int ld, double tile_radius) const;
+		float _getFadeRadius(const BillboardData &data, int ld, const osg::BoundingBoxd &region) const;
+		void _reportLODRanges(const BillboardData &data, double max_bb_size) const;
+		void _addProceduralTile(const BillboardData &data, int ld, const osg::BoundingBoxd &bb, int x, int y, osg::Group* group, osg::BoundingBoxd &out_bb) const;
+		osg::BoundingBoxd _initQuadTree(const osg::BoundingBoxd &bb, BillboardData &data);
+		std::string _createOnDemandFileName(unsigned int lv, unsigned int x, unsigned int y) const;
+		unsigned int _getTileSeed(unsigned int lv, unsigned int x, unsigned int y) const;
+		void _setPagedLODRanges(osg::PagedLOD* plod, const BillboardData &data, int c_index, double tile_cutoff) const;
+		osg::Node* _createOnDemandLOD(int ld, const BillboardData &data, const osg::BoundingBoxd &bb, int x, int y, osg::Group* mesh_group, const osg::BoundingBoxd &cutoff_bb, osg::BoundingBoxd &out_bb);
 	};
 }
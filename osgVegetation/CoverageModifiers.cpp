@@ -0,0 +1,270 @@
+#include "CoverageModifiers.h"
+#include <algorithm>
+#include <cmath>
+
+namespace osgVegetation
+{
+	static double SegmentDistance2(const osg::Vec2d &p, const osg::Vec2d &a, const osg::Vec2d &b)
+	{
+		const osg::Vec2d ab = b - a;
+		const double len2 = ab.length2();
+		double t = len2 > 0 ? ((p - a) * ab) / len2 : 0;
+		t = std::max(0.0, std::min(1.0, t));
+		return (a + ab*t - p).length2();
+	}
+
+	static double Cross(const osg::Vec2d &o, const osg::Vec2d &a, const osg::Vec2d &b)
+	{
+		return (a.x() - o.x())*(b.y() - o.y()) - (a.y() - o.y())*(b.x() - o.x());
+	}
+
+	static bool SegmentsIntersect(const osg::Vec2d &a, const osg::Vec2d &b, const osg::Vec2d &c, const osg::Vec2d &d)
+	{
+		const double d1 = Cross(c, d, a);
+		const double d2 = Cross(c, d, b);
+		const double d3 = Cross(a, b, c);
+		const double d4 = Cross(a, b, d);
+		return ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+			((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0));
+	}
+
+	static bool InsidePolygon(const std::vector<osg::Vec2d> &points, double x, double y)
+	{
+		//crossing number test
+		bool inside = false;
+		const size_t num_points = points.size();
+		for(size_t i = 0, j = num_points - 1; i < num_points; j = i++)
+		{
+			const osg::Vec2d &a = points[i];
+			const osg::Vec2d &b = points[j];
+			if(((a.y() > y) != (b.y() > y)) && (x < (b.x() - a.x())*(y - a.y()) / (b.y() - a.y()) + a.x()))
+				inside = !inside;
+		}
+		return inside;
+	}
+
+	CoverageModifiers::CoverageModifiers(double cell_size) : m_CellSize(cell_size),
+		m_OriginX(0),
+		m_OriginY(0),
+		m_GridX(0),
+		m_GridY(0)
+	{
+
+	}
+
+	CoverageModifiers::~CoverageModifiers()
+	{
+
+	}
+
+	void CoverageModifiers::addPolygon(ModifierMode mode, const std::vector<osg::Vec2d> &points, double buffer, const std::string &material_name)
+	{
+		if(points.size() < 3)
+			OSGV_EXCEPT(std::string("CoverageModifiers::addPolygon - polygon need at least three points").c_str());
+		_addModifier(Modifier(mode, points, true, buffer, material_name));
+	}
+
+	void CoverageModifiers::addPolyline(ModifierMode mode, const std::vector<osg::Vec2d> &points, double buffer, const std::string &material_name)
+	{
+		if(points.size() < 2)
+			OSGV_EXCEPT(std::string("CoverageModifiers::addPolyline - polyline need at least two points").c_str());
+		_addModifier(Modifier(mode, points, false, buffer, material_name));
+	}
+
+	void CoverageModifiers::_addModifier(const Modifier &modifier)
+	{
+		if(modifier.Mode == CM_INCLUDE && modifier.MaterialName == "")
+			OSGV_EXCEPT(std::string("CoverageModifiers - inclusion zone without material").c_str());
+		m_Modifiers.push_back(modifier);
+		Modifier &added = m_Modifiers.back();
+		for(size_t i = 0; i < added.Points.size(); i++)
+			added._Bound.expandBy(osg::Vec3d(added.Points[i].x(), added.Points[i].y(), 0));
+		added._Bound._min -= osg::Vec3d(added.Buffer, added.Buffer, 0);
+		added._Bound._max += osg::Vec3d(added.Buffer, added.Buffer, 0);
+	}
+
+	void CoverageModifiers::build()
+	{
+		osg::BoundingBoxd extent;
+		for(size_t i = 0; i < m_Modifiers.size(); i++)
+			extent.expandBy(m_Modifiers[i]._Bound);
+		m_Cells.clear();
+		m_ExcludedCells.clear();
+		m_GridX = m_GridY = 0;
+		if(!extent.valid())
+			return;
+
+		const double max_extent = std::max(extent.xMax() - extent.xMin(), extent.yMax() - extent.yMin());
+		if(m_CellSize <= 0)
+			m_CellSize = std::max(max_extent / 256.0, 0.001);
+		m_OriginX = extent.xMin();
+		m_OriginY = extent.yMin();
+		m_GridX = static_cast<int>((extent.xMax() - extent.xMin()) / m_CellSize) + 1;
+		m_GridY = static_cast<int>((extent.yMax() - extent.yMin()) / m_CellSize) + 1;
+		m_Cells.resize(m_GridX*m_GridY);
+		m_ExcludedCells.resize(m_GridX*m_GridY, false);
+
+		for(size_t i = 0; i < m_Modifiers.size(); i++)
+		{
+			const Modifier &modifier = m_Modifiers[i];
+			int cx0, cy0, cx1, cy1;
+			_getCell(modifier._Bound.xMin(), modifier._Bound.yMin(), cx0, cy0);
+			_getCell(modifier._Bound.xMax(), modifier._Bound.yMax(), cx1, cy1);
+			for(int cy = cy0; cy <= cy1; cy++)
+			{
+				for(int cx = cx0; cx <= cx1; cx++)
+				{
+					const int cell = cy*m_GridX + cx;
+					//modifier index is kept in flagged cells, area tests need all zones overlapping a cell
+					m_Cells[cell].push_back(static_cast<unsigned int>(i));
+					if(m_ExcludedCells[cell] || modifier.Mode != CM_EXCLUDE)
+						continue;
+					const osg::BoundingBoxd cell_bb(m_OriginX + cx*m_CellSize, m_OriginY + cy*m_CellSize, 0,
+						m_OriginX + (cx + 1)*m_CellSize, m_OriginY + (cy + 1)*m_CellSize, 0);
+					//point tests in flagged cells return without testing modifiers
+					if(_containsBox(modifier, cell_bb))
+						m_ExcludedCells[cell] = true;
+				}
+			}
+		}
+	}
+
+	bool CoverageModifiers::_getCell(double x, double y, int &cx, int &cy) const
+	{
+		cx = static_cast<int>(floor((x - m_OriginX) / m_CellSize));
+		cy = static_cast<int>(floor((y - m_OriginY) / m_CellSize));
+		const bool inside = cx >= 0 && cy >= 0 && cx < m_GridX && cy < m_GridY;
+		cx = std::max(0, std::min(cx, m_GridX - 1));
+		cy = std::max(0, std::min(cy, m_GridY - 1));
+		return inside;
+	}
+
+	bool CoverageModifiers::_contains(const Modifier &modifier, double x, double y) const
+	{
+		if(x < modifier._Bound.xMin() || x > modifier._Bound.xMax() || y < modifier._Bound.yMin() || y > modifier._Bound.yMax())
+			return false;
+		const osg::Vec2d p(x, y);
+		const size_t num_points = modifier.Points.size();
+		const size_t num_segments = modifier.Closed ? num_points : num_points - 1;
+		if(modifier.Closed && InsidePolygon(modifier.Points, x, y))
+			return true;
+		if(modifier.Buffer > 0)
+		{
+			const double buffer2 = modifier.Buffer*modifier.Buffer;
+			for(size_t i = 0; i < num_segments; i++)
+			{
+				if(SegmentDistance2(p, modifier.Points[i], modifier.Points[(i + 1) % num_points]) <= buffer2)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	bool CoverageModifiers::_containsBox(const Modifier &modifier, const osg::BoundingBoxd &box) const
+	{
+		const osg::Vec2d corners[4] = {osg::Vec2d(box.xMin(), box.yMin()), osg::Vec2d(box.xMax(), box.yMin()),
+			osg::Vec2d(box.xMax(), box.yMax()), osg::Vec2d(box.xMin(), box.yMax())};
+		const size_t num_points = modifier.Points.size();
+		if(modifier.Closed)
+		{
+			//all corners inside and no polygon edge crossing box (buffer ignored, conservative)
+			for(int i = 0; i < 4; i++)
+			{
+				if(!InsidePolygon(modifier.Points, corners[i].x(), corners[i].y()))
+					return false;
+			}
+			for(size_t i = 0; i < num_points; i++)
+			{
+				const osg::Vec2d &a = modifier.Points[i];
+				const osg::Vec2d &b = modifier.Points[(i + 1) % num_points];
+				if(a.x() > box.xMin() && a.x() < box.xMax() && a.y() > box.yMin() && a.y() < box.yMax())
+					return false;
+				for(int j = 0; j < 4; j++)
+				{
+					if(SegmentsIntersect(a, b, corners[j], corners[(j + 1) % 4]))
+						return false;
+				}
+			}
+			return true;
+		}
+
+		//buffered segment is convex, box is inside if all corners are inside same segment buffer
+		const double buffer2 = modifier.Buffer*modifier.Buffer;
+		for(size_t i = 0; i + 1 < num_points; i++)
+		{
+			bool inside = true;
+			for(int j = 0; j < 4 && inside; j++)
+				inside = SegmentDistance2(corners[j], modifier.Points[i], modifier.Points[i + 1]) <= buffer2;
+			if(inside)
+				return true;
+		}
+		return false;
+	}
+
+	bool CoverageModifiers::isExcluded(double x, double y) const
+	{
+		int cx, cy;
+		if(m_Cells.empty() || !_getCell(x, y, cx, cy))
+			return false;
+		const int cell = cy*m_GridX + cx;
+		if(m_ExcludedCells[cell])
+			return true;
+		const std::vector<unsigned int> &modifiers = m_Cells[cell];
+		for(size_t i = 0; i < modifiers.size(); i++)
+		{
+			const Modifier &modifier = m_Modifiers[modifiers[i]];
+			if(modifier.Mode == CM_EXCLUDE && _contains(modifier, x, y))
+				return true;
+		}
+		return false;
+	}
+
+	bool CoverageModifiers::getIncludedMaterial(double x, double y, std::string &material_name) const
+	{
+		int cx, cy;
+		if(m_Cells.empty() || !_getCell(x, y, cx, cy))
+			return false;
+		const std::vector<unsigned int> &modifiers = m_Cells[cy*m_GridX + cx];
+		for(size_t i = 0; i < modifiers.size(); i++)
+		{
+			const Modifier &modifier = m_Modifiers[modifiers[i]];
+			if(modifier.Mode == CM_INCLUDE && _contains(modifier, x, y))
+			{
+				material_name = modifier.MaterialName;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool CoverageModifiers::isAreaExcluded(const osg::BoundingBoxd &area) const
+	{
+		if(m_Cells.empty())
+			return false;
+		int cx0, cy0, cx1, cy1;
+		if(!_getCell(area.xMin(), area.yMin(), cx0, cy0) || !_getCell(area.xMax(), area.yMax(), cx1, cy1))
+			return false;
+
+		//fast path, all covered cells are excluded
+		bool all_excluded = true;
+		for(int cy = cy0; cy <= cy1 && all_excluded; cy++)
+		{
+			for(int cx = cx0; cx <= cx1 && all_excluded; cx++)
+				all_excluded = m_ExcludedCells[cy*m_GridX + cx];
+		}
+		if(all_excluded)
+			return true;
+
+		//zone containing area must contain area center and is stored in center cell, also if cell is flagged
+		int cx, cy;
+		_getCell(area.center().x(), area.center().y(), cx, cy);
+		const std::vector<unsigned int> &modifiers = m_Cells[cy*m_GridX + cx];
+		for(size_t i = 0; i < modifiers.size(); i++)
+		{
+			const Modifier &modifier = m_Modifiers[modifiers[i]];
+			if(modifier.Mode == CM_EXCLUDE && _containsBox(modifier, area))
+				return true;
+		}
+		return false;
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Referenced>
+#include <osg/Vec2d>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Vector coverage modifiers (polygons and buffered polylines) applied on top of
+		the coverage texture by TerrainQuery. Exclusion zones (roads, runways, building footprints) reject
+		all scatter samples inside them, inclusion zones override the coverage material.
+		Modifiers are indexed by a uniform grid, each cell hold modifiers overlapping the cell
+		and cells completely inside an exclusion zone are flagged, so point tests are O(1) on average.
+		All coordinates are world xy coordinates.
+	*/
+	class osgvExport CoverageModifiers : public osg::Referenced
+	{
+	public:
+		enum ModifierMode
+		{
+			CM_EXCLUDE,
+			CM_INCLUDE
+		};
+
+		struct Modifier
+		{
+			Modifier(ModifierMode mode, const std::vector<osg::Vec2d> &points, bool closed, double buffer, const std::string &material_name) : Mode(mode),
+				Points(points),
+				Closed(closed),
+				Buffer(buffer),
+				MaterialName(material_name)
+			{
+
+			}
+			ModifierMode Mode;
+			std::vector<osg::Vec2d> Points;
+			//true for polygon, false for polyline
+			bool Closed;
+			//distance from polygon edges or polyline segments included in zone
+			double Buffer;
+			//coverage material used inside inclusion zone
+			std::string MaterialName;
+			//internal data holding xy bound (including buffer)
+			osg::BoundingBoxd _Bound;
+		};
+
+		/**
+			@param cell_size Grid cell size, 0 (default) use 1/256 of modifier extent
+		*/
+		CoverageModifiers(double cell_size = 0);
+
+		/**
+			Add polygon (at least three points, implicitly closed)
+		*/
+		void addPolygon(ModifierMode mode, const std::vector<osg::Vec2d> &points, double buffer = 0, const std::string &material_name = "");
+
+		/**
+			Add polyline (at least two points) with buffer distance on each side
+		*/
+		void addPolyline(ModifierMode mode, const std::vector<osg::Vec2d> &points, double buffer, const std::string &material_name = "");
+
+		/**
+			Build grid index, must be called after all modifiers are added
+		*/
+		void build();
+
+		/**
+			Check if point is inside any exclusion zone
+		*/
+		bool isExcluded(double x, double y) const;
+
+		/**
+			Get coverage material of first inclusion zone containing point
+			@return false if point is not inside any inclusion zone (material is then unchanged)
+		*/
+		bool getIncludedMaterial(double x, double y, std::string &material_name) const;
+
+		/**
+			Check if area (z ignored) is completely inside one exclusion zone
+		*/
+		bool isAreaExcluded(const osg::BoundingBoxd &area) const;
+
+		unsigned int getNumModifiers() const {return static_cast<unsigned int>(m_Modifiers.size());}
+		const Modifier& getModifier(unsigned int index) const {return m_Modifiers[index];}
+	private:
+		virtual ~CoverageModifiers();
+		void _addModifier(const Modifier &modifier);
+		bool _getCell(double x, double y, int &cx, int &cy) const;
+		bool _contains(const Modifier &modifier, double x, double y) const;
+		bool _containsBox(const Modifier &modifier, const osg::BoundingBoxd &box) const;
+
+		std::vector<Modifier> m_Modifiers;
+		//modifier indices overlapping each cell, also kept for excluded cells
+		std::vector<std::vector<unsigned int> > m_Cells;
+		//cells completely inside exclusion zone
+		std::vector<bool> m_ExcludedCells;
+		double m_CellSize;
+		double m_OriginX;
+		double m_OriginY;
+		int m_GridX;
+		int m_GridY;
+	};
+}
@@ -18,7 +18,11 @@ namespace osgVegetation
 			UseFog(false),
 			FogMode(osg::Fog::LINEAR),
 			ShadowMode(SM_DISABLED),
-			BaseShadowTextureUnit(6)
+			BaseShadowTextureUnit(6),
+			ReceivesShadowTraversalMask(0x1),
+			CastsShadowTraversalMask(0x2),
+			ViewFOV(30.0),
+			ViewportHeight(1080)
 		{
 
 		}
@@ -41,5 +45,24 @@ namespace osgVegetation
 		
 		*/
 		int BaseShadowTextureUnit;
+
+		/**
+		Traversal masks used by the shadowed scene (osgShadow::ShadowedScene/ShadowSettings), must be separate bits.
+		When shadows are enabled, regular vegetation tiles are excluded from the shadow pass (node mask without 
+		CastsShadowTraversalMask) and shadow casters (see BillboardData::CastShadows) only use CastsShadowTraversalMask.
+		*/
+		unsigned int ReceivesShadowTraversalMask;
+		unsigned int CastsShadowTraversalMask;
+
+		/**
+		Vertical field of view (degrees) of the target view, 
+		used to compute LOD ranges from screen space error (see BillboardData::ScreenSpaceError)
+		*/
+		double ViewFOV;
+
+		/**
+		Viewport height (pixels) of the target view, used together with ViewFOV
+		*/
+		int ViewportHeight;
 	};
 }
\ No newline at end of file
@@ -12,7 +12,19 @@ namespace osgVegetation
 	public:
 		IBillboardRenderingTech(){}
 		virtual ~IBillboardRenderingTech(){}
-		virtual osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb) = 0;
+		/**
+			Create tile geometry
+			@param trees Instances in tile
+			@param bb Bound of instances, only used for culling
+			@param fade_radius Distance where instances are faded out (TileRadius uniform), 
+			should be based on the tile region and not the instance bound
+		*/
+		virtual osg::Node* create(const BillboardVegetationObjectVector &trees, const osg::BoundingBoxd &bb, float fade_radius) = 0;
 		virtual osg::StateSet* getStateSet() const = 0;
+		/**
+			State set for shadow caster nodes (see ShadowCaster), NULL if technique
+			don't support dedicated shadow casters or shadow casting is disabled
+		*/
+		virtual osg::StateSet* getShadowCasterStateSet() const {return NULL;}
 	};
 }
\ No newline at end of file
@@ -13,5 +13,9 @@ namespace osgVegetation
 		virtual ~IMeshRenderingTech(){}
 		virtual osg::Node* create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb) = 0;
 		virtual osg::StateSet* getStateSet() const = 0;
+		/**
+			Get bounding box of mesh template (before instance transformation)
+		*/
+		virtual osg::BoundingBox getMeshBound(const std::string &mesh_name) = 0;
 	};
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include "Common.h"
 #include <osg/Referenced>
+#include <osg/BoundingBox>
 #include <osg/Vec4>
 #include "CoverageColor.h"
 
@@ -17,5 +18,12 @@ namespace osgVegetation
 			Get terrain data for provided location
 		*/
 		virtual bool getTerrainData(osg::Vec3d& location, osg::Vec4 &color, std::string &coverage_name , CoverageColor &coverage_color, osg::Vec3d &inter) = 0;
+
+		/**
+			Check if whole area (world coordinates, z ignored) is excluded from scattering,
+			used by scattering to skip tiles before any terrain data is queried.
+			Default implementation exclude nothing.
+		*/
+		virtual bool isAreaExcluded(const osg::BoundingBoxd &area) const {return false;}
 	};
 }
@@ -0,0 +1,376 @@
+#include "InstanceCache.h"
+#include <osg/Math>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace osgVegetation
+{
+	const char INSTANCE_CACHE_MAGIC[8] = {'O','S','G','V','I','N','S','T'};
+	const unsigned int INSTANCE_CACHE_VERSION = 1;
+
+	struct InstanceCacheHeader
+	{
+		char Magic[8];
+		unsigned int Version;
+		unsigned int NumLayers;
+		double BBMin[3];
+		double BBMax[3];
+	};
+
+	struct InstanceCacheLayerHeader
+	{
+		unsigned int DataSet;
+		unsigned int Layer;
+		unsigned int GridX;
+		unsigned int GridY;
+		double CellSize;
+		unsigned long long CellOffset;
+		unsigned long long RecordOffset;
+		unsigned long long NumRecords;
+	};
+
+	/**
+		Read only file mapping, mapped data is valid until object is deleted
+	*/
+	class MappedFile
+	{
+	public:
+		/**
+			Map file, return NULL on failure
+		*/
+		static MappedFile* open(const std::string &filename)
+		{
+			MappedFile* mf = new MappedFile;
+#if defined(WIN32)
+			mf->m_File = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			LARGE_INTEGER size;
+			if(mf->m_File != INVALID_HANDLE_VALUE && GetFileSizeEx(mf->m_File, &size) && size.QuadPart > 0)
+			{
+				mf->m_Size = static_cast<size_t>(size.QuadPart);
+				mf->m_Mapping = CreateFileMappingA(mf->m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+				if(mf->m_Mapping)
+					mf->m_Data = static_cast<const char*>(MapViewOfFile(mf->m_Mapping, FILE_MAP_READ, 0, 0, 0));
+			}
+#else
+			const int fd = ::open(filename.c_str(), O_RDONLY);
+			struct stat st;
+			if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+			{
+				void* data = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+				if(data != MAP_FAILED)
+				{
+					mf->m_Data = static_cast<const char*>(data);
+					mf->m_Size = static_cast<size_t>(st.st_size);
+				}
+			}
+			//mapping is kept after file is closed
+			if(fd >= 0)
+				close(fd);
+#endif
+			if(mf->m_Data == NULL)
+			{
+				delete mf;
+				return NULL;
+			}
+			return mf;
+		}
+
+		~MappedFile()
+		{
+#if defined(WIN32)
+			if(m_Data)
+				UnmapViewOfFile(m_Data);
+			if(m_Mapping)
+				CloseHandle(m_Mapping);
+			if(m_File != INVALID_HANDLE_VALUE)
+				CloseHandle(m_File);
+#else
+			if(m_Data)
+				munmap(const_cast<char*>(m_Data), m_Size);
+#endif
+		}
+
+		const char* getData() const {return m_Data;}
+		size_t getSize() const {return m_Size;}
+	private:
+		MappedFile() : m_Data(NULL), m_Size(0)
+#if defined(WIN32)
+			, m_File(INVALID_HANDLE_VALUE), m_Mapping(NULL)
+#endif
+		{
+
+		}
+		const char* m_Data;
+		size_t m_Size;
+#if defined(WIN32)
+		HANDLE m_File;
+		HANDLE m_Mapping;
+#endif
+	};
+
+	InstanceCache::InstanceCache(const osg::BoundingBoxd &bb) : m_BoundingBox(bb),
+		m_MappedFile(NULL)
+	{
+
+	}
+
+	InstanceCache::~InstanceCache()
+	{
+		delete m_MappedFile;
+	}
+
+	void InstanceCache::addLayer(unsigned int data_set, unsigned int layer, double cell_size)
+	{
+		Layer &cache_layer = m_Layers[LayerKey(data_set, layer)];
+		const double size_x = m_BoundingBox.xMax() - m_BoundingBox.xMin();
+		const double size_y = m_BoundingBox.yMax() - m_BoundingBox.yMin();
+		if(cell_size <= 0)
+			cell_size = std::max(size_x, size_y);
+		cache_layer.CellSize = cell_size;
+		cache_layer.GridX = std::max(1u, static_cast<unsigned int>(ceil(size_x / cell_size)));
+		cache_layer.GridY = std::max(1u, static_cast<unsigned int>(ceil(size_y / cell_size)));
+		cache_layer.Indexed = false;
+	}
+
+	void InstanceCache::addInstance(unsigned int data_set, unsigned int layer, const InstanceRecord &record)
+	{
+		LayerMap::iterator iter = m_Layers.find(LayerKey(data_set, layer));
+		if(iter == m_Layers.end())
+			OSGV_EXCEPT(std::string("InstanceCache::addInstance - layer not added").c_str());
+		_copyMappedLayer(iter->second);
+		iter->second.Records.push_back(record);
+		iter->second.Indexed = false;
+	}
+
+	unsigned int InstanceCache::_getCell(const Layer &layer, double x, double y) const
+	{
+		const int cx = static_cast<int>(floor((x - m_BoundingBox.xMin()) / layer.CellSize));
+		const int cy = static_cast<int>(floor((y - m_BoundingBox.yMin()) / layer.CellSize));
+		const unsigned int ucx = static_cast<unsigned int>(osg::clampBetween(cx, 0, static_cast<int>(layer.GridX) - 1));
+		const unsigned int ucy = static_cast<unsigned int>(osg::clampBetween(cy, 0, static_cast<int>(layer.GridY) - 1));
+		return ucy*layer.GridX + ucx;
+	}
+
+	void InstanceCache::_copyMappedLayer(Layer &layer) const
+	{
+		if(!layer.isMapped())
+			return;
+		layer.CellStart.assign(layer.MappedCellStart, layer.MappedCellStart + layer.GridX*layer.GridY + 1);
+		layer.Records.assign(layer.MappedRecords, layer.MappedRecords + layer.NumMappedRecords);
+		layer.MappedCellStart = NULL;
+		layer.MappedRecords = NULL;
+		layer.NumMappedRecords = 0;
+	}
+
+	void InstanceCache::_buildIndex(Layer &layer) const
+	{
+		//mapped layers are always indexed
+		if(layer.Indexed)
+			return;
+		//counting sort of records by cell
+		const size_t num_cells = layer.GridX*layer.GridY;
+		std::vector<unsigned int> record_cells(layer.Records.size());
+		layer.CellStart.assign(num_cells + 1, 0);
+		for(size_t i = 0; i < layer.Records.size(); i++)
+		{
+			record_cells[i] = _getCell(layer, layer.Records[i].Position[0], layer.Records[i].Position[1]);
+			layer.CellStart[record_cells[i] + 1]++;
+		}
+		for(size_t i = 0; i < num_cells; i++)
+			layer.CellStart[i + 1] += layer.CellStart[i];
+
+		std::vector<unsigned long long> insert_pos(layer.CellStart.begin(), layer.CellStart.end() - 1);
+		std::vector<InstanceRecord> sorted(layer.Records.size());
+		for(size_t i = 0; i < layer.Records.size(); i++)
+			sorted[insert_pos[record_cells[i]]++] = layer.Records[i];
+		layer.Records.swap(sorted);
+		layer.Indexed = true;
+	}
+
+	void InstanceCache::getInstances(unsigned int data_set, unsigned int layer, const osg::BoundingBoxd &bb, std::vector<const InstanceRecord*> &instances) const
+	{
+		LayerMap::iterator iter = m_Layers.find(LayerKey(data_set, layer));
+		if(iter == m_Layers.end())
+			return;
+		Layer &cache_layer = iter->second;
+		_buildIndex(cache_layer);
+		const unsigned long long* cell_start = cache_layer.getCellStart();
+		const InstanceRecord* records = cache_layer.getRecords();
+
+		const unsigned int min_cell = _getCell(cache_layer, bb.xMin(), bb.yMin());
+		const unsigned int max_cell = _getCell(cache_layer, bb.xMax(), bb.yMax());
+		const unsigned int min_x = min_cell % cache_layer.GridX, min_y = min_cell / cache_layer.GridX;
+		const unsigned int max_x = max_cell % cache_layer.GridX, max_y = max_cell / cache_layer.GridX;
+		const bool include_max_x = bb.xMax() >= m_BoundingBox.xMax();
+		const bool include_max_y = bb.yMax() >= m_BoundingBox.yMax();
+		for(unsigned int cy = min_y; cy <= max_y; cy++)
+		{
+			for(unsigned int cx = min_x; cx <= max_x; cx++)
+			{
+				const unsigned int cell = cy*cache_layer.GridX + cx;
+				for(unsigned long long i = cell_start[cell]; i < cell_start[cell + 1]; i++)
+				{
+					const InstanceRecord &record = records[i];
+					const double x = record.Position[0];
+					const double y = record.Position[1];
+					if(x < bb.xMin() || y < bb.yMin())
+						continue;
+					if((x < bb.xMax() || (include_max_x && x == bb.xMax())) &&
+						(y < bb.yMax() || (include_max_y && y == bb.yMax())))
+						instances.push_back(&record);
+				}
+			}
+		}
+	}
+
+	bool InstanceCache::hasLayer(unsigned int data_set, unsigned int layer) const
+	{
+		return m_Layers.find(LayerKey(data_set, layer)) != m_Layers.end();
+	}
+
+	unsigned int InstanceCache::getNumLayers(unsigned int data_set) const
+	{
+		unsigned int num_layers = 0;
+		for(LayerMap::const_iterator iter = m_Layers.begin(); iter != m_Layers.end(); ++iter)
+		{
+			if(iter->first.first == data_set)
+				num_layers++;
+		}
+		return num_layers;
+	}
+
+	size_t InstanceCache::getNumInstances() const
+	{
+		size_t num_instances = 0;
+		for(LayerMap::const_iterator iter = m_Layers.begin(); iter != m_Layers.end(); ++iter)
+			num_instances += iter->second.getNumRecords();
+		return num_instances;
+	}
+
+	void InstanceCache::write(const std::string &filename)
+	{
+		//file may be the mapped file, layers must be in memory before it is truncated
+		if(m_MappedFile)
+		{
+			for(LayerMap::iterator iter = m_Layers.begin(); iter != m_Layers.end(); ++iter)
+				_copyMappedLayer(iter->second);
+			delete m_MappedFile;
+			m_MappedFile = NULL;
+		}
+
+		InstanceCacheHeader header;
+		memcpy(header.Magic, INSTANCE_CACHE_MAGIC, sizeof(header.Magic));
+		header.Version = INSTANCE_CACHE_VERSION;
+		header.NumLayers = static_cast<unsigned int>(m_Layers.size());
+		for(int i = 0; i < 3; i++)
+		{
+			header.BBMin[i] = m_BoundingBox._min[i];
+			header.BBMax[i] = m_BoundingBox._max[i];
+		}
+
+		//layer data follow all headers
+		std::vector<InstanceCacheLayerHeader> layer_headers;
+		unsigned long long offset = sizeof(InstanceCacheHeader) + m_Layers.size()*sizeof(InstanceCacheLayerHeader);
+		for(LayerMap::iterator iter = m_Layers.begin(); iter != m_Layers.end(); ++iter)
+		{
+			Layer &layer = iter->second;
+			_buildIndex(layer);
+			InstanceCacheLayerHeader layer_header;
+			layer_header.DataSet = iter->first.first;
+			layer_header.Layer = iter->first.second;
+			layer_header.GridX = layer.GridX;
+			layer_header.GridY = layer.GridY;
+			layer_header.CellSize = layer.CellSize;
+			layer_header.CellOffset = offset;
+			offset += (layer.GridX*layer.GridY + 1)*sizeof(unsigned long long);
+			layer_header.RecordOffset = offset;
+			layer_header.NumRecords = layer.getNumRecords();
+			offset += layer.getNumRecords()*sizeof(InstanceRecord);
+			layer_headers.push_back(layer_header);
+		}
+
+		std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+		if(!file.is_open())
+			OSGV_EXCEPT(std::string("InstanceCache::write - failed to open file:" + filename).c_str());
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if(layer_headers.size() > 0)
+			file.write(reinterpret_cast<const char*>(&layer_headers[0]), layer_headers.size()*sizeof(InstanceCacheLayerHeader));
+		for(LayerMap::const_iterator iter = m_Layers.begin(); iter != m_Layers.end(); ++iter)
+		{
+			const Layer &layer = iter->second;
+			file.write(reinterpret_cast<const char*>(layer.getCellStart()), (layer.GridX*layer.GridY + 1)*sizeof(unsigned long long));
+			if(layer.getNumRecords() > 0)
+				file.write(reinterpret_cast<const char*>(layer.getRecords()), layer.getNumRecords()*sizeof(InstanceRecord));
+		}
+		if(!file.good())
+			OSGV_EXCEPT(std::string("InstanceCache::write - failed to write file:" + filename).c_str());
+	}
+
+	InstanceCache* InstanceCache::read(const std::string &filename, bool use_mapping)
+	{
+		MappedFile* mapped_file = use_mapping ? MappedFile::open(filename) : NULL;
+		std::vector<char> file_data;
+		if(mapped_file == NULL)
+		{
+			std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+			if(!file.is_open())
+				OSGV_EXCEPT(std::string("InstanceCache::read - failed to open file:" + filename).c_str());
+			file_data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+		//cache take ownership of mapping, released on failure
+		osg::ref_ptr<InstanceCache> cache = new InstanceCache(osg::BoundingBoxd());
+		cache->m_MappedFile = mapped_file;
+		const char* data = mapped_file ? mapped_file->getData() : (file_data.empty() ? NULL : &file_data[0]);
+		const size_t data_size = mapped_file ? mapped_file->getSize() : file_data.size();
+
+		InstanceCacheHeader header;
+		if(data_size < sizeof(header))
+			OSGV_EXCEPT(std::string("InstanceCache::read - file too small:" + filename).c_str());
+		memcpy(&header, data, sizeof(header));
+		if(memcmp(header.Magic, INSTANCE_CACHE_MAGIC, sizeof(header.Magic)) != 0 || header.Version != INSTANCE_CACHE_VERSION)
+			OSGV_EXCEPT(std::string("InstanceCache::read - not a instance cache file or unsupported version:" + filename).c_str());
+		if(data_size < sizeof(header) + header.NumLayers*sizeof(InstanceCacheLayerHeader))
+			OSGV_EXCEPT(std::string("InstanceCache::read - corrupt file:" + filename).c_str());
+
+		cache->m_BoundingBox.set(header.BBMin[0], header.BBMin[1], header.BBMin[2], header.BBMax[0], header.BBMax[1], header.BBMax[2]);
+		for(unsigned int i = 0; i < header.NumLayers; i++)
+		{
+			InstanceCacheLayerHeader layer_header;
+			memcpy(&layer_header, data + sizeof(header) + i*sizeof(InstanceCacheLayerHeader), sizeof(layer_header));
+			const unsigned long long num_cells = static_cast<unsigned long long>(layer_header.GridX)*layer_header.GridY;
+			if(num_cells == 0 ||
+				layer_header.CellOffset % sizeof(unsigned long long) != 0 || layer_header.RecordOffset % sizeof(unsigned long long) != 0 ||
+				layer_header.CellOffset + (num_cells + 1)*sizeof(unsigned long long) > data_size ||
+				layer_header.RecordOffset + layer_header.NumRecords*sizeof(InstanceRecord) > data_size)
+				OSGV_EXCEPT(std::string("InstanceCache::read - corrupt file:" + filename).c_str());
+
+			Layer &layer = cache->m_Layers[LayerKey(layer_header.DataSet, layer_header.Layer)];
+			layer.GridX = layer_header.GridX;
+			layer.GridY = layer_header.GridY;
+			layer.CellSize = layer_header.CellSize;
+			layer.Indexed = true;
+			const unsigned long long* cell_start = reinterpret_cast<const unsigned long long*>(data + layer_header.CellOffset);
+			if(cell_start[num_cells] != layer_header.NumRecords)
+				OSGV_EXCEPT(std::string("InstanceCache::read - corrupt file:" + filename).c_str());
+			//offsets are 8 byte aligned, mapped data can be used directly
+			layer.MappedCellStart = cell_start;
+			layer.MappedRecords = reinterpret_cast<const InstanceRecord*>(data + layer_header.RecordOffset);
+			layer.NumMappedRecords = static_cast<size_t>(layer_header.NumRecords);
+			if(mapped_file == NULL)
+				cache->_copyMappedLayer(layer);
+		}
+		return cache.release();
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	class MappedFile;
+
+	/**
+		Raw scatter result for one instance. Only terrain dependent and random values are stored,
+		appearance settings (texture, color ratio, technique etc.) are applied when the scene graph is built.
+		Fixed size (56 bytes) so records can be stored and used directly as file data.
+	*/
+	struct InstanceRecord
+	{
+		InstanceRecord() : Width(0), Height(0), ColorIntensity(1), Reserved(0)
+		{
+			Position[0] = Position[1] = Position[2] = 0;
+			TerrainColor[0] = TerrainColor[1] = TerrainColor[2] = TerrainColor[3] = 1;
+		}
+		//world position (terrain intersection)
+		double Position[3];
+		float Width;
+		float Height;
+		//terrain color under instance
+		float TerrainColor[4];
+		//random color intensity
+		float ColorIntensity;
+		unsigned int Reserved;
+	};
+
+	/**
+		Instance cache holding scatter results for all layers in all data sets, used to separate the
+		scatter step (terrain queries) from scene graph generation. Instances of each layer are spatially
+		indexed by a uniform grid so that quad tree tiles can be populated without visiting all instances.
+
+		File layout (native byte order, all offsets in bytes from file start and 8 byte aligned):
+			Header (magic "OSGVINST", version, number of layers, area bounding box)
+			LayerHeader for each layer (data set index, layer index, grid size, cell size, offsets)
+			Per layer: cell start table (GridX*GridY+1 uint64 record indices) followed by records sorted by cell
+
+		Files are memory mapped when read (mmap or MapViewOfFile), cell tables and records are used
+		directly from the mapping and only the pages touched by queries are loaded. If mapping fails
+		the file is read to memory in one pass. Adding instances to a mapped layer copy the layer to memory.
+	*/
+	class osgvExport InstanceCache : public osg::Referenced
+	{
+	public:
+		/**
+			@param bb Scatter area in world coordinates
+		*/
+		InstanceCache(const osg::BoundingBoxd &bb);
+
+		/**
+			Add layer to cache, must be called before adding instances to layer.
+			@param data_set Data set index
+			@param layer Layer index, order of layers in configuration (see BillboardLayer::_LayerIndex)
+			@param cell_size Spatial index cell size, should be close to the layer tile size
+		*/
+		void addLayer(unsigned int data_set, unsigned int layer, double cell_size);
+
+		void addInstance(unsigned int data_set, unsigned int layer, const InstanceRecord &record);
+
+		/**
+			Get instances of layer inside bounding box (world coordinates).
+			Min edges are inclusive and max edges exclusive (except at area max edge)
+			so that instances on shared tile edges only end up in one tile.
+		*/
+		void getInstances(unsigned int data_set, unsigned int layer, const osg::BoundingBoxd &bb, std::vector<const InstanceRecord*> &instances) const;
+
+		/**
+			Check if cache hold layer
+		*/
+		bool hasLayer(unsigned int data_set, unsigned int layer) const;
+
+		/**
+			Get number of layers stored for data set
+		*/
+		unsigned int getNumLayers(unsigned int data_set) const;
+
+		size_t getNumInstances() const;
+		const osg::BoundingBoxd& getBoundingBox() const {return m_BoundingBox;}
+
+		/**
+			Write cache to file, throw on failure
+		*/
+		void write(const std::string &filename);
+
+		/**
+			Read cache from file, throw on failure
+			@param use_mapping Memory map file, fallback to reading file to memory if mapping fails
+		*/
+		static InstanceCache* read(const std::string &filename, bool use_mapping = true);
+
+		/**
+			Check if layers are used directly from memory mapped file
+		*/
+		bool isMapped() const {return m_MappedFile != NULL;}
+	private:
+		struct Layer
+		{
+			Layer() : GridX(1), GridY(1), CellSize(1), Indexed(false), MappedCellStart(NULL), MappedRecords(NULL), NumMappedRecords(0) {}
+			unsigned int GridX;
+			unsigned int GridY;
+			double CellSize;
+			//record index where each cell start, size GridX*GridY+1
+			std::vector<unsigned long long> CellStart;
+			std::vector<InstanceRecord> Records;
+			bool Indexed;
+			//layer data in mapped file, vectors are empty while mapped
+			const unsigned long long* MappedCellStart;
+			const InstanceRecord* MappedRecords;
+			size_t NumMappedRecords;
+
+			bool isMapped() const {return MappedCellStart != NULL;}
+			const unsigned long long* getCellStart() const {return isMapped() ? MappedCellStart : &CellStart[0];}
+			const InstanceRecord* getRecords() const {return isMapped() ? MappedRecords : (Records.empty() ? NULL : &Records[0]);}
+			size_t getNumRecords() const {return isMapped() ? NumMappedRecords : Records.size();}
+		};
+		typedef std::pair<unsigned int, unsigned int> LayerKey;
+		typedef std::map<LayerKey, Layer> LayerMap;
+
+		virtual ~InstanceCache();
+		void _buildIndex(Layer &layer) const;
+		void _copyMappedLayer(Layer &layer) const;
+		unsigned int _getCell(const Layer &layer, double x, double y) const;
+
+		osg::BoundingBoxd m_BoundingBox;
+		//mutable, spatial index is built on first query
+		mutable LayerMap m_Layers;
+		//file mapping used by mapped layers, NULL if not mapped
+		MappedFile* m_MappedFile;
+	};
+}
@@ -0,0 +1,172 @@
+#include "InstanceExtractor.h"
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Transform>
+#include <osg/TextureBuffer>
+#include <osg/NodeVisitor>
+
+namespace osgVegetation
+{
+	/**
+		Compute bound from template vertices, drawable bounds can't be used
+		because instanced drawables return the tile bound.
+	*/
+	class TemplateBoundVisitor : public osg::NodeVisitor
+	{
+	public:
+		TemplateBoundVisitor()
+		{
+			setTraversalMode(TRAVERSE_ALL_CHILDREN);
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::Transform& transform)
+		{
+			osg::Matrixd matrix = m_Matrices.empty() ? osg::Matrixd() : m_Matrices.back();
+			transform.computeLocalToWorldMatrix(matrix, this);
+			m_Matrices.push_back(matrix);
+			traverse(transform);
+			m_Matrices.pop_back();
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+			{
+				const osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+				const osg::Vec3Array* vertices = geom ? dynamic_cast<const osg::Vec3Array*>(geom->getVertexArray()) : NULL;
+				if(vertices == NULL)
+					continue;
+				for(size_t j = 0; j < vertices->size(); j++)
+				{
+					if(m_Matrices.empty())
+						m_BB.expandBy((*vertices)[j]);
+					else
+						m_BB.expandBy((*vertices)[j] * m_Matrices.back());
+				}
+			}
+		}
+		osg::BoundingBox m_BB;
+	private:
+		std::vector<osg::Matrixd> m_Matrices;
+	};
+
+	const osg::Image* InstanceExtractor::_getDataBufferImage(const osg::StateSet* state_set, const std::string &uniform_name)
+	{
+		//data buffer is always bound to texture unit 1
+		if(state_set == NULL || state_set->getUniform(uniform_name) == NULL)
+			return NULL;
+		const osg::TextureBuffer* tbo = dynamic_cast<const osg::TextureBuffer*>(state_set->getTextureAttribute(1, osg::StateAttribute::TEXTURE));
+		if(tbo == NULL)
+			return NULL;
+		return tbo->getImage();
+	}
+
+	osg::BoundingBox InstanceExtractor::_getTemplateBound(const osg::Node* node)
+	{
+		TemplateBoundVisitor tbv;
+		const_cast<osg::Node*>(node)->accept(tbv);
+		return tbv.m_BB;
+	}
+
+	unsigned int InstanceExtractor::getNumBillboards(const osg::Drawable* drawable)
+	{
+		const osg::StateSet* state_set = drawable->getStateSet();
+		if(state_set == NULL || state_set->getUniform("TileRadius") == NULL)
+			return 0;
+		const osg::Image* image = _getDataBufferImage(state_set, "DataBufferTexture");
+		if(image)
+			return image->s() / 3;
+		const osg::Geometry* geom = drawable->asGeometry();
+		if(geom && geom->getVertexArray())
+			return geom->getVertexArray()->getNumElements() / 3;
+		return 0;
+	}
+
+	unsigned int InstanceExtractor::getNumMeshes(const osg::Node* node)
+	{
+		const osg::Image* image = _getDataBufferImage(node->getStateSet(), "dataBuffer");
+		return image ? image->s() / 4 : 0;
+	}
+
+	bool InstanceExtractor::extractBillboards(const osg::Drawable* drawable, ExtractedInstanceVector &instances)
+	{
+		//all billboard tiles has tile radius uniform
+		const osg::StateSet* state_set = drawable->getStateSet();
+		if(state_set == NULL || state_set->getUniform("TileRadius") == NULL)
+			return false;
+
+		const osg::Image* image = _getDataBufferImage(state_set, "DataBufferTexture");
+		if(image)
+		{
+			//shader instancing, three vec4 per instance (position, color, [width, height, texture index])
+			const unsigned int num_instances = image->s() / 3;
+			for(unsigned int i = 0; i < num_instances; i++)
+			{
+				const osg::Vec4f* ptr = (const osg::Vec4f*) image->data(3 * i);
+				ExtractedInstance instance;
+				instance.Position.set(ptr[0].x(), ptr[0].y(), ptr[0].z());
+				instance.Width = ptr[2].x();
+				instance.Height = ptr[2].y();
+				instance.TextureIndex = static_cast<int>(ptr[2].z());
+				instance.Bound.expandBy(instance.Position);
+				instance.Bound.expandBy(instance.Position + osg::Vec3d(0, 0, instance.Height));
+				instances.push_back(instance);
+			}
+			return true;
+		}
+
+		//geometry shader, vertex triples per instance (position, [width, height, texture index], color)
+		const osg::Geometry* geom = drawable->asGeometry();
+		const osg::Vec3Array* vertices = geom ? dynamic_cast<const osg::Vec3Array*>(geom->getVertexArray()) : NULL;
+		if(vertices == NULL)
+			return false;
+		for(size_t i = 0; i + 2 < vertices->size(); i += 3)
+		{
+			ExtractedInstance instance;
+			instance.Position = (*vertices)[i];
+			instance.Width = (*vertices)[i + 1].x();
+			instance.Height = (*vertices)[i + 1].y();
+			instance.TextureIndex = static_cast<int>((*vertices)[i + 1].z());
+			instance.Bound.expandBy(instance.Position);
+			instance.Bound.expandBy(instance.Position + osg::Vec3d(0, 0, instance.Height));
+			instances.push_back(instance);
+		}
+		return true;
+	}
+
+	bool InstanceExtractor::extractMeshes(const osg::Node* node, ExtractedInstanceVector &instances)
+	{
+		const osg::Image* image = _getDataBufferImage(node->getStateSet(), "dataBuffer");
+		if(image == NULL)
+			return false;
+
+		const osg::BoundingBox template_bb = _getTemplateBound(node);
+
+		//four vec4 per instance, rotation/scale part of instance matrix in xyz and translation in last vec4
+		const unsigned int num_instances = image->s() / 4;
+		for(unsigned int i = 0; i < num_instances; i++)
+		{
+			const osg::Vec4f* ptr = (const osg::Vec4f*) image->data(4 * i);
+			const osg::Matrixd mat(ptr[0].x(), ptr[0].y(), ptr[0].z(), 0,
+				ptr[1].x(), ptr[1].y(), ptr[1].z(), 0,
+				ptr[2].x(), ptr[2].y(), ptr[2].z(), 0,
+				ptr[3].x(), ptr[3].y(), ptr[3].z(), 1);
+
+			ExtractedInstance instance;
+			instance.Position.set(ptr[3].x(), ptr[3].y(), ptr[3].z());
+			//instances are only rotated around z-axis, see MeshQuadTreeScattering
+			instance.Width = osg::Vec3f(ptr[0].x(), ptr[0].y(), ptr[0].z()).length();
+			instance.Height = osg::Vec3f(ptr[2].x(), ptr[2].y(), ptr[2].z()).length();
+			if(template_bb.valid())
+			{
+				for(unsigned int j = 0; j < 8; j++)
+					instance.Bound.expandBy(osg::Vec3d(template_bb.corner(j)) * mat);
+			}
+			else
+				instance.Bound.expandBy(instance.Position);
+			instances.push_back(instance);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Drawable>
+#include <osg/Node>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Vegetation instance decoded from generated scene graph
+	*/
+	struct ExtractedInstance
+	{
+		ExtractedInstance() : Width(0), Height(0), TextureIndex(-1) {}
+		osg::Vec3d Position;
+		float Width;
+		float Height;
+		//billboard texture index (layer), -1 for mesh instances
+		int TextureIndex;
+		/**
+			Bound of instance. Mesh instances use the transformed mesh template bound,
+			billboard instances use the instance axis (position to position + height)
+			because quad extent depend on billboard type not stored in the tile.
+		*/
+		osg::BoundingBoxd Bound;
+	};
+
+	typedef std::vector<ExtractedInstance> ExtractedInstanceVector;
+
+	/**
+		Helper class that decode instance data from tiles created by
+		the rendering techniques, used by tools to inspect generated vegetation.
+	*/
+	class osgvExport InstanceExtractor
+	{
+	public:
+		/**
+			Decode billboard instances from drawable created by BRTShaderInstancing or BRTGeometryShader.
+			@return false if drawable hold no billboard instance data
+		*/
+		static bool extractBillboards(const osg::Drawable* drawable, ExtractedInstanceVector &instances);
+
+		/**
+			Decode mesh instances from node created by MRTShaderInstancing.
+			@return false if node hold no mesh instance data
+		*/
+		static bool extractMeshes(const osg::Node* node, ExtractedInstanceVector &instances);
+
+		/**
+			Get number of billboard instances in drawable without decoding them, 0 if none
+		*/
+		static unsigned int getNumBillboards(const osg::Drawable* drawable);
+
+		/**
+			Get number of mesh instances in node without decoding them, 0 if none
+		*/
+		static unsigned int getNumMeshes(const osg::Node* node);
+	private:
+		static const osg::Image* _getDataBufferImage(const osg::StateSet* state_set, const std::string &uniform_name);
+		static osg::BoundingBox _getTemplateBound(const osg::Node* node);
+	};
+}
@@ -12,17 +12,15 @@
 #include <osg/Image>
 #include <osg/Texture2DArray>
 #include <osg/Multisample>
+#include <osg/ComputeBoundsVisitor>
 #include <osgDB/ReadFile>
+#include "VegetationUtils.h"
+#include "MeshTemplateUtils.h"
+#include "ProgramCache.h"
+#include "ShaderLibrary.h"
 
 namespace osgVegetation
 {
-	struct StaticBoundingBox : public osg::Drawable::ComputeBoundingBoxCallback
-	{
-		osg::BoundingBox _bbox;
-		StaticBoundingBox( const osg::BoundingBoxd& bbox ) : _bbox(osg::BoundingBox(bbox._min, bbox._max)) { }
-		osg::BoundingBox computeBound(const osg::Drawable&) const { return _bbox; }
-	};
-
 	class ConvertToDrawInstanced : public osg::NodeVisitor
 	{
 	public:
@@ -55,8 +53,8 @@ namespace osgVegetation
 						geom->setUseVertexBufferObjects( true );
 					}
 
-					//geom->setComputeBoundingBoxCallback(  new StaticBoundingBox(_bb));
-					//geom->setComputeBoundingBoxCallback(NULL);
+					//template vertices don't reflect instance positions, use tile bound only
+					geom->setComputeBoundingBoxCallback(_staticBBoxCallback.get());
 					geom->setInitialBound(osg::BoundingBox(_bb._min, _bb._max));
 					//geom->dirtyBound();
 
@@ -120,9 +118,13 @@ namespace osgVegetation
 			for(size_t j = 0; j < data.Layers[i].MeshLODs.size(); j++)
 			{
 				const std::string mesh_name = data.Layers[i].MeshLODs[j].MeshName;
+				if(m_MeshNodeMap.find(mesh_name) != m_MeshNodeMap.end())
+					continue;
 				osg::ref_ptr<osg::Node> mesh = osgDB::readNodeFile(mesh_name);
 				if(!mesh.valid())
 					OSGV_EXCEPT(std::string("MRTShaderInstancing::_createStateSet - Failed to load mesh:" + mesh_name).c_str());
+				if(data.OptimizeMeshTemplates)
+					mesh = MeshTemplateUtils::optimize(mesh.get(), mesh_name);
 				m_MeshNodeMap[mesh_name] = mesh;
 			}
 		}
@@ -137,114 +139,24 @@ namespace osgVegetation
 		shadowTextureUnit->set(env_settings.BaseShadowTextureUnit);
 		dstate->addUniform(shadowTextureUnit);
 
-		{
-			osg::Program* program = new osg::Program;
-			dstate->setAttribute(program);
-
-			std::stringstream vertexShaderSource;
-			vertexShaderSource <<
-				"#extension GL_ARB_uniform_buffer_object : enable\n"
-				"uniform samplerBuffer dataBuffer;\n"
-				"varying vec2 TexCoord;\n"
-				"varying vec4 Color;\n"
-				"varying vec3 Normal;\n"
-				"void DynamicShadow( in vec4 ecPosition )                               \n"
-				"{                                                                      \n"
-				"    // generate coords for shadow mapping                              \n"
-				"    gl_TexCoord[2].s = dot( ecPosition, gl_EyePlaneS[2] );             \n"
-				"    gl_TexCoord[2].t = dot( ecPosition, gl_EyePlaneT[2] );             \n"
-				"    gl_TexCoord[2].p = dot( ecPosition, gl_EyePlaneR[2] );             \n"
-				"    gl_TexCoord[2].q = dot( ecPosition, gl_EyePlaneQ[2] );             \n"
-				"    gl_TexCoord[3].s = dot( ecPosition, gl_EyePlaneS[3] );             \n"
-				"    gl_TexCoord[3].t = dot( ecPosition, gl_EyePlaneT[3] );             \n"
-				"    gl_TexCoord[3].p = dot( ecPosition, gl_EyePlaneR[3] );             \n"
-				"    gl_TexCoord[3].q = dot( ecPosition, gl_EyePlaneQ[3] );             \n"
-				"} \n"
-
-
-				"void main()\n"
-				"{\n"
-				"   int instanceAddress = gl_InstanceID * 4;\n"
-				"   vec4 v1 = texelFetch(dataBuffer, instanceAddress);\n"
-				"   vec4 v2 = texelFetch(dataBuffer, instanceAddress + 1);\n"
-				"   vec4 v3 = texelFetch(dataBuffer, instanceAddress + 2);\n"
-				"   vec4 v4 = texelFetch(dataBuffer, instanceAddress + 3);\n"
-				"   mat4 modelView =  gl_ModelViewMatrix*\n"
-				"        mat4( v1.x, v1.y, v1.z, 0.0,\n"
-				"              v2.x, v2.y, v2.z, 0.0,\n"
-				"              v3.x, v3.y, v3.z, 0.0,\n"
-				"              v4.x, v4.y, v4.z, 1.0);\n"
-				"   vec4 mv_pos = modelView * gl_Vertex;\n"
-				"   mat4 mvpMatrix =  gl_ProjectionMatrix * modelView;\n";
-			if (env_settings.ShadowMode != SM_DISABLED)
-				vertexShaderSource << "   DynamicShadow(mv_pos);\n";
-			vertexShaderSource << "   Color = vec4(v1.w, v2.w, v3.w, v4.w);\n"
-				"   gl_Position = mvpMatrix * vec4(gl_Vertex.xyz,1.0) ;\n"
-				"   Normal = normalize(gl_NormalMatrix * gl_Normal);\n"
-				//"   vec3 lightDir = normalize(gl_LightSource[0].position.xyz);\n"
-				//"   float NdotL = max(dot(normal, lightDir), 0.0);\n"
-				//"   Color.xyz = NdotL*Color.xyz*gl_LightSource[0].diffuse.xyz*gl_FrontMaterial.diffuse.xyz + gl_LightSource[0].ambient.xyz*Color.xyz*gl_FrontMaterial.ambient.xyz;\n"
-				"   TexCoord = gl_MultiTexCoord0.st;\n"
-				"}\n";
-			std::stringstream fragmentShaderSource;
-			
-			fragmentShaderSource <<
-				"uniform sampler2D baseTexture; \n";
-			if (env_settings.ShadowMode == SM_VDSM1 || env_settings.ShadowMode == SM_VDSM2)
-			{
-				fragmentShaderSource << "uniform sampler2DShadow shadowTexture0;\n"
-					"uniform int shadowTextureUnit0;\n";
-			}
-			if (env_settings.ShadowMode == SM_VDSM2)
-			{
-				fragmentShaderSource << "uniform sampler2DShadow shadowTexture1;\n"
-					"uniform int shadowTextureUnit1;\n";
-			}
-			fragmentShaderSource << "varying  vec2 TexCoord;\n"
-				"varying  vec4 Color;\n"
-				"varying  vec3 Normal; \n"
-				"void main(void) \n"
-				"{\n"
-				"    vec4 finalColor = texture2D( baseTexture, TexCoord); \n"
-				"    finalColor.xyz *= Color.xyz; \n"
-				"    float depth = gl_FragCoord.z / gl_FragCoord.w;\n"
-				"    vec3 lightDir = normalize(gl_LightSource[0].position.xyz);\n"
-				"    vec3 normal = normalize(Normal);\n"
-				"    float NdotL = max(dot(normal, lightDir), 0);\n";
-			if (env_settings.ShadowMode == SM_VDSM1 || env_settings.ShadowMode == SM_VDSM2)
-			{
-				fragmentShaderSource << "    float shadow0 = shadow2DProj( shadowTexture0, gl_TexCoord[shadowTextureUnit0] ).r;\n"
-				"    NdotL *= shadow0;\n";
-			}
-			if (env_settings.ShadowMode == SM_VDSM2)
-			{
-				fragmentShaderSource << "    float shadow1 = shadow2DProj( shadowTexture1, gl_TexCoord[shadowTextureUnit1] ).r;   \n"
-					"    NdotL *= shadow1;\n";
-			}
-			fragmentShaderSource << 
-				"    finalColor.xyz *= (NdotL * gl_LightSource[0].diffuse.xyz*gl_FrontMaterial.diffuse.xyz + gl_LightSource[0].ambient.xyz*gl_FrontMaterial.ambient.xyz);\n"
-				"    gl_FragColor = finalColor;\n"
-				"}\n";
-			
-			osg::Shader* vertex_shader = new osg::Shader(osg::Shader::VERTEX, vertexShaderSource.str());
-			program->addShader(vertex_shader);
-
-			osg::Shader* fragment_shader = new osg::Shader(osg::Shader::FRAGMENT, fragmentShaderSource.str());
-			program->addShader(fragment_shader);
-
-			osg::Uniform* baseTextureSampler = new osg::Uniform("baseTexture",0);
-			dstate->addUniform(baseTextureSampler);
-
-
-			if (data.UseMultiSample)
-			{ 
-				dstate->setMode(GL_SAMPLE_ALPHA_TO_COVERAGE_ARB, 1);
-				dstate->setAttributeAndModes(new osg::BlendFunc(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO), osg::StateAttribute::OVERRIDE);
-				dstate->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
-			}
-			return dstate;
+		const ShaderDefines defines = ShaderLibrary::getMeshDefines(env_settings);
+		const std::string program_key = ShaderLibrary::getProgramKey("MRTShaderInstancing", defines);
+		osg::Program* program = ProgramCache::instance()->getProgram(program_key);
+		if (program == NULL)
+			program = ProgramCache::instance()->addProgram(program_key, ShaderLibrary::createProgram("MRTShaderInstancing", "mrt_vertex.glsl", "", "mrt_fragment.glsl", defines));
+		dstate->setAttribute(program);
+		ShaderLibrary::applyDefines(dstate, defines);
+
+		osg::Uniform* baseTextureSampler = new osg::Uniform("baseTexture",0);
+		dstate->addUniform(baseTextureSampler);
+
+		if (data.UseMultiSample)
+		{ 
+			dstate->setMode(GL_SAMPLE_ALPHA_TO_COVERAGE_ARB, 1);
+			dstate->setAttributeAndModes(new osg::BlendFunc(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO), osg::StateAttribute::OVERRIDE);
+			dstate->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
 		}
-	
+		return dstate;
 	}
 
 	osg::Node* MRTShaderInstancing::create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb)
@@ -270,10 +182,7 @@ namespace osgVegetation
 				osg::Vec4f* ptr = (osg::Vec4f*)treeParamsImage->data(4*i);
 				MeshObject& tree = **itr;
 
-				osg::Matrixd trans_mat;
-				trans_mat.identity();
-				trans_mat.makeTranslate(tree.Position);
-				trans_mat =  osg::Matrixd::rotate(tree.Rotation) * osg::Matrixd::scale(tree.Width, tree.Width, tree.Height)* trans_mat;
+				osg::Matrixd trans_mat = Utils::getMeshInstanceMatrix(tree.Position, tree.Rotation, tree.Width, tree.Height);
 				double* m = trans_mat.ptr();
 
 				ptr[0] = osg::Vec4f(m[0],m[1],m[2],tree.Color.r());
@@ -287,10 +196,27 @@ namespace osgVegetation
 			geode->getOrCreateStateSet()->setTextureAttribute(1, tbo.get(),osg::StateAttribute::ON);
 
 			geode->setInitialBound(osg::BoundingBox(bb._min, bb._max));
+			//mesh name identify layer in statistics
+			geode->setName(mesh_name);
 			osg::Uniform* dataBufferSampler = new osg::Uniform("dataBuffer",1);
 			geode->getOrCreateStateSet()->addUniform(dataBufferSampler);
 		}
 		return geode;
 	}
 
+	osg::BoundingBox MRTShaderInstancing::getMeshBound(const std::string &mesh_name)
+	{
+		std::map<std::string, osg::BoundingBox>::const_iterator iter = m_MeshBoundMap.find(mesh_name);
+		if(iter != m_MeshBoundMap.end())
+			return iter->second;
+		osg::BoundingBox bb;
+		if(m_MeshNodeMap.find(mesh_name) != m_MeshNodeMap.end())
+		{
+			osg::ComputeBoundsVisitor cbv;
+			m_MeshNodeMap[mesh_name]->accept(cbv);
+			bb = cbv.getBoundingBox();
+		}
+		m_MeshBoundMap[mesh_name] = bb;
+		return bb;
+	}
 }
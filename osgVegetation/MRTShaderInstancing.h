@@ -15,10 +15,12 @@ namespace osgVegetation
 		MRTShaderInstancing(MeshData &data, const EnvironmentSettings& env_settings);
 		osg::Node* create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb);
 		osg::StateSet* getStateSet() const {return m_StateSet;}
+		osg::BoundingBox getMeshBound(const std::string &mesh_name);
 	protected:
 		osg::StateSet* _createStateSet(MeshData &data,const EnvironmentSettings& env_settings);
 		osg::StateSet* m_StateSet; 
 		std::map<std::string, osg::ref_ptr<osg::Node>  > m_MeshNodeMap;
+		std::map<std::string, osg::BoundingBox> m_MeshBoundMap;
 		std::vector<osg::Geometry*> m_Geometries;
 	};
 }
\ No newline at end of file
@@ -11,7 +11,10 @@ namespace osgVegetation
 	struct MeshData
 	{
 		MeshData() : ReceiveShadows(false),
-			UseMultiSample(false)
+			UseMultiSample(false),
+			AdaptiveSubdivision(false),
+			MaxTileInstances(0),
+			OptimizeMeshTemplates(false)
 		{
 
 		}
@@ -26,6 +29,24 @@ namespace osgVegetation
 		*/
 		bool UseMultiSample;
 
+		/**
+			Enable adaptive quad tree subdivision, subtrees without any instances
+			are pruned so that no LOD/PagedLOD nodes or tile files are created for empty areas.
+		*/
+		bool AdaptiveSubdivision;
+
+		/**
+			Max number of instances of each layer in one tile, tiles that exceed this budget are split into
+			quadrant sub tiles (own tile files with paged LOD), see QuadTreeSubdivision. 0 (default) means no limit.
+		*/
+		unsigned int MaxTileInstances;
+
+		/**
+			Preprocess loaded meshes before they are used as instancing templates, drawables are merged
+			and converted to indexed triangles optimized for vertex cache and fetch (see MeshTemplateUtils).
+			Changes the geometry layout of generated output, default to false
+		*/
+		bool OptimizeMeshTemplates;
 
 		/**
 			The mesh layer collection
@@ -0,0 +1,344 @@
+#include "MeshLODGenerator.h"
+#include "MeshTemplateUtils.h"
+#include <osg/AlphaFunc>
+#include <osg/ComputeBoundsVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Math>
+#include <osg/Texture2D>
+#include <osg/TriangleFunctor>
+#include <osg/ValueObject>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgUtil/Simplifier>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace osgVegetation
+{
+	//max number of source vertices used when measuring simplification error
+	const unsigned int MAX_ERROR_SAMPLES = 2000;
+
+	struct CollectTriangles
+	{
+		CollectTriangles() : Vertices(NULL) {}
+		void operator()(const osg::Vec3& v1, const osg::Vec3& v2, const osg::Vec3& v3)
+		{
+			Vertices->push_back(v1 * Matrix);
+			Vertices->push_back(v2 * Matrix);
+			Vertices->push_back(v3 * Matrix);
+		}
+		//older TriangleFunctor signature
+		void operator()(const osg::Vec3& v1, const osg::Vec3& v2, const osg::Vec3& v3, bool)
+		{
+			(*this)(v1, v2, v3);
+		}
+		std::vector<osg::Vec3>* Vertices;
+		osg::Matrix Matrix;
+	};
+
+	/**
+		Collect all triangles in mesh coordinates
+	*/
+	class TriangleCollector : public osg::NodeVisitor
+	{
+	public:
+		TriangleCollector(std::vector<osg::Vec3> &vertices) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+			m_Vertices(vertices)
+		{
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			const osg::Matrix matrix = osg::computeLocalToWorld(getNodePath());
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+			{
+				osg::TriangleFunctor<CollectTriangles> tf;
+				tf.Vertices = &m_Vertices;
+				tf.Matrix = matrix;
+				geode.getDrawable(i)->accept(tf);
+			}
+			traverse(geode);
+		}
+	private:
+		std::vector<osg::Vec3> &m_Vertices;
+	};
+
+	static osg::Vec3 GetClosestPointOnTriangle(const osg::Vec3 &p, const osg::Vec3 &a, const osg::Vec3 &b, const osg::Vec3 &c)
+	{
+		//voronoi region test, see Ericson "Real-Time Collision Detection"
+		const osg::Vec3 ab = b - a;
+		const osg::Vec3 ac = c - a;
+		const osg::Vec3 ap = p - a;
+		const float d1 = ab * ap;
+		const float d2 = ac * ap;
+		if(d1 <= 0 && d2 <= 0)
+			return a;
+		const osg::Vec3 bp = p - b;
+		const float d3 = ab * bp;
+		const float d4 = ac * bp;
+		if(d3 >= 0 && d4 <= d3)
+			return b;
+		const float vc = d1*d4 - d3*d2;
+		if(vc <= 0 && d1 >= 0 && d3 <= 0)
+			return a + ab*(d1 / (d1 - d3));
+		const osg::Vec3 cp = p - c;
+		const float d5 = ab * cp;
+		const float d6 = ac * cp;
+		if(d6 >= 0 && d5 <= d6)
+			return c;
+		const float vb = d5*d2 - d1*d6;
+		if(vb <= 0 && d2 >= 0 && d6 <= 0)
+			return a + ac*(d2 / (d2 - d6));
+		const float va = d3*d6 - d5*d4;
+		if(va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+			return b + (c - b)*((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		const float denom = 1.0f / (va + vb + vc);
+		return a + ab*(vb*denom) + ac*(vc*denom);
+	}
+
+	void MeshLODGenerator::_getTriangles(osg::Node* mesh, std::vector<osg::Vec3> &vertices)
+	{
+		TriangleCollector tc(vertices);
+		mesh->accept(tc);
+	}
+
+	unsigned int MeshLODGenerator::getNumTriangles(osg::Node* mesh)
+	{
+		std::vector<osg::Vec3> vertices;
+		_getTriangles(mesh, vertices);
+		return static_cast<unsigned int>(vertices.size() / 3);
+	}
+
+	double MeshLODGenerator::getSimplificationError(osg::Node* source, osg::Node* simplified)
+	{
+		std::vector<osg::Vec3> source_vertices;
+		std::vector<osg::Vec3> triangles;
+		_getTriangles(source, source_vertices);
+		_getTriangles(simplified, triangles);
+		if(source_vertices.empty())
+			return 0;
+		if(triangles.empty())
+			return source->getBound().radius();
+
+		const size_t step = std::max<size_t>(1, source_vertices.size() / MAX_ERROR_SAMPLES);
+		double max_error = 0;
+		for(size_t i = 0; i < source_vertices.size(); i += step)
+		{
+			const osg::Vec3 &p = source_vertices[i];
+			float min_dist2 = FLT_MAX;
+			for(size_t j = 0; j + 2 < triangles.size() && min_dist2 > 0; j += 3)
+			{
+				const float dist2 = (GetClosestPointOnTriangle(p, triangles[j], triangles[j + 1], triangles[j + 2]) - p).length2();
+				min_dist2 = std::min(min_dist2, dist2);
+			}
+			max_error = std::max(max_error, static_cast<double>(sqrt(min_dist2)));
+		}
+		return max_error;
+	}
+
+	double MeshLODGenerator::_getSwitchDistance(const MeshLayer &layer, double error, const EnvironmentSettings &env_settings)
+	{
+		//largest instance scale in this layer, mesh is scaled by instance width and height
+		const double scale = std::max(layer.Width.y(), layer.Height.y())*layer.Scale.y();
+		//distance where error project to screen space error pixels
+		const double half_fov = osg::DegreesToRadians(env_settings.ViewFOV*0.5);
+		return error*scale*env_settings.ViewportHeight / (2.0*tan(half_fov)*layer.AutoLOD.ScreenSpaceError);
+	}
+
+	std::string MeshLODGenerator::_getFileHash(const std::string &file_name)
+	{
+		//64-bit FNV-1a of file content
+		std::ifstream file(file_name.c_str(), std::ios::binary);
+		if(!file.is_open())
+			OSGV_EXCEPT(std::string("MeshLODGenerator::_getFileHash - Failed to open file:" + file_name).c_str());
+		unsigned long long hash = 14695981039346656037ULL;
+		char buffer[4096];
+		while(file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+		{
+			const std::streamsize size = file.gcount();
+			for(std::streamsize i = 0; i < size; i++)
+			{
+				hash ^= static_cast<unsigned char>(buffer[i]);
+				hash *= 1099511628211ULL;
+			}
+		}
+		std::stringstream ss;
+		ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+		return ss.str();
+	}
+
+	osg::Node* MeshLODGenerator::_createImpostor(const osg::BoundingBox &mesh_bb, const std::string &texture_file)
+	{
+		//crossed quads (both faces) covering mesh bound
+		const float sw = std::max(mesh_bb.xMax() - mesh_bb.xMin(), mesh_bb.yMax() - mesh_bb.yMin())*0.5f;
+		const osg::Vec3 center = mesh_bb.center();
+		const float z0 = mesh_bb.zMin();
+		const float z1 = mesh_bb.zMax();
+		osg::Vec3Array* v = new osg::Vec3Array;
+		osg::Vec3Array* n = new osg::Vec3Array;
+		osg::Vec2Array* t = new osg::Vec2Array;
+		const osg::Vec3 dirs[2] = {osg::Vec3(1, 0, 0), osg::Vec3(0, -1, 0)};
+		for(unsigned int i = 0; i < 2; i++)
+		{
+			const osg::Vec3 left = center - dirs[i]*sw;
+			const osg::Vec3 right = center + dirs[i]*sw;
+			const osg::Vec3 normal = osg::Vec3(0, 0, 1) ^ dirs[i];
+			v->push_back(osg::Vec3(left.x(), left.y(), z0));
+			v->push_back(osg::Vec3(right.x(), right.y(), z0));
+			v->push_back(osg::Vec3(right.x(), right.y(), z1));
+			v->push_back(osg::Vec3(left.x(), left.y(), z1));
+			t->push_back(osg::Vec2(0, 0));
+			t->push_back(osg::Vec2(1, 0));
+			t->push_back(osg::Vec2(1, 1));
+			t->push_back(osg::Vec2(0, 1));
+			for(unsigned int j = 0; j < 4; j++)
+				n->push_back(-normal);
+			//back face
+			v->push_back(osg::Vec3(left.x(), left.y(), z1));
+			v->push_back(osg::Vec3(right.x(), right.y(), z1));
+			v->push_back(osg::Vec3(right.x(), right.y(), z0));
+			v->push_back(osg::Vec3(left.x(), left.y(), z0));
+			t->push_back(osg::Vec2(0, 1));
+			t->push_back(osg::Vec2(1, 1));
+			t->push_back(osg::Vec2(1, 0));
+			t->push_back(osg::Vec2(0, 0));
+			for(unsigned int j = 0; j < 4; j++)
+				n->push_back(normal);
+		}
+
+		osg::Geometry* geom = new osg::Geometry;
+		geom->setVertexArray(v);
+		geom->setNormalArray(n);
+		geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+		geom->setTexCoordArray(0, t);
+		geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, v->size()));
+
+		osg::Texture2D* tex = new osg::Texture2D;
+		tex->setWrap(osg::Texture2D::WRAP_S, osg::Texture2D::CLAMP);
+		tex->setWrap(osg::Texture2D::WRAP_T, osg::Texture2D::CLAMP);
+		tex->setImage(osgDB::readImageFile(texture_file));
+		if(tex->getImage() == NULL)
+			OSGV_EXCEPT(std::string("MeshLODGenerator::_createImpostor - Failed to load texture:" + texture_file).c_str());
+
+		osg::Geode* geode = new osg::Geode;
+		geode->addDrawable(geom);
+		osg::StateSet* state_set = geode->getOrCreateStateSet();
+		state_set->setTextureAttributeAndModes(0, tex, osg::StateAttribute::ON);
+		state_set->setAttributeAndModes(new osg::AlphaFunc(osg::AlphaFunc::GEQUAL, 0.5f), osg::StateAttribute::ON);
+		return geode;
+	}
+
+	void MeshLODGenerator::generate(MeshLayer &layer, const EnvironmentSettings &env_settings)
+	{
+		const MeshLODChain &settings = layer.AutoLOD;
+		if(settings.TriangleRatios.empty())
+			OSGV_EXCEPT(std::string("MeshLODGenerator::generate - No triangle ratios for mesh:" + settings.SourceMesh).c_str());
+		if(settings.ScreenSpaceError <= 0 && settings.MaxDistances.size() != settings.TriangleRatios.size())
+			OSGV_EXCEPT(std::string("MeshLODGenerator::generate - Max distance count don't match triangle ratio count for mesh:" + settings.SourceMesh).c_str());
+
+		const std::string source_file = osgDB::findDataFile(settings.SourceMesh);
+		if(source_file == "")
+			OSGV_EXCEPT(std::string("MeshLODGenerator::generate - Failed to find mesh:" + settings.SourceMesh).c_str());
+		osg::ref_ptr<osg::Node> source = osgDB::readNodeFile(settings.SourceMesh);
+		if(!source.valid())
+			OSGV_EXCEPT(std::string("MeshLODGenerator::generate - Failed to load mesh:" + settings.SourceMesh).c_str());
+		source = MeshTemplateUtils::optimize(source.get(), settings.SourceMesh);
+
+		std::string cache_dir = settings.CacheDirectory;
+		if(cache_dir == "")
+			cache_dir = osgDB::getFilePath(source_file);
+		if(cache_dir != "")
+		{
+			osgDB::makeDirectory(cache_dir);
+			cache_dir += "/";
+		}
+		//cache files are keyed by source content, stale levels are never reused
+		const std::string base_name = cache_dir + osgDB::getStrippedName(settings.SourceMesh) + "_" + _getFileHash(source_file);
+
+		//generate or load each level and measure error
+		std::vector<std::string> files;
+		std::vector<double> errors;
+		const unsigned int source_triangles = getNumTriangles(source.get());
+		for(size_t i = 0; i < settings.TriangleRatios.size(); i++)
+		{
+			//full detail levels are also saved, all levels share the preprocessed source
+			const float ratio = osg::clampBetween(settings.TriangleRatios[i], 0.0f, 1.0f);
+			std::stringstream ss;
+			ss << base_name << "_lod" << i << "_" << static_cast<int>(ratio*100.0f + 0.5f) << ".osgb";
+			const std::string lod_file = ss.str();
+
+			double error = 0;
+			osg::ref_ptr<osg::Node> lod_mesh;
+			if(osgDB::fileExists(lod_file))
+				lod_mesh = osgDB::readNodeFile(lod_file);
+			if(lod_mesh.valid() && lod_mesh->getUserValue("SimplificationError", error))
+			{
+				std::cout << "Mesh LOD:" << lod_file << " (cached)";
+			}
+			else
+			{
+				lod_mesh = dynamic_cast<osg::Node*>(source->clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES |
+					osg::CopyOp::DEEP_COPY_ARRAYS | osg::CopyOp::DEEP_COPY_PRIMITIVES));
+				if(ratio < 1.0f)
+				{
+					osgUtil::Simplifier simplifier(ratio);
+					lod_mesh->accept(simplifier);
+					error = getSimplificationError(source.get(), lod_mesh.get());
+				}
+				lod_mesh->setUserValue("SimplificationError", error);
+				if(!osgDB::writeNodeFile(*lod_mesh, lod_file))
+					OSGV_EXCEPT(std::string("MeshLODGenerator::generate - Failed to write mesh LOD:" + lod_file).c_str());
+				std::cout << "Mesh LOD:" << lod_file;
+			}
+			std::cout << " Triangles:" << getNumTriangles(lod_mesh.get()) << " of:" << source_triangles << " Error:" << error << std::endl;
+			files.push_back(lod_file);
+			errors.push_back(error);
+		}
+
+		//level i is used until next level error is acceptable, distances must increase
+		MeshLODVector lods;
+		double prev_distance = 0;
+		for(size_t i = 0; i < files.size(); i++)
+		{
+			double distance = 0;
+			if(settings.ScreenSpaceError > 0)
+				distance = (i + 1 < files.size()) ? _getSwitchDistance(layer, errors[i + 1], env_settings) : settings.MaxDistance;
+			else
+				distance = settings.MaxDistances[i];
+			distance = std::max(distance, prev_distance);
+			prev_distance = distance;
+			lods.push_back(MeshLOD(files[i], distance));
+			std::cout << "Mesh LOD:" << files[i] << " Max distance:" << distance << std::endl;
+		}
+
+		if(settings.ImpostorTexture != "")
+		{
+			//texture is embedded in impostor file, key by texture content as well
+			const std::string texture_file = osgDB::findDataFile(settings.ImpostorTexture);
+			if(texture_file == "")
+				OSGV_EXCEPT(std::string("MeshLODGenerator::generate - Failed to find impostor texture:" + settings.ImpostorTexture).c_str());
+			const std::string impostor_file = base_name + "_impostor_" + _getFileHash(texture_file) + ".osgb";
+			if(!osgDB::fileExists(impostor_file))
+			{
+				osg::ComputeBoundsVisitor cbv;
+				source->accept(cbv);
+				osg::ref_ptr<osg::Node> impostor = _createImpostor(cbv.getBoundingBox(), settings.ImpostorTexture);
+				if(!osgDB::writeNodeFile(*impostor, impostor_file))
+					OSGV_EXCEPT(std::string("MeshLODGenerator::generate - Failed to write impostor:" + impostor_file).c_str());
+			}
+			const double distance = std::max(settings.ImpostorDistance, prev_distance);
+			lods.push_back(MeshLOD(impostor_file, distance));
+			std::cout << "Mesh LOD:" << impostor_file << " Max distance:" << distance << std::endl;
+		}
+		layer.MeshLODs = lods;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "Common.h"
+#include <osg/Node>
+#include <osg/Vec3>
+#include <string>
+#include <vector>
+#include "MeshLayer.h"
+#include "EnvironmentSettings.h"
+
+namespace osgVegetation
+{
+	/**
+		Generate mesh LOD chain from one high detail mesh (see MeshLayer::AutoLOD).
+		The source mesh is preprocessed with MeshTemplateUtils and each level (also ratio 1) is taken from
+		the preprocessed mesh, simplified with osgUtil::Simplifier to the target triangle ratio. Levels are written
+		to the cache directory as <mesh>_<source hash>_lod<level>_<ratio percent>.osgb and reused by later runs,
+		the source file content hash makes sure levels are regenerated when the source mesh changes.
+		Simplification error (max distance from sampled source vertices to the level triangles) is
+		stored with each level and used for screen space error based switch distances.
+		MeshQuadTreeScattering call generate() for all layers with a source mesh before scattering.
+	*/
+	class osgvExport MeshLODGenerator
+	{
+	public:
+		/**
+			Replace layer MeshLODs with generated levels, an impostor level is added last if
+			AutoLOD.ImpostorTexture is set.
+		*/
+		static void generate(MeshLayer &layer, const EnvironmentSettings &env_settings);
+
+		/**
+			One sided simplification error, max distance from source vertices (max 2000 samples) to simplified triangles.
+			Both meshes are measured in mesh coordinates.
+		*/
+		static double getSimplificationError(osg::Node* source, osg::Node* simplified);
+
+		/**
+			Number of triangles in mesh
+		*/
+		static unsigned int getNumTriangles(osg::Node* mesh);
+	private:
+		static void _getTriangles(osg::Node* mesh, std::vector<osg::Vec3> &vertices);
+		static osg::Node* _createImpostor(const osg::BoundingBox &mesh_bb, const std::string &texture_file);
+		static double _getSwitchDistance(const MeshLayer &layer, double error, const EnvironmentSettings &env_settings);
+		static std::string _getFileHash(const std::string &file_name);
+	};
+}
@@ -27,6 +27,62 @@ namespace osgVegetation
 	};
 	typedef std::vector<MeshLOD> MeshLODVector;
 
+	/**
+		Settings for automatic mesh LOD chain generation (see MeshLODGenerator).
+		Levels are simplified copies of one high detail source mesh, generated files are cached on disk.
+	*/
+	struct MeshLODChain
+	{
+		MeshLODChain() : ScreenSpaceError(0),
+			MaxDistance(0),
+			ImpostorDistance(0)
+		{
+
+		}
+
+		/**
+			High detail source mesh, if set the layer MeshLODs are replaced by generated levels
+		*/
+		std::string SourceMesh;
+
+		/**
+			Target triangle ratio (0-1) for each level, first level is typically 1.0 (source mesh as is)
+		*/
+		std::vector<float> TriangleRatios;
+
+		/**
+			Max distance for each level (same size as TriangleRatios), only used if ScreenSpaceError is 0
+		*/
+		std::vector<double> MaxDistances;
+
+		/**
+			Target screen space error in pixels. If this value is > 0 the switch distance of each level is computed
+			from the measured simplification error of the next level (based on EnvironmentSettings::ViewFOV and ViewportHeight).
+			Default to 0 (use MaxDistances)
+		*/
+		float ScreenSpaceError;
+
+		/**
+			Max distance of last mesh level, only used if ScreenSpaceError is > 0
+		*/
+		double MaxDistance;
+
+		/**
+			Optional texture for a final impostor level (crossed quads), for example baked with billboard_generator
+		*/
+		std::string ImpostorTexture;
+
+		/**
+			Max distance of impostor level
+		*/
+		double ImpostorDistance;
+
+		/**
+			Directory for generated files, default to source mesh directory
+		*/
+		std::string CacheDirectory;
+	};
+
 	/*
 		Mesh layer holding Mesh LOD vector and
 	*/
@@ -40,6 +96,11 @@ namespace osgVegetation
 
 		MeshLODVector MeshLODs;
 
+		/**
+			Automatic LOD chain generation, used if AutoLOD.SourceMesh is set (MeshLODs can then be empty)
+		*/
+		MeshLODChain AutoLOD;
+
 		/**
 			Color intensity interval
 		*/
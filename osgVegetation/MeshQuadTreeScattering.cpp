@@ -10,14 +10,19 @@
 #include <osgDB/FileNameUtils>
 #include <sstream>
 #include "MRTShaderInstancing.h"
+#include "MeshLODGenerator.h"
+#include "QuadTreeSubdivision.h"
 #include "VegetationUtils.h"
+#include "VegetationQuadTree.h"
 #include "ITerrainQuery.h"
+#include "ScatterSampler.h"
 
 namespace osgVegetation
 {
 	MeshQuadTreeScattering::MeshQuadTreeScattering(ITerrainQuery* tq, const EnvironmentSettings& env_settings) : m_MRT(NULL),
 		m_TerrainQuery(tq),
 		m_UsePagedLOD(false),
+		m_UseQuadTreeNode(false),
 		m_FilenamePrefix("quadtree_"),
 		m_EnvSettings(env_settings),
 		m_FinalLOD(0),
@@ -29,45 +34,30 @@ namespace osgVegetation
 
 	void MeshQuadTreeScattering::_populateVegetationTile(MeshLayer& layer,const  osg::BoundingBoxd& bb)
 	{
-		osg::Vec3d origin = bb._min; 
-		osg::Vec3d size = bb._max - bb._min; 
-
-		unsigned int num_objects_to_create = size.x()*size.y()*layer.Density;
-		layer._Instances.reserve(layer._Instances.size()+num_objects_to_create);
-
-		for(unsigned int i=0;i<num_objects_to_create;++i)
+		//mesh scattering is seeded by srand(), use global random state
+		GlobalRandomGenerator rng;
+		std::vector<ScatterSample> samples;
+		ScatterSampler(m_TerrainQuery, m_Offset, m_InitBB).scatterLayer(layer, bb, rng, samples);
+		layer._Instances.reserve(layer._Instances.size() + samples.size());
+		for(size_t i = 0; i < samples.size(); i++)
 		{
-			osg::Vec3d pos(Utils::random(origin.x(),origin.x()+size.x()),Utils::random(origin.y(),origin.y()+size.y()),0);
-			osg::Vec3d inter;
-			osg::Vec4 terrain_color;
-			osg::Vec4 coverage_color;
-			float rand_int = Utils::random(layer.ColorIntensity.x(),layer.ColorIntensity.y());
-			osg::Vec3d offset_pos = pos + m_Offset;
-			if(m_InitBB.contains(pos))
+			const ScatterSample &sample = samples[i];
+			MeshObject* veg_obj = new MeshObject;
+			veg_obj->Width = sample.Width;
+			veg_obj->Height = sample.Height;
+			veg_obj->Position = sample.Position - m_Offset;
+			veg_obj->Rotation.makeRotate(rng.random(0.0, osg::PI_2),osg::Vec3(0,0,1));
+			osg::Vec4 terrain_color = sample.TerrainColor;
+			if(layer.UseTerrainIntensity)
 			{
-				std::string coverage_name;
-				if(m_TerrainQuery->getTerrainData(offset_pos,terrain_color,coverage_name,coverage_color,inter))
-				{
-					if(layer.hasCoverage(coverage_name))
-					{
-						MeshObject* veg_obj = new MeshObject;
-						float tree_scale = Utils::random(layer.Scale.x() ,layer.Scale.y());
-						veg_obj->Width = Utils::random(layer.Width.x(),layer.Width.y())*tree_scale;
-						veg_obj->Height = Utils::random(layer.Height.x(),layer.Height.y())*tree_scale;
-						veg_obj->Position = inter - m_Offset;
-						veg_obj->Rotation.makeRotate(Utils::random(0.0, osg::PI_2),osg::Vec3(0,0,1));
-						if(layer.UseTerrainIntensity)
-						{
-							float intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
-							terrain_color.set(intensity,intensity,intensity,terrain_color.a());
-						}
-						veg_obj->Color = terrain_color*(layer.TerrainColorRatio*rand_int);
-						veg_obj->Color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
-						veg_obj->Color.set(veg_obj->Color.r(), veg_obj->Color.g(), veg_obj->Color.b(), 1.0);
-						layer._Instances.push_back(veg_obj);
-					}
-				}
+				float intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
+				terrain_color.set(intensity,intensity,intensity,terrain_color.a());
 			}
+			const float rand_int = sample.ColorIntensity;
+			veg_obj->Color = terrain_color*(layer.TerrainColorRatio*rand_int);
+			veg_obj->Color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
+			veg_obj->Color.set(veg_obj->Color.r(), veg_obj->Color.g(), veg_obj->Color.b(), 1.0);
+			layer._Instances.push_back(veg_obj);
 		}
 	}
 
@@ -78,7 +68,50 @@ namespace osgVegetation
 		return sstream.str();
 	}
 
-	osg::Node* MeshQuadTreeScattering::_createLODRec(int ld, MeshData &data, MeshVegetationObjectVector instances, const osg::BoundingBoxd &bb,int x, int y)
+	void MeshQuadTreeScattering::_addTileGeometry(const MeshData &data, const MeshVegetationObjectVector &instances, const std::string &mesh_name, const osg::BoundingBoxd &region,
+		osg::Group* group, const std::string &filename, int split_depth, int quadrant_path, osg::BoundingBoxd &out_bb)
+	{
+		if(!QuadTreeSubdivision::needSplit(instances.size(), data.MaxTileInstances, split_depth))
+		{
+			//get tight bound from transformed mesh bound of each instance
+			const osg::BoundingBox mesh_bb = m_MRT->getMeshBound(mesh_name);
+			osg::BoundingBoxd bb;
+			for(size_t i = 0; i < instances.size(); i++)
+			{
+				const MeshObject &obj = *instances[i];
+				bb.expandBy(Utils::getMeshInstanceBound(mesh_bb, Utils::getMeshInstanceMatrix(obj.Position, obj.Rotation, obj.Width, obj.Height)));
+			}
+			osg::Node* node = m_MRT->create(instances, mesh_name, bb);
+			if(node == NULL)
+				return;
+			if(split_depth == 0)
+				group->addChild(node);
+			else
+				m_Subdivision.addSubTile(group, node, bb, m_UsePagedLOD ? m_SavePath : "", QuadTreeSubdivision::getSubTileFileName(filename, split_depth, quadrant_path));
+			out_bb.expandBy(bb);
+			return;
+		}
+
+		//split tile region into quadrant sub tiles
+		osg::Group* split_node = m_Subdivision.createSplitNode(split_depth);
+		group->addChild(split_node);
+		MeshVegetationObjectVector quadrant_instances[4];
+		QuadTreeSubdivision::splitInstances(instances, region, quadrant_instances);
+		osg::BoundingBoxd quadrant_regions[4];
+		QuadTreeSubdivision::getQuadrantRegions(region, quadrant_regions);
+		for(int i = 0; i < 4; i++)
+		{
+			if(quadrant_instances[i].size() > 0)
+				_addTileGeometry(data, quadrant_instances[i], mesh_name, quadrant_regions[i], split_node, filename, split_depth + 1, quadrant_path*4 + i, out_bb);
+		}
+	}
+
+	void MeshQuadTreeScattering::_reportSubdivision(const MeshData &data) const
+	{
+		m_Subdivision.report(data.AdaptiveSubdivision, data.MaxTileInstances, m_UsePagedLOD);
+	}
+
+	osg::Node* MeshQuadTreeScattering::_createLODRec(int ld, MeshData &data, MeshVegetationObjectVector instances, const osg::BoundingBoxd &bb,int x, int y, osg::BoundingBoxd &out_bb)
 	{
 		if(ld < 6) //only show progress above level 6, we don't want to spam the console
 			std::cout << "Progress:" << static_cast<int>(100.0f*(static_cast<float>( m_CurrentTile)/ static_cast<float>(m_NumberOfTiles))) <<  "% Tile:" << m_CurrentTile << " of:" << m_NumberOfTiles << std::endl;
@@ -86,12 +119,14 @@ namespace osgVegetation
 
 		osg::ref_ptr<osg::Group> children_group = new osg::Group;
 
-		//mesh_group is returned as raw pointer so we don't use smart pointer
-		osg::Group* mesh_group = new osg::Group;
+		//mesh_group is released when returned
+		osg::ref_ptr<osg::Group> mesh_group = new osg::Group;
 
 		const double bb_size = (bb._max.x() - bb._min.x());
-		const double tile_radius = sqrt(bb_size*bb_size);
-		const double tile_cutoff = tile_radius*2.0f;
+		const double tile_cutoff = sqrt(bb_size*bb_size)*2.0f;
+
+		//bottom-up bound of this tile and all child tiles
+		out_bb.init();
 
 		bool final_lod = (ld == m_FinalLOD);
 
@@ -131,8 +166,10 @@ namespace osgVegetation
 					//p.set(p.x(),p.y(),p.z() + 1.0);
 					//data.Layers[i]._Instances[j]->Position = p;
 				}
-				osg::Node* node = m_MRT->create(tile_instances, data.Layers[i].MeshLODs[mesh_lod].MeshName, bb);
-				mesh_group->addChild(node);
+				//layer index in sub tile file names, each layer is split separately
+				std::stringstream layer_file;
+				layer_file << osgDB::getNameLessExtension(_createFileName(ld, x, y)) << "_L" << i << "." << m_SaveExt;
+				_addTileGeometry(data, tile_instances, data.Layers[i].MeshLODs[mesh_lod].MeshName, bb, mesh_group.get(), layer_file.str(), 0, 0, out_bb);
 			}
 		}
 
@@ -153,17 +190,36 @@ namespace osgVegetation
 			osg::BoundingBoxd b4(osg::Vec3(bb._min.x(),		 bb._min.y() + sy  ,bb._min.z()),
 				osg::Vec3(bb._min.x() + sx,  bb._max.y()		,bb._max.z()));
 
-			//first check that we are inside initial bounding box
-			if(b1.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b1, x*2,   y*2));
-			if(b2.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b2, x*2,   y*2+1));
-			if(b3.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b3, x*2+1, y*2+1));
-			if(b4.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b4, x*2+1, y*2));
+			//first check that we are inside initial bounding box, 
+			//empty subtrees are returned as NULL in adaptive mode and silently ignored by addChild
+			osg::BoundingBoxd child_bb[4];
+			if(b1.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b1, x*2,   y*2, child_bb[0]));
+			if(b2.intersects(m_InitBB))	children_group->addChild( _createLODRec(ld+1,data,instances,b2, x*2,   y*2+1, child_bb[1]));
+			if(b3.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b3, x*2+1, y*2+1, child_bb[2]));
+			if(b4.intersects(m_InitBB)) children_group->addChild( _createLODRec(ld+1,data,instances,b4, x*2+1, y*2, child_bb[3]));
+			for(int i = 0; i < 4; i++)
+				out_bb.expandBy(child_bb[i]);
+
+			//use tight bound for LOD center and radius, fallback to tile region if empty
+			const osg::BoundingBoxd &lod_bb = out_bb.valid() ? out_bb : bb;
+			const osg::Vec3d tile_center = lod_bb.center();
+			const double tile_radius = lod_bb.radius();
+
+			m_Subdivision.NumInnerTiles++;
+			if(data.AdaptiveSubdivision && children_group->getNumChildren() == 0)
+			{
+				//no instances below this tile, skip LOD node and tile file
+				if(mesh_group->getNumChildren() == 0)
+					return NULL;
+				return mesh_group.release();
+			}
+			m_Subdivision.NumLODNodes++;
 
 			if(m_UsePagedLOD)
 			{
 				osg::PagedLOD* plod = new osg::PagedLOD;
 				plod->setCenterMode( osg::PagedLOD::USER_DEFINED_CENTER );
-				plod->setCenter(bb.center());
+				plod->setCenter(tile_center);
 				plod->setRadius(tile_radius);
 
 				int c_index = 0;
@@ -177,13 +233,14 @@ namespace osgVegetation
 				plod->setFileName( c_index, filename );
 				plod->setRange(c_index, 0, tile_cutoff);
 				osgDB::writeNodeFile( *children_group, m_SavePath + filename );
+				m_Subdivision.NumTileFiles++;
 				return plod;
 			}
 			else
 			{
 				osg::LOD* plod = new osg::LOD;
 				plod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
-				plod->setCenter( bb.center());
+				plod->setCenter(tile_center);
 				plod->setRadius(tile_radius);
 				//regular terrain LOD setup
 				plod->addChild(mesh_group, tile_cutoff, FLT_MAX );
@@ -191,8 +248,10 @@ namespace osgVegetation
 				return plod;
 			}
 		}
+		else if(data.AdaptiveSubdivision && mesh_group->getNumChildren() == 0)
+			return NULL;
 		else
-			return mesh_group;
+			return mesh_group.release();
 	}
 
 	bool MeshSortPredicate(const MeshLOD &lhs, const MeshLOD &rhs)
@@ -215,6 +274,13 @@ namespace osgVegetation
 			OSGV_EXCEPT(std::string("MeshQuadTreeScattering::generate - paged lod requested but no output file supplied").c_str());
 		}
 
+		//generate mesh LOD chains before mesh templates are loaded
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i].AutoLOD.SourceMesh != "")
+				MeshLODGenerator::generate(data.Layers[i], m_EnvSettings);
+		}
+
 		//remove  previous render tech
 		delete m_MRT;
 
@@ -242,6 +308,7 @@ namespace osgVegetation
 		m_FinalLOD =0;
 		m_NumberOfTiles = 1;
 		m_CurrentTile = 0;
+		m_Subdivision.reset();
 
 		//distance sort mesh LODs
 		for(size_t i = 0; i < data.Layers.size(); i++)
@@ -301,7 +368,21 @@ namespace osgVegetation
 
 		//Start recursive scattering process
 		MeshVegetationObjectVector instances;
-		osg::Node* outnode = _createLODRec(0, data, instances, qt_bb,0,0);
+		osg::BoundingBoxd out_bb;
+		osg::Node* outnode = _createLODRec(0, data, instances, qt_bb,0,0, out_bb);
+		if(outnode == NULL) //nothing generated in adaptive mode
+			outnode = new osg::Group;
+		if(m_UseQuadTreeNode && !m_UsePagedLOD)
+		{
+			//LOD/Group nodes are released when replaced, tile content is kept by quad tree
+			osg::ref_ptr<osg::Node> lod_root = outnode;
+			osg::ref_ptr<VegetationQuadTree> quad_tree = VegetationQuadTree::create(lod_root.get());
+			if(quad_tree.valid())
+				outnode = quad_tree.release();
+			else
+				outnode = lod_root.release();
+		}
+		_reportSubdivision(data);
 
 		//Add state set to top node
 		outnode->setStateSet(dynamic_cast<osg::StateSet*>( m_MRT->getStateSet()->clone(osg::CopyOp::DEEP_COPY_STATESETS)));
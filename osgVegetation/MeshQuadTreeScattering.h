@@ -8,6 +8,7 @@
 #include "MeshLayer.h"
 #include "MeshData.h"
 #include "EnvironmentSettings.h"
+#include "QuadTreeSubdivision.h"
 
 namespace osgVegetation
 {
@@ -36,6 +37,13 @@ namespace osgVegetation
 			@param filename_prefix Added to all files (only relevant if out_put_file is defined)
 			*/
 		osg::Node* generate(const osg::BoundingBoxd &bb, MeshData &data, const std::string &output_file = "", bool use_paged_lod = false, const std::string &filename_prefix = "");
+
+		/**
+			Replace nested LOD hierarchy with a flat VegetationQuadTree node (default false).
+			Only used when paged LOD is disabled.
+		*/
+		void setUseQuadTreeNode(bool value) {m_UseQuadTreeNode = value;}
+		bool getUseQuadTreeNode() const {return m_UseQuadTreeNode;}
 	private:
 		int m_FinalLOD;
 
@@ -43,6 +51,9 @@ namespace osgVegetation
 		int m_CurrentTile;
 		int m_NumberOfTiles;
 
+		//data used for adaptive subdivision report
+		QuadTreeSubdivision m_Subdivision;
+
 		//Area bounding box
 		osg::BoundingBoxd m_InitBB;
 
@@ -51,6 +62,7 @@ namespace osgVegetation
 		ITerrainQuery* m_TerrainQuery;
 
 		bool m_UsePagedLOD;
+		bool m_UseQuadTreeNode;
 
 		//Output stuff
 		std::string m_SavePath;
@@ -62,6 +74,9 @@ namespace osgVegetation
 		//Helpers
 		std::string _createFileName(unsigned int lv, unsigned int x, unsigned int y) const;
 		void _populateVegetationTile(MeshLayer& layer,const osg::BoundingBoxd &box);
-		osg::Node* _createLODRec(int ld, MeshData &data, MeshVegetationObjectVector trees, const osg::BoundingBoxd &box ,int x, int y);
+		osg::Node* _createLODRec(int ld, MeshData &data, MeshVegetationObjectVector trees, const osg::BoundingBoxd &box ,int x, int y, osg::BoundingBoxd &out_bb);
+		void _addTileGeometry(const MeshData &data, const MeshVegetationObjectVector &instances, const std::string &mesh_name, const osg::BoundingBoxd &region,
+			osg::Group* group, const std::string &filename, int split_depth, int quadrant_path, osg::BoundingBoxd &out_bb);
+		void _reportSubdivision(const MeshData &data) const;
 	};
 }
@@ -0,0 +1,115 @@
+#include "MeshTemplateUtils.h"
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/LOD>
+#include <osg/Notify>
+#include <osg/PagedLOD>
+#include <osgUtil/Optimizer>
+#include <cfloat>
+
+namespace osgVegetation
+{
+	/**
+		Replace LOD nodes with the child holding highest level of detail
+	*/
+	class SelectHighestLOD : public osg::NodeVisitor
+	{
+	public:
+		SelectHighestLOD() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+		{
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::Group& group)
+		{
+			for(unsigned int i = 0; i < group.getNumChildren(); i++)
+			{
+				osg::LOD* lod = dynamic_cast<osg::LOD*>(group.getChild(i));
+				while(lod && dynamic_cast<osg::PagedLOD*>(lod) == NULL && lod->getNumChildren() > 0)
+				{
+					group.replaceChild(lod, _getHighestLOD(*lod));
+					lod = dynamic_cast<osg::LOD*>(group.getChild(i));
+				}
+			}
+			traverse(group);
+		}
+	private:
+		osg::Node* _getHighestLOD(const osg::LOD& lod) const
+		{
+			//closest range for distance mode, largest pixel size for pixel size mode
+			const bool pixel_size = lod.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN;
+			unsigned int highest = 0;
+			float best_range = pixel_size ? -FLT_MAX : FLT_MAX;
+			for(unsigned int i = 0; i < lod.getNumRanges() && i < lod.getNumChildren(); i++)
+			{
+				const float range = pixel_size ? lod.getMaxRange(i) : lod.getMinRange(i);
+				if(pixel_size ? range > best_range : range < best_range)
+				{
+					best_range = range;
+					highest = i;
+				}
+			}
+			return const_cast<osg::Node*>(lod.getChild(highest));
+		}
+	};
+
+	class MeshStatsVisitor : public osg::NodeVisitor
+	{
+	public:
+		MeshStatsVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+		{
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+			{
+				const osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+				if(geom == NULL)
+					continue;
+				m_Stats.NumDrawables++;
+				m_Stats.NumDraws += geom->getNumPrimitiveSets();
+				if(geom->getVertexArray())
+					m_Stats.NumVertices += geom->getVertexArray()->getNumElements();
+			}
+			traverse(geode);
+		}
+		MeshTemplateUtils::MeshStats m_Stats;
+	};
+
+	MeshTemplateUtils::MeshStats MeshTemplateUtils::getStats(osg::Node* mesh)
+	{
+		MeshStatsVisitor msv;
+		mesh->accept(msv);
+		return msv.m_Stats;
+	}
+
+	osg::ref_ptr<osg::Node> MeshTemplateUtils::optimize(osg::Node* mesh, const std::string &name)
+	{
+		const MeshStats before = getStats(mesh);
+
+		//new root so that LOD and transform nodes at top level can be replaced
+		osg::ref_ptr<osg::Group> root = new osg::Group;
+		root->addChild(mesh);
+		SelectHighestLOD shl;
+		root->accept(shl);
+
+		osgUtil::Optimizer optimizer;
+		optimizer.optimize(root.get(), osgUtil::Optimizer::FLATTEN_STATIC_TRANSFORMS |
+			osgUtil::Optimizer::REMOVE_REDUNDANT_NODES |
+			osgUtil::Optimizer::SHARE_DUPLICATE_STATE |
+			osgUtil::Optimizer::MERGE_GEODES |
+			osgUtil::Optimizer::MERGE_GEOMETRY |
+			osgUtil::Optimizer::INDEX_MESH |
+			osgUtil::Optimizer::VERTEX_POSTTRANSFORM |
+			osgUtil::Optimizer::VERTEX_PRETRANSFORM);
+
+		const MeshStats after = getStats(root.get());
+		OSG_INFO << "MeshTemplateUtils::optimize - mesh template:" << name
+			<< " Vertices:" << before.NumVertices << " -> " << after.NumVertices
+			<< " Drawables:" << before.NumDrawables << " -> " << after.NumDrawables
+			<< " Draws:" << before.NumDraws << " -> " << after.NumDraws << std::endl;
+		return root;
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Common.h"
+#include <osg/Node>
+#include <string>
+
+namespace osgVegetation
+{
+	/**
+		Preprocessing of mesh templates used by mesh rendering techniques. Templates are drawn once
+		for each instance so any inefficiency in the loaded model is multiplied by the instance count.
+		optimize() replace LOD nodes with their highest detail child (instancing ignore LOD ranges),
+		flatten static transforms, merge geodes and drawables that share state, convert all primitives
+		to indexed triangles and reorder indices/vertices for post transform vertex cache and vertex fetch.
+	*/
+	class osgvExport MeshTemplateUtils
+	{
+	public:
+		struct MeshStats
+		{
+			MeshStats() : NumVertices(0),
+				NumDrawables(0),
+				NumDraws(0)
+			{
+
+			}
+			unsigned int NumVertices;
+			unsigned int NumDrawables;
+			//primitive sets, each is one instanced draw call per tile
+			unsigned int NumDraws;
+		};
+
+		/**
+			Count vertices, drawables and primitive sets in mesh
+		*/
+		static MeshStats getStats(osg::Node* mesh);
+
+		/**
+			Optimize mesh template for instancing, vertex and draw counts before and after are reported at OSG_INFO notify level.
+			@param mesh Loaded mesh, modified in place
+			@param name Mesh name used in report
+			@return Group holding the optimized mesh
+		*/
+		static osg::ref_ptr<osg::Node> optimize(osg::Node* mesh, const std::string &name);
+	};
+}
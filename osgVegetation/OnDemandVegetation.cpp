@@ -0,0 +1,146 @@
+#include "OnDemandVegetation.h"
+#include <osgDB/Registry>
+#include <osgDB/ReaderWriter>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <OpenThreads/ScopedLock>
+#include <sstream>
+#include <vector>
+#include "ITerrainQuery.h"
+#include "BillboardQuadTreeScattering.h"
+
+namespace osgVegetation
+{
+	OnDemandVegetation::RegistryMap OnDemandVegetation::m_Registry;
+	OpenThreads::Mutex OnDemandVegetation::m_RegistryMutex;
+	OpenThreads::Mutex OnDemandVegetation::m_GenerateMutex;
+
+	OnDemandVegetation::OnDemandVegetation(const std::string &name, ITerrainQuery* tq, const EnvironmentSettings &env_settings,
+		const BillboardData &data, const osg::BoundingBoxd &bb, unsigned int seed) : m_Name(name),
+		m_TerrainQuery(tq),
+		m_EnvironmentSettings(env_settings),
+		m_Data(data),
+		m_BoundingBox(bb),
+		m_Seed(seed)
+	{
+		if(m_Name == "" || m_Name.find('_') != std::string::npos)
+			OSGV_EXCEPT(std::string("OnDemandVegetation::OnDemandVegetation - name must be non empty and not contain '_': " + m_Name).c_str());
+		if(!m_TerrainQuery.valid())
+			OSGV_EXCEPT(std::string("OnDemandVegetation::OnDemandVegetation - no terrain query provided").c_str());
+	}
+
+	OnDemandVegetation::~OnDemandVegetation()
+	{
+
+	}
+
+	osg::Node* OnDemandVegetation::createRoot()
+	{
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_RegistryMutex);
+			m_Registry[m_Name] = this;
+		}
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_GenerateMutex);
+		m_Scattering = new BillboardQuadTreeScattering(m_TerrainQuery.get(), m_EnvironmentSettings);
+		return m_Scattering->generateOnDemand(m_BoundingBox, m_Data, m_Name, m_Seed);
+	}
+
+	osg::Node* OnDemandVegetation::createTileChildren(int ld, unsigned int x, unsigned int y)
+	{
+		if(!m_Scattering.valid())
+			OSGV_EXCEPT(std::string("OnDemandVegetation::createTileChildren - createRoot not called").c_str());
+
+		std::stringstream ss;
+		ss << m_Name << "_" << ld << "_" << x << "_" << y << ".osgb";
+		const std::string cache_file = m_CacheDirectory != "" ? osgDB::concatPaths(m_CacheDirectory, ss.str()) : "";
+		if(cache_file != "" && osgDB::fileExists(cache_file))
+		{
+			osg::Node* node = osgDB::readNodeFile(cache_file);
+			if(node)
+				return node;
+		}
+
+		osg::Node* node = NULL;
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_GenerateMutex);
+			node = m_Scattering->generateTileChildren(ld, x, y);
+		}
+
+		if(node && cache_file != "")
+		{
+			osg::ref_ptr<osgDB::Options> options = new osgDB::Options("WriteImageHint=IncludeData");
+			if(!osgDB::writeNodeFile(*node, cache_file, options.get()))
+				OSG_WARN << "OnDemandVegetation::createTileChildren - failed to write cache file: " << cache_file << std::endl;
+		}
+		return node;
+	}
+
+	OnDemandVegetation* OnDemandVegetation::getRegistered(const std::string &name)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_RegistryMutex);
+		RegistryMap::iterator iter = m_Registry.find(name);
+		if(iter != m_Registry.end())
+			return iter->second.get();
+		return NULL;
+	}
+
+	void OnDemandVegetation::unregister(const std::string &name)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_RegistryMutex);
+		m_Registry.erase(name);
+	}
+
+	/**
+		Pseudo loader for on demand vegetation tiles, file names are
+		<name>_<level>_<x>_<y>.osgveg where name is a registered OnDemandVegetation.
+	*/
+	class ReaderWriterOSGVEG : public osgDB::ReaderWriter
+	{
+	public:
+		ReaderWriterOSGVEG()
+		{
+			supportsExtension("osgveg", "osgVegetation on demand tile pseudo loader");
+		}
+
+		virtual const char* className() const { return "osgVegetation on demand tile pseudo loader"; }
+
+		virtual ReadResult readNode(const std::string& file, const osgDB::ReaderWriter::Options* /*options*/) const
+		{
+			const std::string ext = osgDB::getLowerCaseFileExtension(file);
+			if(!acceptsExtension(ext))
+				return ReadResult::FILE_NOT_HANDLED;
+
+			//database path may be prepended, only use file name
+			const std::string tile_name = osgDB::getNameLessExtension(osgDB::getSimpleFileName(file));
+			std::vector<std::string> tokens;
+			std::stringstream ss(tile_name);
+			std::string token;
+			while(std::getline(ss, token, '_'))
+				tokens.push_back(token);
+			if(tokens.size() != 4)
+				return ReadResult::FILE_NOT_HANDLED;
+
+			OnDemandVegetation* veg = OnDemandVegetation::getRegistered(tokens[0]);
+			if(veg == NULL)
+			{
+				OSG_WARN << "ReaderWriterOSGVEG::readNode - no on demand vegetation registered with name: " << tokens[0] << std::endl;
+				return ReadResult::FILE_NOT_FOUND;
+			}
+
+			int ld = 0;
+			unsigned int x = 0, y = 0;
+			std::stringstream(tokens[1]) >> ld;
+			std::stringstream(tokens[2]) >> x;
+			std::stringstream(tokens[3]) >> y;
+
+			osg::Node* node = veg->createTileChildren(ld, x, y);
+			if(node == NULL)
+				return ReadResult::ERROR_IN_READING_FILE;
+			return node;
+		}
+	};
+}
+
+REGISTER_OSGPLUGIN(osgveg, osgVegetation::ReaderWriterOSGVEG)
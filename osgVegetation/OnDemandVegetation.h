@@ -0,0 +1,84 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/Node>
+#include <osg/BoundingBox>
+#include <osg/ref_ptr>
+#include <OpenThreads/Mutex>
+#include <map>
+#include <string>
+#include "BillboardData.h"
+#include "EnvironmentSettings.h"
+
+namespace osgVegetation
+{
+	class ITerrainQuery;
+	class BillboardQuadTreeScattering;
+
+	/**
+		On demand billboard vegetation. Only the top tile is created up front, all other
+		tiles are generated at load time by the "osgveg" pseudo loader when requested by the
+		DatabasePager (tile files are named <name>_<level>_<x>_<y>.osgveg). No files are
+		needed on disk but generated tiles can optionally be cached in a directory.
+		The generator is registered by name when createRoot() is called so the pseudo loader can find it.
+		Tile generation is serialized because terrain queries and random number generation are not thread safe.
+	*/
+	class osgvExport OnDemandVegetation : public osg::Referenced
+	{
+	public:
+		/**
+			@param name Unique name used in tile file names
+			@param tq Terrain query used when scattering
+			@param env_settings Environment settings passed to the rendering technique
+			@param data Billboard layers and settings
+			@param bb Generation area
+			@param seed Base seed combined with tile index
+		*/
+		OnDemandVegetation(const std::string &name, ITerrainQuery* tq, const EnvironmentSettings &env_settings,
+			const BillboardData &data, const osg::BoundingBoxd &bb, unsigned int seed = 0);
+
+		/**
+			Create top tile and register this generator
+		*/
+		osg::Node* createRoot();
+
+		/**
+			Generate children of tile, used by the pseudo loader
+		*/
+		osg::Node* createTileChildren(int ld, unsigned int x, unsigned int y);
+
+		/**
+			Optional directory where generated tiles are saved and loaded from (as .osgb files), empty (default) disable cache.
+		*/
+		void setCacheDirectory(const std::string &value) {m_CacheDirectory = value;}
+		std::string getCacheDirectory() const {return m_CacheDirectory;}
+
+		std::string getName() const {return m_Name;}
+
+		/**
+			Find registered generator by name, NULL if not registered
+		*/
+		static OnDemandVegetation* getRegistered(const std::string &name);
+
+		/**
+			Remove generator from registry, tiles referencing it can no longer be loaded
+		*/
+		static void unregister(const std::string &name);
+	protected:
+		virtual ~OnDemandVegetation();
+	private:
+		std::string m_Name;
+		osg::ref_ptr<ITerrainQuery> m_TerrainQuery;
+		EnvironmentSettings m_EnvironmentSettings;
+		BillboardData m_Data;
+		osg::BoundingBoxd m_BoundingBox;
+		unsigned int m_Seed;
+		std::string m_CacheDirectory;
+		osg::ref_ptr<BillboardQuadTreeScattering> m_Scattering;
+
+		typedef std::map<std::string, osg::ref_ptr<OnDemandVegetation> > RegistryMap;
+		static RegistryMap m_Registry;
+		static OpenThreads::Mutex m_RegistryMutex;
+		static OpenThreads::Mutex m_GenerateMutex;
+	};
+}
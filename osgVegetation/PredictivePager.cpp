@@ -0,0 +1,250 @@
+#include "PredictivePager.h"
+#include <osg/PagedLOD>
+#include <osg/Transform>
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osg/Polytope>
+#include <algorithm>
+#include <vector>
+
+namespace osgVegetation
+{
+	struct PrefetchCandidate
+	{
+		std::string FileName;
+		osg::PagedLOD* PLOD;
+		unsigned int Child;
+		osg::NodePath Path;
+		double Distance;
+		float Priority;
+	};
+
+	bool PrefetchCandidateSortPredicate(const PrefetchCandidate &lhs, const PrefetchCandidate &rhs)
+	{
+		return lhs.Distance < rhs.Distance;
+	}
+
+	/**
+		Visitor that collect PagedLOD children that should be prefetched for predicted eye positions,
+		and tiles needed at current eye position (for statistics), needed tiles must also be inside the view frustum.
+		Only loaded children that are active at current or predicted positions are traversed.
+	*/
+	class PrefetchVisitor : public osg::NodeVisitor
+	{
+	public:
+		PrefetchVisitor(const osg::Vec3d &eye, const osg::Polytope &frustum, const std::vector<osg::Vec3d> &predicted, double margin) : m_Eye(eye),
+			m_Frustum(frustum),
+			m_Predicted(predicted),
+			m_Margin(margin)
+		{
+			setTraversalMode(TRAVERSE_ALL_CHILDREN);
+		}
+
+		void apply(osg::Transform& transform)
+		{
+			osg::Matrixd matrix = m_Matrices.empty() ? osg::Matrixd() : m_Matrices.back();
+			transform.computeLocalToWorldMatrix(matrix, this);
+			m_Matrices.push_back(matrix);
+			traverse(transform);
+			m_Matrices.pop_back();
+		}
+
+		void apply(osg::Geode& /*geode*/)
+		{
+			//nothing to page below geodes
+		}
+
+		void apply(osg::LOD& lod)
+		{
+			double eye_dist, pred_dist;
+			_getDistances(lod, eye_dist, pred_dist);
+			for(unsigned int i = 0; i < lod.getNumChildren() && i < lod.getNumRanges(); i++)
+			{
+				if(_isActive(lod, i, eye_dist, pred_dist))
+					lod.getChild(i)->accept(*this);
+			}
+		}
+
+		void apply(osg::PagedLOD& plod)
+		{
+			double eye_dist, pred_dist;
+			_getDistances(plod, eye_dist, pred_dist);
+			//tiles outside view frustum are not requested by cull traversal, not needed yet
+			const bool visible = _isInFrustum(plod);
+			for(unsigned int i = 0; i < plod.getNumRanges(); i++)
+			{
+				const bool loaded = i < plod.getNumChildren();
+				const bool needed = visible && plod.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT &&
+					eye_dist >= plod.getMinRange(i) && eye_dist < plod.getMaxRange(i);
+				const std::string file_name = i < plod.getNumFileNames() ? plod.getFileName(i) : "";
+				const std::string key = plod.getDatabasePath() + file_name;
+
+				if(loaded)
+				{
+					if(needed && file_name != "")
+						m_NeededLoaded.push_back(key);
+					if(_isActive(plod, i, eye_dist, pred_dist))
+						plod.getChild(i)->accept(*this);
+				}
+				else if(file_name != "")
+				{
+					if(needed)
+						m_NeededMissing.push_back(key);
+					//pixel size ranges can't be predicted from distance only, leave them to regular paging
+					else if(plod.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT &&
+						pred_dist >= plod.getMinRange(i) - m_Margin && pred_dist < plod.getMaxRange(i) + m_Margin)
+					{
+						PrefetchCandidate candidate;
+						candidate.FileName = key;
+						candidate.PLOD = &plod;
+						candidate.Child = i;
+						candidate.Path = getNodePath();
+						candidate.Distance = pred_dist;
+						//below regular requests that use [0,1] priority range
+						candidate.Priority = -static_cast<float>(pred_dist / (plod.getMaxRange(i) + m_Margin + 1.0));
+						m_Candidates.push_back(candidate);
+					}
+				}
+			}
+		}
+
+		std::vector<PrefetchCandidate> m_Candidates;
+		std::vector<std::string> m_NeededLoaded;
+		std::vector<std::string> m_NeededMissing;
+	private:
+		void _getDistances(const osg::LOD &lod, double &eye_dist, double &pred_dist) const
+		{
+			osg::Vec3d center = lod.getCenter();
+			if(!m_Matrices.empty())
+				center = center * m_Matrices.back();
+			eye_dist = (m_Eye - center).length();
+			pred_dist = eye_dist;
+			for(size_t i = 0; i < m_Predicted.size(); i++)
+				pred_dist = std::min(pred_dist, (m_Predicted[i] - center).length());
+		}
+
+		bool _isInFrustum(const osg::LOD &lod)
+		{
+			osg::Vec3d center = lod.getCenter();
+			if(!m_Matrices.empty())
+				center = center * m_Matrices.back();
+			//vegetation is only translated (see quad tree scattering), radius is kept as is
+			const double radius = lod.getRadius() > 0 ? lod.getRadius() : lod.getBound().radius();
+			return m_Frustum.contains(osg::BoundingSphere(center, radius));
+		}
+
+		bool _isActive(const osg::LOD &lod, unsigned int i, double eye_dist, double pred_dist) const
+		{
+			if(lod.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN)
+				return true;
+			const double dist = std::min(eye_dist, pred_dist);
+			return dist >= lod.getMinRange(i) - m_Margin && dist < lod.getMaxRange(i) + m_Margin;
+		}
+
+		osg::Vec3d m_Eye;
+		osg::Polytope m_Frustum;
+		std::vector<osg::Vec3d> m_Predicted;
+		double m_Margin;
+		std::vector<osg::Matrixd> m_Matrices;
+	};
+
+	PredictivePager::PredictivePager(osg::Node* vegetation, osgDB::DatabasePager* pager) : m_Vegetation(vegetation),
+		m_Pager(pager),
+		m_LookAheadTime(2.0),
+		m_MaxRequestsPerFrame(8),
+		m_RangeMargin(0),
+		m_HasLastEye(false),
+		m_LastTime(0),
+		m_NumPrefetched(0),
+		m_NumHits(0),
+		m_NumLate(0),
+		m_NumLatePrefetched(0)
+	{
+		if(!m_Vegetation.valid() || !m_Pager.valid())
+			OSGV_EXCEPT(std::string("PredictivePager::PredictivePager - vegetation node and database pager must be provided").c_str());
+	}
+
+	void PredictivePager::update(const osg::Camera* camera, const osg::FrameStamp* frame_stamp)
+	{
+		const osg::Vec3d eye = camera->getInverseViewMatrix().getTrans();
+		//view frustum in world coordinates
+		osg::Polytope frustum;
+		frustum.setToUnitFrustum();
+		frustum.transformProvidingInverse(camera->getViewMatrix()*camera->getProjectionMatrix());
+
+		const double time = frame_stamp->getReferenceTime();
+		if(m_HasLastEye && time > m_LastTime)
+		{
+			const osg::Vec3d velocity = (eye - m_LastEye) / (time - m_LastTime);
+			//smooth to reduce jitter from frame time variation
+			m_Velocity = m_Velocity*0.5 + velocity*0.5;
+		}
+		m_HasLastEye = true;
+		m_LastEye = eye;
+		m_LastTime = time;
+
+		//sample predicted path, not only end point, to get tiles along the path
+		const int num_steps = 4;
+		std::vector<osg::Vec3d> predicted;
+		for(int i = 1; i <= num_steps; i++)
+			predicted.push_back(eye + m_Velocity*(m_LookAheadTime*i / num_steps));
+
+		PrefetchVisitor pv(eye, frustum, predicted, m_RangeMargin);
+		m_Vegetation->accept(pv);
+
+		//classify tiles the first time they are needed
+		for(size_t i = 0; i < pv.m_NeededLoaded.size(); i++)
+		{
+			TileStateMap::iterator iter = m_TileStates.find(pv.m_NeededLoaded[i]);
+			if(iter != m_TileStates.end() && iter->second == TS_PREFETCHED)
+			{
+				iter->second = TS_HIT;
+				m_NumHits++;
+			}
+		}
+
+		for(size_t i = 0; i < pv.m_NeededMissing.size(); i++)
+		{
+			TileStateMap::iterator iter = m_TileStates.find(pv.m_NeededMissing[i]);
+			if(iter == m_TileStates.end())
+			{
+				m_TileStates[pv.m_NeededMissing[i]] = TS_LATE;
+				m_NumLate++;
+			}
+			else if(iter->second == TS_PREFETCHED)
+			{
+				iter->second = TS_LATE;
+				m_NumLate++;
+				m_NumLatePrefetched++;
+			}
+		}
+
+		//closest first, requests must be renewed each frame until loaded
+		std::sort(pv.m_Candidates.begin(), pv.m_Candidates.end(), PrefetchCandidateSortPredicate);
+		for(size_t i = 0; i < pv.m_Candidates.size() && i < m_MaxRequestsPerFrame; i++)
+		{
+			PrefetchCandidate &candidate = pv.m_Candidates[i];
+			m_Pager->requestNodeFile(candidate.FileName, candidate.Path, candidate.Priority, frame_stamp,
+				candidate.PLOD->getDatabaseRequest(candidate.Child), candidate.PLOD->getDatabaseOptions());
+			if(m_TileStates.find(candidate.FileName) == m_TileStates.end())
+			{
+				m_TileStates[candidate.FileName] = TS_PREFETCHED;
+				m_NumPrefetched++;
+			}
+		}
+	}
+
+	void PredictivePager::report(std::ostream &os) const
+	{
+		unsigned int num_unused = 0;
+		for(TileStateMap::const_iterator iter = m_TileStates.begin(); iter != m_TileStates.end(); ++iter)
+		{
+			if(iter->second == TS_PREFETCHED)
+				num_unused++;
+		}
+		os << "Predictive paging, prefetched:" << m_NumPrefetched
+			<< " hits:" << m_NumHits
+			<< " late:" << m_NumLate << " (prefetched but late:" << m_NumLatePrefetched << ")"
+			<< " unused prefetch:" << num_unused << std::endl;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/Node>
+#include <osg/Camera>
+#include <osg/FrameStamp>
+#include <osg/ref_ptr>
+#include <osgDB/DatabasePager>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace osgVegetation
+{
+	/**
+		Camera motion aware prefetcher for PagedLOD vegetation tiles.
+		Camera velocity is estimated from eye positions provided each frame and the eye
+		is extrapolated along the path for the look ahead time. PagedLOD children that will be in
+		range at any of the predicted positions are requested from the DatabasePager ahead of time,
+		closest first and limited by the prefetch budget.
+		The pager drop requests that are not renewed, so update() must be called once every frame.
+		Statistics are collected by also checking which tiles are needed at the current eye position
+		(in range and inside current view frustum): hits are prefetched tiles that were loaded before being needed, 
+		late are tiles that were needed but not yet loaded.
+	*/
+	class osgvExport PredictivePager : public osg::Referenced
+	{
+	public:
+		PredictivePager(osg::Node* vegetation, osgDB::DatabasePager* pager);
+
+		/**
+			Time (seconds) to extrapolate camera motion, default 2
+		*/
+		void setLookAheadTime(double value) {m_LookAheadTime = value;}
+		double getLookAheadTime() const {return m_LookAheadTime;}
+
+		/**
+			Max number of active prefetch requests each frame, default 8
+		*/
+		void setMaxRequestsPerFrame(unsigned int value) {m_MaxRequestsPerFrame = value;}
+		unsigned int getMaxRequestsPerFrame() const {return m_MaxRequestsPerFrame;}
+
+		/**
+			Extra distance (meters) added to LOD ranges when selecting tiles to prefetch, default 0
+		*/
+		void setRangeMargin(double value) {m_RangeMargin = value;}
+		double getRangeMargin() const {return m_RangeMargin;}
+
+		/**
+			Update camera motion and issue prefetch requests, call once each frame after frame()
+			@param camera Main camera, eye position and view frustum are taken from view and projection matrix
+			@param frame_stamp Current frame stamp
+		*/
+		void update(const osg::Camera* camera, const osg::FrameStamp* frame_stamp);
+
+		unsigned int getNumPrefetched() const {return m_NumPrefetched;}
+		unsigned int getNumHits() const {return m_NumHits;}
+		unsigned int getNumLate() const {return m_NumLate;}
+		unsigned int getNumLatePrefetched() const {return m_NumLatePrefetched;}
+
+		/**
+			Write hit/late statistics
+		*/
+		void report(std::ostream &os) const;
+	private:
+		enum TileState
+		{
+			TS_PREFETCHED,
+			TS_HIT,
+			TS_LATE
+		};
+		typedef std::map<std::string, TileState> TileStateMap;
+
+		osg::ref_ptr<osg::Node> m_Vegetation;
+		osg::ref_ptr<osgDB::DatabasePager> m_Pager;
+		double m_LookAheadTime;
+		unsigned int m_MaxRequestsPerFrame;
+		double m_RangeMargin;
+
+		//camera motion
+		bool m_HasLastEye;
+		osg::Vec3d m_LastEye;
+		double m_LastTime;
+		osg::Vec3d m_Velocity;
+
+		TileStateMap m_TileStates;
+		unsigned int m_NumPrefetched;
+		unsigned int m_NumHits;
+		unsigned int m_NumLate;
+		unsigned int m_NumLatePrefetched;
+	};
+}
@@ -0,0 +1,378 @@
+#include "ProgramCache.h"
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osg/Version>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <OpenThreads/ScopedLock>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+namespace osgVegetation
+{
+	static osg::Program::PerContextProgram* GetPCP(const osg::Program* program, osg::State &state)
+	{
+		//getPCP take state since 3.5.3
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,3)
+		return program->getPCP(state);
+#else
+		return program->getPCP(state.getContextID());
+#endif
+	}
+
+	static std::string GetDefineString(const osg::Program::PerContextProgram* pcp)
+	{
+		//one program object for each state set define combination since 3.5.3
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,3)
+		return pcp->getDefineString();
+#else
+		return "";
+#endif
+	}
+
+	/**
+		Program that set the binary of the define combination being linked. osg::Program hold one binary
+		that is used by all program objects, binary is only set while linking and cleared afterwards.
+		Written to file as osg::Program (no META_StateAttribute).
+	*/
+	class BinaryProgram : public osg::Program
+	{
+	public:
+		BinaryProgram(const osg::Program &program) : osg::Program(program, osg::CopyOp::SHALLOW_COPY) {}
+
+		//osg::Program::apply compile and link through this method when program object need link
+		virtual void compileGLObjects(osg::State& state) const
+		{
+			osg::Program::PerContextProgram* pcp = GetPCP(this, state);
+			if(pcp == NULL || !pcp->needsLink())
+			{
+				osg::Program::compileGLObjects(state);
+				return;
+			}
+			const std::string defines = GetDefineString(pcp);
+			ProgramCache* cache = ProgramCache::instance();
+			osg::ref_ptr<osg::ProgramBinary> binary = cache->_loadBinary(this, defines);
+			{
+				//binary is shared by all contexts
+				static OpenThreads::Mutex link_mutex;
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(link_mutex);
+				BinaryProgram* self = const_cast<BinaryProgram*>(this);
+				self->setProgramBinary(binary.get());
+				osg::Program::compileGLObjects(state);
+				self->setProgramBinary(NULL);
+			}
+			cache->_programLinked(this, pcp, state.getContextID(), defines, binary.valid());
+		}
+	protected:
+		virtual ~BinaryProgram() {}
+	};
+
+	ProgramCache::ProgramCache() : m_NumHits(0)
+	{
+
+	}
+
+	ProgramCache::~ProgramCache()
+	{
+
+	}
+
+	ProgramCache* ProgramCache::instance()
+	{
+		static osg::ref_ptr<ProgramCache> cache = new ProgramCache();
+		return cache.get();
+	}
+
+	osg::Program* ProgramCache::getProgram(const std::string &key)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		ProgramMap::iterator iter = m_Programs.find(key);
+		if(iter != m_Programs.end())
+		{
+			m_NumHits++;
+			return iter->second.get();
+		}
+		return NULL;
+	}
+
+	osg::Program* ProgramCache::addProgram(const std::string &key, osg::Program* program)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		ProgramMap::iterator iter = m_Programs.find(key);
+		if(iter != m_Programs.end())
+			return iter->second.get();
+		program = _addProgram(_getSourceKey(program), program);
+		m_Programs[key] = program;
+		return program;
+	}
+
+	osg::Program* ProgramCache::_addProgram(const std::string &source_key, osg::Program* program)
+	{
+		//different variant keys can still end up with identical sources
+		ProgramMap::iterator iter = m_SourcePrograms.find(source_key);
+		if(iter != m_SourcePrograms.end())
+			return iter->second.get();
+		//binaries are set for each define combination when linked
+		if(m_BinaryDirectory != "")
+			program = new BinaryProgram(*program);
+		m_SourcePrograms[source_key] = program;
+		return program;
+	}
+
+	unsigned int ProgramCache::getNumPrograms() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		return static_cast<unsigned int>(m_SourcePrograms.size());
+	}
+
+	void ProgramCache::clear()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		m_Programs.clear();
+		m_SourcePrograms.clear();
+		m_UnsavedPrograms.clear();
+		m_NumHits = 0;
+	}
+
+	std::string ProgramCache::_getSourceKey(const osg::Program* program) const
+	{
+		std::stringstream ss;
+		ss << program->getName() << "\n";
+		for(unsigned int i = 0; i < program->getNumShaders(); i++)
+		{
+			const osg::Shader* shader = program->getShader(i);
+			ss << "#shader " << shader->getType() << "\n" << shader->getShaderSource() << "\n";
+		}
+		ss << "#parameters "
+			<< program->getParameter(GL_GEOMETRY_VERTICES_OUT_EXT) << " "
+			<< program->getParameter(GL_GEOMETRY_INPUT_TYPE_EXT) << " "
+			<< program->getParameter(GL_GEOMETRY_OUTPUT_TYPE_EXT) << "\n";
+		return ss.str();
+	}
+
+	std::string ProgramCache::readDriverInfo()
+	{
+		const GLubyte* vendor = glGetString(GL_VENDOR);
+		const GLubyte* renderer = glGetString(GL_RENDERER);
+		const GLubyte* version = glGetString(GL_VERSION);
+		std::stringstream ss;
+		ss << (vendor ? reinterpret_cast<const char*>(vendor) : "") << "|"
+			<< (renderer ? reinterpret_cast<const char*>(renderer) : "") << "|"
+			<< (version ? reinterpret_cast<const char*>(version) : "");
+		return ss.str();
+	}
+
+	void ProgramCache::setDriverInfo(const std::string &driver_info)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		m_DriverInfo = driver_info;
+	}
+
+	std::string ProgramCache::getDriverInfo() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		return m_DriverInfo;
+	}
+
+	void ProgramCache::DriverInfoOperation::operator()(osg::GraphicsContext* /*gc*/)
+	{
+		ProgramCache::instance()->setDriverInfo(ProgramCache::readDriverInfo());
+	}
+
+	std::string ProgramCache::_getBinaryFileName(const osg::Program* program, const std::string &defines) const
+	{
+		//FNV-1a hash of driver, sources and define combination
+		const std::string source = m_DriverInfo + "\n" + _getSourceKey(program) + "#defines " + defines + "\n";
+		unsigned long long hash = 14695981039346656037ULL;
+		for(size_t i = 0; i < source.size(); i++)
+		{
+			hash ^= static_cast<unsigned char>(source[i]);
+			hash *= 1099511628211ULL;
+		}
+		std::stringstream ss;
+		ss << std::hex << hash << ".bin";
+		return osgDB::concatPaths(m_BinaryDirectory, ss.str());
+	}
+
+	osg::ProgramBinary* ProgramCache::_loadBinary(const osg::Program* program, const std::string &defines) const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		if(m_BinaryDirectory == "" || m_DriverInfo == "")
+			return NULL;
+		const std::string filename = _getBinaryFileName(program, defines);
+		if(!osgDB::fileExists(filename))
+			return NULL;
+
+		std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+		unsigned int format = 0;
+		file.read(reinterpret_cast<char*>(&format), sizeof(format));
+		std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if(!file.good() && !file.eof())
+		{
+			OSG_WARN << "ProgramCache::_loadBinary - failed to read program binary: " << filename << std::endl;
+			return NULL;
+		}
+		if(data.size() == 0)
+			return NULL;
+
+		osg::ProgramBinary* binary = new osg::ProgramBinary;
+		binary->setFormat(static_cast<GLenum>(format));
+		binary->assign(static_cast<unsigned int>(data.size()), reinterpret_cast<const unsigned char*>(&data[0]));
+		return binary;
+	}
+
+	void ProgramCache::_programLinked(const osg::Program* program, osg::Program::PerContextProgram* pcp, unsigned int context_id, const std::string &defines, bool from_binary)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		if(from_binary)
+		{
+			if(!pcp->isLinked())
+			{
+				//binary failed to link (driver mismatch), delete it and relink this combination from source
+				const std::string filename = _getBinaryFileName(program, defines);
+				OSG_WARN << "ProgramCache - program binary failed to link, relinking from source: " << filename << std::endl;
+				std::remove(filename.c_str());
+				pcp->requestLink();
+			}
+			return;
+		}
+		if(!pcp->isLinked())
+			return;
+		LinkedProgram linked;
+		linked.Program = program;
+		linked.PCP = pcp;
+		linked.ContextID = context_id;
+		linked.Defines = defines;
+		m_UnsavedPrograms.push_back(linked);
+	}
+
+	void ProgramCache::setBinaryDirectory(const std::string &dir)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		m_BinaryDirectory = dir;
+		if(m_BinaryDirectory != "" && !osgDB::makeDirectory(m_BinaryDirectory))
+			OSG_WARN << "ProgramCache::setBinaryDirectory - failed to create directory: " << m_BinaryDirectory << std::endl;
+	}
+
+	unsigned int ProgramCache::saveProgramBinaries(osg::State &state)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		if(m_BinaryDirectory == "" || m_DriverInfo == "")
+			return 0;
+		unsigned int num_saved = 0;
+		for(size_t i = 0; i < m_UnsavedPrograms.size();)
+		{
+			const LinkedProgram &linked = m_UnsavedPrograms[i];
+			//program object can be relinked (dirtyProgram) before binary is saved, retry after next link
+			if(linked.ContextID != state.getContextID() || !linked.PCP->isLinked())
+			{
+				i++;
+				continue;
+			}
+
+			//only removed when binary is written, transient failures are retried next call
+			osg::ref_ptr<osg::ProgramBinary> binary = linked.PCP->compileProgramBinary(state);
+			if(!binary.valid() || binary->getSize() == 0)
+			{
+				i++;
+				continue;
+			}
+
+			const std::string filename = _getBinaryFileName(linked.Program.get(), linked.Defines);
+			std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+			const unsigned int format = static_cast<unsigned int>(binary->getFormat());
+			file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+			file.write(reinterpret_cast<const char*>(binary->getData()), binary->getSize());
+			if(!file.good())
+			{
+				OSG_WARN << "ProgramCache::saveProgramBinaries - failed to write program binary: " << filename << std::endl;
+				i++;
+				continue;
+			}
+			m_UnsavedPrograms.erase(m_UnsavedPrograms.begin() + i);
+			num_saved++;
+		}
+		return num_saved;
+	}
+
+	void ProgramCache::SaveBinariesCallback::operator()(osg::RenderInfo& renderInfo) const
+	{
+		ProgramCache::instance()->saveProgramBinaries(*renderInfo.getState());
+	}
+
+	osgDB::ReaderWriter::ReadResult ProgramCache::ShareProgramsReadCallback::readNode(const std::string& filename, const osgDB::Options* options)
+	{
+		osgDB::ReaderWriter::ReadResult result = osgDB::ReadFileCallback::readNode(filename, options);
+		if(result.validNode())
+			ProgramCache::instance()->shareLoadedPrograms(result.getNode());
+		return result;
+	}
+
+	class ShareProgramsVisitor : public osg::NodeVisitor
+	{
+	public:
+		ShareProgramsVisitor(ProgramCache* cache) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+			m_Cache(cache),
+			m_NumReplaced(0)
+		{
+
+		}
+
+		void apply(osg::Node& node)
+		{
+			_shareProgram(node.getStateSet());
+			traverse(node);
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			_shareProgram(geode.getStateSet());
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+				_shareProgram(geode.getDrawable(i)->getStateSet());
+		}
+
+		unsigned int getNumReplaced() const {return m_NumReplaced;}
+	private:
+		void _shareProgram(osg::StateSet* ss)
+		{
+			if(ss == NULL)
+				return;
+			const osg::StateSet::RefAttributePair* pair = ss->getAttributePair(osg::StateAttribute::PROGRAM);
+			if(pair == NULL)
+				return;
+			osg::Program* program = dynamic_cast<osg::Program*>(pair->first.get());
+			if(program == NULL)
+				return;
+			const osg::StateAttribute::OverrideValue value = pair->second;
+			osg::Program* shared = m_Cache->addSourceProgram(program);
+			if(shared != program)
+			{
+				ss->setAttribute(shared, value);
+				m_NumReplaced++;
+			}
+		}
+		ProgramCache* m_Cache;
+		unsigned int m_NumReplaced;
+	};
+
+	osg::Program* ProgramCache::addSourceProgram(osg::Program* program)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		osg::Program* shared = _addProgram(_getSourceKey(program), program);
+		if(shared != program)
+			m_NumHits++;
+		return shared;
+	}
+
+	unsigned int ProgramCache::shareLoadedPrograms(osg::Node* node)
+	{
+		if(node == NULL)
+			return 0;
+		ShareProgramsVisitor visitor(this);
+		node->accept(visitor);
+		return visitor.getNumReplaced();
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Program>
+#include <osg/Camera>
+#include <osg/GraphicsContext>
+#include <osg/State>
+#include <osg/Node>
+#include <osgDB/Callbacks>
+#include <OpenThreads/Mutex>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Process wide cache of shader programs shared by all rendering techniques.
+		Programs created by the techniques are looked up by variant key (see ShaderLibrary::getProgramKey),
+		data sets with same flags will then share one osg::Program and it's only compiled and linked once per context.
+		Programs in loaded files can also be shared by shader source (see shareLoadedPrograms).
+		Optionally program binaries can be stored in a directory and used on later startups to skip GLSL compilation,
+		binary files are named by hash of the shader sources, active shader defines and driver (GL_VENDOR, GL_RENDERER and GL_VERSION)
+		so changed shaders or drivers never pick up stale binaries. Programs that use shader defines from state sets
+		(DefineList, OSG 3.5.3 and later) link one program object for each define combination, each combination get its own binary.
+		Binaries are loaded when a combination is linked, only when driver is known (see DriverInfoOperation).
+		If a binary still fail to link it is deleted and the combination is relinked from source.
+		Only programs added after setBinaryDirectory use binaries.
+	*/
+	class osgvExport ProgramCache : public osg::Referenced
+	{
+	public:
+		static ProgramCache* instance();
+
+		/**
+			Get cached program, NULL if no program is cached for key
+		*/
+		osg::Program* getProgram(const std::string &key);
+
+		/**
+			Add program to cache. If another program was added with same key
+			the cached program is returned, otherwise the provided program.
+		*/
+		osg::Program* addProgram(const std::string &key, osg::Program* program);
+
+		/**
+			Add program to cache by shader source. If a program with identical sources
+			is cached that program is returned, otherwise the provided program.
+		*/
+		osg::Program* addSourceProgram(osg::Program* program);
+
+		/**
+			Replace programs in node state sets with cached programs with identical shader sources,
+			programs not found in cache are added.
+			@return Number of replaced programs
+		*/
+		unsigned int shareLoadedPrograms(osg::Node* node);
+
+		/**
+			Set directory used to load and save program binaries, empty string disable binaries (default).
+			Must be set before programs are added.
+		*/
+		void setBinaryDirectory(const std::string &dir);
+		const std::string& getBinaryDirectory() const {return m_BinaryDirectory;}
+
+		/**
+			Set driver identification used in binary file names, binaries are only loaded and saved
+			when driver is set. Use DriverInfoOperation to set driver from realized context.
+		*/
+		void setDriverInfo(const std::string &driver_info);
+		std::string getDriverInfo() const;
+
+		/**
+			Read GL_VENDOR, GL_RENDERER and GL_VERSION, must be called with context current
+		*/
+		static std::string readDriverInfo();
+
+		/**
+			Save binaries of define combinations linked from source in state's context.
+			Combinations are retried on later calls until the binary file is written.
+			Must be called with context current (draw thread), see SaveBinariesCallback
+			@return Number of saved binaries
+		*/
+		unsigned int saveProgramBinaries(osg::State &state);
+
+		unsigned int getNumPrograms() const;
+		unsigned int getNumHits() const {return m_NumHits;}
+		void clear();
+
+		/**
+			Camera draw callback that save new program binaries each frame
+		*/
+		class osgvExport SaveBinariesCallback : public osg::Camera::DrawCallback
+		{
+		public:
+			virtual void operator()(osg::RenderInfo& renderInfo) const;
+		};
+
+		/**
+			Realize operation that set driver info from the realized context (see setDriverInfo),
+			must be set before viewer is realized to load binaries before first frame.
+		*/
+		class osgvExport DriverInfoOperation : public osg::GraphicsOperation
+		{
+		public:
+			DriverInfoOperation() : osg::GraphicsOperation("ProgramCacheDriverInfo", false) {}
+			virtual void operator()(osg::GraphicsContext* gc);
+		};
+
+		/**
+			Read file callback that share programs in all loaded nodes (including paged tiles), see shareLoadedPrograms
+		*/
+		class osgvExport ShareProgramsReadCallback : public osgDB::ReadFileCallback
+		{
+		public:
+			virtual osgDB::ReaderWriter::ReadResult readNode(const std::string& filename, const osgDB::Options* options);
+		};
+	private:
+		friend class BinaryProgram;
+		struct LinkedProgram
+		{
+			osg::ref_ptr<const osg::Program> Program;
+			osg::ref_ptr<osg::Program::PerContextProgram> PCP;
+			unsigned int ContextID;
+			std::string Defines;
+		};
+
+		ProgramCache();
+		virtual ~ProgramCache();
+		std::string _getSourceKey(const osg::Program* program) const;
+		std::string _getBinaryFileName(const osg::Program* program, const std::string &defines) const;
+		osg::ProgramBinary* _loadBinary(const osg::Program* program, const std::string &defines) const;
+		void _programLinked(const osg::Program* program, osg::Program::PerContextProgram* pcp, unsigned int context_id, const std::string &defines, bool from_binary);
+		osg::Program* _addProgram(const std::string &key, osg::Program* program);
+
+		typedef std::map<std::string, osg::ref_ptr<osg::Program> > ProgramMap;
+		ProgramMap m_Programs;
+		ProgramMap m_SourcePrograms;
+		//define combinations linked from source, binaries not saved yet
+		std::vector<LinkedProgram> m_UnsavedPrograms;
+		std::string m_BinaryDirectory;
+		std::string m_DriverInfo;
+		unsigned int m_NumHits;
+		mutable OpenThreads::Mutex m_Mutex;
+	};
+}
@@ -0,0 +1,102 @@
+#include "QuadTreeSubdivision.h"
+#include <osg/PagedLOD>
+#include <osgDB/FileNameUtils>
+#include <osgDB/WriteFile>
+#include <cfloat>
+#include <iostream>
+#include <sstream>
+
+namespace osgVegetation
+{
+	QuadTreeSubdivision::QuadTreeSubdivision() : NumInnerTiles(0),
+		NumLODNodes(0),
+		NumTileFiles(0),
+		NumSplitTiles(0),
+		NumSubTiles(0)
+	{
+
+	}
+
+	void QuadTreeSubdivision::reset()
+	{
+		NumInnerTiles = 0;
+		NumLODNodes = 0;
+		NumTileFiles = 0;
+		NumSplitTiles = 0;
+		NumSubTiles = 0;
+	}
+
+	void QuadTreeSubdivision::report(bool adaptive_subdivision, unsigned int max_tile_instances, bool paged_lod) const
+	{
+		if(adaptive_subdivision)
+		{
+			std::cout << "Adaptive subdivision, LOD nodes:" << NumLODNodes << " of:" << NumInnerTiles
+				<< " (saved:" << NumInnerTiles - NumLODNodes << ")";
+			if(paged_lod)
+				std::cout << " Tile files:" << NumTileFiles << " of:" << NumInnerTiles
+					<< " (saved:" << NumInnerTiles - NumTileFiles << ")";
+			std::cout << std::endl;
+		}
+		if(max_tile_instances > 0)
+		{
+			std::cout << "Tiles split due to instance budget (" << max_tile_instances << "):" << NumSplitTiles
+				<< " Sub tiles:" << NumSubTiles;
+			if(paged_lod)
+				std::cout << " (one file each)";
+			std::cout << std::endl;
+		}
+	}
+
+	bool QuadTreeSubdivision::needSplit(size_t num_instances, unsigned int max_tile_instances, int split_depth)
+	{
+		return max_tile_instances > 0 && num_instances > max_tile_instances && split_depth < MAX_SPLIT_DEPTH;
+	}
+
+	void QuadTreeSubdivision::getQuadrantRegions(const osg::BoundingBoxd &region, osg::BoundingBoxd quadrant_regions[4])
+	{
+		const osg::Vec3d center = region.center();
+		for(int i = 0; i < 4; i++)
+		{
+			const bool upper_x = (i & 1) != 0;
+			const bool upper_y = (i & 2) != 0;
+			quadrant_regions[i].set(upper_x ? center.x() : region.xMin(), upper_y ? center.y() : region.yMin(), region.zMin(),
+				upper_x ? region.xMax() : center.x(), upper_y ? region.yMax() : center.y(), region.zMax());
+		}
+	}
+
+	std::string QuadTreeSubdivision::getSubTileFileName(const std::string &base_name, int split_depth, int quadrant_path)
+	{
+		std::stringstream sstream;
+		sstream << osgDB::getNameLessExtension(base_name) << "_S" << split_depth << "_" << quadrant_path << "." << osgDB::getFileExtension(base_name);
+		return sstream.str();
+	}
+
+	osg::Group* QuadTreeSubdivision::createSplitNode(int split_depth)
+	{
+		if(split_depth == 0)
+			NumSplitTiles++;
+		return new osg::Group;
+	}
+
+	void QuadTreeSubdivision::addSubTile(osg::Group* group, osg::Node* sub_tile, const osg::BoundingBoxd &bb, const std::string &save_path, const std::string &filename)
+	{
+		NumSubTiles++;
+		if(save_path == "")
+		{
+			group->addChild(sub_tile);
+			return;
+		}
+
+		//keep reference to avoid leak if sub tile is not referenced by writer
+		osg::ref_ptr<osg::Node> sub_tile_ref = sub_tile;
+		osg::PagedLOD* plod = new osg::PagedLOD;
+		plod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
+		plod->setCenter(bb.center());
+		plod->setRadius(bb.radius());
+		//view range is decided by owning tile, sub tile is loaded when inside view frustum
+		plod->setFileName(0, filename);
+		plod->setRange(0, 0, FLT_MAX);
+		osgDB::writeNodeFile(*sub_tile_ref, save_path + filename);
+		group->addChild(plod);
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Group>
+#include <osg/Node>
+#include <osg/ref_ptr>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Adaptive subdivision helpers shared by BillboardQuadTreeScattering and MeshQuadTreeScattering.
+		Tiles with more instances than the instance budget (MaxTileInstances) are split into quadrant
+		sub tiles (same regions as the quad tree children) until each sub tile is within budget.
+		Sub tiles are added as child nodes of the tile, with paged LOD each sub tile is saved to its own
+		file and referenced by a PagedLOD node with tight center and radius, this way dense areas are paged
+		and culled in balanced pieces while view ranges (and billboard fade radius) are kept from the owning tile.
+		Also hold the counters used for the node and file savings report.
+	*/
+	class osgvExport QuadTreeSubdivision
+	{
+	public:
+		QuadTreeSubdivision();
+
+		/**
+			Reset all counters, call before generation
+		*/
+		void reset();
+
+		/**
+			Print adaptive subdivision and instance budget report
+		*/
+		void report(bool adaptive_subdivision, unsigned int max_tile_instances, bool paged_lod) const;
+
+		/**
+			Check if tile with num_instances should be split
+		*/
+		static bool needSplit(size_t num_instances, unsigned int max_tile_instances, int split_depth);
+
+		/**
+			Split region into quadrant regions, index is (x < center ? 0 : 1) + (y < center ? 0 : 2)
+		*/
+		static void getQuadrantRegions(const osg::BoundingBoxd &region, osg::BoundingBoxd quadrant_regions[4]);
+
+		/**
+			Distribute instances to quadrants of region, see getQuadrantRegions
+		*/
+		template<class T>
+		static void splitInstances(const std::vector<osg::ref_ptr<T> > &instances, const osg::BoundingBoxd &region, std::vector<osg::ref_ptr<T> > quadrant_instances[4])
+		{
+			const osg::Vec3d center = region.center();
+			for(size_t i = 0; i < instances.size(); i++)
+			{
+				const osg::Vec3 &pos = instances[i]->Position;
+				const int index = (pos.x() < center.x() ? 0 : 1) + (pos.y() < center.y() ? 0 : 2);
+				quadrant_instances[index].push_back(instances[i]);
+			}
+		}
+
+		/**
+			Sub tile file name, base name is tile file name (or tile file name with layer postfix)
+		*/
+		static std::string getSubTileFileName(const std::string &base_name, int split_depth, int quadrant_path);
+
+		/**
+			Create node for split tile, quadrant nodes are added to returned group
+		*/
+		osg::Group* createSplitNode(int split_depth);
+
+		/**
+			Add sub tile (within budget) to group. If save_path is set the sub tile is saved to file and
+			referenced by a PagedLOD node that is always active when traversed.
+			@param sub_tile Sub tile geometry
+			@param bb Tight bound of sub tile
+			@param save_path Path used for sub tile files, empty string add sub tile directly
+			@param filename Sub tile file name, see getSubTileFileName
+		*/
+		void addSubTile(osg::Group* group, osg::Node* sub_tile, const osg::BoundingBoxd &bb, const std::string &save_path, const std::string &filename);
+
+		//max number of quadrant splits of a tile, avoid infinite recursion if instances share same position
+		static const int MAX_SPLIT_DEPTH = 8;
+
+		//inner quad tree tiles (before pruning)
+		int NumInnerTiles;
+		//created LOD/PagedLOD nodes
+		int NumLODNodes;
+		//saved quad tree tile files
+		int NumTileFiles;
+		//tiles split due to instance budget
+		int NumSplitTiles;
+		//sub tiles (and sub tile files) created by instance budget split
+		int NumSubTiles;
+	};
+}
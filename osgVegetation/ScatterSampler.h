@@ -0,0 +1,125 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Vec4>
+#include <string>
+#include <vector>
+#include "ITerrainQuery.h"
+#include "VegetationUtils.h"
+
+namespace osgVegetation
+{
+	/**
+		Scattered instance before technique specific data is added, position in world coordinates (terrain intersection)
+	*/
+	struct ScatterSample
+	{
+		ScatterSample() : ColorIntensity(1), Width(0), Height(0) {}
+		osg::Vec3d Position;
+		osg::Vec4 TerrainColor;
+		float ColorIntensity;
+		float Width;
+		float Height;
+	};
+
+	/**
+		Random generator using global rand() state, for scattering that is seeded by srand()
+	*/
+	class GlobalRandomGenerator
+	{
+	public:
+		double random(double min, double max) {return Utils::random(min, max);}
+	};
+
+	/**
+		Tile sampling shared by billboard and mesh scattering, all scatter paths use this class so that
+		exclusion, density and random order stay the same. Tiles are in local coordinates,
+		offset is added for terrain queries and samples outside the generation area are rejected.
+	*/
+	class ScatterSampler
+	{
+	public:
+		/**
+			@param tq Terrain query
+			@param offset Local to world offset
+			@param area Generation area in local coordinates
+		*/
+		ScatterSampler(ITerrainQuery* tq, const osg::Vec3d &offset, const osg::BoundingBoxd &area) : m_TerrainQuery(tq),
+			m_Offset(offset),
+			m_Area(area)
+		{
+
+		}
+
+		/**
+			Check if tile is inside exclusion zone, used to skip tiles before any terrain queries
+		*/
+		bool isTileExcluded(const osg::BoundingBoxd &bb) const
+		{
+			return m_TerrainQuery->isAreaExcluded(osg::BoundingBoxd(bb._min + m_Offset, bb._max + m_Offset));
+		}
+
+		/**
+			Query terrain at random position in tile (two random values), used for shared sample pools
+			@return false if position is outside generation area or terrain query fail
+		*/
+		template<class RandomType>
+		bool sampleTerrain(const osg::BoundingBoxd &bb, RandomType &rng, ScatterSample &sample, std::string &material_name) const
+		{
+			const double x = rng.random(bb.xMin(), bb.xMax());
+			const double y = rng.random(bb.yMin(), bb.yMax());
+			return _getTerrainData(osg::Vec3d(x, y, 0), sample, material_name);
+		}
+
+		/**
+			Scatter layer (BillboardLayer or MeshLayer) in tile, number of samples given by layer density.
+			Random values are drawn in fixed order: position, color intensity and for accepted samples size (see randomizeSize).
+		*/
+		template<class LayerType, class RandomType>
+		void scatterLayer(const LayerType &layer, const osg::BoundingBoxd &bb, RandomType &rng, std::vector<ScatterSample> &samples) const
+		{
+			if(isTileExcluded(bb))
+				return;
+			const osg::Vec3d size = bb._max - bb._min;
+			const unsigned int num_samples = size.x()*size.y()*layer.Density;
+			samples.reserve(samples.size() + num_samples);
+			for(unsigned int i = 0; i < num_samples; i++)
+			{
+				const double x = rng.random(bb.xMin(), bb.xMax());
+				const double y = rng.random(bb.yMin(), bb.yMax());
+				ScatterSample sample;
+				sample.ColorIntensity = rng.random(layer.ColorIntensity.x(), layer.ColorIntensity.y());
+				std::string material_name;
+				if(_getTerrainData(osg::Vec3d(x, y, 0), sample, material_name) && layer.hasCoverage(material_name))
+				{
+					randomizeSize(layer, rng, sample);
+					samples.push_back(sample);
+				}
+			}
+		}
+
+		/**
+			Set random width and height from layer intervals (three random values)
+		*/
+		template<class LayerType, class RandomType>
+		static void randomizeSize(const LayerType &layer, RandomType &rng, ScatterSample &sample)
+		{
+			const float scale = rng.random(layer.Scale.x(), layer.Scale.y());
+			sample.Width = rng.random(layer.Width.x(), layer.Width.y())*scale;
+			sample.Height = rng.random(layer.Height.x(), layer.Height.y())*scale;
+		}
+	private:
+		bool _getTerrainData(const osg::Vec3d &pos, ScatterSample &sample, std::string &material_name) const
+		{
+			if(!m_Area.contains(pos))
+				return false;
+			osg::Vec3d offset_pos = pos + m_Offset;
+			CoverageColor coverage_color;
+			return m_TerrainQuery->getTerrainData(offset_pos, sample.TerrainColor, material_name, coverage_color, sample.Position);
+		}
+
+		ITerrainQuery* m_TerrainQuery;
+		osg::Vec3d m_Offset;
+		osg::BoundingBoxd m_Area;
+	};
+}
@@ -3,6 +3,7 @@
 #include "BillboardLayer.h"
 #include "CoverageData.h"
 #include "TerrainQuery.h"
+#include <algorithm>
 #include <sstream>
 #include <iterator>
 
@@ -78,6 +79,7 @@ namespace osgVegetation
 
 				bl_elem->QueryBoolAttribute("UseTerrainIntensity", &layer.UseTerrainIntensity);
 				bl_elem->QueryDoubleAttribute("TerrainColorRatio", &layer.TerrainColorRatio);
+				bl_elem->QueryDoubleAttribute("ShadowDistance", &layer.ShadowDistance);
 
 
 				if (!bl_elem->Attribute("CoverageMaterials"))
@@ -97,13 +99,20 @@ namespace osgVegetation
 
 		bd_elem->QueryBoolAttribute("UseAlphaBlend", &bb_data.UseAlphaBlend);
 		bd_elem->QueryBoolAttribute("UseMultiSample", &bb_data.UseMultiSample);
+		bd_elem->QueryBoolAttribute("UseAlphaHull", &bb_data.UseAlphaHull);
 		
 		bd_elem->QueryFloatAttribute("AlphaRefValue", &bb_data.AlphaRefValue);
 		bd_elem->QueryBoolAttribute("ReceiveShadows", &bb_data.ReceiveShadows);
 		bd_elem->QueryBoolAttribute("CastShadows", &bb_data.CastShadows);
+		bd_elem->QueryFloatAttribute("ShadowInstanceRatio", &bb_data.ShadowInstanceRatio);
 		bd_elem->QueryBoolAttribute("TerrainNormal", &bb_data.TerrainNormal);
 		//bd_elem->QueryBoolAttribute("UseFog", &bb_data.UseFog);
 		bd_elem->QueryIntAttribute("TilePixelSize", &bb_data.TilePixelSize);
+		bd_elem->QueryIntAttribute("ImpostorFrames", &bb_data.ImpostorFrames);
+		bd_elem->QueryBoolAttribute("AdaptiveSubdivision", &bb_data.AdaptiveSubdivision);
+		bd_elem->QueryUnsignedAttribute("MaxTileInstances", &bb_data.MaxTileInstances);
+		bd_elem->QueryFloatAttribute("ScreenSpaceError", &bb_data.ScreenSpaceError);
+		bd_elem->QueryIntAttribute("ProceduralTerrainResolution", &bb_data.ProceduralTerrainResolution);
 
 		const std::string bb_type = bd_elem->Attribute("Type");
 
@@ -113,6 +122,8 @@ namespace osgVegetation
 			bb_data.Type = BT_ROTATED_QUAD;
 		else if (bb_type == "BT_GRASS")
 			bb_data.Type = BT_GRASS;
+		else if (bb_type == "BT_IMPOSTOR")
+			bb_data.Type = BT_IMPOSTOR;
 		else
 			OSGV_EXCEPT(std::string("Serializer::loadBillboardData - Unknown billboard type:" + bb_type).c_str());
 
@@ -125,6 +136,8 @@ namespace osgVegetation
 			bb_data.Technique = BRT_GEOMETRY_SHADER;
 		else if (technique == "BRT_SHADER_INSTANCING")
 			bb_data.Technique = BRT_SHADER_INSTANCING;
+		else if (technique == "BRT_GPU_PROCEDURAL")
+			bb_data.Technique = BRT_GPU_PROCEDURAL;
 		else
 			OSGV_EXCEPT(std::string("Serializer::loadBillboardData - Unknown billboard type:" + bb_type).c_str());
 		}
@@ -185,6 +198,10 @@ namespace osgVegetation
 				OSGV_EXCEPT(std::string("Serializer::loadEnvironmentSettings - Unknown Shadow mode:" + shadow_mode).c_str());
 		}
 		es_elem->QueryIntAttribute("BaseShadowTextureUnit", &settings.BaseShadowTextureUnit);
+		es_elem->QueryUnsignedAttribute("ReceivesShadowTraversalMask", &settings.ReceivesShadowTraversalMask);
+		es_elem->QueryUnsignedAttribute("CastsShadowTraversalMask", &settings.CastsShadowTraversalMask);
+		es_elem->QueryDoubleAttribute("ViewFOV", &settings.ViewFOV);
+		es_elem->QueryIntAttribute("ViewportHeight", &settings.ViewportHeight);
 		return settings;
 	}
 
@@ -238,6 +255,10 @@ namespace osgVegetation
 			tq->setFlipColorCoordinates(flip);
 		}
 
+		TiXmlElement *cm_elem = tq_elem->FirstChildElement("CoverageModifiers");
+		if (cm_elem)
+			tq->setCoverageModifiers(loadCoverageModifiers(cm_elem));
+
 		xmlDoc->Clear();
 		// Delete our allocated document and return data
 		delete xmlDoc;
@@ -273,4 +294,53 @@ namespace osgVegetation
 		}
 		return data;
 	}
+
+	osg::ref_ptr<CoverageModifiers> Serializer::loadCoverageModifiers(TiXmlElement *cm_elem) const
+	{
+		double cell_size = 0;
+		cm_elem->QueryDoubleAttribute("CellSize", &cell_size);
+		osg::ref_ptr<CoverageModifiers> modifiers = new CoverageModifiers(cell_size);
+
+		TiXmlElement *mod_elem = cm_elem->FirstChildElement();
+		while (mod_elem)
+		{
+			const std::string type = mod_elem->Value();
+			if (type != "Polygon" && type != "Polyline")
+				OSGV_EXCEPT(std::string("Serializer::loadCoverageModifiers - Unknown modifier:" + type).c_str());
+
+			CoverageModifiers::ModifierMode mode = CoverageModifiers::CM_EXCLUDE;
+			if (mod_elem->Attribute("Mode"))
+			{
+				const std::string mode_str = mod_elem->Attribute("Mode");
+				if (mode_str == "Include")
+					mode = CoverageModifiers::CM_INCLUDE;
+				else if (mode_str != "Exclude")
+					OSGV_EXCEPT(std::string("Serializer::loadCoverageModifiers - Unknown mode:" + mode_str).c_str());
+			}
+
+			std::string mat_name;
+			if (mod_elem->Attribute("MatName"))
+				mat_name = mod_elem->Attribute("MatName");
+
+			double buffer = 0;
+			mod_elem->QueryDoubleAttribute("Buffer", &buffer);
+
+			//points as "x y, x y, ..."
+			std::string points_str = mod_elem->GetText() ? mod_elem->GetText() : "";
+			std::replace(points_str.begin(), points_str.end(), ',', ' ');
+			std::stringstream ss(points_str);
+			std::vector<osg::Vec2d> points;
+			double x, y;
+			while (ss >> x >> y)
+				points.push_back(osg::Vec2d(x, y));
+
+			if (type == "Polygon")
+				modifiers->addPolygon(mode, points, buffer, mat_name);
+			else
+				modifiers->addPolyline(mode, points, buffer, mat_name);
+			mod_elem = mod_elem->NextSiblingElement();
+		}
+		modifiers->build();
+		return modifiers;
+	}
 }
@@ -2,6 +2,7 @@
 #include "Common.h"
 #include "BillboardData.h"
 #include "CoverageData.h"
+#include "CoverageModifiers.h"
 #include "EnvironmentSettings.h"
 #include <osg/Node>
 #include <vector>
@@ -21,6 +22,7 @@ namespace osgVegetation
 		BillboardData loadBillboardData(TiXmlElement *bd_elem) const;
 		osg::ref_ptr<ITerrainQuery> loadTerrainQuery(osg::Node* terrain, const std::string &filename) const;
 		CoverageData loadCoverageData(TiXmlElement *cd_elem) const;
+		osg::ref_ptr<CoverageModifiers> loadCoverageModifiers(TiXmlElement *cm_elem) const;
 		EnvironmentSettings loadEnvironmentSettings(const std::string &filename) const;
 		EnvironmentSettings loadEnvironmentSettingsImpl(TiXmlElement *es_elem) const;
 
@@ -0,0 +1,207 @@
+#include "ShaderLibrary.h"
+#include "BillboardHull.h"
+#include <osg/Version>
+#include <osgDB/FileUtils>
+#include <osgDB/fstream>
+#include <iostream>
+#include <sstream>
+
+namespace osgVegetation
+{
+	bool ShaderLibrary::useDefineList()
+	{
+		//StateSet::DefineList and "#pragma import_defines" support was added in 3.5.3
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,3)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	ShaderDefines ShaderLibrary::getBillboardDefines(const BillboardData &data, const EnvironmentSettings &env_settings)
+	{
+		ShaderDefines defines;
+		if (data.Type == BT_ROTATED_QUAD)
+			defines.push_back("BT_ROTATED_QUAD");
+		else if (data.Type == BT_GRASS)
+			defines.push_back("BT_GRASS");
+		else if (data.Type == BT_IMPOSTOR)
+			defines.push_back("BT_IMPOSTOR");
+
+		if (data.ReceiveShadows)
+		{
+			if (env_settings.ShadowMode == SM_LISPSM)
+				defines.push_back("SM_LISPSM");
+			else if (env_settings.ShadowMode == SM_VDSM1)
+				defines.push_back("SM_VDSM1");
+			else if (env_settings.ShadowMode == SM_VDSM2)
+				defines.push_back("SM_VDSM2");
+		}
+
+		if (env_settings.UseFog)
+		{
+			if (env_settings.FogMode == osg::Fog::LINEAR)
+				defines.push_back("FM_LINEAR");
+			else if (env_settings.FogMode == osg::Fog::EXP)
+				defines.push_back("FM_EXP");
+			else if (env_settings.FogMode == osg::Fog::EXP2)
+				defines.push_back("FM_EXP2");
+		}
+
+		//shadows are cast by separate shadow caster nodes, fading is kept in main program
+		if (data.TerrainNormal)
+			defines.push_back("TERRAIN_NORMAL");
+		if (BillboardHull::isEnabled(data))
+			defines.push_back("BILLBOARD_HULL");
+		return defines;
+	}
+
+	ShaderDefines ShaderLibrary::getBillboardShadowCasterDefines(const BillboardData &data)
+	{
+		ShaderDefines defines;
+		if (data.Type == BT_ROTATED_QUAD)
+			defines.push_back("BT_ROTATED_QUAD");
+		else if (data.Type == BT_GRASS)
+			defines.push_back("BT_GRASS");
+		else if (data.Type == BT_IMPOSTOR)
+			defines.push_back("BT_IMPOSTOR");
+		if (BillboardHull::isEnabled(data))
+			defines.push_back("BILLBOARD_HULL");
+		//shadow casting and vertex fading don't mix well
+		defines.push_back("CAST_SHADOW");
+		return defines;
+	}
+
+	ShaderDefines ShaderLibrary::getMeshDefines(const EnvironmentSettings &env_settings)
+	{
+		ShaderDefines defines;
+		if (env_settings.ShadowMode == SM_LISPSM)
+			defines.push_back("SM_LISPSM");
+		else if (env_settings.ShadowMode == SM_VDSM1)
+			defines.push_back("SM_VDSM1");
+		else if (env_settings.ShadowMode == SM_VDSM2)
+			defines.push_back("SM_VDSM2");
+
+		if (env_settings.UseFog)
+		{
+			if (env_settings.FogMode == osg::Fog::LINEAR)
+				defines.push_back("FM_LINEAR");
+			else if (env_settings.FogMode == osg::Fog::EXP)
+				defines.push_back("FM_EXP");
+			else if (env_settings.FogMode == osg::Fog::EXP2)
+				defines.push_back("FM_EXP2");
+		}
+		return defines;
+	}
+
+	void ShaderLibrary::applyDefines(osg::StateSet* state_set, const ShaderDefines &defines)
+	{
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,3)
+		for (size_t i = 0; i < defines.size(); i++)
+			state_set->setDefine(defines[i], osg::StateAttribute::ON);
+#endif
+	}
+
+	void ShaderLibrary::disableDefines(osg::StateSet* state_set, const ShaderDefines &defines)
+	{
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,3)
+		for (size_t i = 0; i < defines.size(); i++)
+			state_set->setDefine(defines[i], osg::StateAttribute::OFF);
+#endif
+	}
+
+	std::string ShaderLibrary::getProgramKey(const std::string &technique, const ShaderDefines &defines)
+	{
+		std::stringstream ss;
+		ss << technique;
+		if (!useDefineList())
+		{
+			for (size_t i = 0; i < defines.size(); i++)
+				ss << "|" << defines[i];
+		}
+		return ss.str();
+	}
+
+	osg::Shader* ShaderLibrary::loadShader(osg::Shader::Type type, const std::string &file, const ShaderDefines &defines)
+	{
+		const std::string shader_file = "shaders/" + file;
+		std::string source;
+		if (!readFile(shader_file.c_str(), source))
+			OSGV_EXCEPT(std::string("ShaderLibrary::loadShader - Failed to load shader:" + shader_file).c_str());
+
+		std::stringstream ss;
+		if (!useDefineList())
+		{
+			for (size_t i = 0; i < defines.size(); i++)
+				ss << "#define " << defines[i] << "\n";
+		}
+		source = replaceString(source, "#pragma osgveg", ss.str());
+		osg::Shader* shader = new osg::Shader(type, source);
+		shader->setName(file);
+		return shader;
+	}
+
+	osg::Program* ShaderLibrary::createProgram(const std::string &name, const std::string &vertex_file, const std::string &geometry_file,
+		const std::string &fragment_file, const ShaderDefines &defines)
+	{
+		osg::Program* program = new osg::Program;
+		program->setName(name);
+		if (vertex_file != "")
+			program->addShader(loadShader(osg::Shader::VERTEX, vertex_file, defines));
+		if (geometry_file != "")
+			program->addShader(loadShader(osg::Shader::GEOMETRY, geometry_file, defines));
+		if (fragment_file != "")
+			program->addShader(loadShader(osg::Shader::FRAGMENT, fragment_file, defines));
+		return program;
+	}
+
+	bool ShaderLibrary::readFile(const char* fName, std::string& s)
+	{
+		std::string foundFile = osgDB::findDataFile(fName);
+		if (foundFile.empty()) return false;
+
+		osgDB::ifstream is;//(fName);
+		is.open(foundFile.c_str());
+		if (is.fail())
+		{
+			std::cerr << "Could not open " << fName << " for reading.\n";
+			return false;
+		}
+		char ch = is.get();
+		while (!is.eof())
+		{
+			s += ch;
+			ch = is.get();
+		}
+		is.close();
+		return true;
+	}
+
+	std::string ShaderLibrary::replaceString(const std::string & srceString, std::string fromString, std::string toString)
+	{
+		if (fromString == toString) return srceString;
+
+		std::string destString;
+
+		std::string::size_type fromLength = fromString.length();
+		std::string::size_type srceLength = srceString.length();
+
+		for (std::string::size_type pos = 0; pos < srceLength; )
+		{
+			std::string::size_type end = srceString.find(fromString, pos);
+
+			if (end == std::string::npos)
+				end = srceLength;
+
+			destString.append(srceString, pos, end - pos);
+
+			if (end == srceLength)
+				break;
+
+			destString.append(toString);
+			pos = end + fromLength;
+		}
+
+		return destString;
+	}
+}
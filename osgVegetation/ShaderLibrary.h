@@ -0,0 +1,76 @@
+#pragma once
+#include "Common.h"
+#include <osg/Program>
+#include <osg/Shader>
+#include <osg/StateSet>
+#include <string>
+#include <vector>
+#include "BillboardData.h"
+#include "EnvironmentSettings.h"
+
+namespace osgVegetation
+{
+	typedef std::vector<std::string> ShaderDefines;
+
+	/**
+		Shader library shared by all rendering techniques. Shaders are loaded from the shaders directory
+		(shaders/brt_*.glsl and shaders/mrt_*.glsl) and variants are selected by defines
+		(BT_ROTATED_QUAD, BT_GRASS, BT_IMPOSTOR, SM_LISPSM, SM_VDSM1, SM_VDSM2, FM_LINEAR, FM_EXP, FM_EXP2, CAST_SHADOW, TERRAIN_NORMAL, BILLBOARD_HULL,
+		INSTANCING_LIGHTING and PLACEMENT_OUTPUT).
+		With OSG 3.5.3 and later defines are applied to the state set (StateSet::DefineList) and
+		one program is shared by all variants of a technique. For older OSG versions the
+		defines are injected as text at the "#pragma osgveg" line and each variant get it's own program.
+	*/
+	class osgvExport ShaderLibrary
+	{
+	public:
+		/**
+			Get shader defines for billboard data and environment
+		*/
+		static ShaderDefines getBillboardDefines(const BillboardData &data, const EnvironmentSettings &env_settings);
+
+		/**
+			Get shader defines for billboard shadow casters (billboard type, BILLBOARD_HULL and CAST_SHADOW)
+		*/
+		static ShaderDefines getBillboardShadowCasterDefines(const BillboardData &data);
+
+		/**
+			Get shader defines for mesh data and environment
+		*/
+		static ShaderDefines getMeshDefines(const EnvironmentSettings &env_settings);
+
+		/**
+			Apply defines to state set, does nothing if DefineList is not supported
+		*/
+		static void applyDefines(osg::StateSet* state_set, const ShaderDefines &defines);
+
+		/**
+			Turn off defines inherited from parent state set, does nothing if DefineList is not supported
+		*/
+		static void disableDefines(osg::StateSet* state_set, const ShaderDefines &defines);
+
+		/**
+			Get program cache key, only include defines if DefineList is not supported
+		*/
+		static std::string getProgramKey(const std::string &technique, const ShaderDefines &defines);
+
+		/**
+			Create program from shader files, empty file name skip shader stage
+		*/
+		static osg::Program* createProgram(const std::string &name, const std::string &vertex_file, const std::string &geometry_file,
+			const std::string &fragment_file, const ShaderDefines &defines);
+
+		/**
+			Load shader from library, throw if shader file is not found
+		*/
+		static osg::Shader* loadShader(osg::Shader::Type type, const std::string &file, const ShaderDefines &defines);
+
+		/**
+			Check if defines are applied by state set DefineList
+		*/
+		static bool useDefineList();
+
+		static bool readFile(const char* fName, std::string& s);
+		static std::string replaceString(const std::string & srceString, std::string fromString, std::string toString);
+	};
+}
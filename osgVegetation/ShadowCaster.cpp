@@ -0,0 +1,117 @@
+#include "ShadowCaster.h"
+#include "ShaderLibrary.h"
+#include <osg/Geode>
+#include <osg/LOD>
+#include <osg/Multisample>
+#include <osg/Version>
+#include <osgDB/ObjectWrapper>
+
+namespace osgVegetation
+{
+	ShadowCasterCallback::ShadowCasterCallback(unsigned int receives_mask) : m_ReceivesShadowTraversalMask(receives_mask)
+	{
+
+	}
+
+	ShadowCasterCallback::ShadowCasterCallback(const ShadowCasterCallback& callback, const osg::CopyOp& copyop) : osg::NodeCallback(callback, copyop),
+		m_ReceivesShadowTraversalMask(callback.m_ReceivesShadowTraversalMask)
+	{
+
+	}
+
+	void ShadowCasterCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+	{
+		if(nv->getVisitorType() == osg::NodeVisitor::CULL_VISITOR && (nv->getTraversalMask() & m_ReceivesShadowTraversalMask))
+			return;
+		traverse(node, nv);
+	}
+
+	osg::StateSet* ShadowCaster::createStateSet(osg::Program* program, const BillboardData &data, const EnvironmentSettings &env_settings)
+	{
+		osg::StateSet* state_set = new osg::StateSet;
+		//Protect to avoid problems with LIPSSM shadows
+		state_set->setAttributeAndModes(program, osg::StateAttribute::PROTECTED | osg::StateAttribute::ON);
+		state_set->addUniform(new osg::Uniform("ShadowAlphaRef", data.AlphaRefValue));
+
+		//depth only, override blending and alpha to coverage from technique state set
+		state_set->setMode(GL_BLEND, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED);
+		state_set->setMode(GL_SAMPLE_ALPHA_TO_COVERAGE_ARB, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED);
+		state_set->setRenderingHint(osg::StateSet::OPAQUE_BIN);
+
+		ShaderLibrary::disableDefines(state_set, ShaderLibrary::getBillboardDefines(data, env_settings));
+		ShaderLibrary::applyDefines(state_set, ShaderLibrary::getBillboardShadowCasterDefines(data));
+		state_set->setDataVariance(osg::Object::DYNAMIC);
+		return state_set;
+	}
+
+	osg::Node* ShadowCaster::createNode(osg::Node* geode, const osg::BoundingBoxd &bb, double shadow_distance, osg::StateSet* state_set, const EnvironmentSettings &env_settings)
+	{
+		osg::Geode* caster_geode = dynamic_cast<osg::Geode*>(geode);
+		if(caster_geode)
+		{
+			for(unsigned int i = 0; i < caster_geode->getNumDrawables(); i++)
+			{
+				osg::StateSet* drawable_state_set = caster_geode->getDrawable(i)->getStateSet();
+				if(drawable_state_set)
+					drawable_state_set->removeUniform("TileRadius");
+			}
+		}
+
+		osg::Group* caster = NULL;
+		if(shadow_distance > 0)
+		{
+			osg::LOD* lod = new osg::LOD;
+			lod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+			lod->setCenter(bb.center());
+			lod->setRadius(bb.radius());
+			lod->addChild(geode, 0, shadow_distance);
+			caster = lod;
+		}
+		else
+		{
+			caster = new osg::Group;
+			caster->addChild(geode);
+		}
+		caster->setName("ShadowCaster");
+		caster->setStateSet(state_set);
+		caster->setNodeMask(env_settings.CastsShadowTraversalMask);
+		caster->setCullCallback(new ShadowCasterCallback(env_settings.ReceivesShadowTraversalMask));
+		return caster;
+	}
+
+	void ShadowCaster::selectInstances(const BillboardVegetationObjectVector &instances, float ratio, BillboardVegetationObjectVector &shadow_instances)
+	{
+		if(ratio >= 1.0f)
+		{
+			shadow_instances.insert(shadow_instances.end(), instances.begin(), instances.end());
+			return;
+		}
+		//evenly spread selection, instances are not sorted by position
+		float acc = 0;
+		for(size_t i = 0; i < instances.size(); i++)
+		{
+			acc += ratio;
+			if(acc >= 1.0f)
+			{
+				acc -= 1.0f;
+				shadow_instances.push_back(instances[i]);
+			}
+		}
+	}
+}
+
+//Serializer for .osgb/.osgt/.osgx files, shadow casters are saved in paged tiles
+#if OSG_VERSION_GREATER_OR_EQUAL(3,4,0)
+REGISTER_OBJECT_WRAPPER(osgVegetation_ShadowCasterCallback,
+	new osgVegetation::ShadowCasterCallback,
+	osgVegetation::ShadowCasterCallback,
+	"osg::Object osg::Callback osg::NodeCallback osgVegetation::ShadowCasterCallback")
+#else
+REGISTER_OBJECT_WRAPPER(osgVegetation_ShadowCasterCallback,
+	new osgVegetation::ShadowCasterCallback,
+	osgVegetation::ShadowCasterCallback,
+	"osg::Object osg::NodeCallback osgVegetation::ShadowCasterCallback")
+#endif
+{
+	ADD_UINT_SERIALIZER(ReceivesShadowTraversalMask, 0x1);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Common.h"
+#include <osg/NodeCallback>
+#include <osg/Node>
+#include <osg/Program>
+#include <osg/StateSet>
+#include <osg/BoundingBox>
+#include "BillboardData.h"
+#include "BillboardObject.h"
+#include "EnvironmentSettings.h"
+
+namespace osgVegetation
+{
+	/**
+		Cull callback for vegetation shadow caster nodes. Shadow casters are only traversed when
+		the cull traversal mask exclude ReceivesShadowTraversalMask, ie. when osgShadow cull the shadow
+		casting scene with CastsShadowTraversalMask. The main pass (with or without shadowed scene)
+		always include the receive mask and skip shadow casters.
+	*/
+	class osgvExport ShadowCasterCallback : public osg::NodeCallback
+	{
+	public:
+		ShadowCasterCallback(unsigned int receives_mask = 0x1);
+		ShadowCasterCallback(const ShadowCasterCallback& callback, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY);
+		META_Object(osgVegetation, ShadowCasterCallback);
+
+		void setReceivesShadowTraversalMask(unsigned int mask) {m_ReceivesShadowTraversalMask = mask;}
+		unsigned int getReceivesShadowTraversalMask() const {return m_ReceivesShadowTraversalMask;}
+
+		//osg::NodeCallback interface
+		void operator()(osg::Node* node, osg::NodeVisitor* nv);
+	private:
+		unsigned int m_ReceivesShadowTraversalMask;
+	};
+
+	/**
+		Helpers used to create dedicated shadow caster nodes for billboard tiles.
+		Shadow casters use a depth only program (shaders/brt_shadow_fragment.glsl) that only
+		alpha test the billboard texture, no lighting, fog or shadow lookups.
+	*/
+	class osgvExport ShadowCaster
+	{
+	public:
+		/**
+			Create state set for shadow caster nodes, program should use same vertex stage as the
+			rendering technique and brt_shadow_fragment.glsl.
+			Inherited shader defines not used by shadow casters are turned off.
+		*/
+		static osg::StateSet* createStateSet(osg::Program* program, const BillboardData &data, const EnvironmentSettings &env_settings);
+
+		/**
+			Create shadow caster node from tile geode created by the rendering technique.
+			TileRadius uniforms are removed from caster drawables (no fading), this way
+			casters are not reported as regular vegetation tiles by InstanceExtractor.
+			@param geode Tile geode holding instance subset
+			@param bb Bound of instances
+			@param shadow_distance Max shadow distance, 0 means no limit
+			@param state_set State set created by createStateSet
+		*/
+		static osg::Node* createNode(osg::Node* geode, const osg::BoundingBoxd &bb, double shadow_distance, osg::StateSet* state_set, const EnvironmentSettings &env_settings);
+
+		/**
+			Select instance subset used by shadow casters, every instance is used if ratio >= 1
+		*/
+		static void selectInstances(const BillboardVegetationObjectVector &instances, float ratio, BillboardVegetationObjectVector &shadow_instances);
+	};
+}
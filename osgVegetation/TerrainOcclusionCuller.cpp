@@ -0,0 +1,482 @@
+#include "TerrainOcclusionCuller.h"
+#include <osg/LOD>
+#include <osg/PagedLOD>
+#include <osg/Geode>
+#include <osg/Math>
+#include <osg/NodeVisitor>
+#include <osgUtil/CullVisitor>
+#include <OpenThreads/ScopedLock>
+#include <cfloat>
+#include <iostream>
+#include "ITerrainQuery.h"
+#include "InstanceExtractor.h"
+#include "VegetationQuadTree.h"
+
+namespace osgVegetation
+{
+	//height field value used for samples without terrain
+	const float NO_TERRAIN_DATA = -FLT_MAX;
+
+	/**
+		Test VegetationQuadTree tiles with occlusion culler, keep culler alive as long as quad tree use it
+	*/
+	class OcclusionTileCallback : public VegetationQuadTree::TileCallback
+	{
+	public:
+		OcclusionTileCallback(TerrainOcclusionCuller* culler) : m_Culler(culler) {}
+		bool operator()(VegetationQuadTree* quad_tree, unsigned int index, bool /*content_active*/, osg::NodeVisitor* nv)
+		{
+			return !m_Culler->_cullQuadTreeTile(quad_tree, index, nv);
+		}
+		TerrainOcclusionCuller* getCuller() const {return m_Culler.get();}
+	private:
+		osg::ref_ptr<TerrainOcclusionCuller> m_Culler;
+	};
+
+	/**
+		Visitor that add occlusion cull callback and attach update callback to LOD nodes,
+		traversal stops at LOD nodes, children are handled by the update callback.
+		Quad tree nodes get a tile callback instead.
+	*/
+	class AttachOcclusionVisitor : public osg::NodeVisitor
+	{
+	public:
+		AttachOcclusionVisitor(TerrainOcclusionCuller* culler) : m_Culler(culler)
+		{
+			setTraversalMode(TRAVERSE_ALL_CHILDREN);
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::LOD& lod)
+		{
+			if(lod.getCullCallback() == NULL)
+				lod.setCullCallback(m_Culler);
+
+			//each LOD need its own attach callback to track merged children, keep existing update callbacks
+			if(lod.getUpdateCallback() == NULL)
+			{
+				lod.setUpdateCallback(new TerrainOcclusionCuller::AttachCallback(m_Culler));
+				return;
+			}
+			osg::NodeCallback* current = dynamic_cast<osg::NodeCallback*>(lod.getUpdateCallback());
+			while(current && !_isAttachCallback(current) && current->getNestedCallback())
+				current = dynamic_cast<osg::NodeCallback*>(current->getNestedCallback());
+			if(current && !_isAttachCallback(current))
+				current->setNestedCallback(new TerrainOcclusionCuller::AttachCallback(m_Culler));
+		}
+
+		void apply(osg::Group& group)
+		{
+			VegetationQuadTree* quad_tree = dynamic_cast<VegetationQuadTree*>(&group);
+			if(quad_tree == NULL)
+			{
+				traverse(group);
+				return;
+			}
+			//tile content is handled by tile callback
+			for(unsigned int i = 0; i < quad_tree->getNumTileCallbacks(); i++)
+			{
+				OcclusionTileCallback* callback = dynamic_cast<OcclusionTileCallback*>(quad_tree->getTileCallback(i));
+				if(callback && callback->getCuller() == m_Culler)
+					return;
+			}
+			quad_tree->addTileCallback(new OcclusionTileCallback(m_Culler));
+		}
+
+		void apply(osg::Geode& /*geode*/)
+		{
+			//no LOD nodes below geodes
+		}
+	private:
+		bool _isAttachCallback(osg::NodeCallback* callback) const
+		{
+			TerrainOcclusionCuller::AttachCallback* attach = dynamic_cast<TerrainOcclusionCuller::AttachCallback*>(callback);
+			return attach && attach->getCuller() == m_Culler;
+		}
+		TerrainOcclusionCuller* m_Culler;
+	};
+
+	/**
+		Visitor for occluded tiles that count instances that would be rendered (according to LOD ranges)
+		from eye position and refresh time stamp and frame number of loaded PagedLOD children in range, 
+		same as PagedLOD::traverse, so that hidden tiles are not expired by the database pager.
+		PIXEL_SIZE_ON_SCREEN LOD nodes are handled as all children active.
+	*/
+	class OccludedTileVisitor : public osg::NodeVisitor
+	{
+	public:
+		OccludedTileVisitor(const osg::Vec3 &eye_local, const osg::FrameStamp* frame_stamp) : m_EyeLocal(eye_local), 
+			m_FrameStamp(frame_stamp), 
+			m_NumInstances(0)
+		{
+			setTraversalMode(TRAVERSE_ALL_CHILDREN);
+		}
+
+		void apply(osg::Node& node)
+		{
+			const unsigned int num_meshes = InstanceExtractor::getNumMeshes(&node);
+			if(num_meshes > 0)
+				m_NumInstances += num_meshes;
+			else
+				traverse(node);
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			const unsigned int num_meshes = InstanceExtractor::getNumMeshes(&geode);
+			if(num_meshes > 0)
+			{
+				m_NumInstances += num_meshes;
+				return;
+			}
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+				m_NumInstances += InstanceExtractor::getNumBillboards(geode.getDrawable(i));
+		}
+
+		void apply(osg::LOD& lod)
+		{
+			osg::PagedLOD* plod = dynamic_cast<osg::PagedLOD*>(&lod);
+			if(plod && m_FrameStamp)
+				plod->setFrameNumberOfLastTraversal(m_FrameStamp->getFrameNumber());
+			const float dist = (m_EyeLocal - lod.getCenter()).length();
+			for(unsigned int i = 0; i < lod.getNumChildren() && i < lod.getNumRanges(); i++)
+			{
+				if(lod.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN ||
+					(dist >= lod.getMinRange(i) && dist < lod.getMaxRange(i)))
+				{
+					if(plod && m_FrameStamp)
+					{
+						plod->setTimeStamp(i, m_FrameStamp->getReferenceTime());
+						plod->setFrameNumber(i, m_FrameStamp->getFrameNumber());
+					}
+					lod.getChild(i)->accept(*this);
+				}
+			}
+		}
+
+		/**
+			Visit tile and all child tiles in range, see VegetationQuadTree::traverse
+		*/
+		void applyQuadTreeTile(VegetationQuadTree& quad_tree, unsigned int index)
+		{
+			const bool all_active = quad_tree.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN;
+			std::vector<unsigned int> stack(1, index);
+			while(!stack.empty())
+			{
+				const VegetationQuadTree::Tile tile = quad_tree.getTile(stack.back());
+				stack.pop_back();
+				if(!(getTraversalMask() & (getNodeMaskOverride() | tile.NodeMask)))
+					continue;
+				const float dist = (m_EyeLocal - tile.Center).length();
+				if(tile.Content >= 0 && (all_active || (dist >= tile.ContentMinRange && dist < tile.ContentMaxRange)))
+					quad_tree.getChild(tile.Content)->accept(*this);
+				if(all_active || (dist >= tile.ChildMinRange && dist < tile.ChildMaxRange))
+				{
+					for(unsigned int i = 0; i < tile.NumChildren; i++)
+						stack.push_back(tile.FirstChild + i);
+				}
+			}
+		}
+		osg::Vec3 m_EyeLocal;
+		const osg::FrameStamp* m_FrameStamp;
+		unsigned int m_NumInstances;
+	};
+
+	TerrainOcclusionCuller::TerrainOcclusionCuller(osg::HeightField* height_field, unsigned int receives_mask) : m_HeightField(height_field),
+		m_HeightBias(1.0f),
+		m_Enabled(true),
+		m_ReceivesShadowTraversalMask(receives_mask),
+		m_CacheFrames(10),
+		m_CacheDistance(2.0),
+		m_MaxRaysPerFrame(4096),
+		m_FrameNumber(0),
+		m_PruneFrameNumber(0),
+		m_FrameRays(0),
+		m_NumCulledTiles(0),
+		m_NumCulledInstances(0)
+	{
+		if(!m_HeightField.valid() || m_HeightField->getNumColumns() < 2 || m_HeightField->getNumRows() < 2)
+			OSGV_EXCEPT(std::string("TerrainOcclusionCuller::TerrainOcclusionCuller - height field must have at least 2x2 samples").c_str());
+	}
+
+	osg::ref_ptr<osg::HeightField> TerrainOcclusionCuller::createHeightField(ITerrainQuery* tq, const osg::BoundingBoxd &bb, unsigned int columns, unsigned int rows)
+	{
+		if(columns < 2 || rows < 2)
+			OSGV_EXCEPT(std::string("TerrainOcclusionCuller::createHeightField - at least 2x2 samples needed").c_str());
+
+		osg::ref_ptr<osg::HeightField> hf = new osg::HeightField;
+		hf->allocate(columns, rows);
+		hf->setOrigin(osg::Vec3(bb.xMin(), bb.yMin(), 0));
+		hf->setXInterval((bb.xMax() - bb.xMin()) / static_cast<double>(columns - 1));
+		hf->setYInterval((bb.yMax() - bb.yMin()) / static_cast<double>(rows - 1));
+
+		unsigned int num_failed = 0;
+		for(unsigned int r = 0; r < rows; r++)
+		{
+			for(unsigned int c = 0; c < columns; c++)
+			{
+				osg::Vec3d location(bb.xMin() + c*hf->getXInterval(), bb.yMin() + r*hf->getYInterval(), 0);
+				osg::Vec4 color;
+				std::string coverage_name;
+				CoverageColor coverage_color;
+				osg::Vec3d inter;
+				if(tq->getTerrainData(location, color, coverage_name, coverage_color, inter))
+					hf->setHeight(c, r, inter.z());
+				else
+				{
+					hf->setHeight(c, r, NO_TERRAIN_DATA);
+					num_failed++;
+				}
+			}
+		}
+		if(num_failed > 0)
+			std::cout << "TerrainOcclusionCuller::createHeightField - " << num_failed << " of " << columns*rows << " samples failed\n";
+		return hf;
+	}
+
+	void TerrainOcclusionCuller::install(osg::Node* vegetation)
+	{
+		_attach(vegetation);
+	}
+
+	void TerrainOcclusionCuller::_attach(osg::Node* node)
+	{
+		AttachOcclusionVisitor aov(this);
+		node->accept(aov);
+	}
+
+	void TerrainOcclusionCuller::AttachCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+	{
+		//tiles are merged by database pager before update traversal, attach before they are culled.
+		//Pager add and expire children at the end of the child list, only new children are visited
+		osg::Group* group = node->asGroup();
+		if(group)
+		{
+			if(m_NumChildren > group->getNumChildren())
+				m_NumChildren = group->getNumChildren();
+			for(; m_NumChildren < group->getNumChildren(); m_NumChildren++)
+				m_Culler->_attach(group->getChild(m_NumChildren));
+		}
+		traverse(node, nv);
+	}
+
+	unsigned int TerrainOcclusionCuller::getNumCulledTiles() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_CounterMutex);
+		return m_NumCulledTiles;
+	}
+
+	unsigned int TerrainOcclusionCuller::getNumCulledInstances() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_CounterMutex);
+		return m_NumCulledInstances;
+	}
+
+	void TerrainOcclusionCuller::resetCounters()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_CounterMutex);
+		m_NumCulledTiles = 0;
+		m_NumCulledInstances = 0;
+	}
+
+	float TerrainOcclusionCuller::_getHeight(double x, double y) const
+	{
+		//bilinear interpolation, any missing sample make the result missing
+		const double fc = (x - m_HeightField->getOrigin().x()) / m_HeightField->getXInterval();
+		const double fr = (y - m_HeightField->getOrigin().y()) / m_HeightField->getYInterval();
+		if(fc < 0 || fr < 0 || fc > m_HeightField->getNumColumns() - 1 || fr > m_HeightField->getNumRows() - 1)
+			return NO_TERRAIN_DATA;
+
+		const unsigned int c0 = osg::minimum(static_cast<unsigned int>(fc), m_HeightField->getNumColumns() - 2);
+		const unsigned int r0 = osg::minimum(static_cast<unsigned int>(fr), m_HeightField->getNumRows() - 2);
+		const float h00 = m_HeightField->getHeight(c0, r0);
+		const float h10 = m_HeightField->getHeight(c0 + 1, r0);
+		const float h01 = m_HeightField->getHeight(c0, r0 + 1);
+		const float h11 = m_HeightField->getHeight(c0 + 1, r0 + 1);
+		if(h00 == NO_TERRAIN_DATA || h10 == NO_TERRAIN_DATA || h01 == NO_TERRAIN_DATA || h11 == NO_TERRAIN_DATA)
+			return NO_TERRAIN_DATA;
+
+		const double tx = fc - c0;
+		const double ty = fr - r0;
+		return (h00*(1.0 - tx) + h10*tx)*(1.0 - ty) + (h01*(1.0 - tx) + h11*tx)*ty;
+	}
+
+	bool TerrainOcclusionCuller::_isHorizonAbove(const osg::Vec3d &eye, const osg::Vec2d &dir, double max_dist, double slope) const
+	{
+		//compare slopes instead of elevation angles (monotonic), stop at first sample above
+		const double step = osg::minimum(m_HeightField->getXInterval(), m_HeightField->getYInterval());
+		//start one step ahead, terrain at eye position can't occlude
+		for(double t = step; t < max_dist; t += step)
+		{
+			const float h = _getHeight(eye.x() + dir.x()*t, eye.y() + dir.y()*t);
+			if(h != NO_TERRAIN_DATA && h - m_HeightBias - eye.z() > slope*t)
+				return true;
+		}
+		return false;
+	}
+
+	bool TerrainOcclusionCuller::_isOccluded(const osg::Vec3d &eye, const osg::BoundingSphered &bs, int max_rays, int &num_rays) const
+	{
+		num_rays = 0;
+		//don't cull if eye is below terrain (probably no terrain data)
+		const float eye_height = _getHeight(eye.x(), eye.y());
+		if(eye_height == NO_TERRAIN_DATA || eye.z() < eye_height)
+			return false;
+
+		const osg::Vec2d to_center(bs.center().x() - eye.x(), bs.center().y() - eye.y());
+		const double dist = to_center.length();
+		//only test terrain in front of the sphere
+		const double max_dist = dist - bs.radius();
+		if(max_dist <= 0)
+			return false;
+
+		//highest elevation angle of sphere seen from eye, terrain can't be above vertical
+		const double dist_3d = (bs.center() - eye).length();
+		const double top_angle = atan2(bs.center().z() - eye.z(), dist) + asin(osg::minimum(1.0, bs.radius() / dist_3d));
+		if(top_angle >= osg::PI_2)
+			return false;
+
+		//sweep silhouette with ray spacing at sphere no larger than height field interval
+		const double center_heading = atan2(to_center.y(), to_center.x());
+		const double half_angle = asin(osg::minimum(1.0, bs.radius() / dist));
+		const double step = osg::minimum(m_HeightField->getXInterval(), m_HeightField->getYInterval());
+		num_rays = static_cast<int>(ceil(2.0*half_angle*dist / step)) + 1;
+		if(num_rays > max_rays)
+			return false;
+		const double top_slope = tan(top_angle);
+		for(int i = 0; i < num_rays; i++)
+		{
+			const double heading = center_heading - half_angle + (num_rays > 1 ? 2.0*half_angle*i / (num_rays - 1) : half_angle);
+			const osg::Vec2d dir(cos(heading), sin(heading));
+			if(!_isHorizonAbove(eye, dir, max_dist, top_slope))
+				return false;
+		}
+		return true;
+	}
+
+	void TerrainOcclusionCuller::_beginFrame(unsigned int frame)
+	{
+		if(frame == m_FrameNumber)
+			return;
+		m_FrameNumber = frame;
+		m_FrameRays = 0;
+		//drop results of tiles not tested lately (out of range or expired, node may be deleted)
+		if(frame >= m_PruneFrameNumber + m_CacheFrames)
+		{
+			for(TileCache::iterator iter = m_Cache.begin(); iter != m_Cache.end();)
+			{
+				if(iter->second.LastUsed + m_CacheFrames < frame)
+					m_Cache.erase(iter++);
+				else
+					++iter;
+			}
+			m_PruneFrameNumber = frame;
+		}
+	}
+
+	bool TerrainOcclusionCuller::_cullTile(osg::Node* tile, unsigned int index, const osg::Vec3 &center, double radius, osgUtil::CullVisitor* cv)
+	{
+		//only main view, shadow passes must see tiles hidden from the eye (see ShadowCasterCallback)
+		if(!m_Enabled || cv == NULL || cv->getCurrentCamera() == NULL || (cv->getTraversalMask() & m_ReceivesShadowTraversalMask) == 0)
+			return false;
+
+		//vegetation is only translated (see quad tree scattering), radius is kept as is
+		const osg::Matrixd &inv_view = cv->getCurrentCamera()->getInverseViewMatrix();
+		const osg::Matrixd local_to_world = (*cv->getModelViewMatrix()) * inv_view;
+		const osg::BoundingSphered bs(osg::Vec3d(center) * local_to_world, radius);
+		const osg::Vec3d eye = inv_view.getTrans();
+		const unsigned int frame = cv->getFrameStamp() ? cv->getFrameStamp()->getFrameNumber() : 0;
+		const TileKey key(cv->getCurrentCamera(), std::make_pair(tile, index));
+
+		//use cached result if still valid, otherwise reserve rays from frame budget
+		int max_rays = MAX_RAYS;
+		bool cached = false;
+		bool cached_occluded = false;
+		unsigned int cached_instances = 0;
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_CacheMutex);
+			_beginFrame(frame);
+			TileCache::iterator iter = m_Cache.find(key);
+			if(iter != m_Cache.end() && frame < iter->second.FrameNumber + m_CacheFrames &&
+				iter->second.Bound.center() == bs.center() && iter->second.Bound.radius() == bs.radius() &&
+				(eye - iter->second.Eye).length2() <= m_CacheDistance*m_CacheDistance)
+			{
+				iter->second.LastUsed = frame;
+				cached = true;
+				cached_occluded = iter->second.Occluded;
+				cached_instances = iter->second.NumInstances;
+			}
+			else if(m_MaxRaysPerFrame > 0)
+			{
+				const int budget = m_FrameRays < m_MaxRaysPerFrame ? static_cast<int>(m_MaxRaysPerFrame - m_FrameRays) : 0;
+				max_rays = osg::minimum(max_rays, budget);
+				m_FrameRays += max_rays;
+			}
+		}
+		if(cached)
+		{
+			if(cached_occluded)
+				_addOccludedTile(tile, cached_instances, cv);
+			return cached_occluded;
+		}
+
+		int num_rays = 0;
+		const bool occluded = _isOccluded(eye, bs, max_rays, num_rays);
+		unsigned int num_instances = 0;
+		if(occluded)
+		{
+			//skipped by cull traversal, count instances and keep paged children alive
+			OccludedTileVisitor otv(cv->getEyeLocal(), cv->getFrameStamp());
+			if(index == NO_TILE_INDEX)
+				tile->accept(otv);
+			else
+				otv.applyQuadTreeTile(*static_cast<VegetationQuadTree*>(tile), index);
+			num_instances = otv.m_NumInstances;
+			_addOccludedTile(tile, num_instances, cv);
+		}
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_CacheMutex);
+		//return unused rays, tiles over budget are not cached and tested again next frame
+		const bool over_budget = num_rays > max_rays && max_rays < MAX_RAYS;
+		if(m_MaxRaysPerFrame > 0 && frame == m_FrameNumber)
+			m_FrameRays -= max_rays - (num_rays <= max_rays ? num_rays : 0);
+		if(m_CacheFrames > 0 && !over_budget)
+		{
+			CachedTile &cached = m_Cache[key];
+			cached.Eye = eye;
+			cached.Bound = bs;
+			cached.FrameNumber = frame;
+			cached.LastUsed = frame;
+			cached.Occluded = occluded;
+			cached.NumInstances = num_instances;
+		}
+		return occluded;
+	}
+
+	void TerrainOcclusionCuller::_addOccludedTile(osg::Node* tile, unsigned int num_instances, osgUtil::CullVisitor* cv)
+	{
+		if(m_OccludedCallback.valid())
+			(*m_OccludedCallback)(tile, cv);
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_CounterMutex);
+		m_NumCulledTiles++;
+		m_NumCulledInstances += num_instances;
+	}
+
+	bool TerrainOcclusionCuller::_cullQuadTreeTile(VegetationQuadTree* quad_tree, unsigned int index, osg::NodeVisitor* nv)
+	{
+		const VegetationQuadTree::Tile tile = quad_tree->getTile(index);
+		return _cullTile(quad_tree, index, tile.Center, tile.Radius, dynamic_cast<osgUtil::CullVisitor*>(nv));
+	}
+
+	void TerrainOcclusionCuller::operator()(osg::Node* node, osg::NodeVisitor* nv)
+	{
+		osg::LOD* lod = dynamic_cast<osg::LOD*>(node);
+		if(lod)
+		{
+			const double radius = lod->getRadius() > 0 ? lod->getRadius() : lod->getBound().radius();
+			if(_cullTile(lod, NO_TILE_INDEX, lod->getCenter(), radius, dynamic_cast<osgUtil::CullVisitor*>(nv)))
+				return;
+		}
+		traverse(node, nv);
+	}
+}
@@ -0,0 +1,203 @@
+#pragma once
+#include "Common.h"
+#include <osg/NodeCallback>
+#include <osg/LOD>
+#include <osg/Shape>
+#include <osg/BoundingBox>
+#include <osg/BoundingSphere>
+#include <osg/ref_ptr>
+#include <OpenThreads/Mutex>
+#include <map>
+
+namespace osg
+{
+	class Camera;
+}
+
+namespace osgUtil
+{
+	class CullVisitor;
+}
+
+namespace osgVegetation
+{
+	class ITerrainQuery;
+	class VegetationQuadTree;
+
+	/**
+		Cull callback that skip vegetation LOD/PagedLOD tiles hidden behind terrain.
+		Occlusion is evaluated on the CPU during the cull traversal by a horizon test against a coarse
+		terrain height field. The terrain horizon is traced from the eye along rays that sweep the horizontal
+		silhouette of the tile bounding sphere (ray spacing at the sphere is at most one height field interval)
+		and the tile is culled if the top of the sphere is below the horizon along all rays.
+		The test is conservative with respect to the height field, terrain features smaller than the
+		height field interval (notches between samples) are not captured and can still let a tile
+		be culled even if partly visible, use setHeightBias to compensate. Tiles that need too many rays
+		(close to eye) are never culled.
+		Results are cached per camera and tile and only re-evaluated every setCacheFrames frames
+		or when the eye has moved more than setCacheDistance, the number of rays traced
+		each frame is capped by setMaxRaysPerFrame, tiles over budget are drawn and tested in a later frame.
+		Only the main view cull is tested, cull traversals that exclude ReceivesShadowTraversalMask
+		(shadow map passes) traverse all tiles.
+		Use install() to add the callback to a vegetation scene graph, tiles paged in
+		later are picked up by an update callback on their parent tile. VegetationQuadTree tiles
+		are tested by a tile callback (see VegetationQuadTree::addTileCallback).
+		Occluded tiles are not traversed, to prevent the database pager from expiring hidden tiles
+		(and reload them when visible again) the time stamp and frame number of loaded PagedLOD children
+		in range are refreshed for the occluded tile and all tiles in range below it each time the result is
+		re-evaluated, cache frames should be well below the pager expiry delay.
+	*/
+	class osgvExport TerrainOcclusionCuller : public osg::NodeCallback
+	{
+	public:
+		/**
+			@param height_field Coarse terrain height field in world coordinates, see createHeightField
+			@param receives_mask Traversal mask of main view (see EnvironmentSettings::ReceivesShadowTraversalMask)
+		*/
+		TerrainOcclusionCuller(osg::HeightField* height_field, unsigned int receives_mask = 0x1);
+
+		/**
+			Sample terrain heights with terrain query, failed samples are marked as non-occluding.
+			@param tq Terrain query used to sample terrain
+			@param bb Area to sample (world coordinates)
+			@param columns Number of samples along x-axis (at least 2)
+			@param rows Number of samples along y-axis (at least 2)
+		*/
+		static osg::ref_ptr<osg::HeightField> createHeightField(ITerrainQuery* tq, const osg::BoundingBoxd &bb, unsigned int columns, unsigned int rows);
+
+		/**
+			Add this callback to all top level LOD and PagedLOD nodes and VegetationQuadTree nodes in vegetation scene graph,
+			must be called from update thread (or before viewer is realized)
+		*/
+		void install(osg::Node* vegetation);
+
+		/**
+			Only cull traversals that include this mask are tested, default 0x1
+		*/
+		void setReceivesShadowTraversalMask(unsigned int mask) {m_ReceivesShadowTraversalMask = mask;}
+		unsigned int getReceivesShadowTraversalMask() const {return m_ReceivesShadowTraversalMask;}
+
+		/**
+			Safety margin (meters) subtracted from terrain heights to compensate for under sampled terrain, default 1
+		*/
+		void setHeightBias(float value) {m_HeightBias = value;}
+		float getHeightBias() const {return m_HeightBias;}
+
+		/**
+			Enable/disable occlusion test, default to true
+		*/
+		void setEnabled(bool value) {m_Enabled = value;}
+		bool getEnabled() const {return m_Enabled;}
+
+		/**
+			Number of frames a tile result is reused before it is re-evaluated, 0 disable caching, default 10
+		*/
+		void setCacheFrames(unsigned int value) {m_CacheFrames = value;}
+		unsigned int getCacheFrames() const {return m_CacheFrames;}
+
+		/**
+			Eye movement (meters) that invalidate cached tile results, default 2
+		*/
+		void setCacheDistance(double value) {m_CacheDistance = value;}
+		double getCacheDistance() const {return m_CacheDistance;}
+
+		/**
+			Max rays traced each frame for all tiles and cameras, 0 for no limit, default 4096
+		*/
+		void setMaxRaysPerFrame(unsigned int value) {m_MaxRaysPerFrame = value;}
+		unsigned int getMaxRaysPerFrame() const {return m_MaxRaysPerFrame;}
+
+		/**
+			Number of tiles culled since last resetCounters()
+		*/
+		unsigned int getNumCulledTiles() const;
+
+		/**
+			Number of instances in culled tiles (that would have been selected by LOD ranges) since last resetCounters()
+		*/
+		unsigned int getNumCulledInstances() const;
+
+		void resetCounters();
+
+		/**
+			Callback invoked (from cull thread) for each tile culled by the occlusion test,
+			culled tiles are not traversed so callbacks nested after the culler never see them.
+			Tile is the LOD node or the VegetationQuadTree holding the tile.
+		*/
+		class OccludedCallback : public osg::Referenced
+		{
+		public:
+			virtual void operator()(osg::Node* tile, osgUtil::CullVisitor* cv) = 0;
+		protected:
+			virtual ~OccludedCallback() {}
+		};
+
+		void setOccludedCallback(OccludedCallback* callback) {m_OccludedCallback = callback;}
+		OccludedCallback* getOccludedCallback() const {return m_OccludedCallback.get();}
+
+		//osg::NodeCallback interface
+		void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+		/**
+			Update callback that attach culler to tiles merged by database pager,
+			one instance for each LOD node, only children added since last update are visited.
+		*/
+		class AttachCallback : public osg::NodeCallback
+		{
+		public:
+			AttachCallback(TerrainOcclusionCuller* culler) : m_Culler(culler), m_NumChildren(0) {}
+			void operator()(osg::Node* node, osg::NodeVisitor* nv);
+			TerrainOcclusionCuller* getCuller() const {return m_Culler;}
+		private:
+			TerrainOcclusionCuller* m_Culler;
+			unsigned int m_NumChildren;
+		};
+
+		//max rays traced for each tile, tiles that need more rays are not culled
+		static const int MAX_RAYS = 64;
+	private:
+		friend class OcclusionTileCallback;
+		/**
+			Cached result of tile test
+		*/
+		struct CachedTile
+		{
+			osg::Vec3d Eye;
+			osg::BoundingSphered Bound;
+			unsigned int FrameNumber;
+			unsigned int LastUsed;
+			bool Occluded;
+			unsigned int NumInstances;
+		};
+		//camera and tile node, quad tree tile index or NO_TILE_INDEX for LOD nodes
+		typedef std::pair<const osg::Camera*, std::pair<const osg::Node*, unsigned int> > TileKey;
+		typedef std::map<TileKey, CachedTile> TileCache;
+		static const unsigned int NO_TILE_INDEX = ~0u;
+
+		float _getHeight(double x, double y) const;
+		bool _isHorizonAbove(const osg::Vec3d &eye, const osg::Vec2d &dir, double max_dist, double slope) const;
+		bool _isOccluded(const osg::Vec3d &eye, const osg::BoundingSphered &bs, int max_rays, int &num_rays) const;
+		bool _cullTile(osg::Node* tile, unsigned int index, const osg::Vec3 &center, double radius, osgUtil::CullVisitor* cv);
+		bool _cullQuadTreeTile(VegetationQuadTree* quad_tree, unsigned int index, osg::NodeVisitor* nv);
+		void _addOccludedTile(osg::Node* tile, unsigned int num_instances, osgUtil::CullVisitor* cv);
+		void _beginFrame(unsigned int frame);
+		void _attach(osg::Node* node);
+
+		osg::ref_ptr<osg::HeightField> m_HeightField;
+		float m_HeightBias;
+		bool m_Enabled;
+		unsigned int m_ReceivesShadowTraversalMask;
+		unsigned int m_CacheFrames;
+		double m_CacheDistance;
+		unsigned int m_MaxRaysPerFrame;
+		OpenThreads::Mutex m_CacheMutex;
+		TileCache m_Cache;
+		unsigned int m_FrameNumber;
+		unsigned int m_PruneFrameNumber;
+		unsigned int m_FrameRays;
+		osg::ref_ptr<OccludedCallback> m_OccludedCallback;
+		mutable OpenThreads::Mutex m_CounterMutex;
+		unsigned int m_NumCulledTiles;
+		unsigned int m_NumCulledInstances;
+	};
+}
@@ -51,8 +51,17 @@ namespace osgVegetation
 		m_IntersectionVisitor.setLODSelectionMode(osgUtil::IntersectionVisitor::USE_HIGHEST_LEVEL_OF_DETAIL);
 	}
 
+	bool TerrainQuery::isAreaExcluded(const osg::BoundingBoxd &area) const
+	{
+		return m_CoverageModifiers.valid() && m_CoverageModifiers->isAreaExcluded(area);
+	}
+
 	bool TerrainQuery::getTerrainData(osg::Vec3d& location, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter)
 	{
+		//no need to ray cast inside exclusion zones
+		if(m_CoverageModifiers.valid() && m_CoverageModifiers->isExcluded(location.x(), location.y()))
+			return false;
+
 		osg::Vec3d start_location(location.x(),location.y(), -10000);
 		osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector =	new osgUtil::LineSegmentIntersector(start_location,start_location + osg::Vec3(0.0f,0.0f,20000));
 		m_IntersectionVisitor.setIntersector(intersector.get());
@@ -120,6 +129,8 @@ namespace osgVegetation
 						//coverage_name = "WOODS";
 					}
 				}
+				if(m_CoverageModifiers.valid())
+					m_CoverageModifiers->getIncludedMaterial(location.x(), location.y(), coverage_name);
 				inter = intersection.getWorldIntersectPoint();
 				return true;
 			}
@@ -9,6 +9,7 @@
 #include "ITerrainQuery.h"
 #include "CoverageColor.h"
 #include "CoverageData.h"
+#include "CoverageModifiers.h"
 
 namespace osgSim {class DatabaseCacheReadCallback;}
 
@@ -27,6 +28,11 @@ namespace osgVegetation
 			Get terrain data for provided location
 		*/
 		bool getTerrainData(osg::Vec3d& location, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter);
+
+		/**
+			Check if area is inside exclusion zone of coverage modifiers
+		*/
+		bool isAreaExcluded(const osg::BoundingBoxd &area) const;
 	
 	public:
 		/**
@@ -81,6 +87,18 @@ namespace osgVegetation
 			Flip color texture coordinates
 		*/
 		bool getFlipColorCoordinates() const {return m_FlipColorCoordinates;}
+
+		/**
+			Set vector coverage modifiers applied on top of coverage texture, exclusion zones
+			are tested before any ray cast and inclusion zones override coverage material.
+			Modifiers must be built (see CoverageModifiers::build).
+		*/
+		void setCoverageModifiers(CoverageModifiers* modifiers) {m_CoverageModifiers = modifiers;}
+
+		/**
+			Get vector coverage modifiers, NULL if not used
+		*/
+		CoverageModifiers* getCoverageModifiers() const {return m_CoverageModifiers.get();}
 	private:
 		osg::Image* _loadImage(const std::string &filename);
 		osg::Texture* _getTexture(const osgUtil::LineSegmentIntersector::Intersection& intersection,osg::Vec3& tc) const;
@@ -97,5 +115,6 @@ namespace osgVegetation
 		CoverageData m_CoverageData;
 		bool m_FlipCoverageCoordinates;
 		bool m_FlipColorCoordinates;
+		osg::ref_ptr<CoverageModifiers> m_CoverageModifiers;
 	};
 }
@@ -0,0 +1,314 @@
+#include "TextureCompressor.h"
+#include <osg/Texture>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osg/Math>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace osgVegetation
+{
+	std::string TextureCompressor::getCompressedTextureName(const std::string &texture_name, float alpha_ref)
+	{
+		std::stringstream ss;
+		ss << osgDB::getNameLessExtension(texture_name) << "_bc3_a" << static_cast<int>(osg::clampBetween(alpha_ref, 0.0f, 1.0f)*255.0f + 0.5f) << ".dds";
+		return ss.str();
+	}
+
+	float TextureCompressor::_getCoverage(const std::vector<osg::Vec4f> &texels, float alpha_ref, float alpha_scale)
+	{
+		if(texels.size() == 0)
+			return 0;
+		size_t num_passed = 0;
+		for(size_t i = 0; i < texels.size(); i++)
+		{
+			//match runtime alpha test (GEQUAL)
+			if(texels[i].a()*alpha_scale >= alpha_ref)
+				num_passed++;
+		}
+		return static_cast<float>(num_passed) / static_cast<float>(texels.size());
+	}
+
+	osg::ref_ptr<osg::Image> TextureCompressor::createCoverageMipmaps(const osg::Image* source, float alpha_ref)
+	{
+		int width = source->s();
+		int height = source->t();
+
+		//build unscaled mip chain, each level is filtered from previous unscaled level
+		std::vector< std::vector<osg::Vec4f> > levels(1);
+		std::vector<int> level_widths(1, width);
+		std::vector<int> level_heights(1, height);
+		levels[0].resize(width*height);
+		for(int t = 0; t < height; t++)
+			for(int s = 0; s < width; s++)
+				levels[0][t*width + s] = source->getColor(s, t);
+
+		while(width > 1 || height > 1)
+		{
+			const int new_width = std::max(1, width / 2);
+			const int new_height = std::max(1, height / 2);
+			const std::vector<osg::Vec4f> &prev = levels.back();
+			std::vector<osg::Vec4f> level(new_width*new_height);
+			for(int t = 0; t < new_height; t++)
+			{
+				for(int s = 0; s < new_width; s++)
+				{
+					//alpha weighted color to avoid dark halos from transparent texels
+					osg::Vec3f color_sum(0, 0, 0);
+					osg::Vec3f color_sum_unweighted(0, 0, 0);
+					float alpha_sum = 0;
+					for(int j = 0; j < 2; j++)
+					{
+						for(int i = 0; i < 2; i++)
+						{
+							const int ps = std::min(s*2 + i, width - 1);
+							const int pt = std::min(t*2 + j, height - 1);
+							const osg::Vec4f &c = prev[pt*width + ps];
+							const osg::Vec3f rgb(c.r(), c.g(), c.b());
+							color_sum += rgb*c.a();
+							color_sum_unweighted += rgb;
+							alpha_sum += c.a();
+						}
+					}
+					const osg::Vec3f rgb = alpha_sum > 0 ? color_sum / alpha_sum : color_sum_unweighted*0.25f;
+					level[t*new_width + s] = osg::Vec4f(rgb, alpha_sum*0.25f);
+				}
+			}
+			levels.push_back(level);
+			level_widths.push_back(new_width);
+			level_heights.push_back(new_height);
+			width = new_width;
+			height = new_height;
+		}
+
+		//scale alpha in each level to match top level coverage (binary search)
+		const float target_coverage = _getCoverage(levels[0], alpha_ref, 1.0f);
+		std::vector<float> alpha_scales(levels.size(), 1.0f);
+		//no alpha test (every texel pass), keep filtered alpha
+		for(size_t l = 1; l < levels.size() && alpha_ref > 0; l++)
+		{
+			float min_scale = 0.0f;
+			float max_scale = 4.0f;
+			for(int i = 0; i < 16; i++)
+			{
+				const float scale = (min_scale + max_scale)*0.5f;
+				if(_getCoverage(levels[l], alpha_ref, scale) < target_coverage)
+					min_scale = scale;
+				else
+					max_scale = scale;
+			}
+			alpha_scales[l] = (min_scale + max_scale)*0.5f;
+		}
+
+		size_t total_size = 0;
+		osg::Image::MipmapDataType mipmap_offsets;
+		for(size_t l = 0; l < levels.size(); l++)
+		{
+			if(l > 0)
+				mipmap_offsets.push_back(total_size);
+			total_size += levels[l].size() * 4;
+		}
+
+		unsigned char* data = new unsigned char[total_size];
+		unsigned char* ptr = data;
+		for(size_t l = 0; l < levels.size(); l++)
+		{
+			for(size_t i = 0; i < levels[l].size(); i++)
+			{
+				const osg::Vec4f &c = levels[l][i];
+				*ptr++ = static_cast<unsigned char>(osg::clampBetween(c.r(), 0.0f, 1.0f)*255.0f + 0.5f);
+				*ptr++ = static_cast<unsigned char>(osg::clampBetween(c.g(), 0.0f, 1.0f)*255.0f + 0.5f);
+				*ptr++ = static_cast<unsigned char>(osg::clampBetween(c.b(), 0.0f, 1.0f)*255.0f + 0.5f);
+				*ptr++ = static_cast<unsigned char>(osg::clampBetween(c.a()*alpha_scales[l], 0.0f, 1.0f)*255.0f + 0.5f);
+			}
+		}
+
+		osg::ref_ptr<osg::Image> image = new osg::Image;
+		image->setImage(source->s(), source->t(), 1, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, data, osg::Image::USE_NEW_DELETE);
+		image->setMipmapLevels(mipmap_offsets);
+		return image;
+	}
+
+	void TextureCompressor::_encodeBlock(const unsigned char* rgba, unsigned char* out_block)
+	{
+		//Alpha block, always use 8-alpha mode (alpha0 > alpha1)
+		int min_a = 255, max_a = 0;
+		for(int i = 0; i < 16; i++)
+		{
+			min_a = std::min(min_a, static_cast<int>(rgba[i*4 + 3]));
+			max_a = std::max(max_a, static_cast<int>(rgba[i*4 + 3]));
+		}
+		out_block[0] = static_cast<unsigned char>(max_a);
+		out_block[1] = static_cast<unsigned char>(min_a);
+		int alpha_palette[8];
+		alpha_palette[0] = max_a;
+		alpha_palette[1] = min_a;
+		for(int i = 1; i < 7; i++)
+			alpha_palette[i + 1] = ((7 - i)*max_a + i*min_a) / 7;
+
+		unsigned long long alpha_bits = 0;
+		if(max_a != min_a)
+		{
+			for(int i = 0; i < 16; i++)
+			{
+				int best_index = 0;
+				int best_dist = 256;
+				for(int j = 0; j < 8; j++)
+				{
+					const int dist = abs(alpha_palette[j] - static_cast<int>(rgba[i*4 + 3]));
+					if(dist < best_dist)
+					{
+						best_dist = dist;
+						best_index = j;
+					}
+				}
+				alpha_bits |= static_cast<unsigned long long>(best_index) << (3*i);
+			}
+		}
+		for(int i = 0; i < 6; i++)
+			out_block[2 + i] = static_cast<unsigned char>((alpha_bits >> (8*i)) & 0xFF);
+
+		//Color block, bounding box end points inset to reduce error
+		int min_c[3] = {255, 255, 255};
+		int max_c[3] = {0, 0, 0};
+		for(int i = 0; i < 16; i++)
+		{
+			for(int c = 0; c < 3; c++)
+			{
+				min_c[c] = std::min(min_c[c], static_cast<int>(rgba[i*4 + c]));
+				max_c[c] = std::max(max_c[c], static_cast<int>(rgba[i*4 + c]));
+			}
+		}
+		for(int c = 0; c < 3; c++)
+		{
+			const int inset = (max_c[c] - min_c[c]) / 16;
+			min_c[c] += inset;
+			max_c[c] -= inset;
+		}
+		unsigned short c0 = static_cast<unsigned short>(((max_c[0] >> 3) << 11) | ((max_c[1] >> 2) << 5) | (max_c[2] >> 3));
+		unsigned short c1 = static_cast<unsigned short>(((min_c[0] >> 3) << 11) | ((min_c[1] >> 2) << 5) | (min_c[2] >> 3));
+		if(c0 < c1)
+			std::swap(c0, c1);
+
+		int palette[4][3];
+		const unsigned short end_points[2] = {c0, c1};
+		for(int e = 0; e < 2; e++)
+		{
+			const int r = (end_points[e] >> 11) & 0x1F;
+			const int g = (end_points[e] >> 5) & 0x3F;
+			const int b = end_points[e] & 0x1F;
+			palette[e][0] = (r << 3) | (r >> 2);
+			palette[e][1] = (g << 2) | (g >> 4);
+			palette[e][2] = (b << 3) | (b >> 2);
+		}
+		for(int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+		}
+
+		unsigned int color_bits = 0;
+		if(c0 != c1)
+		{
+			for(int i = 0; i < 16; i++)
+			{
+				int best_index = 0;
+				int best_dist = 0x7FFFFFFF;
+				for(int j = 0; j < 4; j++)
+				{
+					int dist = 0;
+					for(int c = 0; c < 3; c++)
+					{
+						const int d = palette[j][c] - static_cast<int>(rgba[i*4 + c]);
+						dist += d*d;
+					}
+					if(dist < best_dist)
+					{
+						best_dist = dist;
+						best_index = j;
+					}
+				}
+				color_bits |= static_cast<unsigned int>(best_index) << (2*i);
+			}
+		}
+		out_block[8] = static_cast<unsigned char>(c0 & 0xFF);
+		out_block[9] = static_cast<unsigned char>(c0 >> 8);
+		out_block[10] = static_cast<unsigned char>(c1 & 0xFF);
+		out_block[11] = static_cast<unsigned char>(c1 >> 8);
+		for(int i = 0; i < 4; i++)
+			out_block[12 + i] = static_cast<unsigned char>((color_bits >> (8*i)) & 0xFF);
+	}
+
+	osg::ref_ptr<osg::Image> TextureCompressor::compressDXT5(const osg::Image* source)
+	{
+		if(source->getPixelFormat() != GL_RGBA || source->getDataType() != GL_UNSIGNED_BYTE)
+			OSGV_EXCEPT(std::string("TextureCompressor::compressDXT5 - Only RGBA8 images supported").c_str());
+
+		const unsigned int num_levels = source->getNumMipmapLevels();
+		size_t total_size = 0;
+		osg::Image::MipmapDataType mipmap_offsets;
+		for(unsigned int l = 0; l < num_levels; l++)
+		{
+			const int width = std::max(1, source->s() >> l);
+			const int height = std::max(1, source->t() >> l);
+			if(l > 0)
+				mipmap_offsets.push_back(total_size);
+			total_size += ((width + 3) / 4) * ((height + 3) / 4) * 16;
+		}
+
+		unsigned char* data = new unsigned char[total_size];
+		unsigned char* out_ptr = data;
+		unsigned char block[64];
+		for(unsigned int l = 0; l < num_levels; l++)
+		{
+			const int width = std::max(1, source->s() >> l);
+			const int height = std::max(1, source->t() >> l);
+			const unsigned char* level_data = source->getMipmapData(l);
+			for(int by = 0; by < height; by += 4)
+			{
+				for(int bx = 0; bx < width; bx += 4)
+				{
+					//clamp to edge for levels smaller than block size
+					for(int y = 0; y < 4; y++)
+					{
+						for(int x = 0; x < 4; x++)
+						{
+							const int s = std::min(bx + x, width - 1);
+							const int t = std::min(by + y, height - 1);
+							memcpy(&block[(y*4 + x)*4], &level_data[(t*width + s)*4], 4);
+						}
+					}
+					_encodeBlock(block, out_ptr);
+					out_ptr += 16;
+				}
+			}
+		}
+
+		osg::ref_ptr<osg::Image> image = new osg::Image;
+		image->setImage(source->s(), source->t(), 1, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_UNSIGNED_BYTE, data, osg::Image::USE_NEW_DELETE);
+		image->setMipmapLevels(mipmap_offsets);
+		return image;
+	}
+
+	std::string TextureCompressor::compileTexture(const std::string &texture_name, float alpha_ref)
+	{
+		const std::string texture_file = osgDB::findDataFile(texture_name);
+		if(texture_file == "")
+			OSGV_EXCEPT(std::string("TextureCompressor::compileTexture - Failed to find texture:" + texture_name).c_str());
+
+		osg::ref_ptr<osg::Image> image = osgDB::readImageFile(texture_file);
+		if(!image.valid())
+			OSGV_EXCEPT(std::string("TextureCompressor::compileTexture - Failed to load texture:" + texture_file).c_str());
+
+		osg::ref_ptr<osg::Image> mipmapped = createCoverageMipmaps(image.get(), alpha_ref);
+		osg::ref_ptr<osg::Image> compressed = compressDXT5(mipmapped.get());
+		const std::string out_file = getCompressedTextureName(texture_file, alpha_ref);
+		if(!osgDB::writeImageFile(*compressed, out_file))
+			OSGV_EXCEPT(std::string("TextureCompressor::compileTexture - Failed to write texture:" + out_file).c_str());
+		return out_file;
+	}
+}
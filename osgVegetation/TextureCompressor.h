@@ -0,0 +1,51 @@
+#pragma once
+#include "Common.h"
+#include <osg/ref_ptr>
+#include <osg/Image>
+#include <osg/Vec4f>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Offline texture compiler for billboard textures.
+		Create full mipmap chain where alpha in each level is scaled to preserve
+		alpha-test coverage of the top level (this prevent foliage from thinning out in the distance)
+		and encode the result as BC3 (DXT5). The result is saved as DDS next to source texture
+		(see getCompressedTextureName) and picked up by Utils::loadTextureArray when present.
+		Mipmap coverage depend on alpha rejection value, so each alpha value get its own file.
+	*/
+	class osgvExport TextureCompressor
+	{
+	public:
+		/**
+			Get name of compressed texture that correspond to texture_name and alpha_ref,
+			ie. "tree.png" with alpha_ref 0.5 -> "tree_bc3_a128.dds" (alpha_ref in 8-bit units)
+		*/
+		static std::string getCompressedTextureName(const std::string &texture_name, float alpha_ref);
+
+		/**
+			Create RGBA8 image with mipmaps where alpha of each mipmap level is scaled so that
+			fraction of texels passing alpha_ref (alpha >= alpha_ref, same as runtime GEQUAL alpha test)
+			is the same as in the source image.
+		*/
+		static osg::ref_ptr<osg::Image> createCoverageMipmaps(const osg::Image* source, float alpha_ref);
+
+		/**
+			Encode (mipmapped) RGBA8 image as GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+		*/
+		static osg::ref_ptr<osg::Image> compressDXT5(const osg::Image* source);
+
+		/**
+			Load texture, build coverage preserving mipmaps, compress and save result as DDS.
+			@param texture_name Texture to compress, resolved through osgDB data file path
+			@param alpha_ref Alpha rejection value used at runtime (BillboardData::AlphaRefValue)
+			@return Name of written file
+		*/
+		static std::string compileTexture(const std::string &texture_name, float alpha_ref);
+	private:
+		static float _getCoverage(const std::vector<osg::Vec4f> &texels, float alpha_ref, float alpha_scale);
+		static void _encodeBlock(const unsigned char* rgba, unsigned char* out_block);
+	};
+}
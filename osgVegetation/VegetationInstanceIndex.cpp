@@ -0,0 +1,500 @@
+#include "VegetationInstanceIndex.h"
+#include "InstanceExtractor.h"
+#include <osg/Geode>
+#include <osg/Math>
+#include <osg/NodeVisitor>
+#include <osg/PagedLOD>
+#include <osg/ProxyNode>
+#include <osg/Transform>
+#include <osgDB/FileNameUtils>
+#include <osgDB/ReadFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace osgVegetation
+{
+	const char INSTANCE_INDEX_MAGIC[8] = {'O','S','G','V','V','I','D','X'};
+	const unsigned int INSTANCE_INDEX_VERSION = 1;
+
+	struct InstanceIndexHeader
+	{
+		char Magic[8];
+		unsigned int Version;
+		unsigned int NumInstances;
+		double CellSize;
+		double OriginX;
+		double OriginY;
+		int GridX;
+		int GridY;
+		float MaxRadius;
+		unsigned int Reserved;
+	};
+
+	struct InstanceIndexRecord
+	{
+		double Position[3];
+		float Radius;
+		float Height;
+	};
+
+	/**
+		Visitor that load all tiles (PagedLOD and ProxyNode children) and add
+		decoded billboard and mesh instances to index in world coordinates.
+	*/
+	class InstanceIndexVisitor : public osg::NodeVisitor
+	{
+	public:
+		InstanceIndexVisitor(VegetationInstanceIndex* index, const std::string &root_path) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+			m_Index(index),
+			m_RootPath(root_path),
+			m_NumMissingFiles(0)
+		{
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::Node& node)
+		{
+			//don't traverse mesh template
+			if(_addMeshes(node))
+				return;
+			traverse(node);
+		}
+
+		void apply(osg::Transform& transform)
+		{
+			if(_addMeshes(transform))
+				return;
+			osg::Matrixd matrix = m_Matrices.empty() ? osg::Matrixd() : m_Matrices.back();
+			transform.computeLocalToWorldMatrix(matrix, this);
+			m_Matrices.push_back(matrix);
+			traverse(transform);
+			m_Matrices.pop_back();
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			if(_addMeshes(geode))
+				return;
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+			{
+				ExtractedInstanceVector instances;
+				if(!InstanceExtractor::extractBillboards(geode.getDrawable(i), instances))
+					continue;
+				for(size_t j = 0; j < instances.size(); j++)
+					m_Index->addInstance(_toWorld(instances[j].Position), instances[j].Width*0.5f, instances[j].Height);
+			}
+		}
+
+		void apply(osg::PagedLOD& plod)
+		{
+			traverse(plod);
+			for(unsigned int i = 0; i < plod.getNumFileNames(); i++)
+			{
+				if(plod.getFileName(i) != "")
+					_traverseFile(plod.getDatabasePath(), plod.getFileName(i));
+			}
+		}
+
+		void apply(osg::ProxyNode& pn)
+		{
+			traverse(pn);
+			for(unsigned int i = 0; i < pn.getNumFileNames(); i++)
+			{
+				//skip already loaded children
+				if(i < pn.getNumChildren())
+					continue;
+				_traverseFile(pn.getDatabasePath(), pn.getFileName(i));
+			}
+		}
+
+		unsigned int getNumMissingFiles() const {return m_NumMissingFiles;}
+	private:
+		osg::Vec3d _toWorld(const osg::Vec3d &pos) const
+		{
+			return m_Matrices.empty() ? pos : pos * m_Matrices.back();
+		}
+
+		bool _addMeshes(osg::Node& node)
+		{
+			ExtractedInstanceVector instances;
+			if(!InstanceExtractor::extractMeshes(&node, instances))
+				return false;
+			for(size_t i = 0; i < instances.size(); i++)
+			{
+				const osg::BoundingBoxd &bb = instances[i].Bound;
+				float radius = 0;
+				float height = instances[i].Height;
+				if(bb.valid())
+				{
+					radius = 0.5*std::max(bb.xMax() - bb.xMin(), bb.yMax() - bb.yMin());
+					height = bb.zMax() - instances[i].Position.z();
+				}
+				m_Index->addInstance(_toWorld(instances[i].Position), radius, height);
+			}
+			return true;
+		}
+
+		void _traverseFile(const std::string &database_path, const std::string &file_name)
+		{
+			std::string path = database_path;
+			if(path == "")
+				path = m_RootPath;
+			const std::string full_name = path == "" ? file_name : osgDB::concatPaths(path, file_name);
+			//tile is released when decoded
+			osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(full_name);
+			if(!node.valid())
+			{
+				OSG_WARN << "VegetationInstanceIndex - failed to load tile:" << full_name << std::endl;
+				m_NumMissingFiles++;
+				return;
+			}
+			node->accept(*this);
+		}
+
+		VegetationInstanceIndex* m_Index;
+		std::string m_RootPath;
+		std::vector<osg::Matrixd> m_Matrices;
+		unsigned int m_NumMissingFiles;
+	};
+
+	VegetationInstanceIndex::VegetationInstanceIndex(double cell_size) : m_CellSize(cell_size),
+		m_OriginX(0),
+		m_OriginY(0),
+		m_GridX(1),
+		m_GridY(1),
+		m_MaxRadius(0)
+	{
+		m_CellStart.assign(2, 0);
+	}
+
+	VegetationInstanceIndex::~VegetationInstanceIndex()
+	{
+
+	}
+
+	void VegetationInstanceIndex::addInstance(const osg::Vec3d &position, float radius, float height)
+	{
+		m_Instances.push_back(Instance(position, radius, height));
+	}
+
+	void VegetationInstanceIndex::build()
+	{
+		double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+		m_MaxRadius = 0;
+		for(size_t i = 0; i < m_Instances.size(); i++)
+		{
+			const osg::Vec3d &pos = m_Instances[i].Position;
+			if(i == 0)
+			{
+				min_x = max_x = pos.x();
+				min_y = max_y = pos.y();
+			}
+			min_x = std::min(min_x, pos.x());
+			min_y = std::min(min_y, pos.y());
+			max_x = std::max(max_x, pos.x());
+			max_y = std::max(max_y, pos.y());
+			m_MaxRadius = std::max(m_MaxRadius, m_Instances[i].Radius);
+		}
+
+		//default to about 8 instances per cell
+		const double num_instances = static_cast<double>(std::max<size_t>(m_Instances.size(), 1));
+		if(m_CellSize <= 0)
+			m_CellSize = sqrt(std::max((max_x - min_x)*(max_y - min_y), 1.0)*8.0 / num_instances);
+		//instance cylinders must not reach beyond neighbour cells
+		m_CellSize = std::max(m_CellSize, std::max(2.0*m_MaxRadius, 0.001));
+		m_OriginX = min_x;
+		m_OriginY = min_y;
+		do
+		{
+			m_GridX = static_cast<int>((max_x - min_x) / m_CellSize) + 1;
+			m_GridY = static_cast<int>((max_y - min_y) / m_CellSize) + 1;
+			//limit grid memory for sparse instances
+			if(static_cast<double>(m_GridX)*m_GridY > 16.0*num_instances + 1024.0)
+				m_CellSize *= 2.0;
+			else
+				break;
+		} while(true);
+
+		//counting sort of instances by cell
+		const size_t num_cells = static_cast<size_t>(m_GridX)*m_GridY;
+		std::vector<unsigned int> instance_cells(m_Instances.size());
+		m_CellStart.assign(num_cells + 1, 0);
+		for(size_t i = 0; i < m_Instances.size(); i++)
+		{
+			instance_cells[i] = _getCellY(m_Instances[i].Position.y())*m_GridX + _getCellX(m_Instances[i].Position.x());
+			m_CellStart[instance_cells[i] + 1]++;
+		}
+		for(size_t i = 0; i < num_cells; i++)
+			m_CellStart[i + 1] += m_CellStart[i];
+
+		std::vector<unsigned int> insert_pos(m_CellStart.begin(), m_CellStart.end() - 1);
+		std::vector<Instance> sorted(m_Instances.size());
+		for(size_t i = 0; i < m_Instances.size(); i++)
+			sorted[insert_pos[instance_cells[i]]++] = m_Instances[i];
+		m_Instances.swap(sorted);
+	}
+
+	int VegetationInstanceIndex::_getCellX(double x) const
+	{
+		return osg::clampBetween(static_cast<int>(floor((x - m_OriginX) / m_CellSize)), 0, m_GridX - 1);
+	}
+
+	int VegetationInstanceIndex::_getCellY(double y) const
+	{
+		return osg::clampBetween(static_cast<int>(floor((y - m_OriginY) / m_CellSize)), 0, m_GridY - 1);
+	}
+
+	void VegetationInstanceIndex::_getCellRange(double min_x, double min_y, double max_x, double max_y, int &cx0, int &cy0, int &cx1, int &cy1) const
+	{
+		cx0 = _getCellX(min_x);
+		cy0 = _getCellY(min_y);
+		cx1 = _getCellX(max_x);
+		cy1 = _getCellY(max_y);
+	}
+
+	void VegetationInstanceIndex::getInstancesInRadius(const osg::Vec3d &center, double radius, std::vector<unsigned int> &instances) const
+	{
+		int cx0, cy0, cx1, cy1;
+		_getCellRange(center.x() - radius, center.y() - radius, center.x() + radius, center.y() + radius, cx0, cy0, cx1, cy1);
+		const double radius2 = radius*radius;
+		for(int cy = cy0; cy <= cy1; cy++)
+		{
+			for(int cx = cx0; cx <= cx1; cx++)
+			{
+				const int cell = cy*m_GridX + cx;
+				for(unsigned int i = m_CellStart[cell]; i < m_CellStart[cell + 1]; i++)
+				{
+					const double dx = m_Instances[i].Position.x() - center.x();
+					const double dy = m_Instances[i].Position.y() - center.y();
+					if(dx*dx + dy*dy <= radius2)
+						instances.push_back(i);
+				}
+			}
+		}
+	}
+
+	void VegetationInstanceIndex::getInstancesInBox(const osg::BoundingBoxd &box, std::vector<unsigned int> &instances) const
+	{
+		int cx0, cy0, cx1, cy1;
+		_getCellRange(box.xMin() - m_MaxRadius, box.yMin() - m_MaxRadius, box.xMax() + m_MaxRadius, box.yMax() + m_MaxRadius, cx0, cy0, cx1, cy1);
+		for(int cy = cy0; cy <= cy1; cy++)
+		{
+			for(int cx = cx0; cx <= cx1; cx++)
+			{
+				const int cell = cy*m_GridX + cx;
+				for(unsigned int i = m_CellStart[cell]; i < m_CellStart[cell + 1]; i++)
+				{
+					const Instance &instance = m_Instances[i];
+					const osg::Vec3d &pos = instance.Position;
+					if(pos.x() + instance.Radius >= box.xMin() && pos.x() - instance.Radius <= box.xMax() &&
+						pos.y() + instance.Radius >= box.yMin() && pos.y() - instance.Radius <= box.yMax() &&
+						pos.z() + instance.Height >= box.zMin() && pos.z() <= box.zMax())
+						instances.push_back(i);
+				}
+			}
+		}
+	}
+
+	bool VegetationInstanceIndex::_intersectCylinder(const Instance &instance, const osg::Vec3d &start, const osg::Vec3d &dir, float radius_scale, double &ratio) const
+	{
+		double t0 = 0;
+		double t1 = 1;
+
+		//height slab
+		const double z0 = instance.Position.z();
+		const double z1 = z0 + instance.Height;
+		if(fabs(dir.z()) < 1e-12)
+		{
+			if(start.z() < z0 || start.z() > z1)
+				return false;
+		}
+		else
+		{
+			double ta = (z0 - start.z()) / dir.z();
+			double tb = (z1 - start.z()) / dir.z();
+			if(ta > tb)
+				std::swap(ta, tb);
+			t0 = std::max(t0, ta);
+			t1 = std::min(t1, tb);
+			if(t0 > t1)
+				return false;
+		}
+
+		//infinite vertical cylinder
+		const double radius = instance.Radius*radius_scale;
+		const double ox = start.x() - instance.Position.x();
+		const double oy = start.y() - instance.Position.y();
+		const double a = dir.x()*dir.x() + dir.y()*dir.y();
+		const double c = ox*ox + oy*oy - radius*radius;
+		if(a < 1e-12)
+		{
+			if(c > 0)
+				return false;
+		}
+		else
+		{
+			const double b = 2.0*(ox*dir.x() + oy*dir.y());
+			const double disc = b*b - 4.0*a*c;
+			if(disc < 0)
+				return false;
+			const double sq = sqrt(disc);
+			t0 = std::max(t0, (-b - sq) / (2.0*a));
+			t1 = std::min(t1, (-b + sq) / (2.0*a));
+			if(t0 > t1)
+				return false;
+		}
+		ratio = t0;
+		return true;
+	}
+
+	static bool IntersectionSortPredicate(const VegetationInstanceIndex::Intersection &lhs, const VegetationInstanceIndex::Intersection &rhs)
+	{
+		return lhs.Ratio < rhs.Ratio;
+	}
+
+	bool VegetationInstanceIndex::getIntersections(const osg::Vec3d &start, const osg::Vec3d &end, IntersectionVector &intersections, float radius_scale) const
+	{
+		if(m_Instances.empty())
+			return false;
+		radius_scale = osg::clampBetween(radius_scale, 0.0f, 1.0f);
+
+		//sample segment with cell size step, all cylinders touching segment are
+		//then found in neighbour cells of the sample cells (cell size >= 2 * max radius)
+		const osg::Vec3d dir = end - start;
+		const double length_xy = sqrt(dir.x()*dir.x() + dir.y()*dir.y());
+		const int num_steps = static_cast<int>(ceil(length_xy / m_CellSize));
+		std::vector<int> cells;
+		for(int i = 0; i <= num_steps; i++)
+		{
+			const double t = num_steps > 0 ? static_cast<double>(i) / static_cast<double>(num_steps) : 0.0;
+			const osg::Vec3d p = start + dir*t;
+			const int cx = _getCellX(p.x());
+			const int cy = _getCellY(p.y());
+			for(int y = std::max(cy - 1, 0); y <= std::min(cy + 1, m_GridY - 1); y++)
+			{
+				for(int x = std::max(cx - 1, 0); x <= std::min(cx + 1, m_GridX - 1); x++)
+					cells.push_back(y*m_GridX + x);
+			}
+		}
+		std::sort(cells.begin(), cells.end());
+		cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+
+		const size_t num_intersections = intersections.size();
+		for(size_t i = 0; i < cells.size(); i++)
+		{
+			for(unsigned int j = m_CellStart[cells[i]]; j < m_CellStart[cells[i] + 1]; j++)
+			{
+				double ratio = 0;
+				if(_intersectCylinder(m_Instances[j], start, dir, radius_scale, ratio))
+				{
+					Intersection intersection;
+					intersection.InstanceIndex = j;
+					intersection.Ratio = ratio;
+					intersection.Point = start + dir*ratio;
+					intersections.push_back(intersection);
+				}
+			}
+		}
+		std::sort(intersections.begin() + num_intersections, intersections.end(), IntersectionSortPredicate);
+		return intersections.size() > num_intersections;
+	}
+
+	bool VegetationInstanceIndex::getFirstIntersection(const osg::Vec3d &start, const osg::Vec3d &end, Intersection &intersection, float radius_scale) const
+	{
+		IntersectionVector intersections;
+		if(!getIntersections(start, end, intersections, radius_scale))
+			return false;
+		intersection = intersections.front();
+		return true;
+	}
+
+	VegetationInstanceIndex* VegetationInstanceIndex::createFromDatabase(const std::string &filename)
+	{
+		osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(filename);
+		if(!node.valid())
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::createFromDatabase - failed to load:" + filename).c_str());
+		osg::ref_ptr<VegetationInstanceIndex> index = new VegetationInstanceIndex();
+		InstanceIndexVisitor visitor(index.get(), osgDB::getFilePath(filename));
+		node->accept(visitor);
+		if(visitor.getNumMissingFiles() > 0)
+			OSG_WARN << "VegetationInstanceIndex::createFromDatabase - missing tile files:" << visitor.getNumMissingFiles() << std::endl;
+		index->build();
+		return index.release();
+	}
+
+	void VegetationInstanceIndex::write(const std::string &filename) const
+	{
+		InstanceIndexHeader header;
+		memcpy(header.Magic, INSTANCE_INDEX_MAGIC, sizeof(header.Magic));
+		header.Version = INSTANCE_INDEX_VERSION;
+		header.NumInstances = static_cast<unsigned int>(m_Instances.size());
+		header.CellSize = m_CellSize;
+		header.OriginX = m_OriginX;
+		header.OriginY = m_OriginY;
+		header.GridX = m_GridX;
+		header.GridY = m_GridY;
+		header.MaxRadius = m_MaxRadius;
+		header.Reserved = 0;
+
+		std::vector<InstanceIndexRecord> records(m_Instances.size());
+		for(size_t i = 0; i < m_Instances.size(); i++)
+		{
+			for(int j = 0; j < 3; j++)
+				records[i].Position[j] = m_Instances[i].Position[j];
+			records[i].Radius = m_Instances[i].Radius;
+			records[i].Height = m_Instances[i].Height;
+		}
+
+		std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+		if(!file.is_open())
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::write - failed to open file:" + filename).c_str());
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(&m_CellStart[0]), m_CellStart.size()*sizeof(unsigned int));
+		if(records.size() > 0)
+			file.write(reinterpret_cast<const char*>(&records[0]), records.size()*sizeof(InstanceIndexRecord));
+		if(!file.good())
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::write - failed to write file:" + filename).c_str());
+	}
+
+	VegetationInstanceIndex* VegetationInstanceIndex::read(const std::string &filename)
+	{
+		std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+		if(!file.is_open())
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::read - failed to open file:" + filename).c_str());
+		const std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		InstanceIndexHeader header;
+		if(data.size() < sizeof(header))
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::read - file too small:" + filename).c_str());
+		memcpy(&header, &data[0], sizeof(header));
+		if(memcmp(header.Magic, INSTANCE_INDEX_MAGIC, sizeof(header.Magic)) != 0 || header.Version != INSTANCE_INDEX_VERSION)
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::read - not a instance index file or unsupported version:" + filename).c_str());
+		const size_t num_cells = static_cast<size_t>(header.GridX)*header.GridY;
+		const size_t records_offset = sizeof(header) + (num_cells + 1)*sizeof(unsigned int);
+		if(header.GridX < 1 || header.GridY < 1 || data.size() < records_offset + header.NumInstances*sizeof(InstanceIndexRecord))
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::read - corrupt file:" + filename).c_str());
+
+		osg::ref_ptr<VegetationInstanceIndex> index = new VegetationInstanceIndex(header.CellSize);
+		index->m_OriginX = header.OriginX;
+		index->m_OriginY = header.OriginY;
+		index->m_GridX = header.GridX;
+		index->m_GridY = header.GridY;
+		index->m_MaxRadius = header.MaxRadius;
+		index->m_CellStart.resize(num_cells + 1);
+		memcpy(&index->m_CellStart[0], &data[sizeof(header)], index->m_CellStart.size()*sizeof(unsigned int));
+		if(index->m_CellStart.back() != header.NumInstances)
+			OSGV_EXCEPT(std::string("VegetationInstanceIndex::read - corrupt file:" + filename).c_str());
+
+		index->m_Instances.resize(header.NumInstances);
+		for(unsigned int i = 0; i < header.NumInstances; i++)
+		{
+			InstanceIndexRecord record;
+			memcpy(&record, &data[records_offset + i*sizeof(InstanceIndexRecord)], sizeof(record));
+			index->m_Instances[i] = Instance(osg::Vec3d(record.Position[0], record.Position[1], record.Position[2]), record.Radius, record.Height);
+		}
+		return index.release();
+	}
+}
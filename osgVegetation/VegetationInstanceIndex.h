@@ -0,0 +1,121 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Vec3d>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Runtime spatial index over generated vegetation instances (billboards and meshes),
+		used by simulation code to find instances near a point or hit by a segment without
+		intersecting the rendered geometry. Each instance is represented by a vertical
+		cylinder (position at cylinder base, radius and height).
+		Instances are stored sorted by uniform grid cell, the cell size is at least
+		twice the largest instance radius so that queries only need to visit neighbour cells.
+		The index can be created from a saved vegetation database (tiles are loaded one by one
+		and released after decoding) and saved to a compact binary file that can be loaded without any scene graph.
+		Queries are const and thread safe.
+	*/
+	class osgvExport VegetationInstanceIndex : public osg::Referenced
+	{
+	public:
+		struct Instance
+		{
+			Instance() : Radius(0), Height(0) {}
+			Instance(const osg::Vec3d &position, float radius, float height) : Position(position), Radius(radius), Height(height) {}
+			//cylinder base in world coordinates
+			osg::Vec3d Position;
+			float Radius;
+			float Height;
+		};
+
+		struct Intersection
+		{
+			Intersection() : InstanceIndex(0), Ratio(0) {}
+			unsigned int InstanceIndex;
+			//segment ratio (0 at start, 1 at end)
+			double Ratio;
+			osg::Vec3d Point;
+		};
+		typedef std::vector<Intersection> IntersectionVector;
+
+		/**
+			@param cell_size Grid cell size, 0 (default) select cell size from instance density
+		*/
+		VegetationInstanceIndex(double cell_size = 0);
+
+		/**
+			Add instance, build must be called before queries
+		*/
+		void addInstance(const osg::Vec3d &position, float radius, float height);
+
+		/**
+			Build spatial index from added instances, instance indices are changed by this call
+		*/
+		void build();
+
+		/**
+			Get instances with position inside radius (horizontal distance).
+			@param instances Indices of found instances are added to this vector
+		*/
+		void getInstancesInRadius(const osg::Vec3d &center, double radius, std::vector<unsigned int> &instances) const;
+
+		/**
+			Get instances with cylinder overlapping box
+		*/
+		void getInstancesInBox(const osg::BoundingBoxd &box, std::vector<unsigned int> &instances) const;
+
+		/**
+			Get all instance cylinders hit by segment, sorted by distance from start.
+			@param radius_scale Scale applied to instance radius, for example to test trunks instead of crowns (must be <= 1)
+			@return true if any instance was hit
+		*/
+		bool getIntersections(const osg::Vec3d &start, const osg::Vec3d &end, IntersectionVector &intersections, float radius_scale = 1.0f) const;
+
+		/**
+			Get first instance cylinder hit by segment
+			@return true if any instance was hit
+		*/
+		bool getFirstIntersection(const osg::Vec3d &start, const osg::Vec3d &end, Intersection &intersection, float radius_scale = 1.0f) const;
+
+		const Instance& getInstance(unsigned int index) const {return m_Instances[index];}
+		unsigned int getNumInstances() const {return static_cast<unsigned int>(m_Instances.size());}
+		double getCellSize() const {return m_CellSize;}
+
+		/**
+			Create index from vegetation database saved by osgVegetationBuilder,
+			all PagedLOD and ProxyNode files are loaded. Throw if file can't be loaded.
+		*/
+		static VegetationInstanceIndex* createFromDatabase(const std::string &filename);
+
+		/**
+			Save index to binary file, throw on failure
+		*/
+		void write(const std::string &filename) const;
+
+		/**
+			Load index saved by write, throw on failure
+		*/
+		static VegetationInstanceIndex* read(const std::string &filename);
+	private:
+		virtual ~VegetationInstanceIndex();
+		void _getCellRange(double min_x, double min_y, double max_x, double max_y, int &cx0, int &cy0, int &cx1, int &cy1) const;
+		int _getCellX(double x) const;
+		int _getCellY(double y) const;
+		bool _intersectCylinder(const Instance &instance, const osg::Vec3d &start, const osg::Vec3d &dir, float radius_scale, double &ratio) const;
+
+		std::vector<Instance> m_Instances;
+		//instance index where each cell start, size GridX*GridY+1
+		std::vector<unsigned int> m_CellStart;
+		double m_CellSize;
+		double m_OriginX;
+		double m_OriginY;
+		int m_GridX;
+		int m_GridY;
+		float m_MaxRadius;
+	};
+}
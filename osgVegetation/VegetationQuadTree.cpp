@@ -0,0 +1,237 @@
+#include "VegetationQuadTree.h"
+#include <osg/CullStack>
+#include <osg/PagedLOD>
+#include <algorithm>
+#include <cfloat>
+
+namespace osgVegetation
+{
+	//pixel size used when visitor has no cull stack, select highest resolution tiles
+	const float HIGHEST_RESOLUTION_RANGE = FLT_MAX*0.5f;
+
+	static bool IsCulled(const osg::Polytope::PlaneList &planes, const osg::Vec4f &sphere)
+	{
+		const osg::Vec3 center(sphere.x(), sphere.y(), sphere.z());
+		for(osg::Polytope::PlaneList::const_iterator iter = planes.begin(); iter != planes.end(); ++iter)
+		{
+			if(iter->distance(center) < -sphere.w())
+				return true;
+		}
+		return false;
+	}
+
+	static bool IsEmpty(const osg::Node* node)
+	{
+		const osg::Group* group = node->asGroup();
+		return group && group->getNumChildren() == 0;
+	}
+
+	/**
+		Get group holding child tiles if LOD is a quad tree tile that can be flattened,
+		ranges must use quad tree range mode and only root may have state, node mask of other tiles is stored in tile
+	*/
+	static osg::Group* GetChildTiles(osg::Node* node, osg::LOD::RangeMode mode, bool root)
+	{
+		osg::LOD* lod = dynamic_cast<osg::LOD*>(node);
+		if(lod == NULL || dynamic_cast<osg::PagedLOD*>(lod) || lod->getRangeMode() != mode ||
+			lod->getNumChildren() != 2 || lod->getNumRanges() != 2)
+			return NULL;
+		if(!root && (lod->getStateSet() || lod->getCullCallback() || lod->getUpdateCallback()))
+			return NULL;
+		osg::Group* child_tiles = lod->getChild(1)->asGroup();
+		if(child_tiles == NULL || child_tiles->asTransform() || dynamic_cast<osg::LOD*>(child_tiles) ||
+			child_tiles->getStateSet() || child_tiles->getCullCallback() || child_tiles->getNodeMask() != ~0u)
+			return NULL;
+		return child_tiles;
+	}
+
+	VegetationQuadTree::VegetationQuadTree() : m_RangeMode(osg::LOD::DISTANCE_FROM_EYE_POINT)
+	{
+
+	}
+
+	VegetationQuadTree::VegetationQuadTree(const VegetationQuadTree& quad_tree, const osg::CopyOp& copyop) : osg::Group(quad_tree, copyop),
+		m_RangeMode(quad_tree.m_RangeMode),
+		m_Spheres(quad_tree.m_Spheres),
+		m_Ranges(quad_tree.m_Ranges),
+		m_Links(quad_tree.m_Links),
+		m_TileCallbacks(quad_tree.m_TileCallbacks)
+	{
+
+	}
+
+	VegetationQuadTree::~VegetationQuadTree()
+	{
+
+	}
+
+	VegetationQuadTree* VegetationQuadTree::create(osg::Node* root)
+	{
+		osg::LOD* root_lod = dynamic_cast<osg::LOD*>(root);
+		if(root_lod == NULL || GetChildTiles(root_lod, root_lod->getRangeMode(), true) == NULL)
+			return NULL;
+
+		osg::ref_ptr<VegetationQuadTree> quad_tree = new VegetationQuadTree;
+		quad_tree->setRangeMode(root_lod->getRangeMode());
+		quad_tree->setStateSet(root_lod->getStateSet());
+		quad_tree->setNodeMask(root_lod->getNodeMask());
+
+		//breadth first, children of each tile are added last in tile list
+		std::vector<Tile> tiles;
+		std::vector<osg::Node*> tile_nodes;
+		tile_nodes.push_back(root);
+		for(size_t i = 0; i < tile_nodes.size(); i++)
+		{
+			osg::Node* node = tile_nodes[i];
+			osg::Node* content = NULL;
+			Tile tile;
+			osg::Group* child_tiles = GetChildTiles(node, quad_tree->getRangeMode(), i == 0);
+			if(child_tiles)
+			{
+				osg::LOD* lod = static_cast<osg::LOD*>(node);
+				tile.Center = lod->getCenter();
+				tile.Radius = lod->getRadius() >= 0 ? lod->getRadius() : lod->getBound().radius();
+				tile.ContentMinRange = lod->getMinRange(0);
+				tile.ContentMaxRange = lod->getMaxRange(0);
+				tile.ChildMinRange = lod->getMinRange(1);
+				tile.ChildMaxRange = lod->getMaxRange(1);
+				//root mask is set on quad tree node
+				if(i > 0)
+					tile.NodeMask = lod->getNodeMask();
+				tile.FirstChild = static_cast<unsigned int>(tile_nodes.size());
+				for(unsigned int j = 0; j < child_tiles->getNumChildren(); j++)
+				{
+					if(IsEmpty(child_tiles->getChild(j)))
+						continue;
+					tile_nodes.push_back(child_tiles->getChild(j));
+					tile.NumChildren++;
+				}
+				content = lod->getChild(0);
+			}
+			else
+			{
+				//final tile (or node that can't be flattened), always active when parent is
+				tile.Center = node->getBound().center();
+				tile.Radius = node->getBound().radius();
+				tile.ContentMaxRange = FLT_MAX;
+				content = node;
+			}
+
+			if(!IsEmpty(content))
+			{
+				tile.Content = static_cast<int>(quad_tree->getNumChildren());
+				quad_tree->addChild(content);
+			}
+			tiles.push_back(tile);
+		}
+		quad_tree->setTiles(tiles);
+		return quad_tree.release();
+	}
+
+	void VegetationQuadTree::setTiles(const std::vector<Tile> &tiles)
+	{
+		m_Spheres.resize(tiles.size());
+		m_Ranges.resize(tiles.size());
+		m_Links.resize(tiles.size());
+		for(size_t i = 0; i < tiles.size(); i++)
+		{
+			const Tile &tile = tiles[i];
+			if(tile.Content >= static_cast<int>(getNumChildren()) || (tile.NumChildren > 0 && tile.FirstChild + tile.NumChildren > tiles.size()))
+				OSGV_EXCEPT(std::string("VegetationQuadTree::setTiles - tile content or child index out of range").c_str());
+			m_Spheres[i].set(tile.Center.x(), tile.Center.y(), tile.Center.z(), tile.Radius);
+			m_Ranges[i].set(tile.ContentMinRange, tile.ContentMaxRange, tile.ChildMinRange, tile.ChildMaxRange);
+			m_Links[i].FirstChild = tile.FirstChild;
+			m_Links[i].NumChildren = tile.NumChildren;
+			m_Links[i].Content = tile.Content;
+			m_Links[i].NodeMask = tile.NodeMask;
+		}
+	}
+
+	VegetationQuadTree::Tile VegetationQuadTree::getTile(unsigned int index) const
+	{
+		Tile tile;
+		tile.Center.set(m_Spheres[index].x(), m_Spheres[index].y(), m_Spheres[index].z());
+		tile.Radius = m_Spheres[index].w();
+		tile.ContentMinRange = m_Ranges[index].x();
+		tile.ContentMaxRange = m_Ranges[index].y();
+		tile.ChildMinRange = m_Ranges[index].z();
+		tile.ChildMaxRange = m_Ranges[index].w();
+		tile.FirstChild = m_Links[index].FirstChild;
+		tile.NumChildren = m_Links[index].NumChildren;
+		tile.Content = m_Links[index].Content;
+		tile.NodeMask = m_Links[index].NodeMask;
+		return tile;
+	}
+
+	void VegetationQuadTree::addTileCallback(TileCallback* callback)
+	{
+		if(std::find(m_TileCallbacks.begin(), m_TileCallbacks.end(), callback) == m_TileCallbacks.end())
+			m_TileCallbacks.push_back(callback);
+	}
+
+	void VegetationQuadTree::removeTileCallback(TileCallback* callback)
+	{
+		std::vector<osg::ref_ptr<TileCallback> >::iterator iter = std::find(m_TileCallbacks.begin(), m_TileCallbacks.end(), callback);
+		if(iter != m_TileCallbacks.end())
+			m_TileCallbacks.erase(iter);
+	}
+
+	void VegetationQuadTree::traverse(osg::NodeVisitor& nv)
+	{
+		if(nv.getTraversalMode() == osg::NodeVisitor::TRAVERSE_ALL_CHILDREN || m_Spheres.empty())
+		{
+			osg::Group::traverse(nv);
+			return;
+		}
+		if(nv.getTraversalMode() != osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN)
+			return;
+
+		//frustum is in local coordinates of this node, same as tile spheres
+		osg::CullStack* cull_stack = dynamic_cast<osg::CullStack*>(&nv);
+		const osg::Polytope::PlaneList* planes = cull_stack ? &cull_stack->getCurrentCullingSet().getFrustum().getPlaneList() : NULL;
+		const osg::Vec3 view_point = cull_stack ? cull_stack->getViewPointLocal() : osg::Vec3();
+		const float lod_scale = cull_stack ? cull_stack->getLODScale() : 1.0f;
+		const bool pixel_size = m_RangeMode == osg::LOD::PIXEL_SIZE_ON_SCREEN;
+		//same test as NodeVisitor::validNodeMask
+		const osg::Node::NodeMask traversal_mask = nv.getTraversalMask();
+		const osg::Node::NodeMask mask_override = nv.getNodeMaskOverride();
+
+		std::vector<unsigned int> stack;
+		stack.reserve(64);
+		stack.push_back(0);
+		while(!stack.empty())
+		{
+			const unsigned int index = stack.back();
+			stack.pop_back();
+			const TileLinks &links = m_Links[index];
+			if((traversal_mask & (mask_override | links.NodeMask)) == 0)
+				continue;
+			const osg::Vec4f &sphere = m_Spheres[index];
+			if(planes && IsCulled(*planes, sphere))
+				continue;
+
+			//same range as osg::LOD::traverse
+			const osg::Vec3 center(sphere.x(), sphere.y(), sphere.z());
+			float range = 0;
+			if(cull_stack)
+				range = pixel_size ? cull_stack->clampedPixelSize(center, sphere.w()) / lod_scale : (center - view_point).length()*lod_scale;
+			else
+				range = pixel_size ? HIGHEST_RESOLUTION_RANGE : nv.getDistanceToViewPoint(center, true);
+
+			const osg::Vec4f &ranges = m_Ranges[index];
+			const bool content_active = links.Content >= 0 && range >= ranges.x() && range < ranges.y();
+			bool skip = false;
+			for(size_t i = 0; i < m_TileCallbacks.size() && !skip; i++)
+				skip = !(*m_TileCallbacks[i])(this, index, content_active, &nv);
+			if(skip)
+				continue;
+			if(content_active)
+				_children[links.Content]->accept(nv);
+			if(range >= ranges.z() && range < ranges.w())
+			{
+				for(unsigned int i = 0; i < links.NumChildren; i++)
+					stack.push_back(links.FirstChild + i);
+			}
+		}
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "Common.h"
+#include <osg/Group>
+#include <osg/LOD>
+#include <osg/Vec4>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Flat replacement for the nested LOD/Group hierarchy created in non-paged mode.
+		All tiles are stored in contiguous arrays in breadth first order (children of a tile are
+		consecutive), tile content (instance geodes/mesh nodes) are the children of this group.
+		Cull traversal walks the tile arrays with an explicit stack and does frustum and range tests
+		directly on the arrays instead of visiting two nodes (LOD and Group) for each tile.
+		Tile node masks (shadow caster masks) are tested against the visitor traversal mask the same way.
+		Tile ranges use the same rules as the replaced LOD node: content is active
+		inside content range and child tiles are active inside child range, ranges are distances or
+		pixel sizes depending on range mode. Visitors using TRAVERSE_ALL_CHILDREN visit all content.
+		Children must not be added or removed directly, tile content index would be invalid.
+		Tiles have no nodes that cull callbacks can be attached to, use addTileCallback to
+		hook into the tile loop (see TerrainOcclusionCuller and VegetationStats).
+	*/
+	class osgvExport VegetationQuadTree : public osg::Group
+	{
+	public:
+		struct Tile
+		{
+			Tile() : Radius(0),
+				ContentMinRange(0),
+				ContentMaxRange(0),
+				ChildMinRange(0),
+				ChildMaxRange(0),
+				FirstChild(0),
+				NumChildren(0),
+				Content(-1),
+				NodeMask(~0u)
+			{
+
+			}
+			osg::Vec3 Center;
+			float Radius;
+			float ContentMinRange;
+			float ContentMaxRange;
+			float ChildMinRange;
+			float ChildMaxRange;
+			//tile index of first child tile
+			unsigned int FirstChild;
+			unsigned int NumChildren;
+			//group child index of tile content, -1 if no content
+			int Content;
+			//node mask of flattened LOD node, tile and child tiles are skipped if visitor traversal mask don't match
+			osg::Node::NodeMask NodeMask;
+		};
+
+		/**
+			Callback invoked by the cull traversal for each tile inside the view frustum,
+			replace the LOD cull callbacks used by nested LOD hierarchies.
+		*/
+		class TileCallback : public osg::Referenced
+		{
+		public:
+			/**
+				@param quad_tree Quad tree being traversed
+				@param index Tile index, see getTile
+				@param content_active True if tile content is in range and will be traversed
+				@param nv Visitor, could be any visitor that use TRAVERSE_ACTIVE_CHILDREN
+				@return false to skip tile content and child tiles
+			*/
+			virtual bool operator()(VegetationQuadTree* quad_tree, unsigned int index, bool content_active, osg::NodeVisitor* nv) = 0;
+		protected:
+			virtual ~TileCallback() {}
+		};
+
+		VegetationQuadTree();
+		VegetationQuadTree(const VegetationQuadTree& quad_tree, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY);
+		META_Node(osgVegetation, VegetationQuadTree);
+
+		/**
+			Create quad tree from LOD hierarchy created by billboard or mesh quad tree scattering.
+			LOD nodes with two children where last child is a group of child tiles are flattened,
+			other nodes are kept as tile content.
+			@return NULL if root is not a LOD node that can be flattened
+		*/
+		static VegetationQuadTree* create(osg::Node* root);
+
+		/**
+			Set all tiles, first tile is root. Content indices refer to children of this group.
+		*/
+		void setTiles(const std::vector<Tile> &tiles);
+		Tile getTile(unsigned int index) const;
+		unsigned int getNumTiles() const {return static_cast<unsigned int>(m_Spheres.size());}
+
+		void setRangeMode(osg::LOD::RangeMode mode) {m_RangeMode = mode;}
+		osg::LOD::RangeMode getRangeMode() const {return m_RangeMode;}
+
+		/**
+			Add tile callback, callbacks are invoked in order until one skip the tile.
+			Must be called from update thread (or before viewer is realized)
+		*/
+		void addTileCallback(TileCallback* callback);
+		void removeTileCallback(TileCallback* callback);
+		unsigned int getNumTileCallbacks() const {return static_cast<unsigned int>(m_TileCallbacks.size());}
+		TileCallback* getTileCallback(unsigned int index) const {return m_TileCallbacks[index].get();}
+
+		//osg::Node interface
+		virtual void traverse(osg::NodeVisitor& nv);
+	protected:
+		virtual ~VegetationQuadTree();
+	private:
+		struct TileLinks
+		{
+			unsigned int FirstChild;
+			unsigned int NumChildren;
+			int Content;
+			osg::Node::NodeMask NodeMask;
+		};
+
+		osg::LOD::RangeMode m_RangeMode;
+		//tile data split in separate arrays, center and radius are read for every visited tile
+		std::vector<osg::Vec4f> m_Spheres;
+		//content min/max, child min/max
+		std::vector<osg::Vec4f> m_Ranges;
+		std::vector<TileLinks> m_Links;
+		std::vector<osg::ref_ptr<TileCallback> > m_TileCallbacks;
+	};
+}
@@ -0,0 +1,72 @@
+#include "VegetationQuadTree.h"
+#include <osgDB/ObjectWrapper>
+#include <osgDB/InputStream>
+#include <osgDB/OutputStream>
+
+//Serializer for .osgb/.osgt/.osgx files, children are written by osg::Group serializer before tiles
+
+static bool checkRangeMode(const osgVegetation::VegetationQuadTree& node)
+{
+	return true;
+}
+
+static bool readRangeMode(osgDB::InputStream& is, osgVegetation::VegetationQuadTree& node)
+{
+	int mode = 0;
+	is >> mode;
+	node.setRangeMode(static_cast<osg::LOD::RangeMode>(mode));
+	return true;
+}
+
+static bool writeRangeMode(osgDB::OutputStream& os, const osgVegetation::VegetationQuadTree& node)
+{
+	os << static_cast<int>(node.getRangeMode()) << std::endl;
+	return true;
+}
+
+static bool checkTiles(const osgVegetation::VegetationQuadTree& node)
+{
+	return node.getNumTiles() > 0;
+}
+
+static bool readTiles(osgDB::InputStream& is, osgVegetation::VegetationQuadTree& node)
+{
+	const unsigned int size = is.readSize();
+	is >> is.BEGIN_BRACKET;
+	std::vector<osgVegetation::VegetationQuadTree::Tile> tiles(size);
+	for(unsigned int i = 0; i < size; i++)
+	{
+		osgVegetation::VegetationQuadTree::Tile &tile = tiles[i];
+		is >> tile.Center >> tile.Radius;
+		is >> tile.ContentMinRange >> tile.ContentMaxRange >> tile.ChildMinRange >> tile.ChildMaxRange;
+		is >> tile.FirstChild >> tile.NumChildren >> tile.Content >> tile.NodeMask;
+	}
+	is >> is.END_BRACKET;
+	node.setTiles(tiles);
+	return true;
+}
+
+static bool writeTiles(osgDB::OutputStream& os, const osgVegetation::VegetationQuadTree& node)
+{
+	const unsigned int size = node.getNumTiles();
+	os.writeSize(size);
+	os << os.BEGIN_BRACKET << std::endl;
+	for(unsigned int i = 0; i < size; i++)
+	{
+		const osgVegetation::VegetationQuadTree::Tile tile = node.getTile(i);
+		os << tile.Center << tile.Radius;
+		os << tile.ContentMinRange << tile.ContentMaxRange << tile.ChildMinRange << tile.ChildMaxRange;
+		os << tile.FirstChild << tile.NumChildren << tile.Content << tile.NodeMask << std::endl;
+	}
+	os << os.END_BRACKET << std::endl;
+	return true;
+}
+
+REGISTER_OBJECT_WRAPPER(osgVegetation_VegetationQuadTree,
+	new osgVegetation::VegetationQuadTree,
+	osgVegetation::VegetationQuadTree,
+	"osg::Object osg::Node osg::Group osgVegetation::VegetationQuadTree")
+{
+	ADD_USER_SERIALIZER(RangeMode);
+	ADD_USER_SERIALIZER(Tiles);
+}
@@ -0,0 +1,454 @@
+#include "VegetationStats.h"
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+#include <osg/TextureBuffer>
+#include <osg/Timer>
+#include <osgUtil/CullVisitor>
+#include <OpenThreads/ScopedLock>
+#include <sstream>
+#include "InstanceExtractor.h"
+#include "TerrainOcclusionCuller.h"
+#include "VegetationQuadTree.h"
+
+namespace osgVegetation
+{
+	/**
+		Count quad tree tiles, tile content is collected the same way as LOD children
+	*/
+	class StatsTileCallback : public VegetationQuadTree::TileCallback
+	{
+	public:
+		StatsTileCallback(VegetationStats* stats) : m_Stats(stats) {}
+		bool operator()(VegetationQuadTree* quad_tree, unsigned int index, bool content_active, osg::NodeVisitor* nv)
+		{
+			osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+			if(cv && (cv->getTraversalMask() & m_Stats->getReceivesShadowTraversalMask()))
+				m_Stats->_addQuadTreeTile(quad_tree, index, content_active, cv);
+			return true;
+		}
+		VegetationStats* getStats() const {return m_Stats;}
+	private:
+		VegetationStats* m_Stats;
+	};
+
+	/**
+		Visitor that add stats cull callback and attach update callback to LOD nodes,
+		traversal stops at LOD nodes, children are handled by the update callback.
+		Quad tree nodes get the cull callback (cull time) and a tile callback.
+	*/
+	class AttachStatsVisitor : public osg::NodeVisitor
+	{
+	public:
+		AttachStatsVisitor(VegetationStats* stats) : m_Stats(stats)
+		{
+			setTraversalMode(TRAVERSE_ALL_CHILDREN);
+			setNodeMaskOverride(~0);
+		}
+
+		void apply(osg::LOD& lod)
+		{
+			_addCullCallback(lod);
+
+			if(lod.getUpdateCallback() == NULL)
+			{
+				lod.setUpdateCallback(new VegetationStats::AttachCallback(m_Stats));
+				return;
+			}
+			osg::NodeCallback* current = dynamic_cast<osg::NodeCallback*>(lod.getUpdateCallback());
+			while(current && !_isAttachCallback(current) && current->getNestedCallback())
+				current = dynamic_cast<osg::NodeCallback*>(current->getNestedCallback());
+			if(current && !_isAttachCallback(current))
+				current->setNestedCallback(new VegetationStats::AttachCallback(m_Stats));
+		}
+
+		void apply(osg::Group& group)
+		{
+			VegetationQuadTree* quad_tree = dynamic_cast<VegetationQuadTree*>(&group);
+			if(quad_tree)
+			{
+				//added after occlusion tile callback, occluded tiles are counted by StatsOccludedCallback
+				_addCullCallback(group);
+				bool has_callback = false;
+				for(unsigned int i = 0; i < quad_tree->getNumTileCallbacks() && !has_callback; i++)
+				{
+					StatsTileCallback* callback = dynamic_cast<StatsTileCallback*>(quad_tree->getTileCallback(i));
+					has_callback = callback && callback->getStats() == m_Stats;
+				}
+				if(!has_callback)
+					quad_tree->addTileCallback(new StatsTileCallback(m_Stats));
+			}
+			traverse(group);
+		}
+
+		void apply(osg::Geode& /*geode*/)
+		{
+			//no LOD nodes below geodes
+		}
+	private:
+		void _addCullCallback(osg::Node& node)
+		{
+			//keep existing callbacks (occlusion culling), stats callbacks are added last in chain
+			osg::NodeCallback* current = dynamic_cast<osg::NodeCallback*>(node.getCullCallback());
+			if(node.getCullCallback() == NULL)
+				node.setCullCallback(m_Stats);
+			else
+			{
+				while(current && current != m_Stats && current->getNestedCallback())
+					current = dynamic_cast<osg::NodeCallback*>(current->getNestedCallback());
+				if(current && current != m_Stats)
+					current->setNestedCallback(m_Stats);
+			}
+		}
+
+		bool _isAttachCallback(osg::NodeCallback* callback) const
+		{
+			VegetationStats::AttachCallback* attach = dynamic_cast<VegetationStats::AttachCallback*>(callback);
+			return attach && attach->getStats() == m_Stats;
+		}
+		VegetationStats* m_Stats;
+	};
+
+	/**
+		Forward tiles rejected by TerrainOcclusionCuller to stats
+	*/
+	class StatsOccludedCallback : public TerrainOcclusionCuller::OccludedCallback
+	{
+	public:
+		StatsOccludedCallback(VegetationStats* stats) : m_Stats(stats) {}
+		void operator()(osg::Node* /*tile*/, osgUtil::CullVisitor* cv)
+		{
+			if(cv->getTraversalMask() & m_Stats->getReceivesShadowTraversalMask())
+				m_Stats->_addOccludedTile();
+		}
+	private:
+		VegetationStats* m_Stats;
+	};
+
+	static const osg::Image* GetDataBufferImage(const osg::StateSet* state_set)
+	{
+		//data buffer is always bound to texture unit 1
+		const osg::TextureBuffer* tbo = state_set ? dynamic_cast<const osg::TextureBuffer*>(state_set->getTextureAttribute(1, osg::StateAttribute::TEXTURE)) : NULL;
+		return tbo ? tbo->getImage() : NULL;
+	}
+
+	static std::string GetLayerCategory(const std::string &technique, int texture_index)
+	{
+		std::stringstream ss;
+		ss << technique << " layer " << texture_index;
+		return ss.str();
+	}
+
+	VegetationStats::VegetationStats(unsigned int receives_mask) : m_ReceivesShadowTraversalMask(receives_mask)
+	{
+
+	}
+
+	VegetationStats::~VegetationStats()
+	{
+
+	}
+
+	void VegetationStats::install(osg::Node* vegetation)
+	{
+		_attach(vegetation);
+	}
+
+	void VegetationStats::setOcclusionCuller(TerrainOcclusionCuller* culler)
+	{
+		culler->setOccludedCallback(new StatsOccludedCallback(this));
+	}
+
+	void VegetationStats::_attach(osg::Node* node)
+	{
+		AttachStatsVisitor asv(this);
+		node->accept(asv);
+	}
+
+	void VegetationStats::_addOccludedTile()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		m_Frame.NumTilesVisited++;
+		m_Frame.NumTilesOccluded++;
+	}
+
+	void VegetationStats::_addQuadTreeTile(VegetationQuadTree* quad_tree, unsigned int index, bool content_active, osgUtil::CullVisitor* cv)
+	{
+		//same as LOD tile, content is the only child that can be active
+		std::vector<VisitedTile> tiles;
+		const int content = quad_tree->getTile(index).Content;
+		if(content_active && content >= 0)
+			_collectTiles(quad_tree->getChild(content), cv, tiles);
+		_addVisitedTiles(tiles, 0);
+	}
+
+	void VegetationStats::_addVisitedTiles(const std::vector<VisitedTile> &tiles, unsigned int num_pending)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		m_Frame.NumTilesVisited++;
+		m_Frame.NumPendingRequests += num_pending;
+		for(size_t i = 0; i < tiles.size(); i++)
+		{
+			if(tiles[i].Culled)
+			{
+				m_Frame.NumTilesCulled++;
+				continue;
+			}
+			m_Frame.NumTilesDrawn++;
+			const TileInfo &info = _getTileInfo(tiles[i].Tile);
+			m_Frame.DrawnTBOBytes += info.TBOBytes;
+			for(size_t j = 0; j < info.Instances.size(); j++)
+			{
+				if(m_Frame.NumInstances.size() <= info.Instances[j].first)
+					m_Frame.NumInstances.resize(info.Instances[j].first + 1, 0);
+				m_Frame.NumInstances[info.Instances[j].first] += info.Instances[j].second;
+			}
+		}
+	}
+
+	void VegetationStats::AttachCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+	{
+		//tiles are merged by database pager before update traversal, attach before they are culled.
+		//Pager add and expire children at the end of the child list, only new children are visited
+		osg::Group* group = node->asGroup();
+		if(group)
+		{
+			if(m_NumChildren > group->getNumChildren())
+				m_NumChildren = group->getNumChildren();
+			for(; m_NumChildren < group->getNumChildren(); m_NumChildren++)
+				m_Stats->_attach(group->getChild(m_NumChildren));
+		}
+		traverse(node, nv);
+	}
+
+	void VegetationStats::_collectTiles(osg::Node* node, osgUtil::CullVisitor* cv, std::vector<VisitedTile> &tiles) const
+	{
+		//LOD nodes are handled by own callback, tiles are never below transforms
+		if(dynamic_cast<osg::LOD*>(node) || node->asTransform() || !cv->validNodeMask(*node))
+			return;
+
+		osg::Geode* geode = node->asGeode();
+		bool is_tile = InstanceExtractor::getNumMeshes(node) > 0;
+		if(!is_tile && geode)
+		{
+			for(unsigned int i = 0; i < geode->getNumDrawables() && !is_tile; i++)
+			{
+				const osg::StateSet* state_set = geode->getDrawable(i)->getStateSet();
+				is_tile = InstanceExtractor::getNumBillboards(geode->getDrawable(i)) > 0 ||
+					(state_set && state_set->getUniform("LayerInfo"));
+			}
+		}
+
+		if(is_tile)
+			tiles.push_back(VisitedTile(node, cv->isCulled(*node)));
+		else if(osg::Group* group = node->asGroup())
+		{
+			for(unsigned int i = 0; i < group->getNumChildren(); i++)
+				_collectTiles(group->getChild(i), cv, tiles);
+		}
+	}
+
+	unsigned int VegetationStats::_getCategoryIndex(const std::string &category)
+	{
+		std::map<std::string, unsigned int>::const_iterator iter = m_CategoryMap.find(category);
+		if(iter != m_CategoryMap.end())
+			return iter->second;
+		const unsigned int index = static_cast<unsigned int>(m_Categories.size());
+		m_Categories.push_back(category);
+		m_CategoryMap[category] = index;
+		return index;
+	}
+
+	void VegetationStats::_addInstances(TileInfo &info, const std::string &category, unsigned int num_instances)
+	{
+		const unsigned int index = _getCategoryIndex(category);
+		for(size_t i = 0; i < info.Instances.size(); i++)
+		{
+			if(info.Instances[i].first == index)
+			{
+				info.Instances[i].second += num_instances;
+				return;
+			}
+		}
+		info.Instances.push_back(std::pair<unsigned int, unsigned int>(index, num_instances));
+	}
+
+	const VegetationStats::TileInfo& VegetationStats::_getTileInfo(const osg::Node* tile)
+	{
+		//observer is cleared if tile is released, address can then be reused by new tile
+		TileInfoMap::iterator iter = m_TileInfos.find(tile);
+		if(iter != m_TileInfos.end() && iter->second.Tile.valid())
+			return iter->second;
+
+		TileInfo &info = m_TileInfos[tile];
+		info = TileInfo();
+		info.Tile = const_cast<osg::Node*>(tile);
+
+		const unsigned int num_meshes = InstanceExtractor::getNumMeshes(tile);
+		if(num_meshes > 0)
+		{
+			const osg::Image* image = GetDataBufferImage(tile->getStateSet());
+			info.TBOBytes = image ? image->getTotalSizeInBytes() : 0;
+			_addInstances(info, "MRTShaderInstancing " + (tile->getName() != "" ? tile->getName() : std::string("mesh")), num_meshes);
+			return info;
+		}
+
+		//billboard instances counted by texture index before categories are added
+		std::map<int, unsigned int> shader_instancing;
+		std::map<int, unsigned int> geometry_shader;
+		const osg::Geode* geode = tile->asGeode();
+		for(unsigned int i = 0; geode && i < geode->getNumDrawables(); i++)
+		{
+			const osg::Drawable* drawable = geode->getDrawable(i);
+			const osg::Geometry* geom = drawable->asGeometry();
+			const osg::StateSet* state_set = drawable->getStateSet();
+			const osg::Uniform* layer_info = state_set ? state_set->getUniform("LayerInfo") : NULL;
+			if(layer_info)
+			{
+				//procedural grass, one instance for each cell, texture index in LayerInfo.z
+				osg::Vec4 value;
+				layer_info->get(value);
+				const unsigned int num_instances = geom && geom->getNumPrimitiveSets() > 0 ? geom->getPrimitiveSet(0)->getNumInstances() : 0;
+				_addInstances(info, GetLayerCategory("BRTProceduralGrass", static_cast<int>(value.z())), num_instances);
+				continue;
+			}
+
+			const unsigned int num_billboards = InstanceExtractor::getNumBillboards(drawable);
+			if(num_billboards == 0)
+				continue;
+			const osg::Image* image = GetDataBufferImage(state_set);
+			if(image)
+			{
+				//three vec4 per instance, texture index in z of third
+				info.TBOBytes += image->getTotalSizeInBytes();
+				if(image->data() == NULL)
+				{
+					//image data released after upload, layer unknown
+					shader_instancing[-1] += num_billboards;
+					continue;
+				}
+				for(unsigned int j = 0; j < num_billboards; j++)
+				{
+					const osg::Vec4f* ptr = (const osg::Vec4f*) image->data(3 * j);
+					shader_instancing[static_cast<int>(ptr[2].z())]++;
+				}
+			}
+			else
+			{
+				//vertex triples per instance, texture index in z of second
+				const osg::Vec3Array* vertices = geom ? dynamic_cast<const osg::Vec3Array*>(geom->getVertexArray()) : NULL;
+				for(size_t j = 0; vertices && j + 2 < vertices->size(); j += 3)
+					geometry_shader[static_cast<int>((*vertices)[j + 1].z())]++;
+			}
+		}
+		for(std::map<int, unsigned int>::const_iterator iter = shader_instancing.begin(); iter != shader_instancing.end(); ++iter)
+			_addInstances(info, GetLayerCategory("BRTShaderInstancing", iter->first), iter->second);
+		for(std::map<int, unsigned int>::const_iterator iter = geometry_shader.begin(); iter != geometry_shader.end(); ++iter)
+			_addInstances(info, GetLayerCategory("BRTGeometryShader", iter->first), iter->second);
+		return info;
+	}
+
+	void VegetationStats::operator()(osg::Node* node, osg::NodeVisitor* nv)
+	{
+		osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+		osg::LOD* lod = dynamic_cast<osg::LOD*>(node);
+		//quad tree tiles are counted by tile callback, only cull time is added here
+		const bool quad_tree = dynamic_cast<VegetationQuadTree*>(node) != NULL;
+		//only main view, shadow passes would count tiles twice
+		if(cv == NULL || (lod == NULL && !quad_tree) || (cv->getTraversalMask() & m_ReceivesShadowTraversalMask) == 0)
+		{
+			traverse(node, nv);
+			return;
+		}
+
+		const osg::Timer_t start_tick = osg::Timer::instance()->tick();
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			m_Depth[nv]++;
+		}
+
+		std::vector<VisitedTile> tiles;
+		unsigned int num_pending = 0;
+		if(lod)
+		{
+			//same child selection as osg::LOD::traverse
+			float required_range = 0;
+			if(lod->getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT)
+				required_range = cv->getDistanceToViewPoint(lod->getCenter(), true);
+			else
+				required_range = cv->clampedPixelSize(lod->getBound()) / cv->getLODScale();
+
+			const bool paged = dynamic_cast<osg::PagedLOD*>(lod) != NULL;
+			for(unsigned int i = 0; i < lod->getNumRanges(); i++)
+			{
+				if(required_range < lod->getMinRange(i) || required_range >= lod->getMaxRange(i))
+					continue;
+				if(i < lod->getNumChildren())
+					_collectTiles(lod->getChild(i), cv, tiles);
+				else if(paged)
+					num_pending = 1;
+			}
+		}
+
+		traverse(node, nv);
+
+		const double elapsed = osg::Timer::instance()->delta_s(start_tick, osg::Timer::instance()->tick());
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			if(--m_Depth[nv] == 0)
+			{
+				m_Depth.erase(nv);
+				m_Frame.CullTime += elapsed;
+			}
+		}
+		if(lod)
+			_addVisitedTiles(tiles, num_pending);
+	}
+
+	void VegetationStats::recordFrame(osg::Stats* stats, unsigned int frame_number)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		//remove info of released tiles
+		for(TileInfoMap::iterator iter = m_TileInfos.begin(); iter != m_TileInfos.end();)
+		{
+			if(iter->second.Tile.valid())
+				++iter;
+			else
+				m_TileInfos.erase(iter++);
+		}
+		m_Frame.NumInstances.resize(m_Categories.size(), 0);
+
+		if(stats)
+		{
+			stats->setAttribute(frame_number, getTilesVisitedName(), m_Frame.NumTilesVisited);
+			stats->setAttribute(frame_number, getTilesCulledName(), m_Frame.NumTilesCulled);
+			stats->setAttribute(frame_number, getTilesOccludedName(), m_Frame.NumTilesOccluded);
+			stats->setAttribute(frame_number, getTilesDrawnName(), m_Frame.NumTilesDrawn);
+			stats->setAttribute(frame_number, getPendingRequestsName(), m_Frame.NumPendingRequests);
+			stats->setAttribute(frame_number, getDrawnTBOBytesName(), m_Frame.DrawnTBOBytes);
+			stats->setAttribute(frame_number, getCullTimeName(), m_Frame.CullTime);
+			for(size_t i = 0; i < m_Categories.size(); i++)
+				stats->setAttribute(frame_number, getInstancesName(m_Categories[i]), m_Frame.NumInstances[i]);
+		}
+		m_LastFrame = m_Frame;
+		m_Frame = FrameCounters();
+	}
+
+	VegetationStats::FrameCounters VegetationStats::getLastFrame() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		return m_LastFrame;
+	}
+
+	unsigned int VegetationStats::getNumCategories() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		return static_cast<unsigned int>(m_Categories.size());
+	}
+
+	std::string VegetationStats::getCategory(unsigned int index) const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		return m_Categories[index];
+	}
+}
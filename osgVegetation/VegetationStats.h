@@ -0,0 +1,179 @@
+#pragma once
+#include "Common.h"
+#include <osg/NodeCallback>
+#include <osg/Node>
+#include <osg/Stats>
+#include <osg/observer_ptr>
+#include <OpenThreads/Mutex>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace osgUtil
+{
+	class CullVisitor;
+}
+
+namespace osgVegetation
+{
+	class TerrainOcclusionCuller;
+	class VegetationQuadTree;
+
+	/**
+		Per frame vegetation statistics collected by a cull callback on vegetation LOD/PagedLOD tiles
+		and a tile callback on VegetationQuadTree nodes.
+		Each frame the collector count tiles visited by the cull traversal, tiles culled
+		and drawn (tiles are the geodes/mesh nodes holding instance data), instances submitted for drawn tiles
+		per technique and layer (billboard texture index, mesh file name), PagedLOD children in range
+		that are not loaded yet (pending page requests) and time spent in the vegetation cull traversal.
+		TBO bytes are summed over drawn tiles, tiles that are loaded but not drawn are not included.
+		Values are written to a osg::Stats object by recordFrame(), use the attribute names
+		with osgViewer::StatsHandler::addUserStatsLine to show them on the stats page.
+		Only the main view cull is counted, cull traversals that exclude ReceivesShadowTraversalMask
+		(shadow map passes) are ignored.
+		Use install() to add the callbacks to a vegetation scene graph, tiles paged in
+		later are picked up by an update callback on their parent tile. The callback is
+		added as nested callback if a tile already has a cull callback (for example TerrainOcclusionCuller),
+		tiles rejected by the occlusion culler are counted through setOcclusionCuller.
+	*/
+	class osgvExport VegetationStats : public osg::NodeCallback
+	{
+	public:
+		struct FrameCounters
+		{
+			FrameCounters() : NumTilesVisited(0),
+				NumTilesCulled(0),
+				NumTilesOccluded(0),
+				NumTilesDrawn(0),
+				NumPendingRequests(0),
+				DrawnTBOBytes(0),
+				CullTime(0)
+			{
+
+			}
+			unsigned int NumTilesVisited;
+			unsigned int NumTilesCulled;
+			//LOD/PagedLOD tiles rejected by occlusion culler (counted as visited)
+			unsigned int NumTilesOccluded;
+			unsigned int NumTilesDrawn;
+			unsigned int NumPendingRequests;
+			//TBO bytes of drawn tiles
+			unsigned int DrawnTBOBytes;
+			//seconds
+			double CullTime;
+			//submitted instances indexed by category (see getCategory)
+			std::vector<unsigned int> NumInstances;
+		};
+
+		/**
+			@param receives_mask Traversal mask of main view (see EnvironmentSettings::ReceivesShadowTraversalMask)
+		*/
+		VegetationStats(unsigned int receives_mask = 0x1);
+
+		/**
+			Add this callback to all top level LOD and PagedLOD nodes and a tile callback
+			to all VegetationQuadTree nodes in vegetation scene graph,
+			must be called from update thread (or before viewer is realized)
+		*/
+		void install(osg::Node* vegetation);
+
+		/**
+			Count tiles rejected by occlusion culler, these tiles are not traversed by this callback
+		*/
+		void setOcclusionCuller(TerrainOcclusionCuller* culler);
+
+		/**
+			Only cull traversals that include this mask are counted, default 0x1
+		*/
+		void setReceivesShadowTraversalMask(unsigned int mask) {m_ReceivesShadowTraversalMask = mask;}
+		unsigned int getReceivesShadowTraversalMask() const {return m_ReceivesShadowTraversalMask;}
+
+		/**
+			Write counters collected since last call to stats and reset them, call once each frame after frame()
+			@param stats Stats to write to, typically viewer.getViewerStats()
+			@param frame_number Current frame number
+		*/
+		void recordFrame(osg::Stats* stats, unsigned int frame_number);
+
+		/**
+			Counters written by last recordFrame()
+		*/
+		FrameCounters getLastFrame() const;
+
+		/**
+			Instance categories ("<technique> layer <texture index>" or "<technique> <mesh name>"),
+			new categories are added when first seen.
+		*/
+		unsigned int getNumCategories() const;
+		std::string getCategory(unsigned int index) const;
+
+		/**
+			Stats attribute names
+		*/
+		static std::string getTilesVisitedName() {return "Vegetation tiles visited";}
+		static std::string getTilesCulledName() {return "Vegetation tiles culled";}
+		static std::string getTilesOccludedName() {return "Vegetation tiles occluded";}
+		static std::string getTilesDrawnName() {return "Vegetation tiles drawn";}
+		static std::string getPendingRequestsName() {return "Vegetation pending requests";}
+		static std::string getDrawnTBOBytesName() {return "Vegetation drawn TBO bytes";}
+		static std::string getCullTimeName() {return "Vegetation cull time";}
+		static std::string getInstancesName(const std::string &category) {return "Vegetation instances " + category;}
+
+		//osg::NodeCallback interface
+		void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+		/**
+			Update callback that attach stats callback to tiles merged by database pager,
+			one instance for each LOD node, only children added since last update are visited.
+		*/
+		class AttachCallback : public osg::NodeCallback
+		{
+		public:
+			AttachCallback(VegetationStats* stats) : m_Stats(stats), m_NumChildren(0) {}
+			void operator()(osg::Node* node, osg::NodeVisitor* nv);
+			VegetationStats* getStats() const {return m_Stats;}
+		private:
+			VegetationStats* m_Stats;
+			unsigned int m_NumChildren;
+		};
+	private:
+		friend class StatsOccludedCallback;
+		friend class StatsTileCallback;
+		struct TileInfo
+		{
+			TileInfo() : TBOBytes(0) {}
+			osg::observer_ptr<osg::Node> Tile;
+			unsigned int TBOBytes;
+			//category index and number of instances
+			std::vector<std::pair<unsigned int, unsigned int> > Instances;
+		};
+		typedef std::map<const osg::Node*, TileInfo> TileInfoMap;
+
+		struct VisitedTile
+		{
+			VisitedTile(const osg::Node* tile, bool culled) : Tile(tile), Culled(culled) {}
+			const osg::Node* Tile;
+			bool Culled;
+		};
+
+		virtual ~VegetationStats();
+		void _attach(osg::Node* node);
+		void _addOccludedTile();
+		void _addQuadTreeTile(VegetationQuadTree* quad_tree, unsigned int index, bool content_active, osgUtil::CullVisitor* cv);
+		void _addVisitedTiles(const std::vector<VisitedTile> &tiles, unsigned int num_pending);
+		void _collectTiles(osg::Node* node, osgUtil::CullVisitor* cv, std::vector<VisitedTile> &tiles) const;
+		const TileInfo& _getTileInfo(const osg::Node* tile);
+		void _addInstances(TileInfo &info, const std::string &category, unsigned int num_instances);
+		unsigned int _getCategoryIndex(const std::string &category);
+
+		unsigned int m_ReceivesShadowTraversalMask;
+		mutable OpenThreads::Mutex m_Mutex;
+		FrameCounters m_Frame;
+		FrameCounters m_LastFrame;
+		std::vector<std::string> m_Categories;
+		std::map<std::string, unsigned int> m_CategoryMap;
+		TileInfoMap m_TileInfos;
+		//nesting depth of vegetation LOD/quad tree callbacks for each active cull visitor, time is only added at depth 0
+		std::map<const osg::NodeVisitor*, unsigned int> m_Depth;
+	};
+}
@@ -1,52 +1,183 @@
 #include "VegetationUtils.h"
 #include "BillboardData.h"
+#include "TextureCompressor.h"
 #include <osg/Texture2D>
 #include <osg/Image>
 #include <osg/Texture2DArray>
 #include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ObjectWrapper>
+#include <osgDB/InputStream>
+#include <osgDB/OutputStream>
+#include <OpenThreads/ScopedLock>
 
 namespace osgVegetation
 {
-	osg::ref_ptr<osg::Texture2DArray> Utils::loadTextureArray(BillboardData &data)
+	Utils::TextureArrayMap Utils::m_TextureArrays;
+	OpenThreads::Mutex Utils::m_TextureArrayMutex;
+
+	std::string Utils::_getLayerImageName(const std::string &texture_name, const std::string &name_suffix)
+	{
+		if(name_suffix == "")
+			return texture_name;
+		return osgDB::getNameLessExtension(texture_name) + name_suffix + "." + osgDB::getFileExtension(texture_name);
+	}
+
+	osg::ref_ptr<osg::Texture2DArray> Utils::loadTextureArray(BillboardData &data, const std::string &name_suffix)
 	{
+		//assign texture index for each layer and create registry key from ordered list of unique textures
+		std::map<std::string, int> index_map;
+		std::vector<std::string> texture_names;
+		for(size_t i = 0; i < data.Layers.size();i++)
+		{
+			const std::string texture_name = data.Layers[i].TextureName;
+			if(index_map.find(texture_name) == index_map.end())
+			{
+				index_map[texture_name] = static_cast<int>(texture_names.size());
+				texture_names.push_back(texture_name);
+			}
+			data.Layers[i]._TextureIndex = index_map[texture_name];
+		}
+
+		//use precompiled textures (see TextureCompressor) only if available for all layers,
+		//compressed mipmaps depend on alpha rejection value
+		bool use_compressed = true;
+		for(size_t i = 0; i < texture_names.size();i++)
+		{
+			const std::string image_file = _getLayerImageName(texture_names[i], name_suffix);
+			if(osgDB::findDataFile(TextureCompressor::getCompressedTextureName(image_file, data.AlphaRefValue)) == "")
+				use_compressed = false;
+		}
+
+		std::string key = name_suffix;
+		if(use_compressed)
+			key += ";" + TextureCompressor::getCompressedTextureName("", data.AlphaRefValue);
+		for(size_t i = 0; i < texture_names.size();i++)
+			key += ";" + texture_names[i];
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_TextureArrayMutex);
+		TextureArrayMap::iterator iter = m_TextureArrays.find(key);
+		if(iter != m_TextureArrays.end())
+			return iter->second;
+
 		int tex_width = 0;
 		int tex_height = 0;
 		//Load textures
 		const osg::ref_ptr<osgDB::ReaderWriter::Options> options = new osgDB::ReaderWriter::Options();
-		//options->setOptionString("dds_flip");
-		std::map<std::string, osg::Image*> image_map;
-		std::map<std::string, int> index_map;
-		int num_textures = 0;
-		for(size_t i = 0; i < data.Layers.size();i++)
+		//the dds writer flip images (see TextureCompressor), flip back when reading precompiled textures
+		if(use_compressed)
+			options->setOptionString("dds_flip");
+		std::vector<osg::ref_ptr<osg::Image> > images;
+		for(size_t i = 0; i < texture_names.size();i++)
 		{
-			const std::string texture_name = data.Layers[i].TextureName;
-			if(image_map.find(data.Layers[i].TextureName) == image_map.end() )
+			std::string image_file = _getLayerImageName(texture_names[i], name_suffix);
+			if(use_compressed)
+				image_file = TextureCompressor::getCompressedTextureName(image_file, data.AlphaRefValue);
+			osg::Image* image = osgDB::readImageFile(image_file,options);
+			if(image == NULL)
+				OSGV_EXCEPT(std::string("Utils::loadTextureArray - Failed to load texture:" + image_file).c_str());
+			if(tex_width == 0) // first image decide array size
 			{
-				osg::Image* image = osgDB::readImageFile(texture_name,options);
-				if(image == NULL)
-					OSGV_EXCEPT(std::string("Utils::loadTextureArray - Failed to load texture:" + texture_name).c_str());
-				if(image && tex_width == 0) // first image decide array size
-				{
-					tex_width = image->s();
-					tex_height = image->t();
-				}
-				image_map[texture_name] = image;
-				index_map[texture_name] = num_textures;
-				data.Layers[i]._TextureIndex = num_textures;
-				num_textures++;
+				tex_width = image->s();
+				tex_height = image->t();
 			}
-			else
-				data.Layers[i]._TextureIndex = index_map[texture_name];
+			images.push_back(image);
 		}
 
 		osg::ref_ptr<osg::Texture2DArray> tex = new osg::Texture2DArray;
-		tex->setTextureSize(tex_width, tex_height, num_textures);
-		tex->setUseHardwareMipMapGeneration(true);
+		tex->setName(key);
+		tex->setTextureSize(tex_width, tex_height, static_cast<int>(images.size()));
+		//compressed textures already hold coverage preserving mipmaps
+		tex->setUseHardwareMipMapGeneration(!use_compressed);
 
-		for(size_t i = 0; i < data.Layers.size();i++)
+		for(size_t i = 0; i < images.size();i++)
 		{
-			tex->setImage(index_map[data.Layers[i].TextureName], image_map[data.Layers[i].TextureName]);
+			tex->setImage(static_cast<unsigned int>(i), images[i].get());
 		}
+		m_TextureArrays[key] = tex;
 		return tex;
 	}
+
+	osg::BoundingBoxd Utils::getBillboardBound(const osg::Vec3d &position, float width, float height, BillboardType type, BillboardRenderingTechnique technique)
+	{
+		osg::BoundingBoxd bb;
+		if(type == BT_IMPOSTOR)
+		{
+			//camera facing quad centered at half height, see BRTShaderInstancing
+			const double radius = 0.5*sqrt(2.0*width*width + height*height);
+			const osg::Vec3d center = position + osg::Vec3d(0, 0, height*0.5);
+			bb.expandBy(center - osg::Vec3d(radius, radius, radius));
+			bb.expandBy(center + osg::Vec3d(radius, radius, radius));
+			return bb;
+		}
+
+		//quad half width, geometry shader use full width as quad offset
+		double half_width = technique == BRT_GEOMETRY_SHADER ? width : width*0.5;
+		if(type == BT_GRASS)
+		{
+			//grass quads are bent by wind offset (see brt_geometry.glsl)
+			half_width = width*(1.0 + sqrt(2.0)) + 0.2;
+		}
+		if(technique == BRT_GPU_PROCEDURAL)
+		{
+			//crossed quads bent by wind offset (see BRTProceduralGrass)
+			half_width = width*0.5 + 0.2;
+		}
+		bb.expandBy(position - osg::Vec3d(half_width, half_width, 0));
+		bb.expandBy(position + osg::Vec3d(half_width, half_width, height));
+		return bb;
+	}
+
+	osg::Matrixd Utils::getMeshInstanceMatrix(const osg::Vec3d &position, const osg::Quat &rotation, float width, float height)
+	{
+		return osg::Matrixd::rotate(rotation) * osg::Matrixd::scale(width, width, height) * osg::Matrixd::translate(position);
+	}
+
+	osg::BoundingBoxd Utils::getMeshInstanceBound(const osg::BoundingBox &mesh_bb, const osg::Matrixd &instance_matrix)
+	{
+		osg::BoundingBoxd bb;
+		if(!mesh_bb.valid())
+			return bb;
+		for(unsigned int i = 0; i < 8; i++)
+		{
+			bb.expandBy(osg::Vec3d(mesh_bb.corner(i)) * instance_matrix);
+		}
+		return bb;
+	}
+
+	void Utils::clearTextureArrayCache()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_TextureArrayMutex);
+		m_TextureArrays.clear();
+	}
+}
+
+//Serializer for .osgb/.osgt/.osgx files, instanced tiles depend on the static bound when paged in
+
+static bool checkBoundingBox(const osgVegetation::StaticBoundingBox& callback)
+{
+	return true;
+}
+
+static bool readBoundingBox(osgDB::InputStream& is, osgVegetation::StaticBoundingBox& callback)
+{
+	osg::Vec3f bb_min, bb_max;
+	is >> bb_min >> bb_max;
+	callback.setBoundingBox(osg::BoundingBox(bb_min, bb_max));
+	return true;
+}
+
+static bool writeBoundingBox(osgDB::OutputStream& os, const osgVegetation::StaticBoundingBox& callback)
+{
+	os << osg::Vec3f(callback.getBoundingBox()._min) << osg::Vec3f(callback.getBoundingBox()._max) << std::endl;
+	return true;
+}
+
+REGISTER_OBJECT_WRAPPER(osgVegetation_StaticBoundingBox,
+	new osgVegetation::StaticBoundingBox,
+	osgVegetation::StaticBoundingBox,
+	"osg::Object osgVegetation::StaticBoundingBox")
+{
+	ADD_USER_SERIALIZER(BoundingBox);
 }
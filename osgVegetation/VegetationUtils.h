@@ -2,11 +2,56 @@
 #include "Common.h"
 #include <osg/ref_ptr>
 #include <osg/Texture2DArray>
+#include <osg/BoundingBox>
+#include <osg/Drawable>
+#include <osg/Matrixd>
+#include <osg/Quat>
+#include <OpenThreads/Mutex>
 #include <cstdlib>
+#include <string>
+#include <map>
+
+#include "BillboardData.h"
 
 namespace osgVegetation
 {
-	struct BillboardData;
+	/**
+		Bounding box callback that return fixed bounding box, used for instanced
+		drawables where vertex data don't reflect final geometry.
+		The callback is saved with the drawable (see VegetationUtils.cpp serializer) so paged tiles
+		keep the tight bound when loaded.
+	*/
+	struct StaticBoundingBox : public osg::Drawable::ComputeBoundingBoxCallback
+	{
+		osg::BoundingBox _bbox;
+		StaticBoundingBox() { }
+		StaticBoundingBox( const osg::BoundingBoxd& bbox ) : _bbox(osg::BoundingBox(bbox._min, bbox._max)) { }
+		StaticBoundingBox( const StaticBoundingBox& callback, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY) : osg::Drawable::ComputeBoundingBoxCallback(callback, copyop),
+			_bbox(callback._bbox) { }
+		META_Object(osgVegetation, StaticBoundingBox);
+		osg::BoundingBox computeBound(const osg::Drawable&) const { return _bbox; }
+		void setBoundingBox(const osg::BoundingBox &bbox) { _bbox = bbox; }
+		const osg::BoundingBox& getBoundingBox() const { return _bbox; }
+	};
+
+	/**
+		Reentrant random generator (LCG), unlike rand() the state is owned by the caller
+		and not shared with other threads (ie. DatabasePager threads generating on demand tiles).
+	*/
+	class RandomGenerator
+	{
+	public:
+		RandomGenerator(unsigned int seed = 0) : m_State(seed) { }
+		double random(double min, double max)
+		{
+			m_State = m_State*1664525u + 1013904223u;
+			//use high bits, low bits of LCG have short periods
+			return min + (max-min)*static_cast<double>(m_State >> 8)/ static_cast<double>(0xFFFFFFu);
+		}
+	private:
+		unsigned int m_State;
+	};
+
 	class Utils
 	{
 	public:
@@ -16,7 +61,38 @@ namespace osgVegetation
 		/**
 			Helper function that load all layer textures into the returning Texture2DArray.
 			This function will also save texture index into the texture array for each layer (_TextureIndex)
+			If name_suffix is provided this is appended to each texture name (before the extension), 
+			this can be used to load companion textures like impostor normal maps ("_normal") 
+			that share array layout with the base textures.
+			Precompiled textures created by TextureCompressor (for BillboardData::AlphaRefValue) are used if present for all layers.
+			Texture arrays are shared, ie. BillboardData sets that use the same ordered texture list
+			get the same Texture2DArray instance (loaded once).
+		*/
+		static osg::ref_ptr<osg::Texture2DArray> loadTextureArray(BillboardData &data, const std::string &name_suffix = "");
+
+		/**
+			Release all shared texture arrays, call this if textures are modified on disk and need to be reloaded.
+		*/
+		static void clearTextureArrayCache();
+
+		/**
+			Get bounding box of single billboard instance as rendered by the provided technique and billboard type.
+		*/
+		static osg::BoundingBoxd getBillboardBound(const osg::Vec3d &position, float width, float height, BillboardType type, BillboardRenderingTechnique technique);
+
+		/**
+			Get instance matrix used to place mesh instance
+		*/
+		static osg::Matrixd getMeshInstanceMatrix(const osg::Vec3d &position, const osg::Quat &rotation, float width, float height);
+
+		/**
+			Get bounding box of mesh instance, mesh_bb is the bounding box of the mesh template
 		*/
-		static osg::ref_ptr<osg::Texture2DArray> loadTextureArray(BillboardData &data);
+		static osg::BoundingBoxd getMeshInstanceBound(const osg::BoundingBox &mesh_bb, const osg::Matrixd &instance_matrix);
+	private:
+		static std::string _getLayerImageName(const std::string &texture_name, const std::string &name_suffix);
+		typedef std::map<std::string, osg::ref_ptr<osg::Texture2DArray> > TextureArrayMap;
+		static TextureArrayMap m_TextureArrays;
+		static OpenThreads::Mutex m_TextureArrayMutex;
 	};
 }
@@ -1,16 +1,20 @@
 #version 120
-#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,FM_LINEAR,FM_EXP,FM_EXP2 )
+#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,FM_LINEAR,FM_EXP,FM_EXP2,BT_IMPOSTOR,INSTANCING_LIGHTING )
 #extension GL_EXT_gpu_shader4 : enable
 #extension GL_EXT_texture_array : enable
 #pragma osgveg
 uniform sampler2DArray baseTexture; 
 
+#ifdef BT_IMPOSTOR
+	uniform sampler2DArray normalTexture;
+#endif
+
 #ifdef SM_LISPSM
 		uniform sampler2DShadow shadowTexture;
 		uniform int shadowTextureUnit;
 #endif
 
-#if SM_VDSM1
+#ifdef SM_VDSM1
 	uniform sampler2DShadow shadowTexture0;
 	uniform int shadowTextureUnit0;
 #endif
@@ -34,7 +38,13 @@ void main(void)
    outColor.xyz *= Color; 
    float depth = gl_FragCoord.z / gl_FragCoord.w;
    vec3 lightDir = normalize(gl_LightSource[0].position.xyz);
+#ifdef BT_IMPOSTOR
+   //atlas hold model space normal in rgb and depth in alpha
+   vec3 normal = texture2DArray(normalTexture, vec3(TexCoord, TextureIndex)).xyz*2.0 - 1.0;
+   normal = normalize(gl_NormalMatrix * normal);
+#else
    vec3 normal = normalize(Normal);
+#endif
    //add diffuse lighting 
    float NdotL = max(dot(normal, lightDir), 0);
 
@@ -43,7 +53,7 @@ void main(void)
    NdotL *= shadow;
 #endif
 
-#if SM_VDSM1
+#ifdef SM_VDSM1
 	float shadow0 = shadow2DProj( shadowTexture0, gl_TexCoord[shadowTextureUnit0] ).r;
 	NdotL *= shadow0;
 #endif
@@ -51,9 +61,14 @@ void main(void)
 #ifdef SM_VDSM2
 	float shadow0 = shadow2DProj( shadowTexture0, gl_TexCoord[shadowTextureUnit0] ).r;
 	float shadow1 = shadow2DProj( shadowTexture1, gl_TexCoord[shadowTextureUnit1] ).r;
-	NdotL *= shadow0*shadow1; \n";
+	NdotL *= shadow0*shadow1;
 #endif
+#ifdef INSTANCING_LIGHTING
+   //BRTShaderInstancing lighting, shadowed NdotL plus ambient
+   outColor.xyz *= (NdotL + gl_LightSource[0].ambient.xyz);
+#else
    outColor.xyz *= (NdotL * gl_LightSource[0].diffuse.xyz + gl_LightSource[0].ambient.xyz);
+#endif
    //outColor.w = outColor.w * clamp(1.0 - ((depth-TileRadius)/(TileRadius*0.1)), 0.0, 1.0);
 #ifdef FM_LINEAR
    float fogFactor = (gl_Fog.end - depth) * gl_Fog.scale;
@@ -71,5 +86,6 @@ void main(void)
 	fogFactor = clamp(fogFactor, 0.0, 1.0);
     outColor.xyz = mix(gl_Fog.color.xyz, outColor.xyz, fogFactor);
 #endif				
+   if(outColor.w < 0.01) discard;
    gl_FragColor = outColor;
 }
@@ -1,10 +1,10 @@
 #version 120
-#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,CAST_SHADOW,BT_ROTATED_QUAD,BT_GRASS,TERRAIN_NORMAL)
+#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,CAST_SHADOW,BT_ROTATED_QUAD,BT_GRASS,TERRAIN_NORMAL,BILLBOARD_HULL)
 #extension GL_EXT_geometry_shader4 : enable
 #pragma osgveg
 uniform float TileRadius; 
 uniform float osg_SimulationTime;
-#if defined(SM_LISPSM) || defined(SM_VDSM1) || defined(SM_VDSM1)
+#if defined(SM_LISPSM) || defined(SM_VDSM1) || defined(SM_VDSM2)
 	#define HAS_SHADOW
 #endif
 
@@ -20,6 +20,13 @@ uniform float osg_SimulationTime;
 	uniform int shadowTextureUnit0;
 	uniform int shadowTextureUnit1;
 #endif	
+
+#ifdef BILLBOARD_HULL
+	//hull polygons of all textures, two vertices in each vec4 (see BillboardHull)
+	uniform vec4 BillboardHull[64];
+	//convex polygon vertex order as triangle strip
+	const int HULL_STRIP[8] = int[8](0, 1, 7, 2, 6, 3, 5, 4);
+#endif
  
 varying vec2 TexCoord;
 varying vec3 Normal;
@@ -48,6 +55,41 @@ void DynamicShadow(vec4 ecPosition )
 #endif	
 } 
 
+#ifdef BILLBOARD_HULL
+vec2 GetHullVertex(int texture_index, int vertex_index)
+{
+	vec4 pair = BillboardHull[texture_index*4 + vertex_index/2];
+	return (vertex_index - (vertex_index/2)*2) == 0 ? pair.xy : pair.zw;
+}
+#endif
+
+//Emit card vertex at texture coordinate uv, position and normal are interpolated from card corners
+void EmitCardVertex(vec4 c00, vec4 c10, vec4 c01, vec4 c11, vec3 n00, vec3 n10, vec3 n01, vec3 n11, vec2 uv)
+{
+	vec4 e = mix(mix(c00, c10, uv.x), mix(c01, c11, uv.x), uv.y);
+	gl_Position = gl_ModelViewProjectionMatrix * e;
+	DynamicShadow(e);
+	TexCoord = uv;
+	Normal = mix(mix(n00, n10, uv.x), mix(n01, n11, uv.x), uv.y);
+	EmitVertex();
+}
+
+//Emit billboard card, hull polygon of current texture if BILLBOARD_HULL is defined otherwise full quad
+void EmitCard(vec4 c00, vec4 c10, vec4 c01, vec4 c11, vec3 n00, vec3 n10, vec3 n01, vec3 n11)
+{
+#ifdef BILLBOARD_HULL
+	int texture_index = int(TextureIndex + 0.5);
+	for(int i = 0; i < 8; i++)
+		EmitCardVertex(c00, c10, c01, c11, n00, n10, n01, n11, GetHullVertex(texture_index, HULL_STRIP[i]));
+#else
+	EmitCardVertex(c00, c10, c01, c11, n00, n10, n01, n11, vec2(0.0,0.0));
+	EmitCardVertex(c00, c10, c01, c11, n00, n10, n01, n11, vec2(1.0,0.0));
+	EmitCardVertex(c00, c10, c01, c11, n00, n10, n01, n11, vec2(0.0,1.0));
+	EmitCardVertex(c00, c10, c01, c11, n00, n10, n01, n11, vec2(1.0,1.0));
+#endif
+	EndPrimitive();
+}
+
 void main(void)
 {
     vec4 pos = gl_PositionIn[0];
@@ -62,9 +104,6 @@ void main(void)
     float distance = length(camera_pos.xyz - pos.xyz);
     scale = scale*clamp((1.0 - (distance-TileRadius))/(TileRadius*0.2),0.0,1.0);
 #endif
-    vec4 e;
-    e.w = pos.w;
-
 #ifdef BT_ROTATED_QUAD
 	vec3 dir = camera_pos.xyz - pos.xyz;
 	//we are only interested in xy-plane direction
@@ -88,11 +127,9 @@ void main(void)
 		vec3 n3 = n1;
 		vec3 n4 = n2;
 	#endif
-		e.xyz =  pos.xyz + left;       gl_Position = gl_ModelViewProjectionMatrix * e; TexCoord = vec2(0.0,0.0); DynamicShadow(e); Normal = n1; EmitVertex();
-		e.xyz =  pos.xyz - left;       gl_Position = gl_ModelViewProjectionMatrix * e; TexCoord = vec2(1.0,0.0); DynamicShadow(e); Normal = n2; EmitVertex();
-		e.xyz =  pos.xyz + left + up;  gl_Position = gl_ModelViewProjectionMatrix * e; TexCoord = vec2(0.0,1.0); DynamicShadow(e); Normal = n3; EmitVertex();
-		e.xyz =  pos.xyz - left + up;  gl_Position = gl_ModelViewProjectionMatrix * e; TexCoord = vec2(1.0,1.0); DynamicShadow(e); Normal = n4; EmitVertex();
-		EndPrimitive();
+		vec4 left4 = vec4(left, 0.0);
+		vec4 up4 = vec4(up, 0.0);
+		EmitCard(pos + left4, pos - left4, pos + left4 + up4, pos - left4 + up4, n1, n2, n3, n4);
 #elif defined (BT_GRASS)
     float rand_rad = mod(pos.x, 2*3.14);
     float sw = scale.x*sin(rand_rad);
@@ -108,29 +145,10 @@ void main(void)
 	#else
 		vec3 n = vec3(0.0,0.0,1.0);
 	#endif
-		e = pos + vec4(-sw,-cw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,0.0); Normal = n; EmitVertex();
-		e = pos + vec4( sw, cw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,0.0); Normal = n; EmitVertex();
-		e = pos + offset1 + vec4(-sw,-cw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,1.0); Normal = n; EmitVertex();
-		e = pos + offset1 + vec4( sw, cw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,1.0); Normal = n; EmitVertex();
-		EndPrimitive();
-		
-		e = pos + vec4(-sw,-cw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,0.0); Normal = n; EmitVertex();
-		e = pos + vec4( sw, cw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,0.0); Normal = n; EmitVertex();
-		e = pos - offset1 + vec4(-sw,-cw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,1.0); Normal = n; EmitVertex();
-		e = pos - offset1 + vec4( sw, cw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,1.0); Normal = n; EmitVertex();
-		EndPrimitive();
-		
-		e = pos + vec4(-cw, sw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,0.0); Normal = n; EmitVertex();
-		e = pos + vec4( cw,-sw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,0.0); Normal = n; EmitVertex();
-		e = pos + offset2 + vec4(-cw, sw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,1.0); Normal = n; EmitVertex();
-		e = pos + offset2 + vec4( cw,-sw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,1.0); Normal = n; EmitVertex();
-		EndPrimitive();
-		
-		e = pos + vec4(-cw, sw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,0.0); Normal = n; EmitVertex();
-		e = pos + vec4( cw,-sw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,0.0); Normal = n; EmitVertex();
-		e = pos - offset2 + vec4(-cw, sw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,1.0); Normal = n; EmitVertex();
-		e = pos - offset2 + vec4( cw,-sw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,1.0); Normal = n; EmitVertex();
-		EndPrimitive();
+		EmitCard(pos + vec4(-sw,-cw,0.0,0.0), pos + vec4(sw, cw,0.0,0.0), pos + offset1 + vec4(-sw,-cw,h,0.0), pos + offset1 + vec4(sw, cw,h,0.0), n, n, n, n);
+		EmitCard(pos + vec4(-sw,-cw,0.0,0.0), pos + vec4(sw, cw,0.0,0.0), pos - offset1 + vec4(-sw,-cw,h,0.0), pos - offset1 + vec4(sw, cw,h,0.0), n, n, n, n);
+		EmitCard(pos + vec4(-cw, sw,0.0,0.0), pos + vec4(cw,-sw,0.0,0.0), pos + offset2 + vec4(-cw, sw,h,0.0), pos + offset2 + vec4(cw,-sw,h,0.0), n, n, n, n);
+		EmitCard(pos + vec4(-cw, sw,0.0,0.0), pos + vec4(cw,-sw,0.0,0.0), pos - offset2 + vec4(-cw, sw,h,0.0), pos - offset2 + vec4(cw,-sw,h,0.0), n, n, n, n);
 	
 #else
     float rand_rad = mod(pos.x, 2*3.14);
@@ -147,17 +165,8 @@ void main(void)
 	#else
 		vec3 n = vec3(0.0,0.0,1.0);
 	#endif
-		e = pos + vec4(-sw,-cw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,0.0); Normal = n; EmitVertex();
-		e = pos + vec4( sw, cw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,0.0); Normal = n; EmitVertex();
-		e = pos + offset1 + vec4(-sw,-cw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,1.0); Normal = n; EmitVertex();
-		e = pos + offset1 + vec4( sw, cw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,1.0); Normal = n; EmitVertex();
-		EndPrimitive();
-		
-		e = pos + vec4(-cw, sw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,0.0); Normal = n; EmitVertex();
-		e = pos + vec4( cw,-sw,0.0,0.0);  gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,0.0); Normal = n; EmitVertex();
-		e = pos + offset2 + vec4(-cw, sw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(0.0,1.0); Normal = n; EmitVertex();
-		e = pos + offset2 + vec4( cw,-sw,h,0.0);    gl_Position = gl_ModelViewProjectionMatrix * e; DynamicShadow(e); TexCoord = vec2(1.0,1.0); Normal = n; EmitVertex();
-		EndPrimitive();
+		EmitCard(pos + vec4(-sw,-cw,0.0,0.0), pos + vec4(sw, cw,0.0,0.0), pos + offset1 + vec4(-sw,-cw,h,0.0), pos + offset1 + vec4(sw, cw,h,0.0), n, n, n, n);
+		EmitCard(pos + vec4(-cw, sw,0.0,0.0), pos + vec4(cw,-sw,0.0,0.0), pos + offset2 + vec4(-cw, sw,h,0.0), pos + offset2 + vec4(cw,-sw,h,0.0), n, n, n, n);
 	
 #endif
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,CAST_SHADOW,BT_ROTATED_QUAD,BT_IMPOSTOR,TERRAIN_NORMAL,BILLBOARD_HULL )
+#extension GL_ARB_uniform_buffer_object : enable
+#pragma osgveg
+uniform samplerBuffer DataBufferTexture;
+uniform float TileRadius;
+#if defined(SM_LISPSM) || defined(SM_VDSM1) || defined(SM_VDSM2)
+	#define HAS_SHADOW
+#endif
+
+#ifdef SM_LISPSM
+	uniform int shadowTextureUnit;
+#endif
+
+#ifdef SM_VDSM1
+	uniform int shadowTextureUnit0;
+#endif
+
+#ifdef SM_VDSM2
+	uniform int shadowTextureUnit0;
+	uniform int shadowTextureUnit1;
+#endif
+
+#ifdef BT_IMPOSTOR
+	uniform float ImpostorFrames;
+#endif
+
+#ifdef BILLBOARD_HULL
+	//hull polygons of all textures, two vertices in each vec4 (see BillboardHull)
+	uniform vec4 BillboardHull[64];
+#endif
+
+varying vec2 TexCoord;
+varying vec3 Normal;
+varying vec3 Color;
+varying float TextureIndex;
+
+void DynamicShadow(vec4 ecPosition)
+{
+#ifdef HAS_SHADOW
+	#ifdef SM_LISPSM
+		int shadowTextureUnit0 = shadowTextureUnit;
+	#endif
+		// generate coords for shadow mapping
+		gl_TexCoord[shadowTextureUnit0].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit0] );
+	#ifdef SM_VDSM2
+		gl_TexCoord[shadowTextureUnit1].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit1] );
+	#endif
+#endif
+}
+
+#ifdef BILLBOARD_HULL
+vec2 GetHullVertex(int texture_index, int vertex_index)
+{
+	vec4 pair = BillboardHull[texture_index*4 + vertex_index/2];
+	return (vertex_index - (vertex_index/2)*2) == 0 ? pair.xy : pair.zw;
+}
+#endif
+
+void main()
+{
+	int instanceAddress = gl_InstanceID * 3;
+	vec3 position = texelFetch(DataBufferTexture, instanceAddress).xyz;
+	Color         = texelFetch(DataBufferTexture, instanceAddress + 1).xyz;
+	vec4 data     = texelFetch(DataBufferTexture, instanceAddress + 2);
+	vec2 scale    = data.xy;
+	TextureIndex  = data.z;
+	vec4 camera_pos = gl_ModelViewMatrixInverse[3];
+#ifndef CAST_SHADOW
+	//shadow casting and vertex fading don't mix well
+	float distance = length(camera_pos.xyz - position.xyz);
+	scale = scale*clamp((1.0 - (distance-TileRadius))/(TileRadius*0.2),0.0,1.0);
+#endif
+
+#ifdef BILLBOARD_HULL
+	//template vertex hold hull vertex index, card index and normal roundness (see BRTShaderInstancing::_createHullCards),
+	//card is placed in xz-plane (card 0) or yz-plane (card 1) like the quad templates
+	vec2 hull_uv = GetHullVertex(int(TextureIndex + 0.5), int(gl_Vertex.x + 0.5));
+	vec4 template_vertex = gl_Vertex.y < 0.5 ? vec4(hull_uv.x - 0.5, 0.0, hull_uv.y, 1.0) : vec4(0.0, 0.5 - hull_uv.x, hull_uv.y, 1.0);
+	vec3 template_normal = vec3(gl_Vertex.z*(2.0*hull_uv.x - 1.0), -1.0, 0.0);
+	vec2 template_uv = hull_uv;
+#else
+	vec4 template_vertex = gl_Vertex;
+	vec3 template_normal = gl_Normal;
+	vec2 template_uv = gl_MultiTexCoord0.st;
+#endif
+
+#if defined(BT_IMPOSTOR)
+	//Select hemi-octahedral frame closest to view direction and
+	//orient quad toward frame direction using the same right/up convention
+	//as billboard_generator, this way the baked ortho view map exactly to the quad.
+	vec3 center = position + vec3(0.0, 0.0, scale.y*0.5);
+	float radius = 0.5*sqrt(2.0*scale.x*scale.x + scale.y*scale.y);
+	vec3 view_dir = camera_pos.xyz - center;
+	view_dir.z = max(view_dir.z, 0.0);//lower hemisphere is not captured
+	view_dir = normalize(view_dir + vec3(0.0, 0.0, 0.0001));
+	vec2 oct = view_dir.xy / (abs(view_dir.x) + abs(view_dir.y) + view_dir.z);
+	vec2 grid = vec2(oct.x - oct.y, oct.x + oct.y)*0.5 + 0.5;
+	vec2 frame = clamp(floor(grid*ImpostorFrames), 0.0, ImpostorFrames - 1.0);
+	vec2 frame_uv = ((frame + 0.5)/ImpostorFrames)*2.0 - 1.0;
+	vec2 p = vec2(frame_uv.x + frame_uv.y, frame_uv.y - frame_uv.x)*0.5;
+	vec3 frame_dir = normalize(vec3(p, 1.0 - abs(p.x) - abs(p.y)));
+	vec3 right = cross(vec3(0.0, 0.0, 1.0), frame_dir);
+	right = length(right) < 0.0001 ? vec3(1.0, 0.0, 0.0) : normalize(right);
+	vec3 up = cross(frame_dir, right);
+	vec4 m_pos = vec4(center + (right*gl_Vertex.x + up*gl_Vertex.y)*radius, 1.0);
+	DynamicShadow(gl_ModelViewMatrix * m_pos);
+	gl_Position = gl_ModelViewProjectionMatrix * m_pos;
+	//real normal is fetched from normal atlas in fragment shader
+	Normal = normalize(gl_NormalMatrix * vec3(0,0,1));
+	TexCoord = (frame + gl_MultiTexCoord0.st)/ImpostorFrames;
+#elif defined(BT_ROTATED_QUAD)
+	vec3 dir = camera_pos.xyz - position.xyz;
+	//we are only interested in xy-plane direction
+	dir.z = 0;
+	dir = normalize(dir);
+	vec3 left = vec3(-dir.y,dir.x, 0);
+	left = normalize(left);
+	left.xy *= scale.xx;
+	vec4 m_pos = template_vertex;
+	m_pos.z *= scale.y;
+	m_pos.xy = m_pos.x*left.xy;
+	m_pos.xyz += position;
+	DynamicShadow(gl_ModelViewMatrix * m_pos);
+	gl_Position = gl_ModelViewProjectionMatrix * m_pos;
+	#ifdef TERRAIN_NORMAL
+		Normal = normalize(gl_NormalMatrix * vec3(0,0,1));
+	#else
+		//skip standard normal transformation for billboards,
+		//we want normal in eye-space and we know how to handle this transformation by hand
+		Normal = normalize(vec3(template_normal.x,0,-template_normal.y));
+	#endif
+	TexCoord = template_uv;
+#else
+	mat4 modelView = gl_ModelViewMatrix * mat4( scale.x, 0.0, 0.0, 0.0,
+		0.0, scale.x, 0.0, 0.0,
+		0.0, 0.0, scale.y, 0.0,
+		position.x, position.y, position.z, 1.0);
+	vec4 mv_pos = modelView * template_vertex;
+	DynamicShadow(mv_pos);
+	gl_Position = gl_ProjectionMatrix * mv_pos;
+	#ifdef TERRAIN_NORMAL
+		Normal = normalize(gl_NormalMatrix * vec3(0,0,1));
+	#else
+		Normal = normalize(vec3(template_normal.x,0,-template_normal.y));
+	#endif
+	TexCoord = template_uv;
+#endif
+}
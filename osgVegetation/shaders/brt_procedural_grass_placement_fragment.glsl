@@ -0,0 +1,8 @@
+#version 120
+//write instance placement from brt_procedural_grass_vertex.glsl (PLACEMENT_OUTPUT) to float target
+varying vec4 Placement;
+
+void main(void)
+{
+	gl_FragColor = Placement;
+}
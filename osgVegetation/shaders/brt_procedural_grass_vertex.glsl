@@ -0,0 +1,149 @@
+#version 120
+#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,CAST_SHADOW,PLACEMENT_OUTPUT )
+#extension GL_ARB_draw_instanced : require
+#pragma osgveg
+uniform sampler2D TerrainTexture;
+uniform sampler2D CoverageTexture;
+uniform vec4 TileData; //origin x, origin y, size, seed
+uniform vec4 TileInfo; //index x, index y, terrain resolution, radius
+uniform vec4 LayerInfo; //cells, layer bit value, texture index, terrain color ratio
+uniform vec4 LayerSize; //min/max width, min/max height
+uniform vec4 LayerScale; //min/max scale, min/max color intensity
+uniform float LayerTerrainIntensity;
+uniform float osg_SimulationTime;
+#if defined(SM_LISPSM) || defined(SM_VDSM1) || defined(SM_VDSM2)
+	#define HAS_SHADOW
+#endif
+
+#ifdef SM_LISPSM
+	uniform int shadowTextureUnit;
+#endif
+
+#ifdef SM_VDSM1
+	uniform int shadowTextureUnit0;
+#endif
+
+#ifdef SM_VDSM2
+	uniform int shadowTextureUnit0;
+	uniform int shadowTextureUnit1;
+#endif
+
+#ifdef PLACEMENT_OUTPUT
+	//first pixel index of layer, placement image width and height (see BRTProceduralGrass::createPlacementCamera)
+	uniform vec3 PlacementInfo;
+	varying vec4 Placement;
+#endif
+
+varying vec2 TexCoord;
+varying vec3 Normal;
+varying vec3 Color;
+varying float TextureIndex;
+
+void DynamicShadow(vec4 ecPosition)
+{
+#ifdef HAS_SHADOW
+	#ifdef SM_LISPSM
+		int shadowTextureUnit0 = shadowTextureUnit;
+	#endif
+		// generate coords for shadow mapping
+		gl_TexCoord[shadowTextureUnit0].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit0] );
+	#ifdef SM_VDSM2
+		gl_TexCoord[shadowTextureUnit1].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit1] );
+	#endif
+#endif
+}
+
+//hash functions must match BRTProceduralGrass::_mod289, _permute and _random.
+//All values are integers and permute input is kept below 289 so (34x+1)x stay below 2^22,
+//mod289 correct the quotient afterwards so result don't depend on how division is rounded.
+float mod289(float x)
+{
+	float r = x - 289.0*floor(x/289.0);
+	r = r < 0.0 ? r + 289.0 : r;
+	return r >= 289.0 ? r - 289.0 : r;
+}
+
+float permute(float x)
+{
+	return mod289((34.0*x + 1.0)*x);
+}
+
+float cellRandom(vec2 cell, float k)
+{
+	vec2 lo = vec2(mod289(cell.x), mod289(cell.y));
+	vec2 hi = vec2(mod289(floor((cell.x - lo.x)/289.0 + 0.5)), mod289(floor((cell.y - lo.y)/289.0 + 0.5)));
+	float h = permute(mod289(TileData.w + k));
+	h = permute(mod289(h + lo.x));
+	h = permute(mod289(h + lo.y));
+	h = permute(mod289(h + hi.x));
+	h = permute(mod289(h + hi.y));
+	float h2 = permute(mod289(h + 7.0));
+	return (h + h2/289.0)/289.0;
+}
+
+void main(void)
+{
+	float cells = LayerInfo.x;
+	float id = float(gl_InstanceIDARB);
+	float j = floor((id + 0.5)/cells);
+	float i = id - j*cells;
+	vec2 global_cell = TileInfo.xy*cells + vec2(i, j);
+	float cell_size = TileData.z/cells;
+	vec2 local = vec2((i + cellRandom(global_cell, 0.0))*cell_size, (j + cellRandom(global_cell, 1.0))*cell_size);
+	float res = TileInfo.z;
+	vec2 f = local/TileData.z*(res - 1.0);
+	vec2 nearest = clamp(floor(f + 0.5), 0.0, res - 1.0);
+	float mask = texture2DLod(CoverageTexture, (nearest + 0.5)/res, 0.0).x;
+	float covered = mod(floor((mask + 0.5)/LayerInfo.y), 2.0) < 0.5 ? 0.0 : 1.0;
+	vec2 c0 = min(floor(f), vec2(res - 2.0));
+	vec2 t = f - c0;
+	vec4 s00 = texture2DLod(TerrainTexture, (c0 + vec2(0.5, 0.5))/res, 0.0);
+	vec4 s10 = texture2DLod(TerrainTexture, (c0 + vec2(1.5, 0.5))/res, 0.0);
+	vec4 s01 = texture2DLod(TerrainTexture, (c0 + vec2(0.5, 1.5))/res, 0.0);
+	vec4 s11 = texture2DLod(TerrainTexture, (c0 + vec2(1.5, 1.5))/res, 0.0);
+	vec4 terrain = mix(mix(s00, s10, t.x), mix(s01, s11, t.x), t.y);
+	vec3 position = vec3(TileData.xy + local, terrain.a);
+
+#ifdef PLACEMENT_OUTPUT
+	//write placement of instance to one pixel, compared with CPU reference by BRTProceduralGrass::comparePlacement
+	float index = PlacementInfo.x + id;
+	float py = floor((index + 0.5)/PlacementInfo.y);
+	float px = index - py*PlacementInfo.y;
+	Placement = vec4(position, covered);
+	gl_Position = vec4((px + 0.5)/PlacementInfo.y*2.0 - 1.0, (py + 0.5)/PlacementInfo.z*2.0 - 1.0, 0.0, 1.0);
+	gl_PointSize = 1.0;
+#else
+	float scale = mix(LayerScale.x, LayerScale.y, cellRandom(global_cell, 2.0));
+	float w = mix(LayerSize.x, LayerSize.y, cellRandom(global_cell, 3.0))*scale*covered;
+	float h = mix(LayerSize.z, LayerSize.w, cellRandom(global_cell, 4.0))*scale*covered;
+	float intensity = mix(LayerScale.z, LayerScale.w, cellRandom(global_cell, 5.0));
+	float angle = cellRandom(global_cell, 6.0)*6.2831853;
+	vec3 terrain_color = terrain.rgb;
+	if (LayerTerrainIntensity > 0.5) terrain_color = vec3((terrain_color.r + terrain_color.g + terrain_color.b)/3.0);
+	Color = terrain_color*(LayerInfo.w*intensity) + vec3(intensity*(1.0 - LayerInfo.w));
+	TextureIndex = LayerInfo.z;
+#ifndef CAST_SHADOW
+	//shadow casting and vertex fading don't mix well
+	vec4 camera_pos = gl_ModelViewMatrixInverse[3];
+	float distance = length(camera_pos.xyz - position);
+	float fade = clamp((1.0 - (distance - TileInfo.w))/(TileInfo.w*0.2), 0.0, 1.0);
+	w *= fade;
+	h *= fade;
+#endif
+	vec2 dir = gl_Vertex.y < 0.5 ? vec2(cos(angle), sin(angle)) : vec2(-sin(angle), cos(angle));
+	float wind = (1.0 + sin(osg_SimulationTime*2.0))*0.1;
+	vec2 wind_offset = vec2(sin(angle), cos(angle))*wind*gl_Vertex.z*covered;
+	vec4 m_pos = vec4(position + vec3(dir*gl_Vertex.x*w + wind_offset, gl_Vertex.z*h), 1.0);
+	vec4 mv_pos = gl_ModelViewMatrix * m_pos;
+	DynamicShadow(mv_pos);
+	gl_Position = gl_ProjectionMatrix * mv_pos;
+	Normal = normalize(gl_NormalMatrix * vec3(0.0, 0.0, 1.0));
+	TexCoord = gl_MultiTexCoord0.st;
+#endif
+}
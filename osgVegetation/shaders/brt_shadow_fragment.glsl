@@ -0,0 +1,16 @@
+#version 120
+#extension GL_EXT_gpu_shader4 : enable
+#extension GL_EXT_texture_array : enable
+#pragma osgveg
+//depth only shadow caster, alpha tested against billboard texture
+uniform sampler2DArray baseTexture; 
+uniform float ShadowAlphaRef;
+varying vec2 TexCoord; 
+varying float TextureIndex; 
+
+void main(void) 
+{ 
+   float alpha = texture2DArray(baseTexture, vec3(TexCoord, TextureIndex)).a;
+   if(alpha < ShadowAlphaRef) discard;
+   gl_FragColor = vec4(1.0);
+}
@@ -0,0 +1,65 @@
+#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2,FM_LINEAR,FM_EXP,FM_EXP2 )
+#pragma osgveg
+uniform sampler2D baseTexture;
+
+#ifdef SM_LISPSM
+	uniform sampler2DShadow shadowTexture;
+	uniform int shadowTextureUnit;
+#endif
+
+#ifdef SM_VDSM1
+	uniform sampler2DShadow shadowTexture0;
+	uniform int shadowTextureUnit0;
+#endif
+
+#ifdef SM_VDSM2
+	uniform sampler2DShadow shadowTexture0;
+	uniform int shadowTextureUnit0;
+	uniform sampler2DShadow shadowTexture1;
+	uniform int shadowTextureUnit1;
+#endif
+
+varying vec2 TexCoord;
+varying vec4 Color;
+varying vec3 Normal;
+
+void main(void)
+{
+	vec4 finalColor = texture2D( baseTexture, TexCoord);
+	finalColor.xyz *= Color.xyz;
+	float depth = gl_FragCoord.z / gl_FragCoord.w;
+	vec3 lightDir = normalize(gl_LightSource[0].position.xyz);
+	vec3 normal = normalize(Normal);
+	float NdotL = max(dot(normal, lightDir), 0);
+
+#ifdef SM_LISPSM
+	NdotL *= shadow2DProj( shadowTexture, gl_TexCoord[shadowTextureUnit] ).r;
+#endif
+
+#if defined(SM_VDSM1) || defined(SM_VDSM2)
+	NdotL *= shadow2DProj( shadowTexture0, gl_TexCoord[shadowTextureUnit0] ).r;
+#endif
+
+#ifdef SM_VDSM2
+	NdotL *= shadow2DProj( shadowTexture1, gl_TexCoord[shadowTextureUnit1] ).r;
+#endif
+	finalColor.xyz *= (NdotL * gl_LightSource[0].diffuse.xyz*gl_FrontMaterial.diffuse.xyz + gl_LightSource[0].ambient.xyz*gl_FrontMaterial.ambient.xyz);
+
+#ifdef FM_LINEAR
+	float fogFactor = (gl_Fog.end - depth) * gl_Fog.scale;
+#endif
+
+#ifdef FM_EXP
+	float fogFactor = exp(-gl_Fog.density * depth);
+#endif
+
+#ifdef FM_EXP2
+	float fogFactor = exp(-pow((gl_Fog.density * depth), 2.0));
+#endif
+
+#if defined(FM_LINEAR) || defined(FM_EXP) || defined(FM_EXP2)
+	fogFactor = clamp(fogFactor, 0.0, 1.0);
+	finalColor.xyz = mix(gl_Fog.color.xyz, finalColor.xyz, fogFactor);
+#endif
+	gl_FragColor = finalColor;
+}
@@ -0,0 +1,65 @@
+#pragma import_defines ( SM_LISPSM,SM_VDSM1,SM_VDSM2 )
+#extension GL_ARB_uniform_buffer_object : enable
+#pragma osgveg
+uniform samplerBuffer dataBuffer;
+#if defined(SM_LISPSM) || defined(SM_VDSM1) || defined(SM_VDSM2)
+	#define HAS_SHADOW
+#endif
+
+#ifdef SM_LISPSM
+	uniform int shadowTextureUnit;
+#endif
+
+#ifdef SM_VDSM1
+	uniform int shadowTextureUnit0;
+#endif
+
+#ifdef SM_VDSM2
+	uniform int shadowTextureUnit0;
+	uniform int shadowTextureUnit1;
+#endif
+
+varying vec2 TexCoord;
+varying vec4 Color;
+varying vec3 Normal;
+
+void DynamicShadow(vec4 ecPosition)
+{
+#ifdef HAS_SHADOW
+	#ifdef SM_LISPSM
+		int shadowTextureUnit0 = shadowTextureUnit;
+	#endif
+		// generate coords for shadow mapping
+		gl_TexCoord[shadowTextureUnit0].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit0] );
+		gl_TexCoord[shadowTextureUnit0].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit0] );
+	#ifdef SM_VDSM2
+		gl_TexCoord[shadowTextureUnit1].s = dot( ecPosition, gl_EyePlaneS[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].t = dot( ecPosition, gl_EyePlaneT[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].p = dot( ecPosition, gl_EyePlaneR[shadowTextureUnit1] );
+		gl_TexCoord[shadowTextureUnit1].q = dot( ecPosition, gl_EyePlaneQ[shadowTextureUnit1] );
+	#endif
+#endif
+}
+
+void main()
+{
+	int instanceAddress = gl_InstanceID * 4;
+	vec4 v1 = texelFetch(dataBuffer, instanceAddress);
+	vec4 v2 = texelFetch(dataBuffer, instanceAddress + 1);
+	vec4 v3 = texelFetch(dataBuffer, instanceAddress + 2);
+	vec4 v4 = texelFetch(dataBuffer, instanceAddress + 3);
+	mat4 modelView =  gl_ModelViewMatrix*
+		mat4( v1.x, v1.y, v1.z, 0.0,
+			v2.x, v2.y, v2.z, 0.0,
+			v3.x, v3.y, v3.z, 0.0,
+			v4.x, v4.y, v4.z, 1.0);
+	vec4 mv_pos = modelView * gl_Vertex;
+	mat4 mvpMatrix =  gl_ProjectionMatrix * modelView;
+	DynamicShadow(mv_pos);
+	Color = vec4(v1.w, v2.w, v3.w, v4.w);
+	gl_Position = mvpMatrix * vec4(gl_Vertex.xyz,1.0);
+	Normal = normalize(gl_NormalMatrix * gl_Normal);
+	TexCoord = gl_MultiTexCoord0.st;
+}